@@ -3,6 +3,7 @@
 #include "aes.h"
 #include "types.h"
 #include "utils.h"
+#include "stats.h"
 
 /* Allocate a new context. */
 aes_ctx_t *new_aes_ctx(const void *key, unsigned int key_size, aes_mode_t mode) {
@@ -74,8 +75,7 @@ void aes_encrypt(aes_ctx_t *ctx, void *dst, const void *src, size_t l) {
     mbedtls_cipher_finish(&ctx->cipher_enc, NULL, NULL);
 }
 
-/* Decrypt with context. */
-void aes_decrypt(aes_ctx_t *ctx, void *dst, const void *src, size_t l) {
+static void aes_decrypt_blocks(aes_ctx_t *ctx, void *dst, const void *src, size_t l) {
     size_t out_len = 0;
     
     /* Prepare context */
@@ -100,6 +100,14 @@ void aes_decrypt(aes_ctx_t *ctx, void *dst, const void *src, size_t l) {
     mbedtls_cipher_finish(&ctx->cipher_dec, NULL, NULL);
 }
 
+/* Decrypt with context. */
+void aes_decrypt(aes_ctx_t *ctx, void *dst, const void *src, size_t l) {
+    stats_span_t span;
+    stats_begin(&span);
+    aes_decrypt_blocks(ctx, dst, src, l);
+    stats_end(&span, STATS_AES, l);
+}
+
 void get_tweak(unsigned char *tweak, size_t sector) {
     for (int i = 0xF; i >= 0; i--) { /* Nintendo LE custom tweak... */
         tweak[i] = (unsigned char)(sector & 0xFF);
@@ -126,15 +134,18 @@ void aes_xts_encrypt(aes_ctx_t *ctx, void *dst, const void *src, size_t l, size_
 /* Decrypt with context for XTS. */
 void aes_xts_decrypt(aes_ctx_t *ctx, void *dst, const void *src, size_t l, size_t sector, size_t sector_size) {
     unsigned char tweak[0x10];
+    stats_span_t span;
 
     if (l % sector_size != 0) {
         FATAL_ERROR("Length must be multiple of sectors!");
     }
 
+    stats_begin(&span);
     for (size_t i = 0; i < l; i += sector_size) {
         /* Workaround for Nintendo's custom sector...manually generate the tweak. */
         get_tweak(tweak, sector++);
         aes_setiv(ctx, tweak, 16);
-        aes_decrypt(ctx, (char *)dst + i, (char *)src + i, sector_size);
+        aes_decrypt_blocks(ctx, (char *)dst + i, (char *)src + i, sector_size);
     }
+    stats_end(&span, STATS_AES, l);
 }
\ No newline at end of file
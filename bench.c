@@ -0,0 +1,629 @@
+#ifndef _WIN32
+#define _XOPEN_SOURCE 700 /* For nftw and mkdtemp. */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#ifndef _WIN32
+#include <ftw.h>
+#include <unistd.h>
+#endif
+#include "types.h"
+#include "utils.h"
+#include "settings.h"
+#include "pki.h"
+#include "aes.h"
+#include "sha.h"
+#include "rsa.h"
+#include "nca.h"
+#include "bktr.h"
+#include "ivfc.h"
+#include "stats.h"
+#include "gen.h"
+
+/* Benchmarks for hactool's hot paths, on synthetic inputs built from fixed seeds, so that runs on
+ * the same machine can be compared. Each benchmark repeats an operation for at least the minimum
+ * time, several times over, and keeps the fastest repetition. Results are written as JSON, one
+ * benchmark per line; with --compare, they are checked against a previous run's JSON. */
+
+#define BENCH_VERSION 2
+#define BENCH_REPETITIONS 5
+#define BENCH_MIN_NS 100000000ULL /* Per repetition. */
+#define BENCH_BUFFER_SIZE 0x100000
+#define BENCH_SECTION_SIZE 0x1000000
+#define BENCH_RANDOM_READS 0x100
+#define BENCH_RANDOM_READ_SIZE 0x1000
+#define BENCH_BKTR_FILES 0x100
+#define BENCH_BKTR_FILE_SIZE 0x18000 /* About 0x1000000 of RomFS in all. */
+#define BENCH_BKTR_PATCH_PERCENT 50
+#define BENCH_ROMFS_FILE_SIZE 0x400 /* Largest; sizes range from half of it. */
+#define BENCH_DEFAULT_THRESHOLD 10.0
+#define BENCH_MAX_RESULTS 0x40
+
+typedef uint64_t (*bench_op_t)(void *arg); /* Returns the number of bytes processed. */
+
+typedef struct {
+    char name[0x40];
+    uint64_t ops; /* Run in the fastest repetition. */
+    uint64_t bytes; /* Per op. */
+    uint64_t items; /* Per op, e.g. files; 0 if not meaningful. */
+    double ns_per_op;
+} bench_result_t;
+
+typedef struct {
+    const char *filter;
+    const char *work_dir;
+    bench_result_t results[BENCH_MAX_RESULTS];
+    unsigned int num_results;
+} bench_ctx_t;
+
+/* Deterministic data, so every run hashes and decrypts the same bytes. */
+static void bench_fill(void *buf, size_t size, uint64_t seed) {
+    unsigned char *p = buf;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        p[i] = (unsigned char)(seed >> 56);
+    }
+}
+
+static uint64_t bench_next_random(uint64_t *state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return *state >> 33;
+}
+
+static void bench_run(bench_ctx_t *ctx, const char *name, bench_op_t op, void (*cleanup)(void *arg), void *arg, uint64_t items) {
+    if (ctx->filter != NULL && strstr(name, ctx->filter) == NULL) {
+        return;
+    }
+    if (ctx->num_results == BENCH_MAX_RESULTS) {
+        fprintf(stderr, "Too many benchmarks!\n");
+        fatal_exit();
+    }
+    bench_result_t *result = &ctx->results[ctx->num_results++];
+    memset(result, 0, sizeof(*result));
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->items = items;
+
+    /* Warm caches and lazily built state first. */
+    result->bytes = op(arg);
+    if (cleanup != NULL) {
+        cleanup(arg);
+    }
+
+    for (unsigned int rep = 0; rep < BENCH_REPETITIONS; rep++) {
+        uint64_t ops = 0;
+        uint64_t elapsed = 0;
+        while (elapsed < BENCH_MIN_NS) {
+            uint64_t start = stats_now_ns();
+            op(arg);
+            elapsed += stats_now_ns() - start;
+            ops++;
+            if (cleanup != NULL) {
+                cleanup(arg);
+            }
+        }
+        double ns_per_op = (double)elapsed / (double)ops;
+        if (rep == 0 || ns_per_op < result->ns_per_op) {
+            result->ns_per_op = ns_per_op;
+            result->ops = ops;
+        }
+    }
+    fprintf(stderr, "%-28s %14.1f ns/op", name, result->ns_per_op);
+    if (result->bytes != 0) {
+        fprintf(stderr, " %10.1f MB/s", (double)result->bytes / (double)0x100000 / (result->ns_per_op / 1000000000.0));
+    }
+    fprintf(stderr, "\n");
+}
+
+/* Crypto kernels. */
+typedef struct {
+    aes_ctx_t *aes;
+    unsigned char *buf;
+    size_t size;
+    unsigned char ctr[0x10];
+} bench_crypto_t;
+
+static uint64_t bench_aes_ctr(void *arg) {
+    bench_crypto_t *crypto = arg;
+    aes_setiv(crypto->aes, crypto->ctr, 0x10);
+    aes_decrypt(crypto->aes, crypto->buf, crypto->buf, crypto->size);
+    return crypto->size;
+}
+
+static uint64_t bench_aes_xts(void *arg) {
+    bench_crypto_t *crypto = arg;
+    aes_xts_decrypt(crypto->aes, crypto->buf, crypto->buf, crypto->size, 0, 0x200);
+    return crypto->size;
+}
+
+static uint64_t bench_sha256(void *arg) {
+    bench_crypto_t *crypto = arg;
+    unsigned char hash[0x20];
+    sha256_hash_buffer(hash, crypto->buf, crypto->size);
+    return crypto->size;
+}
+
+typedef struct {
+    unsigned char data[0x200];
+    unsigned char signature[0x100];
+    const unsigned char *modulus;
+} bench_rsa_t;
+
+static uint64_t bench_rsa_pss(void *arg) {
+    bench_rsa_t *rsa = arg;
+    /* The signature is random, so this fails, but only after the full public key operation. */
+    rsa2048_pss_verify(rsa->data, sizeof(rsa->data), rsa->signature, rsa->modulus);
+    return sizeof(rsa->data);
+}
+
+static void bench_crypto(bench_ctx_t *ctx) {
+    static const unsigned char key[0x20] = {0x10, 0x32, 0x54, 0x76, 0x98, 0xBA, 0xDC, 0xFE};
+    bench_crypto_t crypto;
+    memset(&crypto, 0, sizeof(crypto));
+    if ((crypto.buf = malloc(BENCH_BUFFER_SIZE)) == NULL) {
+        fprintf(stderr, "Failed to allocate benchmark buffer!\n");
+        fatal_exit();
+    }
+    bench_fill(crypto.buf, BENCH_BUFFER_SIZE, 1);
+    crypto.size = BENCH_BUFFER_SIZE;
+
+    crypto.aes = new_aes_ctx(key, 0x10, AES_MODE_CTR);
+    bench_run(ctx, "aes_ctr_decrypt_1m", bench_aes_ctr, NULL, &crypto, 0);
+    free_aes_ctx(crypto.aes);
+
+    crypto.aes = new_aes_ctx(key, 0x20, AES_MODE_XTS);
+    bench_run(ctx, "aes_xts_decrypt_1m", bench_aes_xts, NULL, &crypto, 0);
+    free_aes_ctx(crypto.aes);
+
+    bench_run(ctx, "sha256_1m", bench_sha256, NULL, &crypto, 0);
+    crypto.size = 0x1000;
+    bench_run(ctx, "sha256_4k", bench_sha256, NULL, &crypto, 0);
+
+    nca_keyset_t *keyset = malloc(sizeof(*keyset));
+    bench_rsa_t rsa;
+    if (keyset == NULL) {
+        fprintf(stderr, "Failed to allocate keyset!\n");
+        fatal_exit();
+    }
+    pki_initialize_keyset(keyset, KEYSET_RETAIL);
+    bench_fill(rsa.data, sizeof(rsa.data), 2);
+    bench_fill(rsa.signature, sizeof(rsa.signature), 3);
+    rsa.signature[0] = 0; /* Below the modulus. */
+    rsa.modulus = keyset->nca_hdr_fixed_key_modulus;
+    bench_run(ctx, "rsa2048_pss_verify", bench_rsa_pss, NULL, &rsa, 0);
+
+    free(keyset);
+    free(crypto.buf);
+}
+
+/* Section reader. */
+typedef struct {
+    nca_section_ctx_t section;
+    nca_fs_header_t header;
+    unsigned char *buf;
+    uint64_t size; /* Of the section's virtual address space. */
+    uint64_t random_state;
+} bench_section_t;
+
+static uint64_t bench_section_sequential(void *arg) {
+    bench_section_t *bench = arg;
+    nca_section_fseek(&bench->section, 0);
+    for (uint64_t ofs = 0; ofs < bench->size; ofs += BENCH_BUFFER_SIZE) {
+        size_t size = bench->size - ofs < BENCH_BUFFER_SIZE ? (size_t)(bench->size - ofs) : BENCH_BUFFER_SIZE;
+        if (nca_section_fread(&bench->section, bench->buf, size) != size) {
+            fprintf(stderr, "Failed to read benchmark section!\n");
+            fatal_exit();
+        }
+    }
+    return bench->size;
+}
+
+static uint64_t bench_section_random(void *arg) {
+    bench_section_t *bench = arg;
+    bench->random_state = 4;
+    for (unsigned int i = 0; i < BENCH_RANDOM_READS; i++) {
+        uint64_t ofs = (bench_next_random(&bench->random_state) % (bench->size / BENCH_RANDOM_READ_SIZE)) * BENCH_RANDOM_READ_SIZE;
+        nca_section_fseek(&bench->section, ofs);
+        if (nca_section_fread(&bench->section, bench->buf, BENCH_RANDOM_READ_SIZE) != BENCH_RANDOM_READ_SIZE) {
+            fprintf(stderr, "Failed to read benchmark section!\n");
+            fatal_exit();
+        }
+    }
+    return (uint64_t)BENCH_RANDOM_READS * BENCH_RANDOM_READ_SIZE;
+}
+
+static FILE *bench_create_file(bench_ctx_t *ctx, const char *name, uint64_t size, uint64_t seed) {
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/%s", ctx->work_dir, name);
+    FILE *f = fopen(path, "w+b");
+    unsigned char *buf = malloc(BENCH_BUFFER_SIZE);
+    if (f == NULL || buf == NULL) {
+        fprintf(stderr, "Failed to create %s!\n", path);
+        fatal_exit();
+    }
+    for (uint64_t ofs = 0; ofs < size; ofs += BENCH_BUFFER_SIZE) {
+        size_t n = size - ofs < BENCH_BUFFER_SIZE ? (size_t)(size - ofs) : BENCH_BUFFER_SIZE;
+        bench_fill(buf, n, seed + ofs);
+        if (fwrite(buf, 1, n, f) != n) {
+            fprintf(stderr, "Failed to write %s!\n", path);
+            fatal_exit();
+        }
+    }
+    free(buf);
+    fflush(f);
+    return f;
+}
+
+static void bench_section_reads(bench_ctx_t *ctx, hactool_ctx_t *tool_ctx) {
+    static const unsigned char key[0x20] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF};
+    static const struct {
+        const char *name;
+        uint8_t crypt_type;
+    } crypt_types[3] = {{"none", CRYPT_NONE}, {"ctr", CRYPT_CTR}, {"xts", CRYPT_XTS}};
+    FILE *f = bench_create_file(ctx, "section.bin", BENCH_SECTION_SIZE + 0x4000, 5);
+    bench_section_t *bench = calloc(1, sizeof(*bench));
+    if (bench == NULL || (bench->buf = malloc(BENCH_BUFFER_SIZE)) == NULL) {
+        fprintf(stderr, "Failed to allocate benchmark buffer!\n");
+        fatal_exit();
+    }
+
+    for (unsigned int i = 0; i < 3; i++) {
+        char name[0x40];
+        memset(&bench->section, 0, sizeof(bench->section));
+        memset(&bench->header, 0, sizeof(bench->header));
+        bench->header.crypt_type = crypt_types[i].crypt_type;
+        bench->section.is_present = 1;
+        bench->section.type = ROMFS;
+        bench->section.file = f;
+        bench->section.offset = 0x4000;
+        bench->section.size = BENCH_SECTION_SIZE;
+        bench->section.header = &bench->header;
+        bench->section.tool_ctx = tool_ctx;
+        bench->section.is_decrypted = crypt_types[i].crypt_type == CRYPT_NONE;
+        if (crypt_types[i].crypt_type == CRYPT_CTR) {
+            bench->section.aes = new_aes_ctx(key, 0x10, AES_MODE_CTR);
+        } else if (crypt_types[i].crypt_type == CRYPT_XTS) {
+            bench->section.aes = new_aes_ctx(key, 0x20, AES_MODE_XTS);
+        }
+        bench->size = BENCH_SECTION_SIZE;
+
+        snprintf(name, sizeof(name), "section_read_%s_seq", crypt_types[i].name);
+        bench_run(ctx, name, bench_section_sequential, NULL, bench, 0);
+        snprintf(name, sizeof(name), "section_read_%s_random", crypt_types[i].name);
+        bench_run(ctx, name, bench_section_random, NULL, bench, BENCH_RANDOM_READS);
+        free_aes_ctx(bench->section.aes);
+    }
+
+    free(bench->buf);
+    free(bench);
+    fclose(f);
+}
+
+/* Writes a generated image to the scratch directory, and returns it open for reading. */
+static FILE *bench_write_image(bench_ctx_t *ctx, const char *name, const gen_buf_t *buf) {
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/%s", ctx->work_dir, name);
+    FILE *f = fopen(path, "w+b");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to create %s!\n", path);
+        fatal_exit();
+    }
+    if (fwrite(buf->data, 1, (size_t)buf->size, f) != buf->size || fflush(f) != 0) {
+        fprintf(stderr, "Failed to write %s!\n", path);
+        fatal_exit();
+    }
+    return f;
+}
+
+static void bench_init_gen(gen_ctx_t *gen, uint32_t num_files, uint64_t file_size, uint64_t seed) {
+    memset(gen, 0, sizeof(*gen));
+    gen->seed = seed;
+    gen->num_romfs_files = num_files;
+    gen->file_size = file_size;
+    gen->patch_percent = BENCH_BKTR_PATCH_PERCENT;
+    pki_initialize_keyset(&gen->keyset, KEYSET_TEST);
+}
+
+/* BKTR virtual reads of an update NCA from hactool-gen's builders. It changes about half of its
+ * base RomFS's files, so reads alternate between patch and base extents. */
+static void bench_bktr_reads(bench_ctx_t *ctx, hactool_ctx_t *tool_ctx) {
+    gen_ctx_t *gen = malloc(sizeof(*gen));
+    nca_ctx_t *nca_ctx = malloc(sizeof(*nca_ctx));
+    bench_section_t *bench = calloc(1, sizeof(*bench));
+    if (gen == NULL || nca_ctx == NULL || bench == NULL || (bench->buf = malloc(BENCH_BUFFER_SIZE)) == NULL) {
+        fprintf(stderr, "Failed to allocate BKTR benchmark!\n");
+        fatal_exit();
+    }
+    bench_init_gen(gen, BENCH_BKTR_FILES, BENCH_BKTR_FILE_SIZE, 6);
+    gen_buf_t romfs = {0}, patched_romfs = {0}, patch = {0};
+    gen_section_t base_section, patched_section, patch_section;
+    gen_build_romfs(gen, &romfs, 0);
+    gen_build_romfs(gen, &patched_romfs, 1);
+    gen_build_romfs_section(&romfs, &base_section, 2);
+    gen_build_romfs_section(&patched_romfs, &patched_section, 2);
+    gen_build_bktr_section(&base_section.data, &patched_section.data, &patched_section.header.romfs_superblock.ivfc_header, &patch_section, 3);
+    gen_build_nca(gen, &patch_section, 1, GEN_TITLE_ID | 0x800, 2, 0, &patch);
+
+    /* The base is read as the plaintext of its RomFS section, as with --baseromfs. */
+    FILE *f = bench_write_image(ctx, "patch.nca", &patch);
+    tool_ctx->base_file = bench_write_image(ctx, "base_romfs.bin", &base_section.data);
+    tool_ctx->base_file_type = BASEFILE_ROMFS;
+    pki_initialize_keyset(&tool_ctx->settings.keyset, KEYSET_TEST);
+    tool_ctx->action = 0;
+
+    nca_init(nca_ctx);
+    nca_ctx->tool_ctx = tool_ctx;
+    nca_ctx->file = f;
+    if (!nca_decrypt_header(nca_ctx)) {
+        fprintf(stderr, "Failed to read generated patch NCA!\n");
+        fatal_exit();
+    }
+    nca_decrypt_key_area(nca_ctx);
+    nca_init_section(nca_ctx, 0);
+    nca_process_bktr_section(&nca_ctx->section_contexts[0]);
+    bench->section = nca_ctx->section_contexts[0];
+    bench->size = nca_ctx->section_contexts[0].bktr_ctx.relocation_block->patch_romfs_size;
+
+    bench_run(ctx, "bktr_read_seq", bench_section_sequential, NULL, bench, 0);
+    bench_run(ctx, "bktr_read_random", bench_section_random, NULL, bench, BENCH_RANDOM_READS);
+
+    nca_free_section_contexts(nca_ctx);
+    fclose(tool_ctx->base_file);
+    tool_ctx->base_file = NULL;
+    fclose(f);
+    gen_free_section(&base_section);
+    gen_free_section(&patched_section);
+    gen_free_section(&patch_section);
+    gen_buf_free(&romfs);
+    gen_buf_free(&patched_romfs);
+    gen_buf_free(&patch);
+    free(bench->buf);
+    free(bench);
+    free(nca_ctx);
+    free(gen);
+}
+
+/* RomFS traversal and extraction, of images from hactool-gen's builder. */
+typedef struct {
+    romfs_ctx_t romfs;
+    hactool_ctx_t *tool_ctx;
+    char out_dir[MAX_PATH];
+} bench_romfs_t;
+
+static FILE *bench_create_romfs(bench_ctx_t *ctx, uint32_t num_files) {
+    gen_ctx_t *gen = malloc(sizeof(*gen));
+    if (gen == NULL) {
+        fprintf(stderr, "Failed to allocate RomFS benchmark!\n");
+        fatal_exit();
+    }
+    bench_init_gen(gen, num_files, BENCH_ROMFS_FILE_SIZE, 8);
+    gen_buf_t romfs = {0};
+    gen_build_romfs(gen, &romfs, 0);
+
+    char file_name[0x40];
+    snprintf(file_name, sizeof(file_name), "romfs_%"PRIu32".bin", num_files);
+    FILE *f = bench_write_image(ctx, file_name, &romfs);
+    gen_buf_free(&romfs);
+    free(gen);
+    return f;
+}
+
+static uint64_t bench_romfs_process(void *arg) {
+    bench_romfs_t *bench = arg;
+    FILE *f = bench->romfs.file;
+    memset(&bench->romfs, 0, sizeof(bench->romfs));
+    bench->romfs.file = f;
+    bench->romfs.tool_ctx = bench->tool_ctx;
+    romfs_process(&bench->romfs);
+    free(bench->romfs.files);
+    free(bench->romfs.directories);
+    return 0;
+}
+
+#ifndef _WIN32
+static int bench_remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    return remove(path);
+}
+#endif
+
+static void bench_romfs_cleanup(void *arg) {
+    bench_romfs_t *bench = arg;
+    if (bench->tool_ctx->action & ACTION_LISTROMFS) {
+        return;
+    }
+#ifndef _WIN32
+    nftw(bench->out_dir, bench_remove_entry, 0x10, FTW_DEPTH | FTW_PHYS);
+#endif
+}
+
+static void bench_romfs(bench_ctx_t *ctx, hactool_ctx_t *tool_ctx) {
+    static const uint32_t scales[3] = {100, 1000, 10000};
+    bench_romfs_t bench;
+    memset(&bench, 0, sizeof(bench));
+    bench.tool_ctx = tool_ctx;
+    snprintf(bench.out_dir, sizeof(bench.out_dir), "%s/romfs", ctx->work_dir);
+
+    for (unsigned int i = 0; i < 3; i++) {
+        char name[0x40];
+        bench.romfs.file = bench_create_romfs(ctx, scales[i]);
+
+        tool_ctx->action = ACTION_EXTRACT | ACTION_LISTROMFS;
+        snprintf(name, sizeof(name), "romfs_list_%"PRIu32, scales[i]);
+        bench_run(ctx, name, bench_romfs_process, bench_romfs_cleanup, &bench, scales[i]);
+
+        tool_ctx->action = ACTION_EXTRACT;
+        filepath_set(&tool_ctx->settings.romfs_dir_path.path, bench.out_dir);
+        tool_ctx->settings.romfs_dir_path.enabled = 1;
+        snprintf(name, sizeof(name), "romfs_extract_%"PRIu32, scales[i]);
+        bench_run(ctx, name, bench_romfs_process, bench_romfs_cleanup, &bench, scales[i]);
+        tool_ctx->settings.romfs_dir_path.enabled = 0;
+
+        fclose(bench.romfs.file);
+    }
+}
+
+static void bench_write_results(bench_ctx_t *ctx, FILE *f) {
+    fprintf(f, "{\n  \"version\": %d,\n  \"benchmarks\": [\n", BENCH_VERSION);
+    for (unsigned int i = 0; i < ctx->num_results; i++) {
+        bench_result_t *result = &ctx->results[i];
+        double seconds = result->ns_per_op / 1000000000.0;
+        fprintf(f, "    {\"name\": \"%s\", \"ops\": %"PRIu64", \"bytes\": %"PRIu64", \"items\": %"PRIu64", \"ns_per_op\": %.1f, \"mb_per_s\": %.1f, \"items_per_s\": %.1f}%s\n",
+                result->name, result->ops, result->bytes, result->items, result->ns_per_op,
+                (double)result->bytes / (double)0x100000 / seconds, (double)result->items / seconds,
+                i + 1 < ctx->num_results ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+/* Check the results against a baseline written by a previous run. Returns the number of slowdowns. */
+static int bench_compare(bench_ctx_t *ctx, const char *path, double threshold) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", path);
+        return -1;
+    }
+    char line[0x200];
+    int num_slower = 0;
+    unsigned int num_compared = 0;
+    fprintf(stderr, "\n%-28s %14s %14s %9s\n", "Benchmark", "Baseline", "Current", "Change");
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char name[0x40];
+        double baseline_ns;
+        const char *name_field = strstr(line, "\"name\": \"");
+        const char *ns_field = strstr(line, "\"ns_per_op\": ");
+        if (name_field == NULL || ns_field == NULL || sscanf(name_field + 9, "%63[^\"]", name) != 1 || sscanf(ns_field + 13, "%lf", &baseline_ns) != 1) {
+            continue;
+        }
+        for (unsigned int i = 0; i < ctx->num_results; i++) {
+            bench_result_t *result = &ctx->results[i];
+            if (strcmp(result->name, name) || baseline_ns <= 0) {
+                continue;
+            }
+            double change = (result->ns_per_op / baseline_ns - 1.0) * 100.0;
+            int is_slower = change > threshold;
+            fprintf(stderr, "%-28s %14.1f %14.1f %+8.1f%%%s\n", name, baseline_ns, result->ns_per_op, change, is_slower ? "  SLOWER" : "");
+            num_slower += is_slower;
+            num_compared++;
+        }
+    }
+    fclose(f);
+    if (num_compared == 0) {
+        fprintf(stderr, "%s has no results in common with this run!\n", path);
+        return -1;
+    }
+    if (num_slower) {
+        fprintf(stderr, "%d of %u benchmarks are more than %.1f%% slower than %s.\n", num_slower, num_compared, threshold, path);
+    } else {
+        fprintf(stderr, "No benchmark is more than %.1f%% slower than %s.\n", threshold, path);
+    }
+    return num_slower;
+}
+
+static void usage(const char *prog_name) {
+    fprintf(stderr,
+        "Usage: %s [options...]\n"
+        "Options:\n"
+        "  --output=file      Write the results as JSON to file, instead of stdout.\n"
+        "  --compare=file     Compare against the JSON results of an earlier run, and fail on slowdowns.\n"
+        "  --threshold=pct    Slowdown that --compare fails on. Default %.0f.\n"
+        "  --filter=text      Only run benchmarks with text in their name.\n"
+        "  --workdir=dir      Where to create scratch files. Default /tmp.\n", prog_name, BENCH_DEFAULT_THRESHOLD);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    bench_ctx_t ctx;
+    const char *output_path = NULL;
+    const char *compare_path = NULL;
+    const char *work_root = "/tmp";
+    double threshold = BENCH_DEFAULT_THRESHOLD;
+    memset(&ctx, 0, sizeof(ctx));
+
+    while (1) {
+        int option_index;
+        static struct option long_options[] = {
+            {"output", 1, NULL, 0},
+            {"compare", 1, NULL, 1},
+            {"threshold", 1, NULL, 2},
+            {"filter", 1, NULL, 3},
+            {"workdir", 1, NULL, 4},
+            {NULL, 0, NULL, 0},
+        };
+        int c = getopt_long(argc, argv, "", long_options, &option_index);
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+            case 0:
+                output_path = optarg;
+                break;
+            case 1:
+                compare_path = optarg;
+                break;
+            case 2:
+                threshold = strtod(optarg, NULL);
+                break;
+            case 3:
+                ctx.filter = optarg;
+                break;
+            case 4:
+                work_root = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+    }
+
+#ifdef _WIN32
+    (void)output_path;
+    (void)compare_path;
+    (void)work_root;
+    (void)threshold;
+    fprintf(stderr, "Benchmarks are not supported on Windows.\n");
+    return EXIT_FAILURE;
+#else
+    char work_dir[MAX_PATH];
+    snprintf(work_dir, sizeof(work_dir), "%s/hactool-bench-XXXXXX", work_root);
+    if (mkdtemp(work_dir) == NULL) {
+        fprintf(stderr, "Failed to create a scratch directory in %s!\n", work_root);
+        return EXIT_FAILURE;
+    }
+    ctx.work_dir = work_dir;
+
+    /* The code under test reports progress on stdout, so results go to a copy of it. */
+    FILE *out = output_path != NULL ? fopen(output_path, "w") : fdopen(dup(STDOUT_FILENO), "w");
+    if (out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", output_path != NULL ? output_path : "stdout");
+        return EXIT_FAILURE;
+    }
+
+    hactool_ctx_t *tool_ctx = calloc(1, sizeof(*tool_ctx));
+    if (tool_ctx == NULL) {
+        fprintf(stderr, "Failed to allocate tool context!\n");
+        return EXIT_FAILURE;
+    }
+    bench_crypto(&ctx);
+    bench_section_reads(&ctx, tool_ctx);
+    bench_bktr_reads(&ctx, tool_ctx);
+    bench_romfs(&ctx, tool_ctx);
+    free(tool_ctx);
+    nftw(work_dir, bench_remove_entry, 0x10, FTW_DEPTH | FTW_PHYS);
+
+    bench_write_results(&ctx, out);
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Failed to write results!\n");
+        return EXIT_FAILURE;
+    }
+    if (compare_path != NULL) {
+        return bench_compare(&ctx, compare_path, threshold) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+#endif
+}
@@ -6,7 +6,7 @@ bktr_relocation_entry_t *bktr_get_relocation(bktr_relocation_block_t *block, uin
     /* Weak check for invalid offset. */
     if (offset > block->patch_romfs_size) {
         fprintf(stderr, "Too big offset looked up in BKTR relocation table!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     if (block->num_entries == 1) { /* Check for edge case, short circuit. */
         return &block->entries[0];
@@ -26,7 +26,7 @@ bktr_relocation_entry_t *bktr_get_relocation(bktr_relocation_block_t *block, uin
         }
     }
     fprintf(stderr, "Failed to find offset %012"PRIx64" in BKTR relocation table!\n", offset);
-    exit(EXIT_FAILURE);
+    fatal_exit();
 }
 
 /* Get a subsection entry from offset and subsection block .*/
@@ -53,5 +53,5 @@ bktr_subsection_entry_t *bktr_get_subsection(bktr_subsection_block_t *block, uin
         }
     }
     fprintf(stderr, "Failed to find offset %012"PRIx64" in BKTR subsection table!\n", offset);
-    exit(EXIT_FAILURE);
+    fatal_exit();
 }
@@ -0,0 +1,544 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#endif
+#include "catalog.h"
+#include "nca.h"
+#include "shard.h"
+#include "utils.h"
+
+/* The catalog is a tab-separated text index, one record per line:
+ *   <path> <size> <mtime> <ctime> <inode> <title id> <content type> <sdk version> <master key rev> <distribution> <rights id> <sections>
+ * where both times are in nanoseconds, and sections is a comma-separated list of
+ * <num>:<type>:<crypt>:<offset>+<size>. A removed file gets
+ *   <path> -
+ * Records are only ever appended, and the last one for a path wins. Files whose size, times and inode
+ * match their record are not opened again; the rest only have their 0xC00 header read and decrypted. */
+
+#define CATALOG_MAX_LINE (MAX_PATH + 0x200)
+#define CATALOG_OLD_SIGNATURE "# hactool catalog v1" /* Had whole seconds of mtime only. */
+
+#ifdef _WIN32
+typedef struct _stat64 catalog_stat_t;
+#define catalog_stat _stat64
+#else
+typedef struct stat catalog_stat_t;
+#define catalog_stat stat
+#endif
+
+static int catalog_compare_entries(const void *a, const void *b) {
+    return strcmp(((const catalog_entry_t *)a)->path, ((const catalog_entry_t *)b)->path);
+}
+
+static uint32_t catalog_hash_path(const char *path) {
+    uint32_t hash = 0x811C9DC5;
+    for (; *path; path++) {
+        hash = (hash ^ (uint8_t)*path) * 0x01000193;
+    }
+    return hash;
+}
+
+/* Returns the bucket holding path, or the empty bucket where it would go. */
+static uint32_t *catalog_get_bucket(catalog_ctx_t *ctx, const char *path) {
+    uint32_t mask = ctx->num_buckets - 1;
+    for (uint32_t i = catalog_hash_path(path) & mask; ; i = (i + 1) & mask) {
+        if (ctx->buckets[i] == 0 || !strcmp(ctx->entries[ctx->buckets[i] - 1].path, path)) {
+            return &ctx->buckets[i];
+        }
+    }
+}
+
+static void catalog_rehash(catalog_ctx_t *ctx) {
+    free(ctx->buckets);
+    ctx->num_buckets = ctx->num_buckets ? ctx->num_buckets * 2 : 0x1000;
+    if ((ctx->buckets = calloc(ctx->num_buckets, sizeof(uint32_t))) == NULL) {
+        fprintf(stderr, "Failed to allocate catalog!\n");
+        fatal_exit();
+    }
+    for (uint32_t i = 0; i < ctx->num_entries; i++) {
+        *catalog_get_bucket(ctx, ctx->entries[i].path) = i + 1;
+    }
+}
+
+static catalog_entry_t *catalog_find(catalog_ctx_t *ctx, const char *path) {
+    uint32_t index = *catalog_get_bucket(ctx, path);
+    return index ? &ctx->entries[index - 1] : NULL;
+}
+
+/* Add an entry for a path known not to be in the catalog yet. */
+static catalog_entry_t *catalog_add_entry(catalog_ctx_t *ctx, char *path) {
+    if (ctx->num_entries == ctx->max_entries) {
+        ctx->max_entries = ctx->max_entries ? ctx->max_entries * 2 : 0x400;
+        if ((ctx->entries = realloc(ctx->entries, ctx->max_entries * sizeof(catalog_entry_t))) == NULL) {
+            fprintf(stderr, "Failed to allocate catalog!\n");
+            fatal_exit();
+        }
+    }
+    catalog_entry_t *entry = &ctx->entries[ctx->num_entries++];
+    memset(entry, 0, sizeof(*entry));
+    entry->path = path;
+    if (ctx->num_entries * 2 > ctx->num_buckets) {
+        catalog_rehash(ctx);
+    } else {
+        *catalog_get_bucket(ctx, path) = ctx->num_entries;
+    }
+    return entry;
+}
+
+/* Take ownership of a record line, replacing any earlier record for its path. Returns 0 for malformed lines. */
+static int catalog_set_record(catalog_ctx_t *ctx, char *line) {
+    char *size_str = strchr(line, '\t');
+    if (size_str == NULL || size_str == line) {
+        return 0;
+    }
+    size_t path_len = (size_t)(size_str - line);
+    size_str++;
+
+    char *path = malloc(path_len + 1);
+    if (path == NULL) {
+        fprintf(stderr, "Failed to allocate catalog path!\n");
+        fatal_exit();
+    }
+    memcpy(path, line, path_len);
+    path[path_len] = '\0';
+
+    catalog_entry_t *entry = catalog_find(ctx, path);
+    if (entry == NULL) {
+        entry = catalog_add_entry(ctx, path);
+    } else {
+        free(path);
+        free(entry->line);
+    }
+    entry->line = line;
+    entry->is_removed = !strcmp(size_str, "-");
+    memset(&entry->stamp, 0, sizeof(entry->stamp));
+    if (!entry->is_removed) {
+        /* A record cut short just never matches, and its file gets read again. */
+        char *end;
+        entry->stamp.size = strtoull(size_str, &end, 10);
+        if (*end == '\t') {
+            entry->stamp.mtime_ns = strtoll(end + 1, &end, 10);
+        }
+        if (*end == '\t') {
+            entry->stamp.ctime_ns = strtoll(end + 1, &end, 10);
+        }
+        if (*end == '\t') {
+            entry->stamp.inode = strtoull(end + 1, &end, 10);
+        }
+    }
+    return 1;
+}
+
+/* Read the records of the index at path. Its header must be for the shard in ctx, unless merging. */
+static int catalog_load(catalog_ctx_t *ctx, const char *path, int is_merging) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        /* First run. */
+        return 1;
+    }
+    char *buf = malloc(CATALOG_MAX_LINE);
+    if (buf == NULL) {
+        fprintf(stderr, "Failed to allocate catalog line buffer!\n");
+        fatal_exit();
+    }
+    uint32_t shard_index, shard_count;
+    if (!is_merging && fgets(buf, CATALOG_MAX_LINE, f) != NULL && shard_parse_header(buf, CATALOG_OLD_SIGNATURE, &shard_index, &shard_count)) {
+        /* Its records can't tell a file rewritten within the same second; start over. */
+        printf("Discarding outdated catalog %s.\n", path);
+        fclose(f);
+        free(buf);
+        if (remove(path) != 0) {
+            fprintf(stderr, "Failed to remove %s!\n", path);
+            return 0;
+        }
+        return 1;
+    }
+    rewind(f);
+    if (fgets(buf, CATALOG_MAX_LINE, f) == NULL || !shard_parse_header(buf, CATALOG_SIGNATURE, &shard_index, &shard_count)) {
+        fprintf(stderr, "%s is not a catalog!\n", path);
+        fclose(f);
+        free(buf);
+        return 0;
+    }
+    if (!is_merging && !shard_check_header(path, buf, CATALOG_SIGNATURE, ctx->shard_index, ctx->shard_count)) {
+        fclose(f);
+        free(buf);
+        return 0;
+    }
+
+    while (fgets(buf, CATALOG_MAX_LINE, f) != NULL) {
+        size_t len = strlen(buf);
+        if (len == 0 || buf[len - 1] != '\n') {
+            /* Torn final line from an interrupted run; that file just gets scanned again. */
+            continue;
+        }
+        buf[--len] = '\0';
+        if (buf[0] == '#' || len == 0) {
+            continue;
+        }
+        char *line = strdup(buf);
+        if (line == NULL) {
+            fprintf(stderr, "Failed to allocate catalog record!\n");
+            fatal_exit();
+        }
+        if (!catalog_set_record(ctx, line)) {
+            free(line);
+            continue;
+        }
+        ctx->num_records++;
+    }
+    fclose(f);
+    free(buf);
+    return 1;
+}
+
+static void catalog_append(catalog_ctx_t *ctx, const char *line) {
+    if (ctx->file == NULL) {
+        int is_new = _fsize(ctx->path) == 0;
+        if ((ctx->file = fopen(ctx->path, "a")) == NULL) {
+            fprintf(stderr, "Failed to open %s!\n", ctx->path);
+            fatal_exit();
+        }
+        if (is_new) {
+            char header[0x40];
+            shard_format_header(header, sizeof(header), CATALOG_SIGNATURE, ctx->shard_index, ctx->shard_count);
+            fprintf(ctx->file, "%s\n", header);
+        }
+    }
+    if (fprintf(ctx->file, "%s\n", line) < 0) {
+        fprintf(stderr, "Failed to write to %s!\n", ctx->path);
+        fatal_exit();
+    }
+    ctx->num_records++;
+}
+
+static const char *catalog_get_section_type(const nca_fs_header_t *header) {
+    if (header->partition_type == PARTITION_PFS0 && header->fs_type == FS_TYPE_PFS0) {
+        return "pfs0";
+    } else if (header->partition_type == PARTITION_ROMFS && header->fs_type == FS_TYPE_ROMFS) {
+        return header->crypt_type == CRYPT_BKTR ? "bktr" : "romfs";
+    }
+    return "invalid";
+}
+
+static const char *catalog_get_crypt_type(const nca_fs_header_t *header) {
+    switch (header->crypt_type) {
+        case CRYPT_NONE:
+            return "none";
+        case CRYPT_XTS:
+            return "xts";
+        case CRYPT_CTR:
+            return "ctr";
+        case CRYPT_BKTR:
+            return "bktr";
+        default:
+            return "unknown";
+    }
+}
+
+/* Read and decrypt just the header, and format its record. */
+static void catalog_format_record(catalog_ctx_t *ctx, nca_ctx_t *nca_ctx, const char *full_path, const char *rel_path, const file_stamp_t *stamp, char *out, size_t out_size) {
+    nca_init(nca_ctx);
+    nca_ctx->tool_ctx = ctx->tool_ctx;
+    int n = snprintf(out, out_size, "%s\t%"PRIu64"\t%"PRId64"\t%"PRId64"\t%"PRIu64, rel_path, stamp->size, stamp->mtime_ns, stamp->ctime_ns, stamp->inode);
+
+    if ((nca_ctx->file = fopen(full_path, "rb")) == NULL) {
+        snprintf(out + n, out_size - n, "\t-\tUnreadable");
+        return;
+    }
+    /* Only the header is read, so don't buffer more than that. */
+    setvbuf(nca_ctx->file, NULL, _IOFBF, 0xC00);
+    int is_valid = stamp->size >= 0xC00 && nca_decrypt_header(nca_ctx);
+    fclose(nca_ctx->file);
+    nca_ctx->file = NULL;
+    if (!is_valid) {
+        snprintf(out + n, out_size - n, "\t-\tInvalid");
+        return;
+    }
+
+    nca_header_t *header = &nca_ctx->header;
+    uint8_t crypto_type = header->crypto_type2 > header->crypto_type ? header->crypto_type2 : header->crypto_type;
+    n += snprintf(out + n, out_size - n, "\t%016"PRIx64"\t%s\t%"PRIu8".%"PRIu8".%"PRIu8".%"PRIu8"\t%"PRIx8"\t%s\t",
+        header->title_id, nca_get_content_type(nca_ctx),
+        header->sdk_major, header->sdk_minor, header->sdk_micro, header->sdk_revision,
+        crypto_type, nca_get_distribution_type(nca_ctx));
+
+    int has_rights_id = 0;
+    for (unsigned int i = 0; i < 0x10; i++) {
+        has_rights_id |= header->rights_id[i];
+    }
+    if (has_rights_id) {
+        for (unsigned int i = 0; i < 0x10; i++) {
+            n += snprintf(out + n, out_size - n, "%02"PRIX8, header->rights_id[i]);
+        }
+    } else {
+        n += snprintf(out + n, out_size - n, "-");
+    }
+
+    n += snprintf(out + n, out_size - n, "\t");
+    int num_sections = 0;
+    for (unsigned int i = 0; i < 4; i++) {
+        if (!header->section_entries[i].media_start_offset) {
+            continue;
+        }
+        uint64_t offset = media_to_real(header->section_entries[i].media_start_offset);
+        uint64_t section_size = media_to_real(header->section_entries[i].media_end_offset) - offset;
+        n += snprintf(out + n, out_size - n, "%s%"PRIu32":%s:%s:0x%"PRIx64"+0x%"PRIx64, num_sections++ ? "," : "",
+            i, catalog_get_section_type(&header->fs_headers[i]), catalog_get_crypt_type(&header->fs_headers[i]), offset, section_size);
+    }
+    if (!num_sections) {
+        snprintf(out + n, out_size - n, "-");
+    }
+}
+
+static int catalog_is_nca_name(const char *name) {
+    size_t len = strlen(name);
+    if (len < 4 || name[len - 4] != '.') {
+        return 0;
+    }
+    return tolower((unsigned char)name[len - 3]) == 'n' && tolower((unsigned char)name[len - 2]) == 'c' && tolower((unsigned char)name[len - 1]) == 'a';
+}
+
+static void catalog_read_worker(void *arg) {
+    catalog_ctx_t *ctx = arg;
+    nca_ctx_t *nca_ctx = malloc(sizeof(nca_ctx_t));
+    char *line = malloc(CATALOG_MAX_LINE);
+    if (nca_ctx == NULL || line == NULL) {
+        fprintf(stderr, "Failed to allocate catalog record!\n");
+        fatal_exit();
+    }
+    uint32_t i;
+    while (!atomic_load(&ctx->stop) && (i = atomic_fetch_add(&ctx->next_pending, 1)) < ctx->num_pending) {
+        catalog_pending_t *pending = &ctx->pending[i];
+        catalog_format_record(ctx, nca_ctx, pending->full_path, pending->rel_path, &pending->stamp, line, CATALOG_MAX_LINE);
+        if ((pending->line = strdup(line)) == NULL) {
+            fprintf(stderr, "Failed to allocate catalog record!\n");
+            fatal_exit();
+        }
+    }
+    free(line);
+    free(nca_ctx);
+}
+
+/* Read the headers of the pending NCAs on several threads, and record them in the order they were found. */
+static void catalog_read_pending(catalog_ctx_t *ctx) {
+    atomic_store(&ctx->next_pending, 0);
+    atomic_store(&ctx->stop, 0);
+    run_workers(ctx->num_pending < ctx->num_jobs ? ctx->num_pending : ctx->num_jobs, catalog_read_worker, ctx, &ctx->stop);
+    for (uint32_t i = 0; i < ctx->num_pending; i++) {
+        catalog_pending_t *pending = &ctx->pending[i];
+        catalog_append(ctx, pending->line);
+        catalog_set_record(ctx, pending->line);
+        catalog_find(ctx, pending->rel_path)->is_seen = 1;
+        ctx->num_updated++;
+        free(pending->full_path);
+        free(pending->rel_path);
+    }
+    ctx->num_pending = 0;
+}
+
+static void catalog_scan_file(catalog_ctx_t *ctx, const char *full_path, const char *rel_path, const catalog_stat_t *st) {
+    file_stamp_t stamp;
+    get_file_stamp(&stamp, st);
+    ctx->num_scanned++;
+
+    catalog_entry_t *entry = catalog_find(ctx, rel_path);
+    if (entry != NULL) {
+        entry->is_seen = 1;
+        if (!entry->is_removed && is_same_file_stamp(&entry->stamp, &stamp)) {
+            return;
+        }
+    }
+
+    catalog_pending_t *pending = &ctx->pending[ctx->num_pending++];
+    pending->full_path = strdup(full_path);
+    pending->rel_path = strdup(rel_path);
+    if (pending->full_path == NULL || pending->rel_path == NULL) {
+        fprintf(stderr, "Failed to allocate catalog record!\n");
+        fatal_exit();
+    }
+    pending->stamp = stamp;
+    pending->line = NULL;
+    if (ctx->num_pending == CATALOG_BATCH_SIZE) {
+        catalog_read_pending(ctx);
+    }
+}
+
+static void catalog_scan_dir(catalog_ctx_t *ctx, const char *dir, const char *rel_dir) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        fprintf(stderr, "Warning: failed to open directory %s!\n", dir);
+        return;
+    }
+    char full_path[MAX_PATH];
+    char rel_path[MAX_PATH];
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+            continue;
+        }
+        if (strchr(ent->d_name, '\t') != NULL || strchr(ent->d_name, '\n') != NULL) {
+            fprintf(stderr, "Warning: skipping %s/%s, its name cannot be cataloged.\n", dir, ent->d_name);
+            continue;
+        }
+        int full_len = snprintf(full_path, sizeof(full_path), "%s/%s", dir, ent->d_name);
+        int rel_len = *rel_dir ? snprintf(rel_path, sizeof(rel_path), "%s/%s", rel_dir, ent->d_name) : snprintf(rel_path, sizeof(rel_path), "%s", ent->d_name);
+        if (full_len < 0 || full_len >= (int)sizeof(full_path) || rel_len < 0 || rel_len >= (int)sizeof(rel_path)) {
+            fprintf(stderr, "Warning: skipping %s/%s, its path is too long.\n", dir, ent->d_name);
+            continue;
+        }
+
+        catalog_stat_t st;
+        if (catalog_stat(full_path, &st) != 0) {
+            continue;
+        }
+#ifndef _WIN32
+        /* Don't follow directory symlinks, which could loop. */
+        struct stat lst;
+        if (S_ISDIR(st.st_mode) && (lstat(full_path, &lst) != 0 || S_ISLNK(lst.st_mode))) {
+            continue;
+        }
+#endif
+        if (S_ISDIR(st.st_mode)) {
+            catalog_scan_dir(ctx, full_path, rel_path);
+        } else if (S_ISREG(st.st_mode) && catalog_is_nca_name(ent->d_name) && strcmp(full_path, ctx->path) &&
+                   shard_contains(ctx->shard_index, ctx->shard_count, rel_path)) {
+            catalog_scan_file(ctx, full_path, rel_path, &st);
+        }
+    }
+    closedir(d);
+}
+
+/* Rewrite the index with only the live records, through a temporary file. */
+static void catalog_compact(catalog_ctx_t *ctx) {
+    char tmp_path[MAX_PATH + 0x10];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", ctx->path);
+    /* Entries move, so the path hash is stale after this; it is not needed any more. */
+    qsort(ctx->entries, ctx->num_entries, sizeof(catalog_entry_t), catalog_compare_entries);
+
+    FILE *f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", tmp_path);
+        fatal_exit();
+    }
+    char header[0x40];
+    shard_format_header(header, sizeof(header), CATALOG_SIGNATURE, ctx->shard_index, ctx->shard_count);
+    fprintf(f, "%s\n", header);
+    ctx->num_records = 0;
+    for (uint32_t i = 0; i < ctx->num_entries; i++) {
+        if (!ctx->entries[i].is_removed) {
+            fprintf(f, "%s\n", ctx->entries[i].line);
+            ctx->num_records++;
+        }
+    }
+    if (ferror(f) || !fsync_file(f) || fclose(f) != 0) {
+        fprintf(stderr, "Failed to write catalog %s!\n", tmp_path);
+        fatal_exit();
+    }
+#ifdef _WIN32
+    remove(ctx->path);
+#endif
+    if (rename(tmp_path, ctx->path) != 0) {
+        fprintf(stderr, "Failed to replace catalog %s!\n", ctx->path);
+        fatal_exit();
+    }
+}
+
+/* Bring the catalog at path up to date with the NCAs under dir. */
+static void catalog_free(catalog_ctx_t *ctx) {
+    for (uint32_t i = 0; i < ctx->num_entries; i++) {
+        free(ctx->entries[i].path);
+        free(ctx->entries[i].line);
+    }
+    free(ctx->entries);
+    free(ctx->buckets);
+    free(ctx->pending);
+    free(ctx->path);
+}
+
+int catalog_update(hactool_ctx_t *tool_ctx, const char *dir, const char *path) {
+    catalog_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.tool_ctx = tool_ctx;
+    if ((ctx.path = strdup(path)) == NULL || (ctx.pending = malloc(CATALOG_BATCH_SIZE * sizeof(catalog_pending_t))) == NULL) {
+        fprintf(stderr, "Failed to allocate catalog context!\n");
+        fatal_exit();
+    }
+    ctx.num_jobs = tool_ctx->settings.jobs ? tool_ctx->settings.jobs : HACTOOL_DEFAULT_JOBS;
+    ctx.shard_index = tool_ctx->settings.shard_index;
+    ctx.shard_count = tool_ctx->settings.shard_count;
+    catalog_rehash(&ctx);
+    if (!catalog_load(&ctx, ctx.path, 0)) {
+        return 0;
+    }
+
+    size_t dir_len = strlen(dir);
+    while (dir_len > 1 && (dir[dir_len - 1] == '/' || dir[dir_len - 1] == '\\')) {
+        dir_len--;
+    }
+    char root[MAX_PATH];
+    snprintf(root, sizeof(root), "%.*s", (int)dir_len, dir);
+    catalog_scan_dir(&ctx, root, "");
+    catalog_read_pending(&ctx);
+
+    uint32_t num_live = 0;
+    for (uint32_t i = 0; i < ctx.num_entries; i++) {
+        catalog_entry_t *entry = &ctx.entries[i];
+        if (entry->is_removed) {
+            continue;
+        }
+        if (!entry->is_seen) {
+            char line[CATALOG_MAX_LINE];
+            snprintf(line, sizeof(line), "%s\t-", entry->path);
+            catalog_append(&ctx, line);
+            entry->is_removed = 1;
+            ctx.num_removed++;
+            continue;
+        }
+        num_live++;
+    }
+
+    if (ctx.file != NULL) {
+        if (!fsync_file(ctx.file) || fclose(ctx.file) != 0) {
+            fprintf(stderr, "Failed to write catalog %s!\n", ctx.path);
+            fatal_exit();
+        }
+        ctx.file = NULL;
+    }
+    /* Superseded records only cost space; drop them once they outnumber the live ones. */
+    if (ctx.num_records > 2 * (uint64_t)num_live + 0x40) {
+        catalog_compact(&ctx);
+    }
+
+    printf("Catalog: %"PRIu64" NCA(s) scanned, %"PRIu64" updated, %"PRIu64" removed, %"PRIu32" listed in %s.\n", ctx.num_scanned, ctx.num_updated, ctx.num_removed, num_live, ctx.path);
+
+    catalog_free(&ctx);
+    return 1;
+}
+
+/* Combine the catalogs of all shards into one full catalog at out_path. */
+int catalog_merge(hactool_ctx_t *tool_ctx, const char *out_path, char **paths, unsigned int num_paths) {
+    catalog_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.tool_ctx = tool_ctx;
+    if ((ctx.path = strdup(out_path)) == NULL) {
+        fprintf(stderr, "Failed to allocate catalog context!\n");
+        fatal_exit();
+    }
+    catalog_rehash(&ctx);
+    for (unsigned int i = 0; i < num_paths; i++) {
+        if (!catalog_load(&ctx, paths[i], 1)) {
+            catalog_free(&ctx);
+            return 0;
+        }
+    }
+    catalog_compact(&ctx);
+    printf("Catalog: merged %u shard(s), %"PRIu64" NCA(s) listed in %s.\n", num_paths, ctx.num_records, ctx.path);
+    catalog_free(&ctx);
+    return 1;
+}
@@ -0,0 +1,55 @@
+#ifndef HACTOOL_CATALOG_H
+#define HACTOOL_CATALOG_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include "types.h"
+#include "settings.h"
+#include "utils.h"
+
+#define CATALOG_SIGNATURE "# hactool catalog v2"
+#define CATALOG_BATCH_SIZE 0x1000 /* Headers read by the workers before their records are written. */
+
+/* Latest record for one NCA in the library. */
+typedef struct {
+    char *path; /* Relative to the scanned directory. */
+    file_stamp_t stamp;
+    char *line; /* The whole record, as written. */
+    int is_removed; /* Last record was a removal. */
+    int is_seen; /* Found by the current scan. */
+} catalog_entry_t;
+
+/* A new or changed NCA, waiting for its header to be read. */
+typedef struct {
+    char *full_path;
+    char *rel_path;
+    file_stamp_t stamp;
+    char *line; /* Its record, once read. */
+} catalog_pending_t;
+
+typedef struct {
+    hactool_ctx_t *tool_ctx;
+    char *path;
+    FILE *file; /* Opened for appending. */
+    catalog_entry_t *entries;
+    uint32_t num_entries;
+    uint32_t max_entries;
+    uint32_t *buckets; /* Open-addressed path hash; each slot holds an entry index plus one. */
+    uint32_t num_buckets;
+    uint64_t num_records; /* Lines in the index, including superseded ones. */
+    catalog_pending_t *pending;
+    uint32_t num_pending;
+    uint32_t num_jobs;
+    atomic_uint_fast32_t next_pending;
+    atomic_int stop; /* Set when a worker fails. */
+    uint32_t shard_index; /* Only NCAs in this shard are indexed, if shard_count is set. */
+    uint32_t shard_count;
+    uint64_t num_scanned;
+    uint64_t num_updated;
+    uint64_t num_removed;
+} catalog_ctx_t;
+
+int catalog_update(hactool_ctx_t *tool_ctx, const char *dir, const char *path);
+int catalog_merge(hactool_ctx_t *tool_ctx, const char *out_path, char **paths, unsigned int num_paths);
+
+#endif
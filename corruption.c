@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "corruption.h"
+#include "utils.h"
+
+/* Open a corruption map for writing. Lines are:
+ *   level <source> <level> <bad>/<checked> <block size>
+ *   range <source> <level> <start>-<end>
+ *   file <source> <path>
+ * Offsets are relative to the start of the source (e.g. an NCA section). */
+int corruption_open(corruption_ctx_t *ctx, const char *path) {
+    memset(ctx, 0, sizeof(*ctx));
+    if ((ctx->file = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", path);
+        return 0;
+    }
+    if ((ctx->path = strdup(path)) == NULL) {
+        fprintf(stderr, "Failed to allocate corruption map path!\n");
+        fatal_exit();
+    }
+    pthread_mutex_init(&ctx->lock, NULL);
+    return 1;
+}
+
+void corruption_close(corruption_ctx_t *ctx) {
+    if (ctx->file == NULL) {
+        return;
+    }
+    if (fclose(ctx->file) != 0) {
+        fprintf(stderr, "Failed to finish %s!\n", ctx->path);
+        fatal_exit();
+    }
+    printf("Corruption map: %"PRIu64" bad block(s), %"PRIu64" affected file(s), written to %s.\n", ctx->num_bad_blocks, ctx->num_bad_files, ctx->path);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx->path);
+    ctx->file = NULL;
+}
+
+/* Blocks are checked in order, so adjacent failures extend the last range. */
+void corruption_list_add(corruption_list_t *list, uint64_t start, uint64_t end) {
+    if (list->num_ranges && list->ranges[list->num_ranges - 1].end == start) {
+        list->ranges[list->num_ranges - 1].end = end;
+        return;
+    }
+    if (list->num_ranges == list->max_ranges) {
+        list->max_ranges = list->max_ranges ? list->max_ranges * 2 : 0x10;
+        list->ranges = realloc(list->ranges, list->max_ranges * sizeof(*list->ranges));
+        if (list->ranges == NULL) {
+            fprintf(stderr, "Failed to allocate corruption ranges!\n");
+            fatal_exit();
+        }
+    }
+    list->ranges[list->num_ranges].start = start;
+    list->ranges[list->num_ranges].end = end;
+    list->num_ranges++;
+}
+
+int corruption_list_overlaps(const corruption_list_t *list, uint64_t start, uint64_t end) {
+    for (uint32_t i = 0; i < list->num_ranges; i++) {
+        if (start < list->ranges[i].end && list->ranges[i].start < end) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void corruption_list_free(corruption_list_t *list) {
+    free(list->ranges);
+    memset(list, 0, sizeof(*list));
+}
+
+void corruption_write_level(corruption_ctx_t *ctx, const char *source, const char *level, const corruption_list_t *list) {
+    if (ctx == NULL || list->num_blocks == 0) {
+        return;
+    }
+    pthread_mutex_lock(&ctx->lock);
+    fprintf(ctx->file, "level %s %s %"PRIu64"/%"PRIu64" 0x%"PRIx64"\n", source, level, list->num_bad_blocks, list->num_blocks, list->block_size);
+    for (uint32_t i = 0; i < list->num_ranges; i++) {
+        fprintf(ctx->file, "range %s %s 0x%012"PRIx64"-0x%012"PRIx64"\n", source, level, list->ranges[i].start, list->ranges[i].end);
+    }
+    ctx->num_bad_blocks += list->num_bad_blocks;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+void corruption_write_file(corruption_ctx_t *ctx, const char *source, const char *path) {
+    if (ctx == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&ctx->lock);
+    fprintf(ctx->file, "file %s %s\n", source, path);
+    ctx->num_bad_files++;
+    pthread_mutex_unlock(&ctx->lock);
+}
@@ -0,0 +1,42 @@
+#ifndef HACTOOL_CORRUPTION_H
+#define HACTOOL_CORRUPTION_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "types.h"
+
+/* A run of failing bytes, [start, end). */
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+} corruption_range_t;
+
+/* Failing blocks of one hash level, as a list of coalesced ranges. */
+typedef struct {
+    corruption_range_t *ranges;
+    uint32_t num_ranges;
+    uint32_t max_ranges;
+    uint64_t block_size;
+    uint64_t num_blocks; /* Blocks checked. */
+    uint64_t num_bad_blocks;
+} corruption_list_t;
+
+typedef struct corruption_ctx {
+    FILE *file;
+    char *path;
+    uint64_t num_bad_blocks;
+    uint64_t num_bad_files;
+    pthread_mutex_t lock; /* Lines may be written by several NCA workers at once. */
+} corruption_ctx_t;
+
+int corruption_open(corruption_ctx_t *ctx, const char *path);
+void corruption_close(corruption_ctx_t *ctx);
+
+void corruption_list_add(corruption_list_t *list, uint64_t start, uint64_t end);
+int corruption_list_overlaps(const corruption_list_t *list, uint64_t start, uint64_t end);
+void corruption_list_free(corruption_list_t *list);
+
+void corruption_write_level(corruption_ctx_t *ctx, const char *source, const char *level, const corruption_list_t *list);
+void corruption_write_file(corruption_ctx_t *ctx, const char *source, const char *path);
+
+#endif
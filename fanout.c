@@ -0,0 +1,599 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "fanout.h"
+#include "aes.h"
+#include "utils.h"
+#include "tar.h"
+#include "manifest.h"
+#include "stats.h"
+
+/* Single-pass NCA extraction: every byte of the NCA is read and decrypted once, */
+/* then handed to each consumer (output file, tar member, hash check) whose range covers it. */
+
+static void fanout_grow(fanout_ctx_t *ctx) {
+    if (ctx->num_consumers < ctx->max_consumers) {
+        return;
+    }
+    ctx->max_consumers = ctx->max_consumers ? ctx->max_consumers * 2 : 0x40;
+    ctx->consumers = realloc(ctx->consumers, ctx->max_consumers * sizeof(fanout_consumer_t));
+    if (ctx->consumers == NULL) {
+        fprintf(stderr, "Failed to allocate fan-out consumers!\n");
+        fatal_exit();
+    }
+}
+
+static fanout_consumer_t *fanout_add(fanout_ctx_t *ctx, fanout_type_t type, nca_section_ctx_t *section, uint64_t ofs, uint64_t size) {
+    if (section != NULL && (ofs > section->size || size > section->size - ofs)) {
+        fprintf(stderr, "Error: data at %012"PRIx64" exceeds section %"PRId32"!\n", ofs, section->section_num);
+        return NULL;
+    }
+    fanout_grow(ctx);
+    fanout_consumer_t *consumer = &ctx->consumers[ctx->num_consumers++];
+    memset(consumer, 0, sizeof(*consumer));
+    consumer->type = type;
+    consumer->section = section;
+    consumer->start = (section != NULL ? section->offset : 0) + ofs;
+    consumer->end = consumer->start + size;
+    return consumer;
+}
+
+static char *fanout_strdup(const char *path) {
+    char *copy = strdup(path);
+    if (copy == NULL) {
+        fprintf(stderr, "Failed to allocate fan-out path!\n");
+        fatal_exit();
+    }
+    return copy;
+}
+
+void fanout_add_file(fanout_ctx_t *ctx, nca_section_ctx_t *section, uint64_t ofs, uint64_t size, const char *path, int sparse) {
+    fanout_consumer_t *consumer = fanout_add(ctx, FANOUT_FILE, section, ofs, size);
+    if (consumer != NULL) {
+        consumer->path = fanout_strdup(path);
+        consumer->is_sparse = sparse;
+    }
+}
+
+void fanout_add_tar_file(fanout_ctx_t *ctx, nca_section_ctx_t *section, uint64_t ofs, uint64_t size, tar_ctx_t *tar, const char *path) {
+    fanout_consumer_t *consumer = fanout_add(ctx, FANOUT_TAR, section, ofs, size);
+    if (consumer != NULL) {
+        consumer->tar = tar;
+        consumer->path = fanout_strdup(path);
+    }
+}
+
+/* Check data_len bytes at data_ofs against the hash table at hash_ofs, both within the section. */
+static void fanout_add_hash_check(fanout_ctx_t *ctx, nca_section_ctx_t *section, uint64_t hash_ofs, uint64_t data_ofs, uint64_t data_len, uint64_t block_size, int full_block, int level, validity_t *validity) {
+    if (block_size == 0) {
+        /* Block size of 0 is always invalid. */
+        *validity = VALIDITY_INVALID;
+        return;
+    }
+    uint64_t hash_table_size = data_len / block_size;
+    if (data_len % block_size) hash_table_size++;
+    hash_table_size *= 0x20;
+    if (hash_ofs > section->size || hash_table_size > section->size - hash_ofs || data_ofs > section->size || data_len > section->size - data_ofs) {
+        *validity = VALIDITY_INVALID;
+        return;
+    }
+
+    unsigned char *hash_table = malloc(hash_table_size ? hash_table_size : 1);
+    if (hash_table == NULL) {
+        fprintf(stderr, "Failed to allocate hash table!\n");
+        fatal_exit();
+    }
+
+    if (hash_ofs + hash_table_size <= data_ofs) {
+        /* Hash table precedes its data, so it can be captured during the pass. */
+        fanout_consumer_t *capture = fanout_add(ctx, FANOUT_CAPTURE, section, hash_ofs, hash_table_size);
+        capture->buffer = hash_table;
+    } else {
+        nca_section_fseek(section, hash_ofs);
+        if (nca_section_fread(section, hash_table, hash_table_size) != hash_table_size) {
+            fprintf(stderr, "Failed to read section!\n");
+            fatal_exit();
+        }
+    }
+
+    fanout_consumer_t *verify = fanout_add(ctx, FANOUT_VERIFY, section, data_ofs, data_len);
+    verify->buffer = hash_table;
+    verify->block_size = block_size;
+    verify->full_block = full_block;
+    verify->validity = validity;
+    verify->level = level;
+    *validity = VALIDITY_VALID;
+}
+
+static void fanout_add_section_checks(fanout_ctx_t *ctx, nca_section_ctx_t *section) {
+    switch (section->type) {
+        case PFS0: {
+            pfs0_superblock_t *sb = section->pfs0_ctx.superblock;
+            fanout_add_hash_check(ctx, section, sb->hash_table_offset, sb->pfs0_offset, sb->pfs0_size, sb->block_size, 0, -1, &section->pfs0_ctx.hash_table_validity);
+            break;
+        }
+        case ROMFS:
+            for (unsigned int i = 1; i < IVFC_MAX_LEVEL; i++) {
+                ivfc_level_ctx_t *cur_level = &section->romfs_ctx.ivfc_levels[i];
+                fanout_add_hash_check(ctx, section, cur_level->hash_offset, cur_level->data_offset, cur_level->data_size, cur_level->hash_block_size, 1, (int)i, &cur_level->hash_validity);
+            }
+            break;
+        case BKTR:
+        case INVALID:
+        default:
+            break;
+    }
+}
+
+static int fanout_consumer_cmp(const void *a, const void *b) {
+    const fanout_consumer_t *ca = a;
+    const fanout_consumer_t *cb = b;
+    if (ca->start != cb->start) {
+        return ca->start < cb->start ? -1 : 1;
+    }
+    if (ca->end != cb->end) {
+        return ca->end < cb->end ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Tar members are written back to back, so overlapping members of one archive can't be streamed. */
+static void fanout_defer_overlapping_tar_files(fanout_ctx_t *ctx) {
+    for (uint32_t i = 0; i < ctx->num_consumers; i++) {
+        fanout_consumer_t *consumer = &ctx->consumers[i];
+        if (consumer->type != FANOUT_TAR) {
+            continue;
+        }
+        for (uint32_t j = i; j-- > 0;) {
+            fanout_consumer_t *prev = &ctx->consumers[j];
+            if (prev->type == FANOUT_TAR && prev->tar == consumer->tar && !prev->is_deferred) {
+                if (prev->end > consumer->start || prev->start == consumer->start) {
+                    consumer->is_deferred = 1;
+                }
+                break;
+            }
+        }
+    }
+}
+
+static void fanout_begin(fanout_ctx_t *ctx, fanout_consumer_t *consumer) {
+    manifest_ctx_t *manifest = ctx->nca->tool_ctx->manifest;
+    trace_begin(&consumer->trace);
+    switch (consumer->type) {
+        case FANOUT_FILE: {
+            filepath_t filepath;
+            filepath_init(&filepath);
+            filepath_set(&filepath, consumer->path);
+            if ((consumer->file = os_fopen(filepath.os_path, OS_MODE_WRITE)) == NULL) {
+                fprintf(stderr, "Failed to open %s!\n", consumer->path);
+                return;
+            }
+            if (!consumer->is_sparse) {
+                preallocate_file(consumer->file, consumer->end - consumer->start);
+            }
+            if (manifest != NULL) {
+                consumer->sha = new_sha_ctx(HASH_TYPE_SHA256, 0);
+            }
+            break;
+        }
+        case FANOUT_TAR:
+            tar_begin_file(consumer->tar, consumer->path, consumer->end - consumer->start);
+            consumer->file = consumer->tar->file;
+            if (manifest != NULL) {
+                consumer->sha = new_sha_ctx(HASH_TYPE_SHA256, 0);
+            }
+            break;
+        case FANOUT_VERIFY:
+            consumer->sha = new_sha_ctx(HASH_TYPE_SHA256, 0);
+            break;
+        case FANOUT_CAPTURE:
+        default:
+            break;
+    }
+}
+
+static void fanout_check_block(fanout_consumer_t *consumer, uint64_t block_start, uint64_t block_end) {
+    static const unsigned char zeroes[0x1000];
+    unsigned char cur_hash[0x20];
+    if (consumer->full_block) {
+        /* Last block is zero-padded to the full block size. */
+        for (uint64_t pad = consumer->block_size - (block_end - block_start); pad > 0;) {
+            uint64_t n = pad < sizeof(zeroes) ? pad : sizeof(zeroes);
+            sha_update(consumer->sha, zeroes, n);
+            pad -= n;
+        }
+    }
+    sha_get_hash(consumer->sha, cur_hash);
+    free_sha_ctx(consumer->sha);
+    consumer->sha = NULL;
+
+    uint64_t index = (block_start - consumer->start) / consumer->block_size;
+    if (memcmp(cur_hash, consumer->buffer + index * 0x20, 0x20) != 0) {
+        *consumer->validity = VALIDITY_INVALID;
+    }
+}
+
+static void fanout_write(fanout_consumer_t *consumer, const unsigned char *data, uint64_t ofs, uint64_t size) {
+    switch (consumer->type) {
+        case FANOUT_FILE:
+        case FANOUT_TAR:
+            if (consumer->file == NULL) {
+                return;
+            }
+            if (consumer->sha != NULL) {
+                sha_update(consumer->sha, data, size);
+            }
+            size_t written;
+            if (consumer->is_sparse) {
+                written = fwrite_sparse(data, size, ofs - consumer->start, consumer->file);
+            } else {
+                stats_span_t span;
+                stats_begin(&span);
+                written = fwrite(data, 1, size, consumer->file);
+                stats_end(&span, STATS_WRITE, written);
+            }
+            if (written != size) {
+                fprintf(stderr, "Failed to write file!\n");
+                fatal_exit();
+            }
+            break;
+        case FANOUT_CAPTURE:
+            memcpy(consumer->buffer + (ofs - consumer->start), data, size);
+            break;
+        case FANOUT_VERIFY:
+            while (size > 0) {
+                if (*consumer->validity != VALIDITY_VALID) {
+                    return;
+                }
+                uint64_t block_start = consumer->start + (ofs - consumer->start) / consumer->block_size * consumer->block_size;
+                uint64_t block_end = block_start + consumer->block_size;
+                if (block_end > consumer->end) block_end = consumer->end;
+                uint64_t n = block_end - ofs < size ? block_end - ofs : size;
+                if (consumer->sha == NULL) {
+                    consumer->sha = new_sha_ctx(HASH_TYPE_SHA256, 0);
+                }
+                sha_update(consumer->sha, data, n);
+                if (ofs + n == block_end) {
+                    fanout_check_block(consumer, block_start, block_end);
+                }
+                data += n;
+                ofs += n;
+                size -= n;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void fanout_end(fanout_ctx_t *ctx, fanout_consumer_t *consumer) {
+    manifest_ctx_t *manifest = ctx->nca->tool_ctx->manifest;
+    unsigned char hash[0x20];
+    switch (consumer->type) {
+        case FANOUT_FILE:
+            if (consumer->file == NULL) {
+                break;
+            }
+            if (consumer->sha != NULL) {
+                sha_get_hash(consumer->sha, hash);
+                manifest_add(manifest, consumer->path, consumer->end - consumer->start, hash);
+            }
+            if (consumer->is_sparse && !finish_sparse_file(consumer->file, consumer->end - consumer->start)) {
+                fprintf(stderr, "Failed to write file!\n");
+                fatal_exit();
+            }
+            fclose(consumer->file);
+            break;
+        case FANOUT_TAR:
+            if (consumer->sha != NULL) {
+                sha_get_hash(consumer->sha, hash);
+                manifest_add(manifest, consumer->tar->cur_name, consumer->end - consumer->start, hash);
+            }
+            tar_end_file(consumer->tar);
+            break;
+        case FANOUT_VERIFY:
+            free(consumer->buffer);
+            break;
+        case FANOUT_CAPTURE:
+        default:
+            break;
+    }
+    free_sha_ctx(consumer->sha);
+    consumer->sha = NULL;
+    consumer->file = NULL;
+
+    /* Outputs are written side by side as the NCA is read, so their spans overlap. */
+    int section_num = consumer->section != NULL ? (int)consumer->section->section_num : TRACE_NO_SECTION;
+    if (consumer->type == FANOUT_FILE || consumer->type == FANOUT_TAR) {
+        trace_end_async(&consumer->trace, "extract file", section_num, "%s", consumer->path);
+    } else if (consumer->type == FANOUT_VERIFY && consumer->level < 0) {
+        trace_end_async(&consumer->trace, "PFS0 verify", section_num, NULL);
+    } else if (consumer->type == FANOUT_VERIFY) {
+        trace_end_async(&consumer->trace, "IVFC verify", section_num, "level %d", consumer->level);
+    }
+}
+
+/* Find the section covering an absolute offset, and where the region containing it ends. */
+static nca_section_ctx_t *fanout_find_region(nca_ctx_t *ctx, uint64_t ofs, uint64_t *region_end) {
+    *region_end = UINT64_MAX;
+    if (ofs < 0xC00) {
+        *region_end = 0xC00;
+        return NULL;
+    }
+    for (unsigned int i = 0; i < 4; i++) {
+        nca_section_ctx_t *section = &ctx->section_contexts[i];
+        if (!section->is_present) {
+            continue;
+        }
+        if (ofs >= section->offset && ofs < section->offset + section->size) {
+            *region_end = section->offset + section->size;
+            return section;
+        }
+        if (section->offset > ofs && section->offset < *region_end) {
+            *region_end = section->offset;
+        }
+    }
+    return NULL;
+}
+
+/* Content IDs are the first half of the SHA-256 of the NCA, and name the file. */
+static validity_t fanout_check_content_id(const char *file_name, const unsigned char *hash) {
+    if (file_name == NULL) {
+        return VALIDITY_UNCHECKED;
+    }
+    const char *base = file_name;
+    for (const char *p = file_name; *p; p++) {
+        if (*p == '/' || *p == '\\') {
+            base = p + 1;
+        }
+    }
+    unsigned char content_id[0x10];
+    for (unsigned int i = 0; i < 0x20; i++) {
+        if (!isxdigit((unsigned char)base[i])) {
+            return VALIDITY_UNCHECKED;
+        }
+    }
+    if (base[0x20] != '\0' && base[0x20] != '.') {
+        return VALIDITY_UNCHECKED;
+    }
+    for (unsigned int i = 0; i < 0x10; i++) {
+        char byte[3] = {base[i * 2], base[i * 2 + 1], '\0'};
+        content_id[i] = (unsigned char)strtoul(byte, NULL, 16);
+    }
+    return memcmp(content_id, hash, 0x10) == 0 ? VALIDITY_VALID : VALIDITY_INVALID;
+}
+
+static void fanout_run(fanout_ctx_t *ctx) {
+    nca_ctx_t *nca = ctx->nca;
+    unsigned char *buf = malloc(FANOUT_BUFFER_SIZE);
+    fanout_consumer_t **active = malloc((ctx->num_consumers + 1) * sizeof(*active));
+    if (buf == NULL || active == NULL) {
+        fprintf(stderr, "Failed to allocate fan-out buffer!\n");
+        fatal_exit();
+    }
+    uint32_t num_active = 0;
+    uint32_t next = 0;
+
+    fseeko64(nca->file, nca->file_offset, SEEK_SET);
+
+    /* Read up to the end of the NCA, so the hash covers anything past the last section too. */
+    sha_ctx_t *nca_sha = new_sha_ctx(HASH_TYPE_SHA256, 0);
+    stats_scope_t scope = stats_enter(STATS_PHASE_PASS, STATS_NO_SECTION);
+    uint64_t ofs = 0;
+    int at_eof = 0;
+    while (!at_eof) {
+        uint64_t region_end;
+        nca_section_ctx_t *section = fanout_find_region(nca, ofs, &region_end);
+        stats_enter(STATS_PHASE_PASS, section != NULL ? section->section_num : STATS_NO_SECTION);
+        uint64_t read_size = FANOUT_BUFFER_SIZE;
+        if (read_size > region_end - ofs) read_size = region_end - ofs;
+        if (nca->file_size != 0 && read_size > nca->file_size - ofs) read_size = nca->file_size - ofs;
+        if (read_size == 0) {
+            break;
+        }
+
+        stats_span_t span;
+        stats_begin(&span);
+        size_t read = fread(buf, 1, read_size, nca->file);
+        stats_end(&span, STATS_READ, read);
+        if (read != read_size) {
+            if (ferror(nca->file)) {
+                fprintf(stderr, "Failed to read NCA!\n");
+                fatal_exit();
+            }
+            at_eof = 1;
+            if (read == 0) {
+                break;
+            }
+            read_size = read;
+        }
+        sha_update(nca_sha, buf, read_size);
+
+        if (section != NULL) {
+            nca_decrypt_section_data(section, buf, ofs, read_size);
+        } else if (ofs < 0xC00) {
+            memcpy(buf, (unsigned char *)&nca->header + ofs, read_size);
+        } else {
+            /* Padding between sections is not part of the plaintext. */
+            memset(buf, 0, read_size);
+        }
+
+        uint64_t chunk_end = ofs + read_size;
+        while (next < ctx->num_consumers && ctx->consumers[next].start < chunk_end) {
+            fanout_consumer_t *consumer = &ctx->consumers[next++];
+            if (!consumer->is_deferred) {
+                active[num_active++] = consumer;
+            }
+        }
+
+        uint32_t still_active = 0;
+        for (uint32_t i = 0; i < num_active; i++) {
+            fanout_consumer_t *consumer = active[i];
+            if (!consumer->is_started) {
+                /* Started in offset order, so tar members are written one after another. */
+                fanout_begin(ctx, consumer);
+                consumer->is_started = 1;
+            }
+            uint64_t lo = consumer->start > ofs ? consumer->start : ofs;
+            uint64_t hi = consumer->end < chunk_end ? consumer->end : chunk_end;
+            if (lo < hi) {
+                fanout_write(consumer, buf + (lo - ofs), lo, hi - lo);
+            }
+            if (consumer->end <= chunk_end) {
+                fanout_end(ctx, consumer);
+            } else {
+                active[still_active++] = consumer;
+            }
+        }
+        num_active = still_active;
+        ofs = chunk_end;
+    }
+
+    stats_leave(scope);
+    sha_get_hash(nca_sha, nca->content_hash);
+    free_sha_ctx(nca_sha);
+    nca->has_content_hash = 1;
+    nca->content_id_validity = fanout_check_content_id(nca->file_name, nca->content_hash);
+
+    /* Only empty outputs may be left; anything else runs past the end of the file. */
+    if (num_active > 0) {
+        fprintf(stderr, "Failed to read NCA!\n");
+        fatal_exit();
+    }
+    for (; next < ctx->num_consumers; next++) {
+        fanout_consumer_t *consumer = &ctx->consumers[next];
+        if (consumer->is_deferred) {
+            continue;
+        }
+        if (consumer->start < consumer->end) {
+            fprintf(stderr, "Failed to read NCA!\n");
+            fatal_exit();
+        }
+        fanout_begin(ctx, consumer);
+        fanout_end(ctx, consumer);
+    }
+
+    free(active);
+    free(buf);
+}
+
+/* Tar members that overlap a previous member are read again on their own. */
+static void fanout_write_deferred(fanout_ctx_t *ctx) {
+    manifest_ctx_t *manifest = ctx->nca->tool_ctx->manifest;
+    for (uint32_t i = 0; i < ctx->num_consumers; i++) {
+        fanout_consumer_t *consumer = &ctx->consumers[i];
+        if (consumer->is_deferred) {
+            unsigned char hash[0x20];
+            uint64_t size = consumer->end - consumer->start;
+            trace_begin(&consumer->trace);
+            tar_begin_file(consumer->tar, consumer->path, size);
+            nca_write_section_file(consumer->section, consumer->start - consumer->section->offset, size, consumer->tar->file, manifest != NULL ? hash : NULL, 0);
+            manifest_add(manifest, consumer->tar->cur_name, size, hash);
+            tar_end_file(consumer->tar);
+            trace_end(&consumer->trace, "extract file", consumer->section->section_num, "%s", consumer->path);
+        }
+    }
+}
+
+static int fanout_has_outputs(hactool_ctx_t *tool_ctx) {
+    hactool_settings_t *settings = &tool_ctx->settings;
+    if (settings->dec_nca_path.valid == VALIDITY_VALID || tool_ctx->romfs_tar != NULL || tool_ctx->pfs0_tar != NULL) {
+        return 1;
+    }
+    for (unsigned int i = 0; i < 4; i++) {
+        if (settings->section_paths[i].valid == VALIDITY_VALID || settings->section_dir_paths[i].valid == VALIDITY_VALID) {
+            return 1;
+        }
+    }
+    return (settings->exefs_path.enabled && settings->exefs_path.path.valid == VALIDITY_VALID) ||
+           (settings->romfs_path.enabled && settings->romfs_path.path.valid == VALIDITY_VALID) ||
+           (settings->exefs_dir_path.enabled && settings->exefs_dir_path.path.valid == VALIDITY_VALID) ||
+           (settings->romfs_dir_path.enabled && settings->romfs_dir_path.path.valid == VALIDITY_VALID);
+}
+
+/* Can this NCA be extracted and verified in a single pass? Must be decided before sections are processed. */
+int nca_fanout_supported(nca_ctx_t *ctx) {
+    uint32_t action = ctx->tool_ctx->action;
+    if (!(action & ACTION_EXTRACT) || (action & ACTION_LISTROMFS)) {
+        return 0;
+    }
+    /* Cheaper verification tiers must not turn into a full read, and corruption maps are built by the section checks. */
+    int full_verify = (action & ACTION_VERIFY) && ctx->tool_ctx->settings.verify_tier == VERIFY_TIER_FULL && ctx->tool_ctx->corruption == NULL && !ctx->verify_cached;
+    if (!full_verify && !fanout_has_outputs(ctx->tool_ctx)) {
+        return 0;
+    }
+
+    for (unsigned int i = 0; i < 4; i++) {
+        nca_section_entry_t *entry = &ctx->header.section_entries[i];
+        if (!entry->media_start_offset) {
+            continue;
+        }
+        /* BKTR reads are virtual, and may come from the base NCA. */
+        uint8_t crypt_type = ctx->header.fs_headers[i].crypt_type;
+        if (crypt_type == CRYPT_BKTR) {
+            return 0;
+        }
+        if (!ctx->is_decrypted && crypt_type != CRYPT_NONE && crypt_type != CRYPT_CTR && crypt_type != CRYPT_XTS) {
+            return 0;
+        }
+        uint64_t start = media_to_real(entry->media_start_offset);
+        uint64_t end = media_to_real(entry->media_end_offset);
+        if (start < 0xC00 || end < start) {
+            return 0;
+        }
+        for (unsigned int j = 0; j < i; j++) {
+            nca_section_entry_t *other = &ctx->header.section_entries[j];
+            if (other->media_start_offset && start < media_to_real(other->media_end_offset) && media_to_real(other->media_start_offset) < end) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+void nca_fanout_process(nca_ctx_t *ctx) {
+    fanout_ctx_t fanout;
+    memset(&fanout, 0, sizeof(fanout));
+    fanout.nca = ctx;
+    /* Saving is reported after the info, as without a fan-out pass. */
+    ctx->hold_save_output = 1;
+
+    for (unsigned int i = 0; i < 4; i++) {
+        nca_section_ctx_t *section = &ctx->section_contexts[i];
+        if (!section->is_present) {
+            continue;
+        }
+        if ((ctx->tool_ctx->action & ACTION_VERIFY) && section->verify_deferred) {
+            fanout_add_section_checks(&fanout, section);
+        }
+        section->fanout = &fanout;
+        nca_save_section(section);
+        section->fanout = NULL;
+        nca_output_printf(&ctx->save_output, "\n");
+    }
+
+    filepath_t *dec_path = &ctx->tool_ctx->settings.dec_nca_path;
+    if (dec_path->valid == VALIDITY_VALID) {
+        uint64_t end_ofs = 0xC00;
+        for (unsigned int i = 0; i < 4; i++) {
+            nca_section_ctx_t *section = &ctx->section_contexts[i];
+            if (section->is_present && section->offset + section->size > end_ofs) {
+                end_ofs = section->offset + section->size;
+            }
+        }
+        nca_output_printf(&ctx->save_output, "Saving Decrypted NCA to %s...\n", dec_path->char_path);
+        fanout_add_file(&fanout, NULL, 0, end_ofs, dec_path->char_path, 1);
+    }
+
+    qsort(fanout.consumers, fanout.num_consumers, sizeof(fanout_consumer_t), fanout_consumer_cmp);
+    fanout_defer_overlapping_tar_files(&fanout);
+    fanout_run(&fanout);
+    fanout_write_deferred(&fanout);
+
+    for (uint32_t i = 0; i < fanout.num_consumers; i++) {
+        free(fanout.consumers[i].path);
+    }
+    free(fanout.consumers);
+    ctx->hold_save_output = 0;
+    ctx->did_fanout = 1;
+}
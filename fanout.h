@@ -0,0 +1,52 @@
+#ifndef HACTOOL_FANOUT_H
+#define HACTOOL_FANOUT_H
+
+#include "types.h"
+#include "sha.h"
+#include "filepath.h"
+#include "nca.h"
+#include "trace.h"
+
+#define FANOUT_BUFFER_SIZE 0x400000 /* 4 MB per read. */
+
+typedef enum {
+    FANOUT_FILE, /* Regular output file. */
+    FANOUT_TAR, /* Member of a tar archive. */
+    FANOUT_CAPTURE, /* Copy into memory, e.g. a hash table ahead of its data. */
+    FANOUT_VERIFY /* Block-wise SHA-256 check against a hash table. */
+} fanout_type_t;
+
+typedef struct {
+    fanout_type_t type;
+    uint64_t start; /* Absolute offsets within the NCA. */
+    uint64_t end;
+    nca_section_ctx_t *section;
+    char *path;
+    FILE *file;
+    struct tar_ctx *tar;
+    sha_ctx_t *sha; /* Whole-output hash for the manifest, or current block hash when verifying. */
+    unsigned char *buffer; /* Capture destination, or hash table when verifying. */
+    uint64_t block_size;
+    int full_block;
+    validity_t *validity;
+    int is_sparse; /* Zeroed blocks become holes. */
+    int is_started;
+    int is_deferred; /* Could not be streamed; written after the pass. */
+    int level; /* Of the IVFC hashes being verified, or -1 for a PFS0 hash table. */
+    trace_span_t trace;
+} fanout_consumer_t;
+
+typedef struct fanout_ctx {
+    nca_ctx_t *nca;
+    fanout_consumer_t *consumers;
+    uint32_t num_consumers;
+    uint32_t max_consumers;
+} fanout_ctx_t;
+
+int nca_fanout_supported(nca_ctx_t *ctx);
+void nca_fanout_process(nca_ctx_t *ctx);
+
+void fanout_add_file(fanout_ctx_t *ctx, nca_section_ctx_t *section, uint64_t ofs, uint64_t size, const char *path, int sparse);
+void fanout_add_tar_file(fanout_ctx_t *ctx, nca_section_ctx_t *section, uint64_t ofs, uint64_t size, struct tar_ctx *tar, const char *path);
+
+#endif
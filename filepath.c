@@ -8,6 +8,7 @@
 #include "filepath.h"
 
 #include "convertUTF.h"
+#include "stats.h"
 
 void os_strcpy(oschar_t *dst, const char *src) {
 #ifdef _WIN32
@@ -23,7 +24,7 @@ void os_strcpy(oschar_t *dst, const char *src) {
 
     if (ConvertUTF8toUTF16(&sourceStart, sourceEnd, &targetStart, targetEnd, 0) != conversionOK) {
         fprintf(stderr, "Failed to convert %s to UTF-16!\n", src);
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 #else
     strcpy(dst, src);
@@ -31,11 +32,15 @@ void os_strcpy(oschar_t *dst, const char *src) {
 }
 
 int os_makedir(const oschar_t *dir) {
+    stats_span_t span;
+    stats_begin(&span);
 #ifdef _WIN32
-    return _wmkdir(dir);
+    int result = _wmkdir(dir);
 #else
-    return mkdir(dir, 0777);
+    int result = mkdir(dir, 0777);
 #endif
+    stats_end(&span, STATS_MKDIR, 0);
+    return result;
 }
 
 void filepath_update(filepath_t *fpath) {
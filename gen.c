@@ -0,0 +1,721 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gen.h"
+#include "utils.h"
+#include "aes.h"
+#include "sha.h"
+#include "rsa.h"
+#include "pfs0.h"
+#include "hfs0.h"
+#include "xci.h"
+#include "nsp.h"
+
+/* Builders of synthetic NCAs, and XCI and NSP containers of them, encrypted and signed with the
+ * test keyset, shared by hactool-gen and hactool-bench. Everything is derived from the seed, so
+ * the same options always give the same bytes. Images are built in memory. */
+
+#define GEN_PFS0_HASH_BLOCK_SIZE 0x10000
+#define GEN_IVFC_BLOCK_SIZE 0x4000
+#define GEN_IVFC_BLOCK_SIZE_LOG2 14
+#define GEN_BKTR_SUBSECTION_SIZE 0x100000
+#define GEN_XCI_HFS0_OFFSET 0xF000
+#define GEN_SDK_VERSION 0x000C1100
+#define GEN_CONTENT_TYPE_PROGRAM 0
+#define GEN_CONTENT_TYPE_META 1
+#define GEN_META_TYPE_APPLICATION 0x80
+#define GEN_TICKET_BODY_OFFSET 0x140
+#define GEN_CERT_KEY_RSA2048 1
+
+/* Private exponent of the test keyset's NCA header key, so that generated headers verify. */
+static const unsigned char gen_test_header_private_exponent[0x100] = {
+    0x09, 0x48, 0xDD, 0xD3, 0xD1, 0x6A, 0x16, 0x5A, 0xE7, 0x1D, 0x77, 0x3A, 0xA0, 0xEF, 0xD2, 0xF0,
+    0x7B, 0xB5, 0x2E, 0xC6, 0x5F, 0x59, 0x43, 0xD0, 0x17, 0xD2, 0xA4, 0x5C, 0x55, 0xD3, 0xCF, 0x81,
+    0x05, 0x0D, 0xDB, 0x70, 0xA3, 0xEC, 0xDB, 0x72, 0x6D, 0xE3, 0xAF, 0xA9, 0xC5, 0xFC, 0xD6, 0x7D,
+    0xBD, 0x86, 0xC2, 0xE6, 0x8D, 0x4B, 0xDD, 0x0C, 0x90, 0xC5, 0x02, 0x88, 0x61, 0x46, 0x9C, 0xDC,
+    0x62, 0x44, 0x65, 0xEF, 0x1D, 0x25, 0xE1, 0x16, 0xC4, 0x4D, 0x47, 0x70, 0x14, 0xB1, 0x89, 0x7B,
+    0x31, 0x41, 0xAA, 0x4B, 0x1C, 0x03, 0x08, 0xE9, 0x2C, 0x69, 0x72, 0x8F, 0xA1, 0x48, 0x3A, 0x85,
+    0xE0, 0x19, 0x60, 0x0E, 0x2E, 0xB0, 0x0D, 0x7E, 0xA6, 0x02, 0x90, 0xD9, 0xE6, 0xF6, 0x79, 0x40,
+    0x64, 0x5C, 0x61, 0xEB, 0xD2, 0x4D, 0x89, 0xCC, 0x75, 0xEA, 0x67, 0xD4, 0x5B, 0x53, 0x45, 0xD6,
+    0x28, 0xBA, 0x4E, 0x6C, 0x87, 0x12, 0x11, 0xB7, 0x06, 0xE4, 0xAB, 0x14, 0x32, 0x3B, 0x29, 0xF6,
+    0x59, 0x1A, 0x8A, 0x65, 0xE2, 0x09, 0x3E, 0xD7, 0xC5, 0x13, 0xF0, 0x54, 0xA5, 0x2B, 0x22, 0xB1,
+    0x30, 0x6A, 0x01, 0x35, 0x94, 0x8F, 0xF9, 0xE5, 0xAC, 0x49, 0x6D, 0xEC, 0xEC, 0x0F, 0xB4, 0xC2,
+    0x66, 0xA0, 0xE8, 0x9C, 0x1A, 0xCB, 0xBB, 0x01, 0x32, 0x1B, 0xD3, 0xDE, 0x22, 0xB3, 0xE2, 0xB1,
+    0xBA, 0x5B, 0xCB, 0xEA, 0x8C, 0xC2, 0x58, 0x4B, 0xCA, 0xAC, 0x1D, 0x54, 0xBB, 0x00, 0x08, 0x8F,
+    0x2E, 0x6A, 0xA3, 0x8C, 0xB0, 0x46, 0x79, 0x32, 0xB2, 0xBE, 0x5B, 0x45, 0xF4, 0x04, 0xA7, 0x25,
+    0x90, 0xA3, 0x1A, 0x80, 0xA1, 0x4C, 0x8E, 0x8E, 0xD1, 0x00, 0xCF, 0xF0, 0xD8, 0xB8, 0x39, 0x66,
+    0x44, 0x58, 0xE2, 0x32, 0xC1, 0xA3, 0x4A, 0xE9, 0xAE, 0x87, 0xDC, 0x1E, 0xF4, 0xD7, 0xED, 0x41
+};
+
+typedef enum {
+    GEN_SEED_FILE_SIZE = 1,
+    GEN_SEED_ROMFS_DATA = 2,
+    GEN_SEED_PFS0_DATA = 3,
+    GEN_SEED_PATCH = 4,
+    GEN_SEED_PATCH_DATA = 5,
+    GEN_SEED_KEYS = 6
+} gen_seed_kind_t;
+
+static void gen_buf_reserve(gen_buf_t *buf, uint64_t size) {
+    if (size <= buf->max_size) {
+        return;
+    }
+    uint64_t max_size = buf->max_size ? buf->max_size : 0x10000;
+    while (max_size < size) {
+        max_size *= 2;
+    }
+    unsigned char *data = realloc(buf->data, max_size);
+    if (data == NULL) {
+        fprintf(stderr, "Failed to allocate %"PRIu64" bytes!\n", max_size);
+        fatal_exit();
+    }
+    buf->data = data;
+    buf->max_size = max_size;
+}
+
+/* Appends size bytes of data, or zeroes if data is NULL, and returns their offset. */
+uint64_t gen_buf_append(gen_buf_t *buf, const void *data, uint64_t size) {
+    gen_buf_reserve(buf, buf->size + size);
+    uint64_t offset = buf->size;
+    if (data != NULL) {
+        memcpy(buf->data + offset, data, (size_t)size);
+    } else {
+        memset(buf->data + offset, 0, (size_t)size);
+    }
+    buf->size += size;
+    return offset;
+}
+
+static void gen_buf_align(gen_buf_t *buf, uint64_t align) {
+    gen_buf_append(buf, NULL, align64(buf->size, align) - buf->size);
+}
+
+void gen_buf_free(gen_buf_t *buf) {
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+/* splitmix64, to derive independent seeds for each thing generated. */
+static uint64_t gen_mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t gen_seed(gen_ctx_t *ctx, gen_seed_kind_t kind, uint64_t index) {
+    return gen_mix(ctx->seed ^ gen_mix(((uint64_t)kind << 56) ^ index));
+}
+
+static void gen_fill(void *buf, size_t size, uint64_t seed) {
+    unsigned char *p = buf;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        p[i] = (unsigned char)(seed >> 56);
+    }
+}
+
+/* File sizes are spread between half the configured size and all of it. */
+static uint64_t gen_file_size(gen_ctx_t *ctx, gen_seed_kind_t kind, uint32_t i) {
+    uint64_t min_size = ctx->file_size / 2;
+    return min_size + gen_seed(ctx, GEN_SEED_FILE_SIZE, ((uint64_t)kind << 32) | i) % (ctx->file_size - min_size + 1);
+}
+
+/* Hashes each block of data into hashes. Unless full_block, the last block's hash only covers its data. */
+static void gen_hash_blocks(gen_buf_t *hashes, const gen_buf_t *data, uint64_t block_size, int full_block) {
+    unsigned char *block = calloc(1, (size_t)block_size);
+    if (block == NULL) {
+        fprintf(stderr, "Failed to allocate hash block!\n");
+        fatal_exit();
+    }
+    for (uint64_t ofs = 0; ofs < data->size; ofs += block_size) {
+        uint64_t size = data->size - ofs < block_size ? data->size - ofs : block_size;
+        unsigned char hash[0x20];
+        if (full_block && size < block_size) {
+            memset(block, 0, (size_t)block_size);
+            memcpy(block, data->data + ofs, (size_t)size);
+            sha256_hash_buffer(hash, block, (size_t)block_size);
+        } else {
+            sha256_hash_buffer(hash, data->data + ofs, (size_t)size);
+        }
+        gen_buf_append(hashes, hash, sizeof(hash));
+    }
+    free(block);
+}
+
+void gen_build_pfs0(gen_buf_t *out, uint32_t num_files, const char *const *names, const gen_buf_t *files) {
+    uint64_t *sizes = calloc(num_files ? num_files : 1, sizeof(uint64_t));
+    if (sizes == NULL) {
+        fprintf(stderr, "Failed to allocate PFS0 files!\n");
+        fatal_exit();
+    }
+    for (uint32_t i = 0; i < num_files; i++) {
+        sizes[i] = files[i].size;
+    }
+    pfs0_header_t *header = pfs0_build_header(num_files, names, sizes);
+    gen_buf_append(out, header, pfs0_get_header_size(header));
+    for (uint32_t i = 0; i < num_files; i++) {
+        gen_buf_append(out, files[i].data, files[i].size);
+    }
+    free(header);
+    free(sizes);
+}
+
+/* Returns the size of the HFS0 header. hashed_sizes may be NULL to hash the first 0x200 bytes of each file. */
+static uint64_t gen_build_hfs0(gen_buf_t *out, uint32_t num_files, const char *const *names, const gen_buf_t *files, const uint64_t *hashed_sizes) {
+    uint32_t names_size = 0;
+    for (uint32_t i = 0; i < num_files; i++) {
+        names_size += (uint32_t)strlen(names[i]) + 1;
+    }
+    uint64_t header_size = sizeof(hfs0_header_t) + num_files * sizeof(hfs0_file_entry_t) + names_size;
+    hfs0_header_t header = {MAGIC_HFS0, num_files, names_size + (uint32_t)(align64(header_size, MEDIA_SIZE) - header_size), 0};
+    gen_buf_append(out, &header, sizeof(header));
+
+    uint64_t data_offset = 0;
+    uint32_t name_offset = 0;
+    for (uint32_t i = 0; i < num_files; i++) {
+        hfs0_file_entry_t entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.offset = data_offset;
+        entry.size = files[i].size;
+        entry.string_table_offset = name_offset;
+        entry.hashed_size = (uint32_t)(hashed_sizes != NULL ? hashed_sizes[i] : (files[i].size < MEDIA_SIZE ? files[i].size : MEDIA_SIZE));
+        sha256_hash_buffer(entry.hash, files[i].data, entry.hashed_size);
+        gen_buf_append(out, &entry, sizeof(entry));
+        data_offset += align64(files[i].size, MEDIA_SIZE);
+        name_offset += (uint32_t)strlen(names[i]) + 1;
+    }
+    for (uint32_t i = 0; i < num_files; i++) {
+        gen_buf_append(out, names[i], strlen(names[i]) + 1);
+    }
+    gen_buf_align(out, MEDIA_SIZE);
+    header_size = out->size;
+    for (uint32_t i = 0; i < num_files; i++) {
+        gen_buf_append(out, files[i].data, files[i].size);
+        gen_buf_align(out, MEDIA_SIZE);
+    }
+    return header_size;
+}
+
+static uint32_t gen_romfs_hash(uint32_t parent, const char *name) {
+    uint32_t hash = parent ^ 123456789;
+    for (; *name; name++) {
+        hash = (hash >> 5) | (hash << 27);
+        hash ^= (unsigned char)*name;
+    }
+    return hash;
+}
+
+/* Bucket counts as chosen by official tools: small odd counts, or a number with no small factors. */
+static uint32_t gen_romfs_bucket_count(uint32_t num_entries) {
+    if (num_entries < 3) {
+        return 3;
+    }
+    if (num_entries < 19) {
+        return num_entries | 1;
+    }
+    uint32_t count = num_entries;
+    while (count % 2 == 0 || count % 3 == 0 || count % 5 == 0 || count % 7 == 0 || count % 11 == 0 || count % 13 == 0 || count % 17 == 0) {
+        count++;
+    }
+    return count;
+}
+
+/* Adds an entry to a RomFS meta table, chaining it into its hash bucket. Returns its offset. */
+static uint32_t gen_romfs_add_entry(gen_buf_t *table, uint32_t *buckets, uint32_t num_buckets, uint32_t *fields, uint32_t num_fields, uint32_t parent, const char *name) {
+    uint32_t offset = (uint32_t)table->size;
+    uint32_t name_size = (uint32_t)strlen(name);
+    uint32_t bucket = gen_romfs_hash(parent, name) % num_buckets;
+    fields[num_fields - 1] = buckets[bucket];
+    buckets[bucket] = offset;
+    gen_buf_append(table, fields, num_fields * 4);
+    gen_buf_append(table, &name_size, 4);
+    gen_buf_append(table, name, name_size);
+    gen_buf_align(table, 4);
+    return offset;
+}
+
+static uint32_t gen_romfs_entry_size(uint32_t base_size, const char *name) {
+    return base_size + (uint32_t)align64(strlen(name), 4);
+}
+
+/* A RomFS of ctx->num_romfs_files files, spread over enough directories to keep them small. The
+ * patched variant has the same layout, with the contents of some files changed. */
+void gen_build_romfs(gen_ctx_t *ctx, gen_buf_t *out, int is_patched) {
+    uint32_t num_files = ctx->num_romfs_files;
+    uint32_t num_dirs = 0;
+    while (num_dirs * num_dirs < num_files) {
+        num_dirs++;
+    }
+    uint32_t files_per_dir = num_dirs ? (num_files + num_dirs - 1) / num_dirs : 0;
+    uint32_t num_dir_buckets = gen_romfs_bucket_count(num_dirs + 1);
+    uint32_t num_file_buckets = gen_romfs_bucket_count(num_files);
+    uint32_t *dir_buckets = malloc(num_dir_buckets * 4);
+    uint32_t *file_buckets = malloc(num_file_buckets * 4);
+    if (dir_buckets == NULL || file_buckets == NULL) {
+        fprintf(stderr, "Failed to allocate RomFS hash tables!\n");
+        fatal_exit();
+    }
+    memset(dir_buckets, 0xFF, num_dir_buckets * 4);
+    memset(file_buckets, 0xFF, num_file_buckets * 4);
+
+    romfs_hdr_t header;
+    memset(&header, 0, sizeof(header));
+    header.header_size = ROMFS_HEADER_SIZE;
+    header.data_offset = MEDIA_SIZE;
+    gen_buf_append(out, &header, sizeof(header));
+    gen_buf_align(out, MEDIA_SIZE);
+
+    /* Entries are laid out in traversal order, so sibling, child and file offsets are known up front. */
+    gen_buf_t dirs = {0}, files = {0};
+    char name[0x20];
+    uint32_t next_dir_offset = gen_romfs_entry_size(0x18, "");
+    uint32_t next_file_offset = 0;
+    uint32_t root_fields[5] = {0, ROMFS_ENTRY_EMPTY, num_dirs ? next_dir_offset : ROMFS_ENTRY_EMPTY, ROMFS_ENTRY_EMPTY, 0};
+    gen_romfs_add_entry(&dirs, dir_buckets, num_dir_buckets, root_fields, 5, 0, "");
+    for (uint32_t d = 0; d < num_dirs; d++) {
+        uint32_t first_file = d * files_per_dir < num_files ? d * files_per_dir : num_files;
+        uint32_t end_file = first_file + files_per_dir < num_files ? first_file + files_per_dir : num_files;
+        snprintf(name, sizeof(name), "dir%04"PRIu32, d);
+        uint32_t dir_offset = next_dir_offset;
+        next_dir_offset += gen_romfs_entry_size(0x18, name);
+        uint32_t dir_fields[5] = {0, d + 1 < num_dirs ? next_dir_offset : ROMFS_ENTRY_EMPTY, ROMFS_ENTRY_EMPTY, first_file < end_file ? next_file_offset : ROMFS_ENTRY_EMPTY, 0};
+        gen_romfs_add_entry(&dirs, dir_buckets, num_dir_buckets, dir_fields, 5, 0, name);
+
+        for (uint32_t i = first_file; i < end_file; i++) {
+            uint64_t size = gen_file_size(ctx, GEN_SEED_ROMFS_DATA, i);
+            uint64_t seed = gen_seed(ctx, GEN_SEED_ROMFS_DATA, i);
+            if (is_patched && gen_seed(ctx, GEN_SEED_PATCH, i) % 100 < ctx->patch_percent) {
+                seed = gen_seed(ctx, GEN_SEED_PATCH_DATA, i);
+            }
+            gen_buf_align(out, 0x10);
+            uint64_t data_offset = gen_buf_append(out, NULL, size) - header.data_offset;
+            gen_fill(out->data + header.data_offset + data_offset, (size_t)size, seed);
+
+            snprintf(name, sizeof(name), "file%05"PRIu32".bin", i);
+            next_file_offset += gen_romfs_entry_size(0x20, name);
+            uint32_t file_fields[7] = {dir_offset, i + 1 < end_file ? next_file_offset : ROMFS_ENTRY_EMPTY, 0, 0, 0, 0, 0};
+            memcpy(&file_fields[2], &data_offset, 8);
+            memcpy(&file_fields[4], &size, 8);
+            gen_romfs_add_entry(&files, file_buckets, num_file_buckets, file_fields, 7, dir_offset, name);
+        }
+    }
+
+    gen_buf_align(out, 4);
+    header.dir_hash_table_offset = gen_buf_append(out, dir_buckets, num_dir_buckets * 4);
+    header.dir_hash_table_size = num_dir_buckets * 4;
+    header.dir_meta_table_offset = gen_buf_append(out, dirs.data, dirs.size);
+    header.dir_meta_table_size = dirs.size;
+    header.file_hash_table_offset = gen_buf_append(out, file_buckets, num_file_buckets * 4);
+    header.file_hash_table_size = num_file_buckets * 4;
+    header.file_meta_table_offset = gen_buf_append(out, files.data, files.size);
+    header.file_meta_table_size = files.size;
+    memcpy(out->data, &header, sizeof(header));
+
+    gen_buf_free(&dirs);
+    gen_buf_free(&files);
+    free(dir_buckets);
+    free(file_buckets);
+}
+
+/* Wraps a RomFS in IVFC hash levels. Each level hashes the next, level 0 first and the RomFS last. */
+static void gen_build_ivfc(const gen_buf_t *romfs, gen_buf_t *out, ivfc_hdr_t *header) {
+    gen_buf_t levels[IVFC_MAX_LEVEL];
+    memset(levels, 0, sizeof(levels));
+    levels[IVFC_MAX_LEVEL - 1] = *romfs;
+    for (int i = IVFC_MAX_LEVEL - 2; i >= 0; i--) {
+        gen_hash_blocks(&levels[i], &levels[i + 1], GEN_IVFC_BLOCK_SIZE, 1);
+    }
+    if (levels[0].size > GEN_IVFC_BLOCK_SIZE) {
+        fprintf(stderr, "RomFS is too large for %d IVFC levels!\n", IVFC_MAX_LEVEL);
+        fatal_exit();
+    }
+
+    memset(header, 0, sizeof(*header));
+    header->magic = MAGIC_IVFC;
+    header->id = 0x20000;
+    header->master_hash_size = 0x20;
+    header->num_levels = IVFC_MAX_LEVEL + 1;
+    for (unsigned int i = 0; i < IVFC_MAX_LEVEL; i++) {
+        gen_buf_align(out, GEN_IVFC_BLOCK_SIZE);
+        header->level_headers[i].logical_offset = gen_buf_append(out, levels[i].data, levels[i].size);
+        header->level_headers[i].hash_data_size = levels[i].size;
+        header->level_headers[i].block_size = GEN_IVFC_BLOCK_SIZE_LOG2;
+    }
+    gen_buf_align(out, MEDIA_SIZE);
+
+    gen_buf_t master = {0};
+    gen_buf_append(&master, levels[0].data, levels[0].size);
+    gen_buf_append(&master, NULL, GEN_IVFC_BLOCK_SIZE - levels[0].size);
+    sha256_hash_buffer(header->master_hash, master.data, GEN_IVFC_BLOCK_SIZE);
+    gen_buf_free(&master);
+    for (unsigned int i = 0; i < IVFC_MAX_LEVEL - 1; i++) {
+        gen_buf_free(&levels[i]);
+    }
+}
+
+static void gen_init_section(gen_section_t *section, section_partition_type_t partition_type, section_fs_type_t fs_type, section_crypt_type_t crypt_type, uint32_t section_ctr_low) {
+    memset(section, 0, sizeof(*section));
+    section->header._0x0 = 2;
+    section->header.partition_type = (uint8_t)partition_type;
+    section->header.fs_type = (uint8_t)fs_type;
+    section->header.crypt_type = (uint8_t)crypt_type;
+    section->header.section_ctr_low = section_ctr_low;
+}
+
+/* A PFS0 section of the given files, behind a hash table of its blocks. */
+static void gen_build_pfs0_section_of(gen_section_t *section, uint32_t num_files, const char *const *names, const gen_buf_t *files, section_crypt_type_t crypt_type, uint32_t section_ctr_low) {
+    gen_buf_t pfs0 = {0}, hash_table = {0};
+    gen_build_pfs0(&pfs0, num_files, names, files);
+    gen_hash_blocks(&hash_table, &pfs0, GEN_PFS0_HASH_BLOCK_SIZE, 0);
+
+    gen_init_section(section, PARTITION_PFS0, FS_TYPE_PFS0, crypt_type, section_ctr_low);
+    pfs0_superblock_t *superblock = &section->header.pfs0_superblock;
+    sha256_hash_buffer(superblock->master_hash, hash_table.data, (size_t)hash_table.size);
+    superblock->block_size = GEN_PFS0_HASH_BLOCK_SIZE;
+    superblock->always_2 = 2;
+    superblock->hash_table_offset = gen_buf_append(&section->data, hash_table.data, hash_table.size);
+    superblock->hash_table_size = hash_table.size;
+    gen_buf_align(&section->data, MEDIA_SIZE);
+    superblock->pfs0_offset = gen_buf_append(&section->data, pfs0.data, pfs0.size);
+    superblock->pfs0_size = pfs0.size;
+    gen_buf_align(&section->data, MEDIA_SIZE);
+
+    gen_buf_free(&pfs0);
+    gen_buf_free(&hash_table);
+}
+
+/* An ExeFS-like PFS0 section of ctx->num_pfs0_files files. */
+void gen_build_pfs0_section(gen_ctx_t *ctx, gen_section_t *section, section_crypt_type_t crypt_type, uint32_t section_ctr_low) {
+    uint32_t num_files = ctx->num_pfs0_files;
+    char (*names)[0x20] = calloc(num_files ? num_files : 1, sizeof(*names));
+    const char **name_ptrs = calloc(num_files ? num_files : 1, sizeof(*name_ptrs));
+    gen_buf_t *files = calloc(num_files ? num_files : 1, sizeof(*files));
+    if (names == NULL || name_ptrs == NULL || files == NULL) {
+        fprintf(stderr, "Failed to allocate PFS0 files!\n");
+        fatal_exit();
+    }
+    for (uint32_t i = 0; i < num_files; i++) {
+        snprintf(names[i], sizeof(names[i]), "file%03"PRIu32, i);
+        name_ptrs[i] = names[i];
+        uint64_t size = gen_file_size(ctx, GEN_SEED_PFS0_DATA, i);
+        gen_buf_append(&files[i], NULL, size);
+        gen_fill(files[i].data, (size_t)size, gen_seed(ctx, GEN_SEED_PFS0_DATA, i));
+    }
+    gen_build_pfs0_section_of(section, num_files, name_ptrs, files, crypt_type, section_ctr_low);
+
+    for (uint32_t i = 0; i < num_files; i++) {
+        gen_buf_free(&files[i]);
+    }
+    free(files);
+    free(name_ptrs);
+    free(names);
+}
+
+void gen_build_romfs_section(const gen_buf_t *romfs, gen_section_t *section, uint32_t section_ctr_low) {
+    gen_init_section(section, PARTITION_ROMFS, FS_TYPE_ROMFS, CRYPT_CTR, section_ctr_low);
+    gen_build_ivfc(romfs, &section->data, &section->header.romfs_superblock.ivfc_header);
+}
+
+/* A BKTR section patching base, a RomFS section's plaintext, into patched, which has the same
+ * layout. Changed blocks are stored in order at the start of the section, followed by the
+ * relocation and subsection tables. */
+void gen_build_bktr_section(const gen_buf_t *base, const gen_buf_t *patched, const ivfc_hdr_t *ivfc_header, gen_section_t *section, uint32_t section_ctr_low) {
+    if (base->size != patched->size) {
+        fprintf(stderr, "Patched RomFS changed size!\n");
+        fatal_exit();
+    }
+    gen_init_section(section, PARTITION_ROMFS, FS_TYPE_ROMFS, CRYPT_BKTR, section_ctr_low);
+    gen_buf_t *data = &section->data;
+    gen_buf_t relocations = {0};
+    int was_patch = -1;
+    for (uint64_t ofs = 0; ofs < patched->size; ofs += GEN_IVFC_BLOCK_SIZE) {
+        uint64_t size = patched->size - ofs < GEN_IVFC_BLOCK_SIZE ? patched->size - ofs : GEN_IVFC_BLOCK_SIZE;
+        int is_patch = memcmp(base->data + ofs, patched->data + ofs, (size_t)size) != 0;
+        if (is_patch != was_patch) {
+            bktr_relocation_entry_t entry = {ofs, is_patch ? data->size : ofs, (uint32_t)is_patch};
+            gen_buf_append(&relocations, &entry, sizeof(entry));
+            was_patch = is_patch;
+        }
+        if (is_patch) {
+            gen_buf_append(data, patched->data + ofs, size);
+        }
+    }
+    gen_buf_align(data, 0x10);
+    section->patch_data_size = data->size;
+
+    uint32_t num_relocations = (uint32_t)(relocations.size / sizeof(bktr_relocation_entry_t));
+    uint64_t relocation_offset = gen_buf_append(data, NULL, sizeof(bktr_relocation_block_t));
+    bktr_relocation_block_t *relocation_block = (bktr_relocation_block_t *)(data->data + relocation_offset);
+    relocation_block->num_entries = num_relocations;
+    relocation_block->patch_romfs_size = patched->size;
+    gen_buf_append(data, relocations.data, relocations.size);
+    gen_buf_free(&relocations);
+
+    /* Each subsection of patch data has its own counter; the tables use the section's. */
+    section->num_subsections = (uint32_t)((section->patch_data_size + GEN_BKTR_SUBSECTION_SIZE - 1) / GEN_BKTR_SUBSECTION_SIZE);
+    if (section->num_subsections == 0) {
+        section->num_subsections = 1;
+    }
+    if ((section->subsections = calloc(section->num_subsections, sizeof(*section->subsections))) == NULL) {
+        fprintf(stderr, "Failed to allocate BKTR subsections!\n");
+        fatal_exit();
+    }
+    for (uint32_t i = 0; i < section->num_subsections; i++) {
+        section->subsections[i].offset = (uint64_t)i * GEN_BKTR_SUBSECTION_SIZE;
+        section->subsections[i].ctr_val = section_ctr_low + 1 + i;
+    }
+    uint64_t subsection_offset = gen_buf_append(data, NULL, sizeof(bktr_subsection_block_t));
+    bktr_subsection_block_t *subsection_block = (bktr_subsection_block_t *)(data->data + subsection_offset);
+    subsection_block->num_entries = section->num_subsections;
+    subsection_block->bktr_entry_offset = section->patch_data_size;
+    gen_buf_append(data, section->subsections, section->num_subsections * sizeof(*section->subsections));
+    gen_buf_align(data, MEDIA_SIZE);
+
+    bktr_superblock_t *superblock = &section->header.bktr_superblock;
+    superblock->ivfc_header = *ivfc_header;
+    superblock->relocation_header.offset = relocation_offset;
+    superblock->relocation_header.size = subsection_offset - relocation_offset;
+    superblock->relocation_header.magic = MAGIC_BKTR;
+    superblock->relocation_header._0x14 = 1;
+    superblock->relocation_header.num_entries = num_relocations;
+    superblock->subsection_header.offset = subsection_offset;
+    superblock->subsection_header.size = data->size - subsection_offset;
+    superblock->subsection_header.magic = MAGIC_BKTR;
+    superblock->subsection_header._0x14 = 1;
+    superblock->subsection_header.num_entries = section->num_subsections;
+}
+
+void gen_free_section(gen_section_t *section) {
+    gen_buf_free(&section->data);
+    free(section->subsections);
+    section->subsections = NULL;
+}
+
+static void gen_encrypt_ctr(const unsigned char *key, unsigned char *data, uint64_t size, uint32_t ctr_high, uint32_t ctr_low, uint64_t offset) {
+    unsigned char ctr[0x10];
+    for (unsigned int j = 0; j < 4; j++) {
+        ctr[j] = (unsigned char)(ctr_high >> (24 - 8 * j));
+        ctr[4 + j] = (unsigned char)(ctr_low >> (24 - 8 * j));
+    }
+    nca_update_ctr(ctr, offset);
+    aes_ctx_t *aes_ctx = new_aes_ctx(key, 16, AES_MODE_CTR);
+    aes_setiv(aes_ctx, ctr, 0x10);
+    aes_encrypt(aes_ctx, data, data, (size_t)size);
+    free_aes_ctx(aes_ctx);
+}
+
+/* Encrypts a section in place, at offset in its NCA. */
+static void gen_encrypt_section(unsigned char *data, uint64_t offset, const gen_section_t *section, unsigned char keys[4][0x10]) {
+    const nca_fs_header_t *header = &section->header;
+    uint64_t size = section->data.size;
+    switch (header->crypt_type) {
+        case CRYPT_XTS: {
+            aes_ctx_t *aes_ctx = new_aes_ctx(keys[0], 32, AES_MODE_XTS);
+            aes_xts_encrypt(aes_ctx, data, data, (size_t)size, 0, 0x200);
+            free_aes_ctx(aes_ctx);
+            break;
+        }
+        case CRYPT_CTR:
+            gen_encrypt_ctr(keys[2], data, size, header->section_ctr_high, header->section_ctr_low, offset);
+            break;
+        case CRYPT_BKTR:
+            for (uint32_t i = 0; i < section->num_subsections; i++) {
+                uint64_t start = section->subsections[i].offset;
+                uint64_t end = i + 1 < section->num_subsections ? section->subsections[i + 1].offset : section->patch_data_size;
+                gen_encrypt_ctr(keys[2], data + start, end - start, header->section_ctr_high, section->subsections[i].ctr_val, offset + start);
+            }
+            gen_encrypt_ctr(keys[2], data + section->patch_data_size, size - section->patch_data_size, header->section_ctr_high, header->section_ctr_low, offset + section->patch_data_size);
+            break;
+        default:
+            break;
+    }
+}
+
+/* A rights ID is the title ID, followed by the master key revision the title key is under. */
+static void gen_rights_id(uint64_t title_id, unsigned char *rights_id) {
+    memset(rights_id, 0, 0x10);
+    for (unsigned int i = 0; i < 8; i++) {
+        rights_id[i] = (unsigned char)(title_id >> (56 - 8 * i));
+    }
+}
+
+static void gen_build_content(gen_ctx_t *ctx, const gen_section_t *sections, unsigned int num_sections, uint64_t title_id, uint8_t content_type, uint32_t key_index, int has_rights_id, gen_buf_t *out) {
+    nca_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MAGIC_NCA3;
+    header.content_type = content_type;
+    header.title_id = title_id;
+    header.sdk_version = GEN_SDK_VERSION;
+
+    /* With a rights ID, the CTR key is the title key, and the key area is left empty. */
+    unsigned char keys[4][0x10];
+    gen_fill(keys, sizeof(keys), gen_seed(ctx, GEN_SEED_KEYS, key_index));
+    if (has_rights_id) {
+        gen_rights_id(title_id, header.rights_id);
+    } else {
+        aes_ctx_t *aes_ctx = new_aes_ctx(ctx->keyset.key_area_keys[header.crypto_type][header.kaek_ind], 16, AES_MODE_ECB);
+        aes_encrypt(aes_ctx, header.encrypted_keys, keys, sizeof(keys));
+        free_aes_ctx(aes_ctx);
+    }
+
+    gen_buf_append(out, NULL, sizeof(header));
+    for (unsigned int i = 0; i < num_sections; i++) {
+        uint64_t offset = gen_buf_append(out, sections[i].data.data, sections[i].data.size);
+        gen_encrypt_section(out->data + offset, offset, &sections[i], keys);
+        header.section_entries[i].media_start_offset = (uint32_t)(offset / MEDIA_SIZE);
+        header.section_entries[i].media_end_offset = (uint32_t)(out->size / MEDIA_SIZE);
+        header.fs_headers[i] = sections[i].header;
+        sha256_hash_buffer(header.section_hashes[i], &header.fs_headers[i], sizeof(header.fs_headers[i]));
+    }
+    header.nca_size = out->size;
+
+    if (!rsa2048_pss_sign(header.fixed_key_sig, &header.magic, 0x200, ctx->keyset.nca_hdr_fixed_key_modulus, gen_test_header_private_exponent)) {
+        fprintf(stderr, "Failed to sign NCA header!\n");
+        fatal_exit();
+    }
+    aes_ctx_t *aes_ctx = new_aes_ctx(ctx->keyset.header_key, 32, AES_MODE_XTS);
+    aes_xts_encrypt(aes_ctx, out->data, &header, sizeof(header), 0, 0x200);
+    free_aes_ctx(aes_ctx);
+}
+
+/* A program NCA of the given sections, with keys derived from key_index. With has_rights_id, they
+ * are decrypted with the title key of gen_build_ticket's ticket, which only covers CTR sections. */
+void gen_build_nca(gen_ctx_t *ctx, const gen_section_t *sections, unsigned int num_sections, uint64_t title_id, uint32_t key_index, int has_rights_id, gen_buf_t *out) {
+    gen_build_content(ctx, sections, num_sections, title_id, GEN_CONTENT_TYPE_PROGRAM, key_index, has_rights_id, out);
+}
+
+/* A Meta NCA of an application's CNMT, recording each of contents as a program, in order. */
+void gen_build_meta_nca(gen_ctx_t *ctx, uint64_t title_id, uint32_t num_contents, const gen_buf_t *contents, uint32_t key_index, gen_buf_t *out) {
+    cnmt_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.title_id = title_id;
+    header.type = GEN_META_TYPE_APPLICATION;
+    header.extended_header_size = 0x10;
+    header.content_count = (uint16_t)num_contents;
+    uint64_t patch_title_id = title_id | 0x800;
+
+    /* The extended header names the application's update; the digest at the end is left zero. */
+    gen_buf_t cnmt = {0};
+    gen_buf_append(&cnmt, &header, sizeof(header));
+    gen_buf_append(&cnmt, &patch_title_id, sizeof(patch_title_id));
+    gen_buf_append(&cnmt, NULL, header.extended_header_size - sizeof(patch_title_id));
+    for (uint32_t i = 0; i < num_contents; i++) {
+        cnmt_content_record_t record;
+        memset(&record, 0, sizeof(record));
+        sha256_hash_buffer(record.hash, contents[i].data, (size_t)contents[i].size);
+        memcpy(record.content_id, record.hash, sizeof(record.content_id));
+        for (unsigned int k = 0; k < 6; k++) {
+            record.size[k] = (uint8_t)(contents[i].size >> (8 * k));
+        }
+        record.type = CONTENT_TYPE_PROGRAM;
+        record.id_offset = (uint8_t)i;
+        gen_buf_append(&cnmt, &record, sizeof(record));
+    }
+    gen_buf_append(&cnmt, NULL, 0x20);
+
+    char name[0x30];
+    const char *name_ptr = name;
+    snprintf(name, sizeof(name), "Application_%016"PRIx64".cnmt", title_id);
+    gen_section_t section;
+    gen_build_pfs0_section_of(&section, 1, &name_ptr, &cnmt, CRYPT_CTR, 1);
+    gen_build_content(ctx, &section, 1, title_id, GEN_CONTENT_TYPE_META, key_index, 0, out);
+    gen_free_section(&section);
+    gen_buf_free(&cnmt);
+}
+
+/* A common ticket for the title key of gen_build_nca's NCAs with a rights ID. Its title key is
+ * encrypted the way nca.c decrypts it. Its signature can't be made with the test keyset, and is
+ * left zero; hactool doesn't check it. */
+void gen_build_ticket(gen_ctx_t *ctx, uint64_t title_id, uint32_t key_index, gen_buf_t *out) {
+    uint32_t sig_type = SIGTYPE_RSA2048_SHA256;
+    gen_buf_append(out, &sig_type, sizeof(sig_type));
+    gen_buf_append(out, NULL, GEN_TICKET_BODY_OFFSET - sizeof(sig_type));
+
+    unsigned char keys[4][0x10];
+    gen_fill(keys, sizeof(keys), gen_seed(ctx, GEN_SEED_KEYS, key_index));
+    ticket_body_t body;
+    memset(&body, 0, sizeof(body));
+    snprintf(body.issuer, sizeof(body.issuer), "Root-CA00000003-XS00000020");
+    aes_ctx_t *aes_ctx = new_aes_ctx(ctx->keyset.titlekeks[0], 16, AES_MODE_CTR);
+    aes_encrypt(aes_ctx, body.titlekey_block, keys[2], 0x10);
+    free_aes_ctx(aes_ctx);
+    body.format_version = 2;
+    body.titlekey_type = TITLEKEY_COMMON;
+    gen_rights_id(title_id, body.rights_id);
+    gen_buf_append(out, &body, sizeof(body));
+}
+
+static void gen_append_cert(gen_buf_t *out, uint32_t sig_type, uint64_t sig_size, const char *issuer, const char *name) {
+    char field[0x40];
+    gen_buf_append(out, &sig_type, sizeof(sig_type));
+    gen_buf_append(out, NULL, sig_size + 0x3C);
+    memset(field, 0, sizeof(field));
+    snprintf(field, sizeof(field), "%s", issuer);
+    gen_buf_append(out, field, sizeof(field));
+    uint32_t key_type = GEN_CERT_KEY_RSA2048;
+    gen_buf_append(out, &key_type, sizeof(key_type));
+    memset(field, 0, sizeof(field));
+    snprintf(field, sizeof(field), "%s", name);
+    gen_buf_append(out, field, sizeof(field));
+    gen_buf_append(out, NULL, 4 + 0x100 + 4 + 0x34); /* Key ID, modulus, exponent and padding. */
+}
+
+/* The certificate chain of gen_build_ticket's issuer, shipped alongside tickets. Its signatures
+ * and keys are left zero, like the ticket's signature. */
+void gen_build_cert(gen_buf_t *out) {
+    gen_append_cert(out, SIGTYPE_RSA4096_SHA256, 0x200, "Root", "CA00000003");
+    gen_append_cert(out, SIGTYPE_RSA2048_SHA256, 0x100, "Root-CA00000003", "XS00000020");
+}
+
+/* Contents are named by their content ID, the first half of their SHA-256, and suffix. */
+void gen_content_name(const gen_buf_t *nca, const char *suffix, char *name, size_t name_size) {
+    unsigned char hash[0x20];
+    sha256_hash_buffer(hash, nca->data, (size_t)nca->size);
+    for (unsigned int i = 0; i < 0x10 && 2 * i + 2 < name_size; i++) {
+        snprintf(name + 2 * i, name_size - 2 * i, "%02x", hash[i]);
+    }
+    strncat(name, suffix, name_size - strlen(name) - 1);
+}
+
+/* Tickets and their certificate chains are named by the rights ID, and suffix. */
+void gen_ticket_name(uint64_t title_id, const char *suffix, char *name, size_t name_size) {
+    unsigned char rights_id[0x10];
+    gen_rights_id(title_id, rights_id);
+    for (unsigned int i = 0; i < 0x10 && 2 * i + 2 < name_size; i++) {
+        snprintf(name + 2 * i, name_size - 2 * i, "%02x", rights_id[i]);
+    }
+    strncat(name, suffix, name_size - strlen(name) - 1);
+}
+
+/* A gamecard image: a root HFS0 of empty update and normal partitions, and a secure partition of
+ * the contents. Its header signature can't be made with the test keyset, so it will not verify. */
+void gen_build_xci(uint32_t num_contents, const char *const *names, const gen_buf_t *contents, gen_buf_t *out) {
+    static const char *const partition_names[3] = {"update", "normal", "secure"};
+    gen_buf_t partitions[3];
+    uint64_t partition_header_sizes[3];
+    memset(partitions, 0, sizeof(partitions));
+    partition_header_sizes[0] = gen_build_hfs0(&partitions[0], 0, NULL, NULL, NULL);
+    partition_header_sizes[1] = gen_build_hfs0(&partitions[1], 0, NULL, NULL, NULL);
+    partition_header_sizes[2] = gen_build_hfs0(&partitions[2], num_contents, names, contents, NULL);
+    gen_buf_t root = {0};
+    uint64_t root_header_size = gen_build_hfs0(&root, 3, partition_names, partitions, partition_header_sizes);
+
+    xci_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MAGIC_HEAD;
+    header.secure_offset = (uint32_t)((GEN_XCI_HFS0_OFFSET + root_header_size + hfs0_get_file_entry((hfs0_header_t *)root.data, 2)->offset) / MEDIA_SIZE);
+    header.cart_type = CARTSIZE_2GB;
+    header.cart_size = (GEN_XCI_HFS0_OFFSET + root.size) / MEDIA_SIZE - 1;
+    header.hfs0_offset = GEN_XCI_HFS0_OFFSET;
+    header.hfs0_header_size = root_header_size;
+    sha256_hash_buffer(header.hfs0_header_hash, root.data, (size_t)root_header_size);
+    gen_buf_append(out, &header, sizeof(header));
+    gen_buf_append(out, NULL, GEN_XCI_HFS0_OFFSET - out->size);
+    gen_buf_append(out, root.data, root.size);
+
+    for (unsigned int i = 0; i < 3; i++) {
+        gen_buf_free(&partitions[i]);
+    }
+    gen_buf_free(&root);
+}
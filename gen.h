@@ -0,0 +1,54 @@
+#ifndef HACTOOL_GEN_H
+#define HACTOOL_GEN_H
+
+#include "types.h"
+#include "settings.h"
+#include "nca.h"
+#include "bktr.h"
+#include "ivfc.h"
+
+#define GEN_TITLE_ID 0x0100000000C0F000ULL
+
+typedef struct {
+    unsigned char *data;
+    uint64_t size;
+    uint64_t max_size;
+} gen_buf_t;
+
+typedef struct {
+    uint64_t seed;
+    uint32_t num_romfs_files;
+    uint32_t num_pfs0_files;
+    uint64_t file_size;
+    uint32_t patch_percent;
+    int corrupt_content; /* hactool-gen: damage a content of game.nsp after its CNMT is made. */
+    const char *out_dir;
+    nca_keyset_t keyset;
+} gen_ctx_t;
+
+typedef struct {
+    gen_buf_t data; /* Plaintext, from the start of the section. */
+    nca_fs_header_t header;
+    bktr_subsection_entry_t *subsections; /* BKTR only: how the patch data is encrypted. */
+    uint32_t num_subsections;
+    uint64_t patch_data_size;
+} gen_section_t;
+
+uint64_t gen_buf_append(gen_buf_t *buf, const void *data, uint64_t size);
+void gen_buf_free(gen_buf_t *buf);
+
+void gen_build_pfs0(gen_buf_t *out, uint32_t num_files, const char *const *names, const gen_buf_t *files);
+void gen_build_romfs(gen_ctx_t *ctx, gen_buf_t *out, int is_patched);
+void gen_build_pfs0_section(gen_ctx_t *ctx, gen_section_t *section, section_crypt_type_t crypt_type, uint32_t section_ctr_low);
+void gen_build_romfs_section(const gen_buf_t *romfs, gen_section_t *section, uint32_t section_ctr_low);
+void gen_build_bktr_section(const gen_buf_t *base, const gen_buf_t *patched, const ivfc_hdr_t *ivfc_header, gen_section_t *section, uint32_t section_ctr_low);
+void gen_free_section(gen_section_t *section);
+void gen_build_nca(gen_ctx_t *ctx, const gen_section_t *sections, unsigned int num_sections, uint64_t title_id, uint32_t key_index, int has_rights_id, gen_buf_t *out);
+void gen_build_meta_nca(gen_ctx_t *ctx, uint64_t title_id, uint32_t num_contents, const gen_buf_t *contents, uint32_t key_index, gen_buf_t *out);
+void gen_build_ticket(gen_ctx_t *ctx, uint64_t title_id, uint32_t key_index, gen_buf_t *out);
+void gen_build_cert(gen_buf_t *out);
+void gen_content_name(const gen_buf_t *nca, const char *suffix, char *name, size_t name_size);
+void gen_ticket_name(uint64_t title_id, const char *suffix, char *name, size_t name_size);
+void gen_build_xci(uint32_t num_contents, const char *const *names, const gen_buf_t *contents, gen_buf_t *out);
+
+#endif
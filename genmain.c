@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "gen.h"
+#include "utils.h"
+#include "pki.h"
+#include "filepath.h"
+
+/* hactool-gen: writes synthetic content, built by gen.c, to a directory for tests and benchmarks
+ * that can't ship real content. */
+
+#define GEN_DEFAULT_ROMFS_FILES 64
+#define GEN_DEFAULT_PFS0_FILES 4
+#define GEN_DEFAULT_FILE_SIZE 0x10000
+#define GEN_DEFAULT_PATCH_PERCENT 10
+#define GEN_NUM_CONTENTS 2 /* NCAs put in the XCI and NSP. */
+#define GEN_NUM_NSP_FILES 5 /* The contents, a Meta NCA, a certificate chain and a ticket. */
+
+static void gen_write_file(gen_ctx_t *ctx, const char *name, const gen_buf_t *buf) {
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/%s", ctx->out_dir, name);
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", path);
+        fatal_exit();
+    }
+    if (fwrite(buf->data, 1, (size_t)buf->size, f) != buf->size || fclose(f) != 0) {
+        fprintf(stderr, "Failed to write %s!\n", path);
+        fatal_exit();
+    }
+    printf("Wrote %s (%"PRIu64" bytes).\n", path, buf->size);
+}
+
+static void gen_generate(gen_ctx_t *ctx) {
+    gen_section_t base_sections[2], xts_sections[2], patch_sections[2];
+    gen_buf_t contents[GEN_NUM_CONTENTS], patch = {0};
+    memset(contents, 0, sizeof(contents));
+
+    /* The base program, and a copy with its ExeFS encrypted with XTS instead of CTR. */
+    gen_buf_t romfs = {0};
+    gen_build_romfs(ctx, &romfs, 0);
+    gen_build_pfs0_section(ctx, &base_sections[0], CRYPT_CTR, 1);
+    gen_build_romfs_section(&romfs, &base_sections[1], 2);
+    gen_build_nca(ctx, base_sections, 2, GEN_TITLE_ID, 0, 0, &contents[0]);
+    gen_write_file(ctx, "base.nca", &contents[0]);
+
+    gen_build_pfs0_section(ctx, &xts_sections[0], CRYPT_XTS, 1);
+    gen_build_romfs_section(&romfs, &xts_sections[1], 2);
+    gen_build_nca(ctx, xts_sections, 2, GEN_TITLE_ID, 1, 0, &contents[1]);
+    gen_write_file(ctx, "xts.nca", &contents[1]);
+
+    /* An update changing some RomFS files, to apply on top of the base program. */
+    gen_buf_t patched_romfs = {0};
+    gen_section_t patched_section;
+    gen_build_romfs(ctx, &patched_romfs, 1);
+    gen_build_romfs_section(&patched_romfs, &patched_section, 2);
+    gen_build_pfs0_section(ctx, &patch_sections[0], CRYPT_CTR, 1);
+    gen_build_bktr_section(&base_sections[1].data, &patched_section.data, &patched_section.header.romfs_superblock.ivfc_header, &patch_sections[1], 3);
+    gen_build_nca(ctx, patch_sections, 2, GEN_TITLE_ID | 0x800, 2, 0, &patch);
+    gen_write_file(ctx, "patch.nca", &patch);
+
+    char names[GEN_NUM_NSP_FILES][0x30];
+    const char *name_ptrs[GEN_NUM_NSP_FILES];
+    for (unsigned int i = 0; i < GEN_NUM_CONTENTS; i++) {
+        gen_content_name(&contents[i], ".nca", names[i], sizeof(names[i]));
+        name_ptrs[i] = names[i];
+    }
+    gen_buf_t xci = {0}, nsp = {0};
+    gen_build_xci(GEN_NUM_CONTENTS, name_ptrs, contents, &xci);
+    gen_write_file(ctx, "game.xci", &xci);
+
+    /* The NSP's program is under a title key, as from the eShop, with the ticket holding it and a
+     * Meta NCA whose CNMT lists both contents. */
+    gen_buf_t nsp_files[GEN_NUM_NSP_FILES];
+    memset(nsp_files, 0, sizeof(nsp_files));
+    gen_build_nca(ctx, base_sections, 2, GEN_TITLE_ID, 0, 1, &nsp_files[0]);
+    gen_buf_append(&nsp_files[1], contents[1].data, contents[1].size);
+    gen_build_meta_nca(ctx, GEN_TITLE_ID, GEN_NUM_CONTENTS, nsp_files, 3, &nsp_files[2]);
+    gen_build_cert(&nsp_files[3]);
+    gen_build_ticket(ctx, GEN_TITLE_ID, 0, &nsp_files[4]);
+    if (ctx->corrupt_content) {
+        nsp_files[1].data[nsp_files[1].size / 2] ^= 0xFF;
+    }
+    gen_content_name(&nsp_files[0], ".nca", names[0], sizeof(names[0]));
+    gen_content_name(&nsp_files[2], ".cnmt.nca", names[2], sizeof(names[2]));
+    gen_ticket_name(GEN_TITLE_ID, ".cert", names[3], sizeof(names[3]));
+    gen_ticket_name(GEN_TITLE_ID, ".tik", names[4], sizeof(names[4]));
+    for (unsigned int i = 0; i < GEN_NUM_NSP_FILES; i++) {
+        name_ptrs[i] = names[i];
+    }
+    gen_build_pfs0(&nsp, GEN_NUM_NSP_FILES, name_ptrs, nsp_files);
+    gen_write_file(ctx, "game.nsp", &nsp);
+
+    for (unsigned int i = 0; i < 2; i++) {
+        gen_free_section(&base_sections[i]);
+        gen_free_section(&xts_sections[i]);
+        gen_free_section(&patch_sections[i]);
+    }
+    for (unsigned int i = 0; i < GEN_NUM_CONTENTS; i++) {
+        gen_buf_free(&contents[i]);
+    }
+    for (unsigned int i = 0; i < GEN_NUM_NSP_FILES; i++) {
+        gen_buf_free(&nsp_files[i]);
+    }
+    gen_free_section(&patched_section);
+    gen_buf_free(&romfs);
+    gen_buf_free(&patched_romfs);
+    gen_buf_free(&patch);
+    gen_buf_free(&xci);
+    gen_buf_free(&nsp);
+}
+
+static void usage(const char *prog_name) {
+    fprintf(stderr,
+        "Usage: %s [options...] <dir>\n"
+        "Writes base.nca, xts.nca, patch.nca, game.xci and game.nsp to dir, for hactool --test-keys.\n"
+        "Options:\n"
+        "  --seed=n           Seed everything is derived from. Default 0.\n"
+        "  --romfs-files=n    Number of RomFS files. Default %d.\n"
+        "  --pfs0-files=n     Number of ExeFS files. Default %d.\n"
+        "  --file-size=n      Largest file size in bytes; sizes range from half of it. Default %d.\n"
+        "  --patch-percent=n  Share of RomFS files changed by patch.nca. Default %d.\n"
+        "  --corrupt-content  Damage xts.nca inside game.nsp, so its CNMT record hash check fails.\n",
+        prog_name, GEN_DEFAULT_ROMFS_FILES, GEN_DEFAULT_PFS0_FILES, GEN_DEFAULT_FILE_SIZE, GEN_DEFAULT_PATCH_PERCENT);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    gen_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.num_romfs_files = GEN_DEFAULT_ROMFS_FILES;
+    ctx.num_pfs0_files = GEN_DEFAULT_PFS0_FILES;
+    ctx.file_size = GEN_DEFAULT_FILE_SIZE;
+    ctx.patch_percent = GEN_DEFAULT_PATCH_PERCENT;
+
+    while (1) {
+        int option_index;
+        static struct option long_options[] = {
+            {"seed", 1, NULL, 0},
+            {"romfs-files", 1, NULL, 1},
+            {"pfs0-files", 1, NULL, 2},
+            {"file-size", 1, NULL, 3},
+            {"patch-percent", 1, NULL, 4},
+            {"corrupt-content", 0, NULL, 5},
+            {NULL, 0, NULL, 0},
+        };
+        int c = getopt_long(argc, argv, "", long_options, &option_index);
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+            case 0:
+                ctx.seed = strtoull(optarg, NULL, 0);
+                break;
+            case 1:
+                ctx.num_romfs_files = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 2:
+                ctx.num_pfs0_files = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 3:
+                ctx.file_size = strtoull(optarg, NULL, 0);
+                break;
+            case 4:
+                ctx.patch_percent = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 5:
+                ctx.corrupt_content = 1;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+    }
+    ctx.out_dir = argv[optind];
+
+    filepath_t out_path;
+    filepath_init(&out_path);
+    filepath_set(&out_path, ctx.out_dir);
+    os_makedir(out_path.os_path);
+
+    pki_initialize_keyset(&ctx.keyset, KEYSET_TEST);
+    gen_generate(&ctx);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,633 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include "hactool.h"
+#include "types.h"
+#include "utils.h"
+#include "settings.h"
+#include "pki.h"
+#include "nca.h"
+#include "xci.h"
+#include "splitfile.h"
+#include "stats.h"
+
+/* The parsers report fatal errors through fatal_exit(). Every entry point here sets a trap for
+ * them first, so a bad input turns into HACTOOL_ERROR_FORMAT instead of ending the process.
+ * Anything a failing call stored in the handle is released by hactool_close(). */
+
+#define HACTOOL_READ_CHUNK 0x400000
+
+typedef struct {
+    char *path;
+    uint64_t offset; /* Of the data, in the section's address space. */
+    uint64_t size;
+} hactool_entry_t;
+
+typedef struct {
+    hactool_section_info_t info;
+    nca_section_ctx_t *nca_section; /* Reads are decrypted through this, if set; otherwise they are raw file offsets. */
+    hfs0_ctx_t *hfs0_ctx;
+    int list_result; /* Of listing the files, once done. */
+    int is_listed;
+    hactool_entry_t *entries;
+    uint32_t num_entries;
+    uint32_t max_entries;
+} hactool_section_t;
+
+struct hactool_handle {
+    hactool_ctx_t tool_ctx;
+    hactool_type_t type;
+    nca_ctx_t *nca_ctx;
+    xci_ctx_t *xci_ctx;
+    pfs0_ctx_t pfs0_ctx;
+    romfs_ctx_t romfs_ctx;
+    hactool_section_t sections[4];
+    uint32_t num_sections;
+};
+
+/* Deriving the keys costs more than opening a small file, so it is done once per variant (per thread). */
+static _Thread_local nca_keyset_t g_hactool_keysets[3];
+static _Thread_local int g_hactool_keysets_derived[3];
+
+typedef struct {
+    hactool_handle_t *handle;
+    uint32_t section;
+    uint32_t file;
+    const char *path;
+    void *buffer;
+    uint64_t size;
+    uint64_t offset;
+    int64_t result;
+} hactool_call_t;
+
+static int hactool_trap(int (*fn)(hactool_call_t *), hactool_call_t *call) {
+    jmp_buf trap;
+    jmp_buf *prev = fatal_set_trap(&trap);
+    int result;
+    if (setjmp(trap)) {
+        result = HACTOOL_ERROR_FORMAT;
+    } else {
+        result = fn(call);
+    }
+    fatal_set_trap(prev);
+    return result;
+}
+
+static void hactool_add_entry(hactool_section_t *section, char *path, uint64_t offset, uint64_t size) {
+    if (section->num_entries == section->max_entries) {
+        section->max_entries = section->max_entries ? section->max_entries * 2 : 0x40;
+        if ((section->entries = realloc(section->entries, section->max_entries * sizeof(hactool_entry_t))) == NULL) {
+            fprintf(stderr, "Failed to allocate file list!\n");
+            fatal_exit();
+        }
+    }
+    section->entries[section->num_entries].path = path;
+    section->entries[section->num_entries].offset = offset;
+    section->entries[section->num_entries].size = size;
+    section->num_entries++;
+}
+
+static char *hactool_join_path(const char *prefix, const char *name, uint32_t name_size) {
+    size_t prefix_len = strlen(prefix);
+    char *path = malloc(prefix_len + name_size + 2);
+    if (path == NULL) {
+        fprintf(stderr, "Failed to allocate file path!\n");
+        fatal_exit();
+    }
+    if (prefix_len) {
+        sprintf(path, "%s/%.*s", prefix, (int)name_size, name);
+    } else {
+        sprintf(path, "%.*s", (int)name_size, name);
+    }
+    return path;
+}
+
+static void hactool_list_pfs0(hactool_section_t *section, pfs0_header_t *header, uint64_t base) {
+    for (uint32_t i = 0; i < header->num_files; i++) {
+        pfs0_file_entry_t *cur_file = pfs0_get_file_entry(header, i);
+        char *name = pfs0_get_file_name(header, i);
+        hactool_add_entry(section, hactool_join_path("", name, (uint32_t)strlen(name)), base + pfs0_get_header_size(header) + cur_file->offset, cur_file->size);
+    }
+}
+
+static void hactool_list_hfs0(hactool_section_t *section, hfs0_ctx_t *ctx) {
+    for (uint32_t i = 0; i < ctx->header->num_files; i++) {
+        hfs0_file_entry_t *cur_file = hfs0_get_file_entry(ctx->header, i);
+        char *name = hfs0_get_file_name(ctx->header, i);
+        hactool_add_entry(section, hactool_join_path("", name, (uint32_t)strlen(name)), ctx->offset + hfs0_get_header_size(ctx->header) + cur_file->offset, cur_file->size);
+    }
+}
+
+typedef struct {
+    hactool_section_t *section;
+    romfs_hdr_t *header;
+    romfs_direntry_t *directories;
+    romfs_fentry_t *files;
+    uint64_t base;
+    uint64_t budget; /* Entries left to visit, so that looping tables end. */
+} hactool_romfs_walk_t;
+
+static void hactool_list_romfs_dir(hactool_romfs_walk_t *walk, uint32_t dir_offset, const char *prefix) {
+    while (dir_offset != ROMFS_ENTRY_EMPTY) {
+        romfs_direntry_t *dir = romfs_get_direntry(walk->directories, dir_offset);
+        if (walk->budget-- == 0 || (uint64_t)dir_offset + sizeof(*dir) > walk->header->dir_meta_table_size ||
+            (uint64_t)dir_offset + sizeof(*dir) + dir->name_size > walk->header->dir_meta_table_size) {
+            fprintf(stderr, "RomFS directory table is corrupt!\n");
+            fatal_exit();
+        }
+        /* The root has no name, so its files get no prefix. */
+        char *dir_path = hactool_join_path(prefix, dir->name, dir->name_size);
+
+        for (uint32_t file_offset = dir->file; file_offset != ROMFS_ENTRY_EMPTY; ) {
+            romfs_fentry_t *file = romfs_get_fentry(walk->files, file_offset);
+            if (walk->budget-- == 0 || (uint64_t)file_offset + sizeof(*file) > walk->header->file_meta_table_size ||
+                (uint64_t)file_offset + sizeof(*file) + file->name_size > walk->header->file_meta_table_size) {
+                fprintf(stderr, "RomFS file table is corrupt!\n");
+                fatal_exit();
+            }
+            hactool_add_entry(walk->section, hactool_join_path(dir_path, file->name, file->name_size), walk->base + walk->header->data_offset + file->offset, file->size);
+            file_offset = file->sibling;
+        }
+
+        hactool_list_romfs_dir(walk, dir->child, dir_path);
+        free(dir_path);
+        dir_offset = dir->sibling;
+    }
+}
+
+static void hactool_list_romfs(hactool_section_t *section, romfs_hdr_t *header, romfs_direntry_t *directories, romfs_fentry_t *files, uint64_t base) {
+    if (header->header_size != ROMFS_HEADER_SIZE || directories == NULL || files == NULL) {
+        fprintf(stderr, "RomFS header is corrupt!\n");
+        fatal_exit();
+    }
+    hactool_romfs_walk_t walk;
+    walk.section = section;
+    walk.header = header;
+    walk.directories = directories;
+    walk.files = files;
+    walk.base = base;
+    walk.budget = header->dir_meta_table_size / sizeof(romfs_direntry_t) + header->file_meta_table_size / sizeof(romfs_fentry_t);
+    hactool_list_romfs_dir(&walk, 0, "");
+}
+
+static int hactool_list_files(hactool_call_t *call) {
+    hactool_handle_t *handle = call->handle;
+    hactool_section_t *section = &handle->sections[call->section];
+    nca_section_ctx_t *nca_section = section->nca_section;
+    switch (section->info.type) {
+        case HACTOOL_SECTION_PFS0:
+            if (nca_section == NULL) {
+                hactool_list_pfs0(section, handle->pfs0_ctx.header, 0);
+            } else if (nca_section_get_pfs0_header(nca_section) != NULL) {
+                hactool_list_pfs0(section, nca_section->pfs0_ctx.header, nca_section->pfs0_ctx.superblock->pfs0_offset);
+                section->info.is_exefs = nca_section->pfs0_ctx.is_exefs;
+            } else {
+                return HACTOOL_ERROR_FORMAT;
+            }
+            break;
+        case HACTOOL_SECTION_ROMFS:
+            if (nca_section == NULL) {
+                hactool_list_romfs(section, &handle->romfs_ctx.header, handle->romfs_ctx.directories, handle->romfs_ctx.files, 0);
+            } else {
+                nca_section_load_romfs(nca_section);
+                hactool_list_romfs(section, &nca_section->romfs_ctx.header, nca_section->romfs_ctx.directories, nca_section->romfs_ctx.files, nca_section->romfs_ctx.romfs_offset);
+            }
+            break;
+        case HACTOOL_SECTION_HFS0:
+            hactool_list_hfs0(section, section->hfs0_ctx);
+            break;
+        case HACTOOL_SECTION_BKTR:
+            return HACTOOL_ERROR_UNSUPPORTED;
+        case HACTOOL_SECTION_INVALID:
+        default:
+            return HACTOOL_ERROR_FORMAT;
+    }
+    section->info.num_files = section->num_entries;
+    return HACTOOL_OK;
+}
+
+/* List a section's files on first use, remembering the outcome. */
+static int hactool_get_entries(hactool_handle_t *handle, uint32_t section_num) {
+    if (handle == NULL || section_num >= handle->num_sections) {
+        return HACTOOL_ERROR_ARGUMENT;
+    }
+    hactool_section_t *section = &handle->sections[section_num];
+    if (!section->is_listed) {
+        hactool_call_t call;
+        memset(&call, 0, sizeof(call));
+        call.handle = handle;
+        call.section = section_num;
+        section->list_result = hactool_trap(hactool_list_files, &call);
+        section->is_listed = 1;
+    }
+    return section->list_result;
+}
+
+/* Measured through the open file, which is all parts of a split input, not just the path's first. */
+static uint64_t hactool_get_size(hactool_handle_t *handle) {
+    FILE *f = handle->tool_ctx.file;
+    if (fseeko64(f, 0, SEEK_END) != 0) {
+        return 0;
+    }
+    int64_t size = (int64_t)ftello(f);
+    fseeko64(f, 0, SEEK_SET);
+    return size < 0 ? 0 : (uint64_t)size;
+}
+
+static int hactool_open_nca(hactool_call_t *call) {
+    hactool_handle_t *handle = call->handle;
+    if ((handle->nca_ctx = malloc(sizeof(nca_ctx_t))) == NULL) {
+        fprintf(stderr, "Failed to allocate NCA context!\n");
+        fatal_exit();
+    }
+    nca_ctx_t *ctx = handle->nca_ctx;
+    nca_init(ctx);
+    ctx->file = handle->tool_ctx.file;
+    ctx->file_size = hactool_get_size(handle);
+    ctx->tool_ctx = &handle->tool_ctx;
+    if (!nca_decrypt_header(ctx)) {
+        return HACTOOL_ERROR_FORMAT;
+    }
+    nca_init_keys(ctx);
+
+    for (unsigned int i = 0; i < 4; i++) {
+        if (!ctx->header.section_entries[i].media_start_offset) {
+            continue;
+        }
+        nca_init_section(ctx, i);
+        nca_section_ctx_t *nca_section = &ctx->section_contexts[i];
+        hactool_section_t *section = &handle->sections[handle->num_sections++];
+        section->nca_section = nca_section;
+        section->info.index = i;
+        section->info.offset = nca_section->offset;
+        section->info.size = nca_section->size;
+        switch (nca_section->type) {
+            case PFS0:
+                section->info.type = HACTOOL_SECTION_PFS0;
+                break;
+            case ROMFS:
+                section->info.type = HACTOOL_SECTION_ROMFS;
+                nca_process_ivfc_section(nca_section);
+                break;
+            case BKTR:
+                section->info.type = HACTOOL_SECTION_BKTR;
+                break;
+            case INVALID:
+            default:
+                section->info.type = HACTOOL_SECTION_INVALID;
+                break;
+        }
+    }
+    return HACTOOL_OK;
+}
+
+static int hactool_open_xci(hactool_call_t *call) {
+    hactool_handle_t *handle = call->handle;
+    if ((handle->xci_ctx = calloc(1, sizeof(xci_ctx_t))) == NULL) {
+        fprintf(stderr, "Failed to allocate XCI context!\n");
+        fatal_exit();
+    }
+    xci_ctx_t *ctx = handle->xci_ctx;
+    ctx->file = handle->tool_ctx.file;
+    ctx->tool_ctx = &handle->tool_ctx;
+    xci_process(ctx);
+    if (ctx->header.magic != MAGIC_HEAD || ctx->secure_ctx.header == NULL) {
+        return HACTOOL_ERROR_FORMAT;
+    }
+
+    hfs0_ctx_t *partitions[3] = {&ctx->update_ctx, &ctx->normal_ctx, &ctx->secure_ctx};
+    for (unsigned int i = 0; i < 3; i++) {
+        hactool_section_t *section = &handle->sections[handle->num_sections++];
+        section->hfs0_ctx = partitions[i];
+        section->info.index = i;
+        section->info.type = HACTOOL_SECTION_HFS0;
+        section->info.name = partitions[i]->name;
+        section->info.offset = partitions[i]->offset;
+        section->info.size = hfs0_get_file_entry(ctx->partition_ctx.header, i)->size;
+    }
+    return HACTOOL_OK;
+}
+
+static int hactool_open_raw(hactool_call_t *call) {
+    hactool_handle_t *handle = call->handle;
+    hactool_section_t *section = &handle->sections[handle->num_sections++];
+    section->info.size = hactool_get_size(handle);
+    if (handle->type == HACTOOL_TYPE_PFS0) {
+        handle->pfs0_ctx.file = handle->tool_ctx.file;
+        handle->pfs0_ctx.tool_ctx = &handle->tool_ctx;
+        pfs0_process(&handle->pfs0_ctx);
+        section->info.type = HACTOOL_SECTION_PFS0;
+        section->info.is_exefs = handle->pfs0_ctx.is_exefs;
+    } else {
+        /* Listing makes romfs_process load the tables, without printing or extracting anything. */
+        handle->tool_ctx.action = ACTION_LISTROMFS;
+        handle->romfs_ctx.file = handle->tool_ctx.file;
+        handle->romfs_ctx.tool_ctx = &handle->tool_ctx;
+        romfs_process(&handle->romfs_ctx);
+        handle->tool_ctx.action = 0;
+        section->info.type = HACTOOL_SECTION_ROMFS;
+    }
+    return HACTOOL_OK;
+}
+
+static int hactool_open_file(hactool_call_t *call) {
+    switch (call->handle->type) {
+        case HACTOOL_TYPE_NCA:
+            return hactool_open_nca(call);
+        case HACTOOL_TYPE_XCI:
+            return hactool_open_xci(call);
+        case HACTOOL_TYPE_PFS0:
+        case HACTOOL_TYPE_ROMFS:
+            return hactool_open_raw(call);
+        default:
+            return HACTOOL_ERROR_ARGUMENT;
+    }
+}
+
+int hactool_open(hactool_handle_t **out, const char *path, hactool_type_t type, const hactool_options_t *options) {
+    if (out == NULL || path == NULL || type > HACTOOL_TYPE_ROMFS) {
+        return HACTOOL_ERROR_ARGUMENT;
+    }
+    *out = NULL;
+    hactool_handle_t *handle = calloc(1, sizeof(*handle));
+    if (handle == NULL) {
+        return HACTOOL_ERROR_OPEN;
+    }
+    handle->type = type;
+    keyset_variant_t variant = KEYSET_RETAIL;
+    if (options != NULL && options->use_test_keys) {
+        variant = KEYSET_TEST;
+    } else if (options != NULL && options->use_dev_keys) {
+        variant = KEYSET_DEV;
+    }
+    if (!g_hactool_keysets_derived[variant]) {
+        pki_initialize_keyset(&g_hactool_keysets[variant], variant);
+        g_hactool_keysets_derived[variant] = 1;
+    }
+    memcpy(&handle->tool_ctx.settings.keyset, &g_hactool_keysets[variant], sizeof(nca_keyset_t));
+    if (options != NULL && options->has_titlekey) {
+        memcpy(handle->tool_ctx.settings.titlekey, options->titlekey, 0x10);
+        handle->tool_ctx.settings.has_titlekey = 1;
+    }
+    if ((handle->tool_ctx.file = split_fopen(path)) == NULL) {
+        free(handle);
+        return HACTOOL_ERROR_OPEN;
+    }
+
+    hactool_call_t call;
+    memset(&call, 0, sizeof(call));
+    call.handle = handle;
+    call.path = path;
+    int result = hactool_trap(hactool_open_file, &call);
+    if (result != HACTOOL_OK) {
+        hactool_close(handle);
+        return result;
+    }
+    *out = handle;
+    return HACTOOL_OK;
+}
+
+void hactool_close(hactool_handle_t *handle) {
+    if (handle == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < handle->num_sections; i++) {
+        for (uint32_t j = 0; j < handle->sections[i].num_entries; j++) {
+            free(handle->sections[i].entries[j].path);
+        }
+        free(handle->sections[i].entries);
+    }
+    if (handle->nca_ctx != NULL) {
+        nca_free_section_contexts(handle->nca_ctx);
+        free(handle->nca_ctx);
+    }
+    if (handle->xci_ctx != NULL) {
+        free(handle->xci_ctx->partition_ctx.header);
+        free(handle->xci_ctx->update_ctx.header);
+        free(handle->xci_ctx->normal_ctx.header);
+        free(handle->xci_ctx->secure_ctx.header);
+        free(handle->xci_ctx);
+    }
+    free(handle->pfs0_ctx.header);
+    free(handle->pfs0_ctx.npdm);
+    free(handle->romfs_ctx.directories);
+    free(handle->romfs_ctx.files);
+    if (handle->tool_ctx.file != NULL) {
+        fclose(handle->tool_ctx.file);
+    }
+    free(handle);
+}
+
+int hactool_get_info(hactool_handle_t *handle, hactool_info_t *info) {
+    if (handle == NULL || info == NULL) {
+        return HACTOOL_ERROR_ARGUMENT;
+    }
+    memset(info, 0, sizeof(*info));
+    info->type = handle->type;
+    info->num_sections = handle->num_sections;
+    if (handle->nca_ctx != NULL) {
+        nca_header_t *header = &handle->nca_ctx->header;
+        info->title_id = header->title_id;
+        info->content_size = header->nca_size;
+        info->content_type = header->content_type;
+        info->distribution = header->distribution;
+        info->master_key_revision = handle->nca_ctx->crypto_type;
+        info->sdk_version[0] = header->sdk_major;
+        info->sdk_version[1] = header->sdk_minor;
+        info->sdk_version[2] = header->sdk_micro;
+        info->sdk_version[3] = header->sdk_revision;
+        info->has_rights_id = handle->nca_ctx->has_rights_id;
+        memcpy(info->rights_id, header->rights_id, sizeof(info->rights_id));
+    }
+    return HACTOOL_OK;
+}
+
+int hactool_get_section(hactool_handle_t *handle, uint32_t section, hactool_section_info_t *info) {
+    if (handle == NULL || info == NULL || section >= handle->num_sections) {
+        return HACTOOL_ERROR_ARGUMENT;
+    }
+    /* Sections whose files can't be listed are still described. */
+    hactool_get_entries(handle, section);
+    memcpy(info, &handle->sections[section].info, sizeof(*info));
+    return HACTOOL_OK;
+}
+
+int hactool_get_file(hactool_handle_t *handle, uint32_t section, uint32_t file, hactool_file_info_t *info) {
+    int result = hactool_get_entries(handle, section);
+    if (result != HACTOOL_OK) {
+        return result;
+    }
+    if (info == NULL || file >= handle->sections[section].num_entries) {
+        return HACTOOL_ERROR_ARGUMENT;
+    }
+    info->path = handle->sections[section].entries[file].path;
+    info->size = handle->sections[section].entries[file].size;
+    return HACTOOL_OK;
+}
+
+int hactool_find_file(hactool_handle_t *handle, uint32_t section, const char *path, uint32_t *file) {
+    int result = hactool_get_entries(handle, section);
+    if (result != HACTOOL_OK) {
+        return result;
+    }
+    if (path == NULL || file == NULL) {
+        return HACTOOL_ERROR_ARGUMENT;
+    }
+    while (*path == '/') {
+        path++;
+    }
+    for (uint32_t i = 0; i < handle->sections[section].num_entries; i++) {
+        if (!strcmp(handle->sections[section].entries[i].path, path)) {
+            *file = i;
+            return HACTOOL_OK;
+        }
+    }
+    return HACTOOL_ERROR_NOT_FOUND;
+}
+
+static int hactool_read_entry(hactool_call_t *call) {
+    hactool_section_t *section = &call->handle->sections[call->section];
+    hactool_entry_t *entry = &section->entries[call->file];
+    uint64_t size = call->size;
+    if (call->offset >= entry->size) {
+        size = 0;
+    } else if (size > entry->size - call->offset) {
+        size = entry->size - call->offset;
+    }
+
+    uint64_t total = 0;
+    while (total < size) {
+        uint64_t chunk = size - total;
+        if (chunk > HACTOOL_READ_CHUNK) chunk = HACTOOL_READ_CHUNK;
+        unsigned char *dst = (unsigned char *)call->buffer + total;
+        size_t read;
+        if (section->nca_section != NULL) {
+            nca_section_fseek(section->nca_section, entry->offset + call->offset + total);
+            read = nca_section_fread(section->nca_section, dst, (size_t)chunk);
+        } else {
+            stats_span_t span;
+            stats_begin(&span);
+            fseeko64(call->handle->tool_ctx.file, entry->offset + call->offset + total, SEEK_SET);
+            read = fread(dst, 1, (size_t)chunk, call->handle->tool_ctx.file);
+            stats_end(&span, STATS_READ, read);
+        }
+        if (read != chunk) {
+            return HACTOOL_ERROR_IO;
+        }
+        total += chunk;
+    }
+    call->result = (int64_t)total;
+    return HACTOOL_OK;
+}
+
+int64_t hactool_pread(hactool_handle_t *handle, uint32_t section, uint32_t file, void *buffer, uint64_t size, uint64_t offset) {
+    int result = hactool_get_entries(handle, section);
+    if (result != HACTOOL_OK) {
+        return result;
+    }
+    if ((buffer == NULL && size) || file >= handle->sections[section].num_entries) {
+        return HACTOOL_ERROR_ARGUMENT;
+    }
+    hactool_call_t call;
+    memset(&call, 0, sizeof(call));
+    call.handle = handle;
+    call.section = section;
+    call.file = file;
+    call.buffer = buffer;
+    call.size = size;
+    call.offset = offset;
+    result = hactool_trap(hactool_read_entry, &call);
+    return result != HACTOOL_OK ? result : call.result;
+}
+
+int hactool_extract(hactool_handle_t *handle, uint32_t section, uint32_t file, const char *out_path) {
+    hactool_file_info_t info;
+    int result = hactool_get_file(handle, section, file, &info);
+    if (result != HACTOOL_OK) {
+        return result;
+    }
+    if (out_path == NULL) {
+        return HACTOOL_ERROR_ARGUMENT;
+    }
+    unsigned char *buf = malloc(HACTOOL_READ_CHUNK);
+    if (buf == NULL) {
+        return HACTOOL_ERROR_IO;
+    }
+    FILE *f_out = fopen(out_path, "wb");
+    if (f_out == NULL) {
+        free(buf);
+        return HACTOOL_ERROR_OPEN;
+    }
+    for (uint64_t ofs = 0; ofs < info.size; ) {
+        int64_t read = hactool_pread(handle, section, file, buf, HACTOOL_READ_CHUNK, ofs);
+        if (read <= 0) {
+            result = read < 0 ? (int)read : HACTOOL_ERROR_IO;
+            break;
+        }
+        stats_span_t span;
+        stats_begin(&span);
+        size_t written = fwrite(buf, 1, (size_t)read, f_out);
+        stats_end(&span, STATS_WRITE, written);
+        if (written != (size_t)read) {
+            result = HACTOOL_ERROR_IO;
+            break;
+        }
+        ofs += (uint64_t)read;
+    }
+    if (fclose(f_out) != 0 && result == HACTOOL_OK) {
+        result = HACTOOL_ERROR_IO;
+    }
+    free(buf);
+    return result;
+}
+
+void hactool_enable_stats(int enable) {
+    stats_enable(enable);
+}
+
+int hactool_get_stats(hactool_stats_t *stats) {
+    static _Thread_local stats_total_t totals[STATS_MAX_PHASE][STATS_NO_SECTION + 1][STATS_MAX_COUNTER];
+    if (stats == NULL) {
+        return HACTOOL_ERROR_ARGUMENT;
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats_collect(totals);
+    for (unsigned int p = 0; p < STATS_MAX_PHASE; p++) {
+        for (unsigned int s = 0; s <= STATS_NO_SECTION; s++) {
+            /* The public counters are numbered like the internal ones. */
+            for (unsigned int c = 0; c < STATS_MAX_COUNTER && c < HACTOOL_NUM_COUNTERS; c++) {
+                stats->counters[c].calls += totals[p][s][c].calls;
+                stats->counters[c].bytes += totals[p][s][c].bytes;
+                stats->counters[c].nanoseconds += totals[p][s][c].ns;
+            }
+        }
+    }
+    stats->peak_memory = stats_peak_memory();
+    return HACTOOL_OK;
+}
+
+void hactool_reset_stats(void) {
+    stats_reset();
+}
+
+const char *hactool_error_string(int error) {
+    switch (error) {
+        case HACTOOL_OK:
+            return "Success";
+        case HACTOOL_ERROR_ARGUMENT:
+            return "Invalid argument";
+        case HACTOOL_ERROR_OPEN:
+            return "Failed to open file";
+        case HACTOOL_ERROR_FORMAT:
+            return "Invalid or corrupt input";
+        case HACTOOL_ERROR_NOT_FOUND:
+            return "File not found";
+        case HACTOOL_ERROR_IO:
+            return "Read or write failed";
+        case HACTOOL_ERROR_UNSUPPORTED:
+            return "Not supported";
+        default:
+            return "Unknown error";
+    }
+}
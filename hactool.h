@@ -0,0 +1,118 @@
+#ifndef HACTOOL_H
+#define HACTOOL_H
+
+/* libhactool: read NCA, XCI, PFS0 and RomFS files from another program.
+ *
+ * Every call reports failure through its return value instead of exiting. Handles are independent,
+ * so different threads may use different handles at the same time; a single handle must not be
+ * used from two threads at once. Diagnostics are still written to stderr. */
+
+#include <stdint.h>
+
+typedef enum {
+    HACTOOL_OK = 0,
+    HACTOOL_ERROR_ARGUMENT = -1, /* Bad handle, index or parameter. */
+    HACTOOL_ERROR_OPEN = -2, /* The input or output file could not be opened. */
+    HACTOOL_ERROR_FORMAT = -3, /* The input is corrupt, or not of the given type. */
+    HACTOOL_ERROR_NOT_FOUND = -4, /* No such file in the section. */
+    HACTOOL_ERROR_IO = -5, /* A read or write failed. */
+    HACTOOL_ERROR_UNSUPPORTED = -6 /* E.g. patch (BKTR) sections, which need their base NCA. */
+} hactool_error_t;
+
+typedef enum {
+    HACTOOL_TYPE_NCA = 0,
+    HACTOOL_TYPE_XCI = 1,
+    HACTOOL_TYPE_PFS0 = 2,
+    HACTOOL_TYPE_ROMFS = 3
+} hactool_type_t;
+
+typedef enum {
+    HACTOOL_SECTION_PFS0 = 0,
+    HACTOOL_SECTION_ROMFS = 1,
+    HACTOOL_SECTION_BKTR = 2,
+    HACTOOL_SECTION_HFS0 = 3,
+    HACTOOL_SECTION_INVALID = 4
+} hactool_section_type_t;
+
+typedef struct {
+    int use_dev_keys;
+    int has_titlekey;
+    unsigned char titlekey[0x10]; /* Encrypted title key, for Rights ID NCAs. */
+    int use_test_keys; /* Keys of synthetic content from hactool-gen; overrides use_dev_keys. */
+} hactool_options_t;
+
+typedef struct {
+    hactool_type_t type;
+    uint32_t num_sections;
+    /* The rest is only set for NCAs. */
+    uint64_t title_id;
+    uint64_t content_size;
+    uint8_t content_type; /* 0 = Program, 1 = Meta, 2 = Control, 3 = Manual, 4 = Data. */
+    uint8_t distribution; /* 0 = Download, 1 = Gamecard. */
+    uint8_t master_key_revision;
+    uint8_t sdk_version[4]; /* Major, minor, micro, revision. */
+    int has_rights_id;
+    unsigned char rights_id[0x10];
+} hactool_info_t;
+
+typedef struct {
+    uint32_t index; /* NCA section number, or partition number for XCIs. */
+    hactool_section_type_t type;
+    const char *name; /* XCI partition name, or NULL. */
+    int is_exefs;
+    uint64_t offset; /* Within the input file. */
+    uint64_t size;
+    uint32_t num_files;
+} hactool_section_info_t;
+
+typedef struct {
+    const char *path; /* Relative to the section root, using '/'. Valid until the handle is closed. */
+    uint64_t size;
+} hactool_file_info_t;
+
+typedef struct hactool_handle hactool_handle_t;
+
+/* Open path as the given type. options may be NULL. */
+int hactool_open(hactool_handle_t **out, const char *path, hactool_type_t type, const hactool_options_t *options);
+void hactool_close(hactool_handle_t *handle);
+
+int hactool_get_info(hactool_handle_t *handle, hactool_info_t *info);
+
+/* Sections are numbered 0 to num_sections - 1. Their files are listed on first use. */
+int hactool_get_section(hactool_handle_t *handle, uint32_t section, hactool_section_info_t *info);
+int hactool_get_file(hactool_handle_t *handle, uint32_t section, uint32_t file, hactool_file_info_t *info);
+int hactool_find_file(hactool_handle_t *handle, uint32_t section, const char *path, uint32_t *file);
+
+/* Read up to size bytes at offset within a file. Returns the number of bytes read, or an error. */
+int64_t hactool_pread(hactool_handle_t *handle, uint32_t section, uint32_t file, void *buffer, uint64_t size, uint64_t offset);
+int hactool_extract(hactool_handle_t *handle, uint32_t section, uint32_t file, const char *out_path);
+
+typedef enum {
+    HACTOOL_COUNTER_READ = 0, /* Reading (and decrypting) input data. */
+    HACTOOL_COUNTER_AES = 1,
+    HACTOOL_COUNTER_SHA256 = 2,
+    HACTOOL_COUNTER_WRITE = 3,
+    HACTOOL_COUNTER_MKDIR = 4,
+    HACTOOL_NUM_COUNTERS = 5
+} hactool_counter_t;
+
+typedef struct {
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t nanoseconds; /* Excluding time counted elsewhere, e.g. AES done within a read. */
+} hactool_counter_stats_t;
+
+typedef struct {
+    hactool_counter_stats_t counters[HACTOOL_NUM_COUNTERS];
+    uint64_t peak_memory; /* Of the whole process, in bytes, or 0 where unknown. */
+} hactool_stats_t;
+
+/* Performance counters are off until enabled. Each thread counts on its own; hactool_get_stats sums
+ * the counts of every thread, and is exact once the other threads are idle. */
+void hactool_enable_stats(int enable);
+int hactool_get_stats(hactool_stats_t *stats);
+void hactool_reset_stats(void);
+
+const char *hactool_error_string(int error);
+
+#endif
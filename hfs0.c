@@ -1,5 +1,6 @@
 #include <string.h>
 #include "hfs0.h"
+#include "tar.h"
 
 void hfs0_process(hfs0_ctx_t *ctx) {
     /* Read *just* safe amount. */
@@ -7,26 +8,26 @@ void hfs0_process(hfs0_ctx_t *ctx) {
     fseeko64(ctx->file, ctx->offset, SEEK_SET);
     if (fread(&raw_header, 1, sizeof(raw_header), ctx->file) != sizeof(raw_header)) {
         fprintf(stderr, "Failed to read HFS0 header!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     
     if (raw_header.magic != MAGIC_HFS0) {
         memdump(stdout, "Sanity: ", &raw_header, sizeof(raw_header));
         printf("Error: HFS0 is corrupt!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     uint64_t header_size = hfs0_get_header_size(&raw_header);
     ctx->header = malloc(header_size);
     if (ctx->header == NULL) {
         fprintf(stderr, "Failed to allocate HFS0 header!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     
     fseeko64(ctx->file, ctx->offset, SEEK_SET);
     if (fread(ctx->header, 1, header_size, ctx->file) != header_size) {
         fprintf(stderr, "Failed to read HFS0 header!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     
     /* Weak file validation. */
@@ -37,7 +38,7 @@ void hfs0_process(hfs0_ctx_t *ctx) {
         hfs0_file_entry_t *cur_file = hfs0_get_file_entry(ctx->header, i);
         if (cur_file->offset < cur_ofs) {
             printf("Error: HFS0 is corrupt!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
         cur_ofs += cur_file->size;
     }
@@ -55,13 +56,13 @@ void hfs0_process(hfs0_ctx_t *ctx) {
 void hfs0_save_file(hfs0_ctx_t *ctx, uint32_t i, filepath_t *dirpath) {
     if (i >= ctx->header->num_files) {
         fprintf(stderr, "Could not save file %"PRId32"!\n", i);
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     hfs0_file_entry_t *cur_file = hfs0_get_file_entry(ctx->header, i);
 
     if (strlen(hfs0_get_file_name(ctx->header, i)) >= MAX_PATH - strlen(dirpath->char_path) - 1) {
         fprintf(stderr, "Filename too long in HFS0!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     filepath_t filepath;
@@ -70,9 +71,28 @@ void hfs0_save_file(hfs0_ctx_t *ctx, uint32_t i, filepath_t *dirpath) {
 
     printf("Saving %s to %s...\n", hfs0_get_file_name(ctx->header, i), filepath.char_path);
     uint64_t ofs = hfs0_get_header_size(ctx->header) + cur_file->offset;
-    save_file_section(ctx->file, ctx->offset + ofs, cur_file->size, &filepath);
+    save_file_section(ctx->file, ctx->offset + ofs, cur_file->size, &filepath, ctx->tool_ctx->manifest);
 }
 
+/* Stream file i into an archive, under an optional directory prefix. */
+void hfs0_archive_file(hfs0_ctx_t *ctx, uint32_t i, tar_ctx_t *tar, const char *prefix) {
+    if (i >= ctx->header->num_files) {
+        fprintf(stderr, "Could not archive file %"PRId32"!\n", i);
+        fatal_exit();
+    }
+    hfs0_file_entry_t *cur_file = hfs0_get_file_entry(ctx->header, i);
+
+    char name[MAX_PATH];
+    if (prefix != NULL) {
+        snprintf(name, sizeof(name), "%s/%s", prefix, hfs0_get_file_name(ctx->header, i));
+    } else {
+        snprintf(name, sizeof(name), "%s", hfs0_get_file_name(ctx->header, i));
+    }
+
+    printf("Archiving %s...\n", name);
+    uint64_t ofs = hfs0_get_header_size(ctx->header) + cur_file->offset;
+    tar_save_file_section(tar, ctx->file, ctx->offset + ofs, cur_file->size, name, ctx->tool_ctx->manifest);
+}
 
 void hfs0_save(hfs0_ctx_t *ctx) {
     /* Extract to directory. */
@@ -83,7 +103,11 @@ void hfs0_save(hfs0_ctx_t *ctx) {
     if (dirpath == NULL || dirpath->valid != VALIDITY_VALID) {
         dirpath = &ctx->tool_ctx->settings.hfs0_dir_path;
     }
-    if (dirpath != NULL && dirpath->valid == VALIDITY_VALID) {
+    if (ctx->tool_ctx->hfs0_tar != NULL) {
+        for (uint32_t i = 0; i < ctx->header->num_files; i++) {
+            hfs0_archive_file(ctx, i, ctx->tool_ctx->hfs0_tar, NULL);
+        }
+    } else if (dirpath != NULL && dirpath->valid == VALIDITY_VALID) {
         os_makedir(dirpath->os_path);
         for (uint32_t i = 0; i < ctx->header->num_files; i++) {
             hfs0_save_file(ctx, i, dirpath);
@@ -101,6 +125,7 @@ void hfs0_print(hfs0_ctx_t *ctx) {
             hfs0_file_entry_t *cur_file = hfs0_get_file_entry(ctx->header, i);
             if (ctx->tool_ctx->action & ACTION_VERIFY) {
                 validity_t hash_validity = check_memory_hash_table(ctx->file, cur_file->hash, ctx->offset + hfs0_get_header_size(ctx->header) + cur_file->offset, cur_file->hashed_size, cur_file->hashed_size, 0);
+                results_add_check(ctx->tool_ctx->results, hash_validity);
                 printf("%s%s:/%-48s %012"PRIx64"-%012"PRIx64" (%s)\n", i == 0 ? "                              " : "                                    ", ctx->name == NULL ? "hfs0" : ctx->name, hfs0_get_file_name(ctx->header, i), cur_file->offset, cur_file->offset + cur_file->size, GET_VALIDITY_STR(hash_validity));
             } else {
                 printf("%s%s:/%-48s %012"PRIx64"-%012"PRIx64"\n", i == 0 ? "                              " : "                                    ", ctx->name == NULL ? "hfs0" : ctx->name, hfs0_get_file_name(ctx->header, i), cur_file->offset, cur_file->offset + cur_file->size);
@@ -53,6 +53,9 @@ void hfs0_process(hfs0_ctx_t *ctx);
 void hfs0_save(hfs0_ctx_t *ctx);
 void hfs0_print(hfs0_ctx_t *ctx);
 
+struct tar_ctx;
+
 void hfs0_save_file(hfs0_ctx_t *ctx, uint32_t i, filepath_t *dirpath);
+void hfs0_archive_file(hfs0_ctx_t *ctx, uint32_t i, struct tar_ctx *tar, const char *prefix);
 
 #endif
\ No newline at end of file
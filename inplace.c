@@ -0,0 +1,279 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inplace.h"
+#include "settings.h"
+#include "sha.h"
+#include "utils.h"
+
+/* Decrypting in place overwrites the only copy of the ciphertext, so before a chunk is written, the
+ * journal gets a record of what each of its pages looks like encrypted and decrypted, and is synced.
+ * Records sit at a fixed place per chunk, so chunks can be decrypted by several threads in any order,
+ * and the NCA is only synced once, before its header goes in as plaintext. After a crash, a chunk
+ * with a record is read back and only the pages still encrypted are decrypted; chunks without one
+ * were never touched. */
+
+static void inplace_fail(const char *msg, const char *path) {
+    fprintf(stderr, msg, path);
+    fatal_exit();
+}
+
+static void inplace_write(FILE *f, uint64_t ofs, const void *data, uint64_t size, const char *path) {
+    fseeko64(f, ofs, SEEK_SET);
+    if (fwrite(data, 1, size, f) != size) {
+        inplace_fail("Failed to write to %s!\n", path);
+    }
+}
+
+static void inplace_sync(FILE *f, const char *path) {
+    if (!fsync_file(f)) {
+        inplace_fail("Failed to sync %s!\n", path);
+    }
+}
+
+static uint64_t inplace_record_offset(uint64_t chunk) {
+    return sizeof(inplace_journal_header_t) + chunk * sizeof(inplace_journal_record_t);
+}
+
+static void inplace_digest_page(uint8_t *digest, const unsigned char *page, uint64_t size) {
+    unsigned char hash[0x20];
+    sha256_hash_buffer(hash, page, size);
+    memcpy(digest, hash, INPLACE_DIGEST_SIZE);
+}
+
+/* Read back a chunk's record; returns 1 if an interrupted run left an intact one for it. */
+static int inplace_read_record(FILE *f_jnl, uint64_t chunk, uint64_t ofs, uint64_t size, inplace_journal_record_t *rec) {
+    unsigned char hash[0x20];
+    fseeko64(f_jnl, inplace_record_offset(chunk), SEEK_SET);
+    if (fread(rec, 1, sizeof(*rec), f_jnl) != sizeof(*rec)) {
+        return 0;
+    }
+    sha256_hash_buffer(hash, rec, offsetof(inplace_journal_record_t, hash));
+    return !memcmp(hash, rec->hash, sizeof(hash)) && rec->chunk == chunk && rec->offset == ofs && rec->size == size;
+}
+
+static void inplace_worker(void *arg) {
+    inplace_ctx_t *ctx = arg;
+    nca_ctx_t *nca = ctx->nca;
+    FILE *f_nca = fopen(nca->file_name, "r+b");
+    FILE *f_jnl = fopen(ctx->jnl_path, "r+b");
+    if (f_nca == NULL || f_jnl == NULL) {
+        inplace_fail("Failed to open %s!\n", f_nca == NULL ? nca->file_name : ctx->jnl_path);
+    }
+    unsigned char *buf = malloc(INPLACE_CHUNK_SIZE);
+    unsigned char *dec = malloc(INPLACE_CHUNK_SIZE);
+    inplace_journal_record_t *rec = malloc(sizeof(inplace_journal_record_t));
+    if (buf == NULL || dec == NULL || rec == NULL) {
+        fprintf(stderr, "Failed to allocate in-place decryption buffer!\n");
+        fatal_exit();
+    }
+    /* Sections share their AES context's IV, so each thread decrypts with its own. */
+    nca_section_ctx_t sections[4];
+    aes_ctx_t *aes_ctxs[4] = {NULL, NULL, NULL, NULL};
+
+    uint64_t c;
+    while (!atomic_load(&ctx->stop) && (c = atomic_fetch_add(&ctx->next_chunk, 1)) < ctx->num_chunks) {
+        unsigned int n = 0;
+        while (c >= ctx->first_chunks[n + 1]) {
+            n++;
+        }
+        unsigned int i = ctx->order[n];
+        if (aes_ctxs[i] == NULL) {
+            sections[i] = nca->section_contexts[i];
+            sections[i].aes = aes_ctxs[i] = nca_new_section_aes_ctx(nca, i);
+        }
+        nca_section_ctx_t *section = &sections[i];
+        uint64_t ofs = section->offset + (c - ctx->first_chunks[n]) * INPLACE_CHUNK_SIZE;
+        uint64_t size = section->offset + section->size - ofs;
+        if (size > INPLACE_CHUNK_SIZE) size = INPLACE_CHUNK_SIZE;
+        uint64_t num_pages = (size + INPLACE_PAGE_SIZE - 1) / INPLACE_PAGE_SIZE;
+
+        fseeko64(f_nca, ofs, SEEK_SET);
+        if (fread(buf, 1, size, f_nca) != size) {
+            fprintf(stderr, "Failed to read NCA!\n");
+            fatal_exit();
+        }
+        memcpy(dec, buf, size);
+        nca_decrypt_section_data(section, dec, ofs, size);
+
+        if (inplace_read_record(f_jnl, c, ofs, size, rec)) {
+            /* The chunk may be partly written; its pages tell which of them still need to be. */
+            atomic_fetch_add(&ctx->num_recovered, 1);
+            for (uint64_t p = 0; p < num_pages; p++) {
+                uint64_t page_ofs = p * INPLACE_PAGE_SIZE;
+                uint64_t page_size = size - page_ofs < INPLACE_PAGE_SIZE ? size - page_ofs : INPLACE_PAGE_SIZE;
+                uint8_t digest[INPLACE_DIGEST_SIZE];
+                inplace_digest_page(digest, buf + page_ofs, page_size);
+                if (!memcmp(digest, rec->pages[p].encrypted, INPLACE_DIGEST_SIZE)) {
+                    inplace_write(f_nca, ofs + page_ofs, dec + page_ofs, page_size, nca->file_name);
+                } else if (memcmp(digest, rec->pages[p].decrypted, INPLACE_DIGEST_SIZE)) {
+                    fprintf(stderr, "Data at 0x%012"PRIx64" of %s is neither encrypted nor decrypted, and can't be recovered!\n", ofs + page_ofs, nca->file_name);
+                    fatal_exit();
+                }
+            }
+            continue;
+        }
+
+        memset(rec, 0, sizeof(*rec));
+        rec->chunk = c;
+        rec->offset = ofs;
+        rec->size = size;
+        for (uint64_t p = 0; p < num_pages; p++) {
+            uint64_t page_ofs = p * INPLACE_PAGE_SIZE;
+            uint64_t page_size = size - page_ofs < INPLACE_PAGE_SIZE ? size - page_ofs : INPLACE_PAGE_SIZE;
+            inplace_digest_page(rec->pages[p].encrypted, buf + page_ofs, page_size);
+            inplace_digest_page(rec->pages[p].decrypted, dec + page_ofs, page_size);
+        }
+        sha256_hash_buffer(rec->hash, rec, offsetof(inplace_journal_record_t, hash));
+        inplace_write(f_jnl, inplace_record_offset(c), rec, sizeof(*rec), ctx->jnl_path);
+        inplace_sync(f_jnl, ctx->jnl_path);
+        inplace_write(f_nca, ofs, dec, size, nca->file_name);
+    }
+
+    for (unsigned int i = 0; i < 4; i++) {
+        if (aes_ctxs[i] != NULL) {
+            free_aes_ctx(aes_ctxs[i]);
+        }
+    }
+    if (fclose(f_nca) != 0) {
+        inplace_fail("Failed to write to %s!\n", nca->file_name);
+    }
+    fclose(f_jnl);
+    free(buf);
+    free(dec);
+    free(rec);
+}
+
+static void inplace_run_workers(inplace_ctx_t *ctx) {
+    uint32_t num_threads = ctx->num_chunks < ctx->num_jobs ? (uint32_t)ctx->num_chunks : ctx->num_jobs;
+    atomic_store(&ctx->next_chunk, 0);
+    atomic_store(&ctx->stop, 0);
+    run_workers(num_threads, inplace_worker, ctx, &ctx->stop);
+}
+
+/* Put back the original header of an interrupted run. Returns 1 if there was one to resume. */
+static int inplace_recover(nca_ctx_t *ctx, FILE *f_jnl, const char *jnl_path) {
+    inplace_journal_header_t hdr;
+    unsigned char hash[0x20];
+    int have_hdr = fread(&hdr, 1, sizeof(hdr), f_jnl) == sizeof(hdr);
+    sha256_hash_buffer(hash, &hdr, offsetof(inplace_journal_header_t, hash));
+    if (!have_hdr || hdr.magic != MAGIC_HJNL || memcmp(hash, hdr.hash, sizeof(hash))) {
+        /* The header is synced before the NCA is touched, so a torn one means nothing was changed. */
+        printf("Discarding incomplete journal %s.\n", jnl_path);
+        return 0;
+    }
+    if (hdr.version != INPLACE_JOURNAL_VERSION) {
+        inplace_fail("Journal %s was written by another version of hactool, which must finish the run!\n", jnl_path);
+    }
+    if (hdr.file_size != _fsize(ctx->file_name)) {
+        inplace_fail("Journal %s does not belong to this NCA!\n", jnl_path);
+    }
+
+    printf("Resuming interrupted decryption from %s...\n", jnl_path);
+    inplace_write(ctx->file, 0, hdr.header, sizeof(hdr.header), ctx->file_name);
+    inplace_sync(ctx->file, ctx->file_name);
+    return 1;
+}
+
+int nca_decrypt_in_place(nca_ctx_t *ctx) {
+    char jnl_path[MAX_PATH + 0x10];
+    snprintf(jnl_path, sizeof(jnl_path), "%s.journal", ctx->file_name);
+
+    int is_resuming = 0;
+    FILE *f_jnl = fopen(jnl_path, "rb");
+    if (f_jnl != NULL) {
+        is_resuming = inplace_recover(ctx, f_jnl, jnl_path);
+        fclose(f_jnl);
+    }
+
+    if (!nca_decrypt_header(ctx)) {
+        fprintf(stderr, "Invalid NCA header!\n");
+        fatal_exit();
+    }
+    if (ctx->is_decrypted) {
+        printf("%s is already decrypted.\n", ctx->file_name);
+        remove(jnl_path);
+        return 1;
+    }
+    if (ctx->header._0x340[0] != 0 || memcmp(ctx->header._0x340, ctx->header._0x340 + 1, sizeof(ctx->header._0x340) - 1)) {
+        fprintf(stderr, "NCA header padding is not empty, a plaintext header would not be recognized!\n");
+        fatal_exit();
+    }
+
+    nca_init_keys(ctx);
+
+    inplace_ctx_t ip_ctx;
+    memset(&ip_ctx, 0, sizeof(ip_ctx));
+    ip_ctx.nca = ctx;
+    ip_ctx.jnl_path = jnl_path;
+    ip_ctx.num_jobs = ctx->tool_ctx->settings.jobs ? ctx->tool_ctx->settings.jobs : HACTOOL_DEFAULT_JOBS;
+
+    /* Chunks are numbered in file order, so that a chunk's record always describes the same bytes. */
+    uint64_t file_size = _fsize(ctx->file_name);
+    for (unsigned int i = 0; i < 4; i++) {
+        if (!ctx->header.section_entries[i].media_start_offset) {
+            continue;
+        }
+        nca_init_section(ctx, i);
+        nca_section_ctx_t *section = &ctx->section_contexts[i];
+        if (section->header->crypt_type == CRYPT_BKTR) {
+            fprintf(stderr, "In-place decryption of BKTR sections is not supported!\n");
+            fatal_exit();
+        }
+        if (section->offset + section->size > file_size) {
+            fprintf(stderr, "Section %"PRId32" extends past the end of the NCA!\n", i);
+            fatal_exit();
+        }
+        if (section->is_decrypted) {
+            continue;
+        }
+        unsigned int j = ip_ctx.num_sections++;
+        for (; j > 0 && ctx->section_contexts[ip_ctx.order[j-1]].offset > section->offset; j--) {
+            ip_ctx.order[j] = ip_ctx.order[j-1];
+        }
+        ip_ctx.order[j] = i;
+    }
+    for (unsigned int n = 0; n < ip_ctx.num_sections; n++) {
+        ip_ctx.first_chunks[n] = ip_ctx.num_chunks;
+        ip_ctx.num_chunks += (ctx->section_contexts[ip_ctx.order[n]].size + INPLACE_CHUNK_SIZE - 1) / INPLACE_CHUNK_SIZE;
+    }
+    ip_ctx.first_chunks[ip_ctx.num_sections] = ip_ctx.num_chunks;
+
+    if (!is_resuming) {
+        inplace_journal_header_t hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.magic = MAGIC_HJNL;
+        hdr.version = INPLACE_JOURNAL_VERSION;
+        hdr.file_size = file_size;
+        fseeko64(ctx->file, 0, SEEK_SET);
+        if (fread(hdr.header, 1, sizeof(hdr.header), ctx->file) != sizeof(hdr.header)) {
+            fprintf(stderr, "Failed to read NCA header!\n");
+            fatal_exit();
+        }
+        sha256_hash_buffer(hdr.hash, &hdr, offsetof(inplace_journal_header_t, hash));
+        if ((f_jnl = fopen(jnl_path, "wb")) == NULL) {
+            inplace_fail("Failed to create journal %s!\n", jnl_path);
+        }
+        inplace_write(f_jnl, 0, &hdr, sizeof(hdr), jnl_path);
+        inplace_sync(f_jnl, jnl_path);
+        fclose(f_jnl);
+    }
+
+    printf("Decrypting %u section(s) in place...\n", ip_ctx.num_sections);
+    inplace_run_workers(&ip_ctx);
+    inplace_sync(ctx->file, ctx->file_name);
+
+    /* Last of all, the header goes in as plaintext, which marks the whole NCA as decrypted. */
+    inplace_write(ctx->file, 0, &ctx->header, 0xC00, ctx->file_name);
+    inplace_sync(ctx->file, ctx->file_name);
+
+    if (remove(jnl_path) != 0) {
+        fprintf(stderr, "Failed to remove journal %s!\n", jnl_path);
+    }
+    if (atomic_load(&ip_ctx.num_recovered)) {
+        printf("Recovered %"PRIu64" chunk(s) of the interrupted run.\n", (uint64_t)atomic_load(&ip_ctx.num_recovered));
+    }
+    printf("Decrypted %s in place.\n", ctx->file_name);
+    return 1;
+}
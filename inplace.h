@@ -0,0 +1,54 @@
+#ifndef HACTOOL_INPLACE_H
+#define HACTOOL_INPLACE_H
+
+#include <stdatomic.h>
+#include "types.h"
+#include "nca.h"
+
+#define MAGIC_HJNL 0x4C4E4A48 /* "HJNL" */
+#define INPLACE_JOURNAL_VERSION 2
+#define INPLACE_CHUNK_SIZE 0x400000 /* Decrypted by a worker at a time. */
+#define INPLACE_PAGE_SIZE 0x1000 /* Writes are taken to land whole or not at all at this size. */
+#define INPLACE_CHUNK_PAGES (INPLACE_CHUNK_SIZE / INPLACE_PAGE_SIZE)
+#define INPLACE_DIGEST_SIZE 8
+
+/* Written once, before anything in the NCA is touched. */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t file_size;
+    uint8_t header[0xC00]; /* Original (encrypted) NCA header. */
+    uint8_t hash[0x20]; /* SHA-256 over the fields above. */
+} inplace_journal_header_t;
+
+/* Truncated SHA-256 of a page before and after decryption, to tell which of the two it holds. */
+typedef struct {
+    uint8_t encrypted[INPLACE_DIGEST_SIZE];
+    uint8_t decrypted[INPLACE_DIGEST_SIZE];
+} inplace_page_digest_t;
+
+/* One per chunk, at a fixed place after the header, synced before the chunk is written. */
+typedef struct {
+    uint64_t chunk;
+    uint64_t offset;
+    uint64_t size;
+    inplace_page_digest_t pages[INPLACE_CHUNK_PAGES];
+    uint8_t hash[0x20]; /* SHA-256 over the fields above. */
+} inplace_journal_record_t;
+
+typedef struct {
+    nca_ctx_t *nca;
+    const char *jnl_path;
+    unsigned int order[4]; /* Sections to decrypt, in file order. */
+    uint64_t first_chunks[5]; /* Chunks are numbered across sections. */
+    unsigned int num_sections;
+    uint32_t num_jobs;
+    atomic_uint_fast64_t next_chunk;
+    atomic_int stop; /* Set when a worker fails. */
+    uint64_t num_chunks;
+    atomic_uint_fast64_t num_recovered; /* Chunks an interrupted run had started on. */
+} inplace_ctx_t;
+
+int nca_decrypt_in_place(nca_ctx_t *ctx);
+
+#endif
@@ -9,6 +9,22 @@
 #include "pki.h"
 #include "nca.h"
 #include "xci.h"
+#include "tar.h"
+#include "manifest.h"
+#include "corruption.h"
+#include "vcache.h"
+#include "catalog.h"
+#include "serve.h"
+#include "watch.h"
+#include "shard.h"
+#include "stats.h"
+#include "trace.h"
+#include "inplace.h"
+#include "nsp.h"
+#include "splitfile.h"
+#include "romfsbuild.h"
+#include "ncapack.h"
+#include "pfs0pack.h"
 
 static char *prog_name = "hactool";
 
@@ -26,12 +42,47 @@ static void usage(void) {
         "                      This is also the default action.\n"
         "  -r, --raw          Keep raw data, don't unpack.\n"
         "  -y, --verify       Verify hashes and signatures.\n"
+        "  --verify-tier=tier Verification depth [full, quick, sampled]. Implies --verify.\n"
+        "  --sample-percent=n Share of data blocks hashed by sampled verification. Default 10.\n"
+        "  --sample-seed=n    Seed selecting the sampled blocks, for reproducible results.\n"
+        "  --corruption-map=file Scan every hash block and write failing ranges and affected files. Implies --verify.\n"
+        "  --verify-cache=file Reuse full verification results of unchanged NCAs, and record new ones.\n"
+        "  --refresh-cache    Re-verify everything, replacing the results in the verification cache.\n"
+        "  --jobs=n           Threads for the NCAs of an XCI or NSP, corruption scans, catalog reads, --serve requests and --decrypt-in-place. Default 4.\n"
         "  -d, --dev          Decrypt with development keys instead of retail.\n"
-        "  -t, --intype=type  Specify input file type [nca, xci, pfs0, romfs, hfs0]\n"
+        "  --test-keys        Decrypt with the test keys of synthetic content from hactool-gen.\n"
+        "  -t, --intype=type  Specify input file type [nca, xci, nsp, pfs0, romfs, hfs0]\n"
         "  --titlekey=key     Set title key for Rights ID crypto titles.\n"
         "  --contentkey=key   Set raw key for NCA body decryption.\n"
+        "  --romfs-tar=file   Stream extracted RomFS files into a tar archive. Use - for stdout.\n"
+        "  --pfs0-tar=file    Stream extracted PFS0/ExeFS files into a tar archive. Use - for stdout.\n"
+        "  --hfs0-tar=file    Stream extracted HFS0/XCI files into a tar archive. Use - for stdout.\n"
+        "  --manifest=file    Write SHA-256, size and path of every extracted file to a manifest.\n"
+        "  --catalog=dir      Index the NCA headers under dir into the catalog given as <file>, skipping unchanged files.\n"
+        "  --serve=socket     Answer info, list, read and extract requests on a Unix socket, keeping inputs open. No <file>.\n"
+        "  --watch=dir        Process each file that lands in dir with the other options, logging results to <file>.\n"
+        "  --watch-jobs=n     Worker processes for --watch. Default 2.\n"
+        "  --watch-catalog=file Also keep a catalog of dir up to date, as with --catalog.\n"
+        "  --shard=i/n        With --catalog or --watch, only handle the files of shard i of n, split by path.\n"
+        "  --merge=file       Combine the catalogs or watch logs of every shard, given as <file>s, into file.\n"
+        "  --stats            Print time spent reading, decrypting, hashing and writing, and peak memory, to stderr.\n"
+        "  --trace=file       Write a Chrome trace-event file of where time went, for Perfetto or chrome://tracing.\n"
+        "  --build-romfs=dir  Build a RomFS of dir into <file>, followed by its IVFC hash levels.\n"
+        "  --build-jobs=n     Threads for --build-romfs and --pack-*. Default 4.\n"
+        "  --build-cache=file Reuse hashes of files unchanged since the build recorded in file, and record this one.\n"
+        "  --ivfc-header=file Write the IVFC header of the image built by --build-romfs to file.\n"
+        "  --pack-exefs=dir   Pack the files in dir into the ExeFS of a new NCA at <file>.\n"
+        "  --pack-romfs=file  Pack a RomFS image into a new NCA at <file>, after the ExeFS if any.\n"
+        "  --pack-title-id=id Title ID of the packed NCA, in hex. Default 0.\n"
+        "  --pack-keygen=n    Master key revision to encrypt the key area of the packed NCA with. Default 0.\n"
+        "  --pack-type=type   Content type of the packed NCA [program, meta, control, manual, data]. Default program with an ExeFS, else data.\n"
+        "  --pack-sign-key=file Sign the packed NCA's header with the 0x100-byte private exponent in file. Unsigned by default.\n"
+        "  --pack-pfs0=file   Write the <file>s into a PFS0, such as an NSP of NCAs and tickets, at file.\n", __TIME__, __DATE__, prog_name);
+    /* Split up, to stay within the string length compilers must support. */
+    fprintf(stderr,
         "NCA options:\n"
         "  --plaintext=file   Specify file path for saving a decrypted copy of the NCA.\n"
+        "  --decrypt-in-place Decrypt the NCA into the input file itself, resuming if interrupted.\n"
         "  --header=file      Specify Header file path.\n"
         "  --section0=file    Specify Section 0 file path.\n"
         "  --section1=file    Specify Section 1 file path.\n"
@@ -47,7 +98,8 @@ static void usage(void) {
         "  --romfsdir=dir     Specify RomFS directory path. Overrides appropriate section directory path.\n"
         "  --listromfs        List files in RomFS.\n"
         "  --baseromfs        Set Base RomFS to use with update partitions.\n"
-        "  --basenca          Set Base NCA to use with update partitions.\n" 
+        "  --basenca          Set Base NCA to use with update partitions.\n");
+    fprintf(stderr,
         "PFS0 options:\n"
         "  --pfs0dir=dir      Specify PFS0 directory path.\n"
         "  --outdir=dir       Specify PFS0 directory path. Overrides previous path, if present.\n"
@@ -65,8 +117,11 @@ static void usage(void) {
         "  --updatedir=dir    Specify XCI update HFS0 directory path.\n"
         "  --normaldir=dir    Specify XCI normal HFS0 directory path.\n"
         "  --securedir=dir    Specify XCI secure HFS0 directory path.\n"
+        "  --ncadir=dir       Process secure partition NCAs directly, extracting their sections to dir/<name>/.\n"
         "  --outdir=dir       Specify XCI directory path. Overrides previous paths, if present.\n"
-        "\n", __TIME__, __DATE__, prog_name);
+        "NSP options:\n"
+        "  --ncadir=dir       Extract the sections of each content NCA to dir/<name>/.\n"
+        "\n");
     exit(EXIT_FAILURE);
 }
 
@@ -84,6 +139,18 @@ static char hextoi(char c) {
     return 0;
 }
 
+/* Prints --stats and writes --trace once a run is over. Returns 0 if the trace couldn't be written. */
+static int finish_run(hactool_ctx_t *tool_ctx, uint64_t start_ns) {
+    if (tool_ctx->settings.print_stats) {
+        /* On stderr, as stdout may be carrying a tar archive. */
+        stats_print(stderr, stats_now_ns() - start_ns);
+    }
+    if (tool_ctx->settings.trace_path.valid == VALIDITY_VALID && !trace_write(tool_ctx->settings.trace_path.char_path)) {
+        return 0;
+    }
+    return 1;
+}
+
 void parse_hex_key(unsigned char *key, const char *hex) {
     if (strlen(hex) != 32) {
         fprintf(stderr, "Key must be 32 hex digits!\n");
@@ -127,6 +194,7 @@ int main(int argc, char **argv) {
 
     nca_ctx.tool_ctx->action = ACTION_INFO | ACTION_EXTRACT;
     pki_initialize_keyset(&tool_ctx.settings.keyset, KEYSET_RETAIL);
+    tool_ctx.settings.sample_percent = 10;
 
     while (1) {
         int option_index;
@@ -165,6 +233,40 @@ int main(int argc, char **argv) {
             {"updatedir", 1, NULL, 23},
             {"normaldir", 1, NULL, 24},
             {"securedir", 1, NULL, 25},
+            {"romfs-tar", 1, NULL, 26},
+            {"pfs0-tar", 1, NULL, 27},
+            {"hfs0-tar", 1, NULL, 28},
+            {"manifest", 1, NULL, 29},
+            {"decrypt-in-place", 0, NULL, 30},
+            {"ncadir", 1, NULL, 31},
+            {"verify-tier", 1, NULL, 32},
+            {"sample-percent", 1, NULL, 33},
+            {"sample-seed", 1, NULL, 34},
+            {"corruption-map", 1, NULL, 35},
+            {"verify-cache", 1, NULL, 36},
+            {"refresh-cache", 0, NULL, 37},
+            {"catalog", 1, NULL, 38},
+            {"serve", 1, NULL, 39},
+            {"watch", 1, NULL, 40},
+            {"watch-jobs", 1, NULL, 41},
+            {"watch-catalog", 1, NULL, 42},
+            {"shard", 1, NULL, 43},
+            {"merge", 1, NULL, 44},
+            {"stats", 0, NULL, 45},
+            {"trace", 1, NULL, 46},
+            {"test-keys", 0, NULL, 47},
+            {"build-romfs", 1, NULL, 48},
+            {"build-jobs", 1, NULL, 49},
+            {"build-cache", 1, NULL, 50},
+            {"ivfc-header", 1, NULL, 51},
+            {"pack-exefs", 1, NULL, 52},
+            {"pack-romfs", 1, NULL, 53},
+            {"pack-title-id", 1, NULL, 54},
+            {"pack-keygen", 1, NULL, 55},
+            {"pack-type", 1, NULL, 56},
+            {"pack-sign-key", 1, NULL, 57},
+            {"pack-pfs0", 1, NULL, 58},
+            {"jobs", 1, NULL, 59},
             {NULL, 0, NULL, 0},
         };
 
@@ -188,6 +290,7 @@ int main(int argc, char **argv) {
                 break;
             case 'd':
                 pki_initialize_keyset(&tool_ctx.settings.keyset, KEYSET_DEV);
+                tool_ctx.settings.use_dev_keys = 1;
                 break;
             case 't':
                 if (!strcmp(optarg, "nca")) {
@@ -200,6 +303,8 @@ int main(int argc, char **argv) {
                     nca_ctx.tool_ctx->file_type = FILETYPE_HFS0;
                 } else if (!strcmp(optarg, "xci") || !strcmp(optarg, "gamecard") || !strcmp(optarg, "gc")) {
                     nca_ctx.tool_ctx->file_type = FILETYPE_XCI;
+                } else if (!strcmp(optarg, "nsp")) {
+                    nca_ctx.tool_ctx->file_type = FILETYPE_NSP;
                 }
                 /* } else if (!strcmp(optarg, "package2") || !strcmp(optarg, "pk21")) {
                  *    nca_ctx.tool_ctx->file_type = FILETYPE_PACKAGE2;
@@ -303,12 +408,189 @@ int main(int argc, char **argv) {
             case 25:
                 filepath_set(&tool_ctx.settings.secure_dir_path, optarg); 
                 break;
+            case 26:
+                filepath_set(&tool_ctx.settings.romfs_tar_path, optarg); 
+                break;
+            case 27:
+                filepath_set(&tool_ctx.settings.pfs0_tar_path, optarg); 
+                break;
+            case 28:
+                filepath_set(&tool_ctx.settings.hfs0_tar_path, optarg); 
+                break;
+            case 29:
+                filepath_set(&tool_ctx.settings.manifest_path, optarg); 
+                break;
+            case 30:
+                nca_ctx.tool_ctx->action |= ACTION_DECRYPT_IN_PLACE;
+                break;
+            case 31:
+                filepath_set(&tool_ctx.settings.nca_dir_path, optarg); 
+                break;
+            case 32:
+                if (!strcmp(optarg, "full")) {
+                    tool_ctx.settings.verify_tier = VERIFY_TIER_FULL;
+                } else if (!strcmp(optarg, "quick")) {
+                    tool_ctx.settings.verify_tier = VERIFY_TIER_QUICK;
+                } else if (!strcmp(optarg, "sampled")) {
+                    tool_ctx.settings.verify_tier = VERIFY_TIER_SAMPLED;
+                } else {
+                    fprintf(stderr, "Unknown verification tier: %s\n", optarg);
+                    usage();
+                }
+                nca_ctx.tool_ctx->action |= ACTION_VERIFY;
+                break;
+            case 33:
+                tool_ctx.settings.sample_percent = strtoul(optarg, NULL, 10);
+                if (tool_ctx.settings.sample_percent == 0 || tool_ctx.settings.sample_percent > 100) {
+                    fprintf(stderr, "Sample percentage must be between 1 and 100!\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 34:
+                tool_ctx.settings.sample_seed = strtoull(optarg, NULL, 0);
+                break;
+            case 35:
+                filepath_set(&tool_ctx.settings.corruption_map_path, optarg);
+                nca_ctx.tool_ctx->action |= ACTION_VERIFY;
+                break;
+            case 36:
+                filepath_set(&tool_ctx.settings.verify_cache_path, optarg);
+                break;
+            case 37:
+                tool_ctx.settings.refresh_verify_cache = 1;
+                break;
+            case 38:
+                filepath_set(&tool_ctx.settings.catalog_dir_path, optarg);
+                break;
+            case 39:
+                filepath_set(&tool_ctx.settings.serve_path, optarg);
+                break;
+            case 40:
+                filepath_set(&tool_ctx.settings.watch_dir_path, optarg);
+                break;
+            case 41:
+                tool_ctx.settings.watch_jobs = strtoul(optarg, NULL, 10);
+                if (tool_ctx.settings.watch_jobs == 0 || tool_ctx.settings.watch_jobs > WATCH_MAX_JOBS) {
+                    fprintf(stderr, "Watch jobs must be between 1 and %d!\n", WATCH_MAX_JOBS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 42:
+                filepath_set(&tool_ctx.settings.watch_catalog_path, optarg);
+                break;
+            case 43:
+                if (!shard_parse(&tool_ctx.settings.shard_index, &tool_ctx.settings.shard_count, optarg)) {
+                    fprintf(stderr, "Shard must be given as i/n, with i between 1 and n!\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 44:
+                filepath_set(&tool_ctx.settings.merge_path, optarg);
+                break;
+            case 45:
+                tool_ctx.settings.print_stats = 1;
+                break;
+            case 46:
+                filepath_set(&tool_ctx.settings.trace_path, optarg);
+                break;
+            case 47:
+                pki_initialize_keyset(&tool_ctx.settings.keyset, KEYSET_TEST);
+                tool_ctx.settings.use_test_keys = 1;
+                break;
+            case 48:
+                filepath_set(&tool_ctx.settings.build_romfs_dir_path, optarg);
+                break;
+            case 49:
+                tool_ctx.settings.build_jobs = strtoul(optarg, NULL, 10);
+                if (tool_ctx.settings.build_jobs == 0 || tool_ctx.settings.build_jobs > ROMFS_BUILD_MAX_JOBS) {
+                    fprintf(stderr, "Build jobs must be between 1 and %d!\n", ROMFS_BUILD_MAX_JOBS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 50:
+                filepath_set(&tool_ctx.settings.build_cache_path, optarg);
+                break;
+            case 51:
+                filepath_set(&tool_ctx.settings.ivfc_header_path, optarg);
+                break;
+            case 52:
+                filepath_set(&tool_ctx.settings.pack_exefs_dir_path, optarg);
+                break;
+            case 53:
+                filepath_set(&tool_ctx.settings.pack_romfs_path, optarg);
+                break;
+            case 54:
+                tool_ctx.settings.pack_title_id = strtoull(optarg, NULL, 16);
+                break;
+            case 55:
+                tool_ctx.settings.pack_key_generation = strtoul(optarg, NULL, 0);
+                if (tool_ctx.settings.pack_key_generation >= 0x20) {
+                    fprintf(stderr, "Master key revision must be below 0x20!\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 56:
+                tool_ctx.settings.has_pack_content_type = 1;
+                if (!strcmp(optarg, "program")) {
+                    tool_ctx.settings.pack_content_type = 0;
+                } else if (!strcmp(optarg, "meta")) {
+                    tool_ctx.settings.pack_content_type = 1;
+                } else if (!strcmp(optarg, "control")) {
+                    tool_ctx.settings.pack_content_type = 2;
+                } else if (!strcmp(optarg, "manual")) {
+                    tool_ctx.settings.pack_content_type = 3;
+                } else if (!strcmp(optarg, "data")) {
+                    tool_ctx.settings.pack_content_type = 4;
+                } else {
+                    fprintf(stderr, "Unknown content type %s!\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 57:
+                filepath_set(&tool_ctx.settings.pack_sign_key_path, optarg);
+                break;
+            case 58:
+                filepath_set(&tool_ctx.settings.pack_pfs0_path, optarg);
+                break;
+            case 59:
+                tool_ctx.settings.jobs = strtoul(optarg, NULL, 10);
+                if (tool_ctx.settings.jobs == 0 || tool_ctx.settings.jobs > HACTOOL_MAX_JOBS) {
+                    fprintf(stderr, "Jobs must be between 1 and %d!\n", HACTOOL_MAX_JOBS);
+                    return EXIT_FAILURE;
+                }
+                break;
             default:
                 usage();
                 return EXIT_FAILURE;
         }
     }
 
+    uint64_t start_ns = stats_now_ns();
+    stats_enable(tool_ctx.settings.print_stats);
+    if (tool_ctx.settings.trace_path.valid == VALIDITY_VALID) {
+        trace_enable();
+    }
+
+    if (tool_ctx.settings.merge_path.valid == VALIDITY_VALID) {
+        /* Every input file is the partial result of a shard. */
+        if (optind == argc) {
+            usage();
+        }
+        return shard_merge(&tool_ctx, tool_ctx.settings.merge_path.char_path, argv + optind, (unsigned int)(argc - optind)) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (tool_ctx.settings.pack_pfs0_path.valid == VALIDITY_VALID) {
+        /* Every input file becomes a file of the PFS0. */
+        if (optind == argc) {
+            usage();
+        }
+        int result = pfs0_pack(&tool_ctx, tool_ctx.settings.pack_pfs0_path.char_path, argv + optind, (uint32_t)(argc - optind));
+        if (!finish_run(&tool_ctx, start_ns)) {
+            return EXIT_FAILURE;
+        }
+        return result ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     if (optind == argc - 1) {
         /* Copy input file. */
         strncpy(input_name, argv[optind], sizeof(input_name));
@@ -316,13 +598,123 @@ int main(int argc, char **argv) {
         usage();
     }
 
-    if ((tool_ctx.file = fopen(input_name, "rb")) == NULL) {
+    if (tool_ctx.settings.serve_path.valid == VALIDITY_VALID) {
+        /* Requests name their own inputs. */
+        return serve_run(&tool_ctx, tool_ctx.settings.serve_path.char_path) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (tool_ctx.settings.catalog_dir_path.valid == VALIDITY_VALID) {
+        /* The input file is the catalog itself. */
+        return catalog_update(&tool_ctx, tool_ctx.settings.catalog_dir_path.char_path, input_name) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (tool_ctx.settings.build_romfs_dir_path.valid == VALIDITY_VALID) {
+        /* The input file is the image to build. */
+        int result = romfs_build(&tool_ctx, tool_ctx.settings.build_romfs_dir_path.char_path, input_name);
+        if (!finish_run(&tool_ctx, start_ns)) {
+            return EXIT_FAILURE;
+        }
+        return result ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (tool_ctx.settings.pack_exefs_dir_path.valid == VALIDITY_VALID || tool_ctx.settings.pack_romfs_path.valid == VALIDITY_VALID) {
+        /* The input file is the NCA to pack. */
+        int result = nca_pack(&tool_ctx, input_name);
+        if (!finish_run(&tool_ctx, start_ns)) {
+            return EXIT_FAILURE;
+        }
+        return result ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    hactool_results_t results;
+    memset(&results, 0, sizeof(results));
+    if (tool_ctx.settings.watch_dir_path.valid == VALIDITY_VALID) {
+        /* The input file is the log. Only workers return, each with a new file to process. */
+        int result = watch_run(&tool_ctx, tool_ctx.settings.watch_dir_path.char_path, input_name, sizeof(input_name));
+        if (result <= 0) {
+            return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        /* Workers report how the file went through their exit status. */
+        tool_ctx.results = &results;
+    }
+
+    if (tool_ctx.action & ACTION_DECRYPT_IN_PLACE) {
+        if (split_is_split_input(input_name)) {
+            fprintf(stderr, "--decrypt-in-place does not support split input files!\n");
+            return EXIT_FAILURE;
+        }
+        tool_ctx.file = fopen(input_name, "rb+");
+    } else {
+        /* Split dumps (.xc0/.xc1, 00/01, ...) are read as one file. */
+        tool_ctx.file = split_fopen(input_name);
+    }
+    if (tool_ctx.file == NULL) {
         fprintf(stderr, "unable to open %s: %s\n", input_name, strerror(errno));
         return EXIT_FAILURE;
     }
+
+    if ((tool_ctx.action & ACTION_DECRYPT_IN_PLACE) && tool_ctx.file_type != FILETYPE_NCA) {
+        fprintf(stderr, "--decrypt-in-place is only supported for NCAs!\n");
+        return EXIT_FAILURE;
+    }
+
+    manifest_ctx_t manifest;
+    if (tool_ctx.settings.manifest_path.valid == VALIDITY_VALID) {
+        if (!manifest_open(&manifest, tool_ctx.settings.manifest_path.char_path)) {
+            return EXIT_FAILURE;
+        }
+        tool_ctx.manifest = &manifest;
+    }
+
+    corruption_ctx_t corruption;
+    if (tool_ctx.settings.corruption_map_path.valid == VALIDITY_VALID) {
+        if (!corruption_open(&corruption, tool_ctx.settings.corruption_map_path.char_path)) {
+            return EXIT_FAILURE;
+        }
+        tool_ctx.corruption = &corruption;
+    }
+
+    vcache_ctx_t vcache;
+    if (tool_ctx.settings.verify_cache_path.valid == VALIDITY_VALID) {
+        if (!vcache_open(&vcache, tool_ctx.settings.verify_cache_path.char_path, tool_ctx.settings.refresh_verify_cache)) {
+            return EXIT_FAILURE;
+        }
+        tool_ctx.vcache = &vcache;
+    }
+
+    /* Open archive outputs. Types given the same path share one archive. */
+    tar_ctx_t tars[3];
+    filepath_t *tar_paths[3] = {&tool_ctx.settings.romfs_tar_path, &tool_ctx.settings.pfs0_tar_path, &tool_ctx.settings.hfs0_tar_path};
+    tar_ctx_t **tar_ctxs[3] = {&tool_ctx.romfs_tar, &tool_ctx.pfs0_tar, &tool_ctx.hfs0_tar};
+    for (unsigned int i = 0; i < 3; i++) {
+        if (tar_paths[i]->valid != VALIDITY_VALID) {
+            continue;
+        }
+        for (unsigned int j = 0; j < i; j++) {
+            if (*tar_ctxs[j] != NULL && !strcmp(tar_paths[i]->char_path, tar_paths[j]->char_path)) {
+                *tar_ctxs[i] = *tar_ctxs[j];
+                break;
+            }
+        }
+        if (*tar_ctxs[i] == NULL) {
+            if (!tar_open(&tars[i], tar_paths[i]->char_path)) {
+                return EXIT_FAILURE;
+            }
+            *tar_ctxs[i] = &tars[i];
+        }
+    }
     
+    trace_span_t span;
+    trace_begin(&span);
     switch (tool_ctx.file_type) {
         case FILETYPE_NCA: {
+            if (nca_ctx.tool_ctx->action & ACTION_DECRYPT_IN_PLACE) {
+                nca_ctx.file = tool_ctx.file;
+                nca_ctx.file_name = input_name;
+                nca_decrypt_in_place(&nca_ctx);
+                nca_free_section_contexts(&nca_ctx);
+                break;
+            }
             if (nca_ctx.tool_ctx->base_nca_ctx != NULL) {
                 memcpy(&base_ctx.settings.keyset, &tool_ctx.settings.keyset, sizeof(nca_keyset_t));
                 nca_ctx.tool_ctx->base_nca_ctx->tool_ctx = &base_ctx;
@@ -341,6 +733,8 @@ int main(int argc, char **argv) {
             }
 
             nca_ctx.file = tool_ctx.file;
+            nca_ctx.file_name = input_name;
+            nca_ctx.file_path = input_name;
             nca_process(&nca_ctx);
             nca_free_section_contexts(&nca_ctx);
             
@@ -396,20 +790,57 @@ int main(int argc, char **argv) {
             xci_ctx_t xci_ctx;
             memset(&xci_ctx, 0, sizeof(xci_ctx));
             xci_ctx.file = tool_ctx.file;
+            xci_ctx.file_name = input_name;
             xci_ctx.tool_ctx = &tool_ctx;
             xci_process(&xci_ctx);
             break;
         }
+        case FILETYPE_NSP: {
+            nsp_ctx_t nsp_ctx;
+            memset(&nsp_ctx, 0, sizeof(nsp_ctx));
+            nsp_ctx.file = tool_ctx.file;
+            nsp_ctx.file_name = input_name;
+            nsp_ctx.tool_ctx = &tool_ctx;
+            nsp_process(&nsp_ctx);
+            nsp_free(&nsp_ctx);
+            break;
+        }
         default: {
             fprintf(stderr, "Unknown File Type!\n\n");
             usage();
         }
     }
+    trace_end(&span, "process input", TRACE_NO_SECTION, "%s", input_name);
     
     if (tool_ctx.file != NULL) {
         fclose(tool_ctx.file);
     }
+    for (unsigned int i = 0; i < 3; i++) {
+        if (*tar_ctxs[i] == &tars[i]) {
+            tar_close(&tars[i]);
+        }
+    }
+    if (tool_ctx.manifest != NULL) {
+        manifest_close(tool_ctx.manifest);
+    }
+    if (tool_ctx.corruption != NULL) {
+        corruption_close(tool_ctx.corruption);
+    }
+    if (tool_ctx.vcache != NULL) {
+        vcache_close(tool_ctx.vcache);
+    }
+    if (!finish_run(&tool_ctx, start_ns)) {
+        return EXIT_FAILURE;
+    }
     printf("Done!\n");
 
+    if (tool_ctx.results != NULL) {
+        if (atomic_load(&results.num_errors)) {
+            return EXIT_FAILURE;
+        }
+        if (atomic_load(&results.num_failed_checks)) {
+            return WATCH_EXIT_FAILED_CHECK;
+        }
+    }
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "manifest.h"
+#include "utils.h"
+
+/* Open a manifest for writing. Entries are "<sha256> <size> <path>", one per line. */
+int manifest_open(manifest_ctx_t *ctx, const char *path) {
+    memset(ctx, 0, sizeof(*ctx));
+    if ((ctx->file = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", path);
+        return 0;
+    }
+    if ((ctx->path = strdup(path)) == NULL) {
+        fprintf(stderr, "Failed to allocate manifest path!\n");
+        fatal_exit();
+    }
+    pthread_mutex_init(&ctx->lock, NULL);
+    return 1;
+}
+
+void manifest_close(manifest_ctx_t *ctx) {
+    if (ctx->file == NULL) {
+        return;
+    }
+    if (fclose(ctx->file) != 0) {
+        fprintf(stderr, "Failed to finish %s!\n", ctx->path);
+        fatal_exit();
+    }
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx->path);
+    ctx->file = NULL;
+}
+
+void manifest_add(manifest_ctx_t *ctx, const char *path, uint64_t size, const unsigned char *hash) {
+    if (ctx == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&ctx->lock);
+    for (unsigned int i = 0; i < 0x20; i++) {
+        fprintf(ctx->file, "%02x", hash[i]);
+    }
+    /* Always record forward slashes, so manifests compare across platforms. */
+    fprintf(ctx->file, " %"PRIu64" ", size);
+    for (const char *p = path; *p; p++) {
+        fputc(*p == '\\' ? '/' : *p, ctx->file);
+    }
+    fputc('\n', ctx->file);
+    ctx->num_entries++;
+    pthread_mutex_unlock(&ctx->lock);
+}
@@ -0,0 +1,20 @@
+#ifndef HACTOOL_MANIFEST_H
+#define HACTOOL_MANIFEST_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "types.h"
+
+typedef struct manifest_ctx {
+    FILE *file;
+    char *path;
+    uint64_t num_entries;
+    pthread_mutex_t lock; /* Files may be added by several NCA workers at once. */
+} manifest_ctx_t;
+
+int manifest_open(manifest_ctx_t *ctx, const char *path);
+void manifest_close(manifest_ctx_t *ctx);
+
+void manifest_add(manifest_ctx_t *ctx, const char *path, uint64_t size, const unsigned char *hash);
+
+#endif
@@ -1,16 +1,75 @@
 #include <stdlib.h>
+#include <stdarg.h>
 #include "nca.h"
 #include "aes.h"
 #include "sha.h"
 #include "rsa.h"
 #include "utils.h"
 #include "filepath.h"
+#include "tar.h"
+#include "manifest.h"
+#include "fanout.h"
+#include "corruption.h"
+#include "vcache.h"
+#include "stats.h"
+#include "trace.h"
+#include "splitfile.h"
 
 /* Initialize the context. */
 void nca_init(nca_ctx_t *ctx) {
     memset(ctx, 0, sizeof(*ctx));
 }
 
+/* Set up an NCA stored as a byte range of a container file. It gets its own tool context,
+ * sharing keys with the parent, and extracts its sections to <ncadir>/<name>/sectionN. */
+void nca_init_nested(nca_ctx_t *ctx, hactool_ctx_t *tool_ctx, hactool_ctx_t *parent, FILE *file, uint64_t offset, uint64_t size, const char *name) {
+    memset(tool_ctx, 0, sizeof(*tool_ctx));
+    tool_ctx->file_type = FILETYPE_NCA;
+    tool_ctx->file = file;
+    tool_ctx->action = parent->action;
+    tool_ctx->manifest = parent->manifest;
+    tool_ctx->corruption = parent->corruption;
+    tool_ctx->vcache = parent->vcache;
+    tool_ctx->results = parent->results;
+    tool_ctx->titlekeys = parent->titlekeys;
+    tool_ctx->num_titlekeys = parent->num_titlekeys;
+    tool_ctx->romfs_tar = parent->romfs_tar;
+    tool_ctx->pfs0_tar = parent->pfs0_tar;
+    memcpy(&tool_ctx->settings.keyset, &parent->settings.keyset, sizeof(nca_keyset_t));
+    tool_ctx->settings.has_titlekey = parent->settings.has_titlekey;
+    memcpy(tool_ctx->settings.titlekey, parent->settings.titlekey, 0x10);
+    tool_ctx->settings.verify_tier = parent->settings.verify_tier;
+    tool_ctx->settings.sample_percent = parent->settings.sample_percent;
+    tool_ctx->settings.sample_seed = parent->settings.sample_seed;
+    tool_ctx->settings.jobs = parent->settings.jobs;
+
+    filepath_t *dirpath = &parent->settings.nca_dir_path;
+    if (dirpath->valid == VALIDITY_VALID) {
+        size_t name_len = strlen(name);
+        if (name_len >= 4 && !strcmp(name + name_len - 4, ".nca")) {
+            name_len -= 4;
+        }
+        filepath_t nca_dirpath;
+        filepath_copy(&nca_dirpath, dirpath);
+        filepath_append(&nca_dirpath, "%.*s", (int)name_len, name);
+        if (tool_ctx->action & ACTION_EXTRACT) {
+            os_makedir(dirpath->os_path);
+            os_makedir(nca_dirpath.os_path);
+        }
+        for (unsigned int i = 0; i < 4; i++) {
+            filepath_copy(&tool_ctx->settings.section_dir_paths[i], &nca_dirpath);
+            filepath_append(&tool_ctx->settings.section_dir_paths[i], "section%"PRId32, i);
+        }
+    }
+
+    nca_init(ctx);
+    ctx->file = file;
+    ctx->file_offset = offset;
+    ctx->file_size = size;
+    ctx->file_name = name;
+    ctx->tool_ctx = tool_ctx;
+}
+
 /* Updates the CTR for an offset. */
 void nca_update_ctr(unsigned char *ctr, uint64_t ofs) {
     ofs >>= 4;
@@ -36,10 +95,10 @@ void nca_update_bktr_ctr(unsigned char *ctr, uint32_t ctr_val, uint64_t ofs) {
 /* Seek to an offset within a section. */
 void nca_section_fseek(nca_section_ctx_t *ctx, uint64_t offset) {
     if (ctx->is_decrypted) {
-        fseeko64(ctx->file, (ctx->offset + offset), SEEK_SET);
+        fseeko64(ctx->file, ctx->file_offset + (ctx->offset + offset), SEEK_SET);
         ctx->cur_seek = (ctx->offset + offset);
     } else if (ctx->header->crypt_type == CRYPT_XTS) {
-        fseeko64(ctx->file, (ctx->offset + offset) & ~0x1FF, SEEK_SET);
+        fseeko64(ctx->file, ctx->file_offset + ((ctx->offset + offset) & ~0x1FF), SEEK_SET);
         ctx->cur_seek = (ctx->offset + offset) & ~0x1FF;
         ctx->sector_num = offset / 0x200;
         ctx->sector_ofs = offset & 0x1FF;
@@ -60,20 +119,22 @@ void nca_section_fseek(nca_section_ctx_t *ctx, uint64_t offset) {
             }
         }
     } else if (ctx->header->crypt_type != CRYPT_NONE) { /* CTR, and BKTR until subsections are read. */
-        fseeko64(ctx->file, (ctx->offset + offset) & ~0xF, SEEK_SET);
+        fseeko64(ctx->file, ctx->file_offset + ((ctx->offset + offset) & ~0xF), SEEK_SET);
         ctx->cur_seek = (ctx->offset + offset) & ~0xF;
         nca_update_ctr(ctx->ctr, ctx->offset + offset);
         ctx->sector_ofs = offset & 0xF;
     }
 }
 
+static size_t nca_section_read(nca_section_ctx_t *ctx, void *buffer, size_t count);
+
 size_t nca_bktr_section_physical_fread(nca_section_ctx_t *ctx, void *buffer, size_t count) {
     size_t read = 0; /* XXX */
     size_t size = 1;
     char block_buf[0x10];
     
     if (ctx->is_decrypted) {
-        fseeko64(ctx->file, (ctx->offset + ctx->bktr_ctx.bktr_seek), SEEK_SET);
+        fseeko64(ctx->file, ctx->file_offset + (ctx->offset + ctx->bktr_ctx.bktr_seek), SEEK_SET);
         read = fread(buffer, size, count, ctx->file);
         nca_section_fseek(ctx, ctx->bktr_ctx.virtual_seek + read);
         return read;
@@ -81,7 +142,7 @@ size_t nca_bktr_section_physical_fread(nca_section_ctx_t *ctx, void *buffer, siz
     
     bktr_subsection_entry_t *subsec = bktr_get_subsection(ctx->bktr_ctx.subsection_block, ctx->bktr_ctx.bktr_seek);
     nca_update_bktr_ctr(ctx->ctr, subsec->ctr_val, ctx->bktr_ctx.bktr_seek + ctx->offset);
-    fseeko64(ctx->file, (ctx->offset + ctx->bktr_ctx.bktr_seek) & ~0xF, SEEK_SET);
+    fseeko64(ctx->file, ctx->file_offset + ((ctx->offset + ctx->bktr_ctx.bktr_seek) & ~0xF), SEEK_SET);
     uint32_t block_ofs;
     bktr_subsection_entry_t *next_subsec = bktr_get_subsection(ctx->bktr_ctx.subsection_block, ctx->bktr_ctx.bktr_seek + count);
     if (next_subsec == subsec || (ctx->bktr_ctx.bktr_seek + count == next_subsec->offset && next_subsec == subsec + 1)) {
@@ -100,7 +161,7 @@ size_t nca_bktr_section_physical_fread(nca_section_ctx_t *ctx, void *buffer, siz
             memcpy(buffer, block_buf + block_ofs, 0x10 - block_ofs);
             uint32_t read_in_block = 0x10 - block_ofs;
             nca_section_fseek(ctx, ctx->bktr_ctx.virtual_seek - block_ofs + 0x10);
-            return read_in_block + nca_section_fread(ctx, (char *)buffer + read_in_block, count - read_in_block);
+            return read_in_block + nca_section_read(ctx, (char *)buffer + read_in_block, count - read_in_block);
         }
         if ((read = fread(buffer, 1, count, ctx->file)) != count) {
                 return 0;
@@ -111,10 +172,10 @@ size_t nca_bktr_section_physical_fread(nca_section_ctx_t *ctx, void *buffer, siz
     } else {
         /* Sad path. */
         uint64_t within_subsection = next_subsec->offset - ctx->bktr_ctx.bktr_seek;
-        if ((read = nca_section_fread(ctx, buffer, within_subsection)) != within_subsection) {
+        if ((read = nca_section_read(ctx, buffer, within_subsection)) != within_subsection) {
             return 0;
         }
-        read += nca_section_fread(ctx, (char *)buffer + within_subsection, count - within_subsection);
+        read += nca_section_read(ctx, (char *)buffer + within_subsection, count - within_subsection);
         if (read != count) {
             return 0;
         }
@@ -123,7 +184,7 @@ size_t nca_bktr_section_physical_fread(nca_section_ctx_t *ctx, void *buffer, siz
     return read;
 }
 
-size_t nca_section_fread(nca_section_ctx_t *ctx, void *buffer, size_t count) {
+static size_t nca_section_read(nca_section_ctx_t *ctx, void *buffer, size_t count) {
     size_t read = 0; /* XXX */
     size_t size = 1;
     char block_buf[0x10];
@@ -140,11 +201,11 @@ size_t nca_section_fread(nca_section_ctx_t *ctx, void *buffer, size_t count) {
         }
         aes_xts_decrypt(ctx->aes, &sector_buf, &sector_buf, 0x200, ctx->sector_num, 0x200);
         if (count > 0x200 - ctx->sector_ofs) { /* We're leaving the sector... */
-            memcpy(buffer, &sector_buf + ctx->sector_ofs, 0x200 - ctx->sector_ofs);
-            ctx->sector_num++;
-            ctx->sector_ofs = 0;
+            memcpy(buffer, sector_buf + ctx->sector_ofs, 0x200 - ctx->sector_ofs);
             size_t remaining = count - (0x200 - ctx->sector_ofs);
             size_t ofs = (0x200 - ctx->sector_ofs);
+            ctx->sector_num++;
+            ctx->sector_ofs = 0;
             if (remaining & ~0x1FF) { /* Read intermediate sectors. */
                 if ((read = fread((char *)buffer + ofs, size, (remaining & ~0x1FF), ctx->file)) != (remaining & ~0x1FF)) {
                     return ofs;
@@ -162,13 +223,17 @@ size_t nca_section_fread(nca_section_ctx_t *ctx, void *buffer, size_t count) {
                 aes_xts_decrypt(ctx->aes, &sector_buf, &sector_buf, 0x200, ctx->sector_num, 0x200);
                 memcpy((char *)buffer + ofs, &sector_buf, remaining);
                 ctx->sector_ofs = remaining;
-                read = count;
             }
+            read = count;
         } else {
-            memcpy(buffer, &sector_buf + ctx->sector_ofs, count);
+            memcpy(buffer, sector_buf + ctx->sector_ofs, count);
             ctx->sector_num += (ctx->sector_ofs + count) / 0x200;
             ctx->sector_ofs += count;
             ctx->sector_ofs &= 0x1FF;
+            read = count;
+        }
+        if (ctx->sector_ofs) { /* Stopped within a sector, so the next read starts by re-reading it. */
+            fseeko64(ctx->file, -0x200, SEEK_CUR);
         }
     } else {
         /* Perform decryption, if necessary. */
@@ -190,7 +255,7 @@ size_t nca_section_fread(nca_section_ctx_t *ctx, void *buffer, size_t count) {
                 memcpy(buffer, block_buf + ctx->sector_ofs, 0x10 - ctx->sector_ofs);
                 uint32_t read_in_block = 0x10 - ctx->sector_ofs;
                 nca_section_fseek(ctx, ctx->cur_seek - ctx->offset + 0x10);
-                return read_in_block + nca_section_fread(ctx, (char *)buffer + read_in_block, count - read_in_block);
+                return read_in_block + nca_section_read(ctx, (char *)buffer + read_in_block, count - read_in_block);
             }
             if ((read = fread(buffer, 1, count, ctx->file)) != count) {
                     return 0;
@@ -206,6 +271,8 @@ size_t nca_section_fread(nca_section_ctx_t *ctx, void *buffer, size_t count) {
                 uint64_t virt_seek = ctx->bktr_ctx.virtual_seek;
                 if (ctx->bktr_ctx.virtual_seek + count <= next_reloc->virt_offset) {
                     /* Easy path: We're reading *only* within the current relocation. */
+                    trace_span_t span;
+                    trace_begin(&span);
                     if (reloc->is_patch) {
                         read = nca_bktr_section_physical_fread(ctx, buffer, count);
                     } else {
@@ -224,19 +291,20 @@ size_t nca_section_fread(nca_section_ctx_t *ctx, void *buffer, size_t count) {
                                 }
                             }
                             nca_section_fseek(&base_ctx->section_contexts[romfs_section_num], ctx->bktr_ctx.base_seek);
-                            if ((read = nca_section_fread(&base_ctx->section_contexts[romfs_section_num], buffer, count)) != count) {
+                            if ((read = nca_section_read(&base_ctx->section_contexts[romfs_section_num], buffer, count)) != count) {
                                 fprintf(stderr, "Failed to read from Base NCA RomFS!\n");
-                                exit(EXIT_FAILURE);
+                                fatal_exit();
                             }
                         }
                     }        
+                    trace_end(&span, "BKTR extent read", ctx->section_num, "%s 0x%"PRIx64"+0x%zx", reloc->is_patch ? "patch" : "base", virt_seek, count);
                 } else {
                     uint64_t within_relocation = next_reloc->virt_offset - ctx->bktr_ctx.virtual_seek;
-                    if ((read = nca_section_fread(ctx, buffer, within_relocation)) != within_relocation) {
+                    if ((read = nca_section_read(ctx, buffer, within_relocation)) != within_relocation) {
                         return 0;
                     }
                     nca_section_fseek(ctx, virt_seek + within_relocation);
-                    read += nca_section_fread(ctx, (char *)buffer + within_relocation, count - within_relocation);
+                    read += nca_section_read(ctx, (char *)buffer + within_relocation, count - within_relocation);
                     if (read != count) {
                         return 0;
                     }
@@ -250,14 +318,88 @@ size_t nca_section_fread(nca_section_ctx_t *ctx, void *buffer, size_t count) {
     return read;
 }
 
+size_t nca_section_fread(nca_section_ctx_t *ctx, void *buffer, size_t count) {
+    stats_span_t span;
+    stats_begin(&span);
+    size_t read = nca_section_read(ctx, buffer, count);
+    stats_end(&span, STATS_READ, read);
+    return read;
+}
+
+/* Decrypt raw section data read from absolute offset ofs. Only CTR and XTS data can be decrypted without seeking. */
+void nca_decrypt_section_data(nca_section_ctx_t *ctx, void *buf, uint64_t ofs, uint64_t size) {
+    if (ctx->is_decrypted || ctx->aes == NULL) {
+        return;
+    }
+    if (ctx->header->crypt_type == CRYPT_XTS) {
+        aes_xts_decrypt(ctx->aes, buf, buf, size & ~0x1FF, (ofs - ctx->offset) / 0x200, 0x200);
+    } else if (ctx->header->crypt_type == CRYPT_CTR) {
+        unsigned char ctr[0x10];
+        memcpy(ctr, ctx->ctr, sizeof(ctr));
+        nca_update_ctr(ctr, ofs);
+        aes_setiv(ctx->aes, ctr, 0x10);
+        aes_decrypt(ctx->aes, buf, buf, size);
+    }
+}
+
+/* Append to out, or print right away if out is NULL. */
+void nca_output_printf(nca_output_t *out, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    if (out == NULL) {
+        vprintf(fmt, args);
+        va_end(args);
+        return;
+    }
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (out->len + (size_t)len + 1 > out->size) {
+        while (out->len + (size_t)len + 1 > out->size) {
+            out->size = out->size ? out->size * 2 : 0x1000;
+        }
+        if ((out->data = realloc(out->data, out->size)) == NULL) {
+            fprintf(stderr, "Failed to allocate output buffer!\n");
+            fatal_exit();
+        }
+    }
+    va_start(args, fmt);
+    vsnprintf(out->data + out->len, (size_t)len + 1, fmt, args);
+    va_end(args);
+    out->len += (size_t)len;
+}
+
+/* Print what was held back in out, and empty it. */
+void nca_output_flush(nca_output_t *out) {
+    if (out->len) {
+        fwrite(out->data, 1, out->len, stdout);
+    }
+    free(out->data);
+    memset(out, 0, sizeof(*out));
+}
+
+static nca_output_t *nca_get_save_output(nca_ctx_t *ctx) {
+    return ctx->hold_save_output || ctx->defer_print ? &ctx->save_output : NULL;
+}
+
+static nca_output_t *nca_get_verify_output(nca_ctx_t *ctx) {
+    return ctx->defer_print ? &ctx->verify_output : NULL;
+}
+
 void nca_free_section_contexts(nca_ctx_t *ctx) {
     for (unsigned int i = 0; i < 4; i++) {
         if (ctx->section_contexts[i].is_present) {
+            if (ctx->section_contexts[i].corruption) {
+                for (unsigned int j = 0; j < IVFC_MAX_LEVEL; j++) {
+                    corruption_list_free(&ctx->section_contexts[i].corruption[j]);
+                }
+                free(ctx->section_contexts[i].corruption);
+            }
             if (ctx->section_contexts[i].aes) {
                 free_aes_ctx(ctx->section_contexts[i].aes);
             }
-            if (ctx->section_contexts[i].pfs0_ctx.is_exefs) {
+            if (ctx->section_contexts[i].type == PFS0) {
                 free(ctx->section_contexts[i].pfs0_ctx.npdm);
+                free(ctx->section_contexts[i].pfs0_ctx.header);
             } else if (ctx->section_contexts[i].type == ROMFS) {
                 if (ctx->section_contexts[i].romfs_ctx.directories) {
                     free(ctx->section_contexts[i].romfs_ctx.directories);
@@ -284,27 +426,50 @@ void nca_free_section_contexts(nca_ctx_t *ctx) {
 }
 
 void nca_save(nca_ctx_t *ctx) {
+    stats_scope_t scope = stats_enter(STATS_PHASE_SAVE, STATS_NO_SECTION);
+    stats_span_t span;
+
     /* Save header. */
     filepath_t *header_path = &ctx->tool_ctx->settings.header_path;
 
     if (header_path->valid == VALIDITY_VALID) {
-        printf("Saving Header to %s...\n", header_path->char_path);
+        nca_output_printf(nca_get_save_output(ctx), "Saving Header to %s...\n", header_path->char_path);
         FILE *f_hdr = os_fopen(header_path->os_path, OS_MODE_WRITE);
 
         if (f_hdr != NULL) {
+            stats_begin(&span);
             fwrite(&ctx->header, 1, 0xC00, f_hdr);
+            stats_end(&span, STATS_WRITE, 0xC00);
             fclose(f_hdr);
+            if (ctx->tool_ctx->manifest != NULL) {
+                unsigned char hash[0x20];
+                sha256_hash_buffer(hash, &ctx->header, 0xC00);
+                manifest_add(ctx->tool_ctx->manifest, header_path->char_path, 0xC00, hash);
+            }
         } else {
             fprintf(stderr, "Failed to open %s!\n", header_path->char_path);
         }
     }
 
-    
+
+    if (ctx->did_fanout) {
+        /* Sections and the decrypted NCA were already written by the fan-out pass, which held back its messages. */
+        if (!ctx->defer_print) {
+            nca_output_flush(&ctx->save_output);
+        }
+        stats_leave(scope);
+        return;
+    }
+
     for (unsigned int i = 0; i < 4; i++) {
         if (ctx->section_contexts[i].is_present) {
             /* printf("Saving section %"PRId32"...\n", i); */
+            stats_enter(STATS_PHASE_SAVE, i);
+            trace_span_t span;
+            trace_begin(&span);
             nca_save_section(&ctx->section_contexts[i]);
-            printf("\n");
+            trace_end(&span, "save section", i, NULL);
+            nca_output_printf(nca_get_save_output(ctx), "\n");
         }
     }
     
@@ -312,22 +477,32 @@ void nca_save(nca_ctx_t *ctx) {
     filepath_t *dec_path = &ctx->tool_ctx->settings.dec_nca_path;
 
     if (dec_path->valid == VALIDITY_VALID) {
-        printf("Saving Decrypted NCA to %s...\n", dec_path->char_path);
+        nca_output_printf(nca_get_save_output(ctx), "Saving Decrypted NCA to %s...\n", dec_path->char_path);
+        trace_span_t trace_span;
+        trace_begin(&trace_span);
         FILE *f_dec = os_fopen(dec_path->os_path, OS_MODE_WRITE);
 
         if (f_dec != NULL) {
+            stats_enter(STATS_PHASE_SAVE, STATS_NO_SECTION);
+            stats_begin(&span);
             if (fwrite(&ctx->header, 1, 0xC00, f_dec) != 0xC00) {
                 fprintf(stderr, "Failed to write header!\n");
-                exit(EXIT_FAILURE);
+                fatal_exit();
             }
+            stats_end(&span, STATS_WRITE, 0xC00);
             
             unsigned char *buf = malloc(0x400000);
             if (buf == NULL) {
                 fprintf(stderr, "Failed to allocate file-save buffer!\n");
-                exit(EXIT_FAILURE);
+                fatal_exit();
             }
+            uint64_t dec_size = 0xC00;
             for (unsigned int i = 0; i < 4; i++) {
                 if (ctx->section_contexts[i].is_present) {
+                    stats_enter(STATS_PHASE_SAVE, i);
+                    if (ctx->section_contexts[i].offset + ctx->section_contexts[i].size > dec_size) {
+                        dec_size = ctx->section_contexts[i].offset + ctx->section_contexts[i].size;
+                    }
                     fseeko64(f_dec, ctx->section_contexts[i].offset, SEEK_SET);
                     ctx->section_contexts[i].physical_reads = 1;
                     
@@ -340,11 +515,11 @@ void nca_save(nca_ctx_t *ctx) {
                         if (ofs + read_size >= end_ofs) read_size = end_ofs - ofs;
                         if (nca_section_fread(&ctx->section_contexts[i], buf, read_size) != read_size) {
                             fprintf(stderr, "Failed to read file!\n");
-                            exit(EXIT_FAILURE);
+                            fatal_exit();
                         }
-                        if (fwrite(buf, 1, read_size, f_dec) != read_size) {
+                        if (fwrite_sparse(buf, read_size, ctx->section_contexts[i].offset + ofs, f_dec) != read_size) {
                             fprintf(stderr, "Failed to write file!\n");
-                            exit(EXIT_FAILURE);
+                            fatal_exit();
                         }
                         ofs += read_size;
                     }
@@ -353,28 +528,23 @@ void nca_save(nca_ctx_t *ctx) {
                 }
             }
             
+            if (!finish_sparse_file(f_dec, dec_size)) {
+                fprintf(stderr, "Failed to write file!\n");
+                fatal_exit();
+            }
             fclose(f_dec);
 
             free(buf);
+            trace_end(&trace_span, "extract file", TRACE_NO_SECTION, "%s", dec_path->char_path);
         } else {
             fprintf(stderr, "Failed to open %s!\n", dec_path->char_path);
         }
     }
+    stats_leave(scope);
 }
 
-void nca_process(nca_ctx_t *ctx) {
-    /* First things first, decrypt header. */
-    if (!nca_decrypt_header(ctx)) {
-        fprintf(stderr, "Invalid NCA header!\n");
-        return;
-    }
-
-    if (rsa2048_pss_verify(&ctx->header.magic, 0x200, ctx->header.fixed_key_sig, ctx->tool_ctx->settings.keyset.nca_hdr_fixed_key_modulus)) {
-        ctx->fixed_sig_validity = VALIDITY_VALID;
-    } else {
-        ctx->fixed_sig_validity = VALIDITY_INVALID;
-    }
-
+/* Work out the master key revision and the keys needed to decrypt sections. */
+void nca_init_keys(nca_ctx_t *ctx) {
     /* Sort out crypto type. */
     ctx->crypto_type = ctx->header.crypto_type;
     if (ctx->header.crypto_type2 > ctx->header.crypto_type)
@@ -395,6 +565,16 @@ void nca_process(nca_ctx_t *ctx) {
     if (!ctx->has_rights_id) {
         nca_decrypt_key_area(ctx);
     } else {
+        /* Fall back to title keys read from tickets. */
+        if (!ctx->tool_ctx->settings.has_titlekey) {
+            for (uint32_t i = 0; i < ctx->tool_ctx->num_titlekeys; i++) {
+                if (!memcmp(ctx->tool_ctx->titlekeys[i].rights_id, ctx->header.rights_id, 0x10)) {
+                    memcpy(ctx->tool_ctx->settings.titlekey, ctx->tool_ctx->titlekeys[i].titlekey, 0x10);
+                    ctx->tool_ctx->settings.has_titlekey = 1;
+                    break;
+                }
+            }
+        }
         /* Decrypt title key. */
         if (ctx->tool_ctx->settings.has_titlekey) {
             aes_ctx_t *aes_ctx = new_aes_ctx(ctx->tool_ctx->settings.keyset.titlekeks[ctx->crypto_type], 16, AES_MODE_CTR);
@@ -402,75 +582,431 @@ void nca_process(nca_ctx_t *ctx) {
             free_aes_ctx(aes_ctx);
         }
     }
+}
 
-    /* Parse sections. */
+/* Set up the context for a present section from the decrypted header. */
+void nca_init_section(nca_ctx_t *ctx, unsigned int i) {
+    ctx->section_contexts[i].is_present = 1;
+    ctx->section_contexts[i].is_decrypted = ctx->is_decrypted;
+    ctx->section_contexts[i].tool_ctx = ctx->tool_ctx;
+    ctx->section_contexts[i].nca = ctx;
+    ctx->section_contexts[i].file = ctx->file;
+    ctx->section_contexts[i].file_offset = ctx->file_offset;
+    ctx->section_contexts[i].section_num = i;
+    ctx->section_contexts[i].offset = media_to_real(ctx->header.section_entries[i].media_start_offset);
+    ctx->section_contexts[i].size = media_to_real(ctx->header.section_entries[i].media_end_offset) - ctx->section_contexts[i].offset;
+    ctx->section_contexts[i].header = &ctx->header.fs_headers[i];
+    if (ctx->tool_ctx->corruption != NULL) {
+        /* One list per hash level; PFS0 only uses the first two. */
+        if ((ctx->section_contexts[i].corruption = calloc(IVFC_MAX_LEVEL, sizeof(corruption_list_t))) == NULL) {
+            fprintf(stderr, "Failed to allocate corruption map!\n");
+            fatal_exit();
+        }
+    }
+    if (ctx->section_contexts[i].header->partition_type == PARTITION_PFS0 && ctx->section_contexts[i].header->fs_type == FS_TYPE_PFS0) {
+        ctx->section_contexts[i].type = PFS0;
+        ctx->section_contexts[i].pfs0_ctx.superblock = &ctx->section_contexts[i].header->pfs0_superblock;
+    } else if (ctx->section_contexts[i].header->partition_type == PARTITION_ROMFS && ctx->section_contexts[i].header->fs_type == FS_TYPE_ROMFS) {
+        if (ctx->section_contexts[i].header->crypt_type == CRYPT_BKTR) {
+            ctx->section_contexts[i].type = BKTR;
+            ctx->section_contexts[i].bktr_ctx.superblock = &ctx->section_contexts[i].header->bktr_superblock;
+        } else {
+            ctx->section_contexts[i].type = ROMFS;
+            ctx->section_contexts[i].romfs_ctx.superblock = &ctx->section_contexts[i].header->romfs_superblock;
+        }
+    } else {
+        ctx->section_contexts[i].type = INVALID;
+    }
+    uint64_t ofs = ctx->section_contexts[i].offset >> 4;
+    for (unsigned int j = 0; j < 0x8; j++) {
+        ctx->section_contexts[i].ctr[j] = ctx->section_contexts[i].header->section_ctr[0x8-j-1];
+        ctx->section_contexts[i].ctr[0x10-j-1] = (unsigned char)(ofs & 0xFF);
+        ofs >>= 8;
+    }
+    ctx->section_contexts[i].sector_num = 0;
+    ctx->section_contexts[i].sector_ofs = 0;
+    ctx->section_contexts[i].verify_tier = ctx->tool_ctx->settings.verify_tier;
+
+    if (ctx->section_contexts[i].header->crypt_type == CRYPT_NONE) {
+        ctx->section_contexts[i].is_decrypted = 1;
+    }
+
+    ctx->section_contexts[i].aes = nca_new_section_aes_ctx(ctx, i);
+}
+
+/* A context set up like the section's own, for threads that decrypt it alongside others. */
+aes_ctx_t *nca_new_section_aes_ctx(nca_ctx_t *ctx, unsigned int i) {
+    if (ctx->tool_ctx->settings.has_contentkey) {
+        return new_aes_ctx(ctx->tool_ctx->settings.contentkey, 16, AES_MODE_CTR);
+    } else if (ctx->has_rights_id) {
+        return new_aes_ctx(ctx->tool_ctx->settings.dec_titlekey, 16, AES_MODE_CTR);
+    } else if (ctx->section_contexts[i].header->crypt_type == CRYPT_CTR || ctx->section_contexts[i].header->crypt_type == CRYPT_BKTR) {
+        return new_aes_ctx(ctx->decrypted_keys[2], 16, AES_MODE_CTR);
+    } else if (ctx->section_contexts[i].header->crypt_type == CRYPT_XTS) {
+        return new_aes_ctx(ctx->decrypted_keys[0], 32, AES_MODE_XTS);
+    }
+    return NULL;
+}
+
+/* Failing hash table entries leave the blocks they cover unverifiable, too. */
+static void nca_project_corruption(corruption_list_t *out, const corruption_list_t *hashes, uint64_t hash_ofs, uint64_t data_ofs, uint64_t data_len, uint64_t block_size) {
+    for (uint32_t i = 0; i < hashes->num_ranges; i++) {
+        const corruption_range_t *range = &hashes->ranges[i];
+        if (range->end <= hash_ofs) {
+            continue;
+        }
+        uint64_t first = (range->start > hash_ofs ? range->start - hash_ofs : 0) / 0x20;
+        uint64_t last = (range->end - hash_ofs + 0x1F) / 0x20;
+        uint64_t start = data_ofs + first * block_size;
+        uint64_t end = data_ofs + last * block_size;
+        if (end > data_ofs + data_len) {
+            end = data_ofs + data_len;
+        }
+        if (start < end) {
+            corruption_list_add(out, start, end);
+        }
+    }
+}
+
+static void nca_append_corruption(corruption_list_t *out, const corruption_list_t *in) {
+    for (uint32_t i = 0; i < in->num_ranges; i++) {
+        corruption_list_add(out, in->ranges[i].start, in->ranges[i].end);
+    }
+}
+
+/* Ranges of the data level that failed, or whose hashes failed further up the tree. */
+static void nca_get_affected_data(nca_section_ctx_t *ctx, corruption_list_t *affected) {
+    memset(affected, 0, sizeof(*affected));
+    if (ctx->type == PFS0) {
+        pfs0_superblock_t *sb = ctx->pfs0_ctx.superblock;
+        nca_project_corruption(affected, &ctx->corruption[0], sb->hash_table_offset, sb->pfs0_offset, sb->pfs0_size, sb->block_size);
+        nca_append_corruption(affected, &ctx->corruption[1]);
+        return;
+    }
+
+    ivfc_level_ctx_t *levels = ctx->type == ROMFS ? ctx->romfs_ctx.ivfc_levels : ctx->bktr_ctx.ivfc_levels;
+    nca_append_corruption(affected, &ctx->corruption[0]);
+    for (unsigned int i = 1; i < IVFC_MAX_LEVEL; i++) {
+        corruption_list_t next;
+        memset(&next, 0, sizeof(next));
+        nca_project_corruption(&next, affected, levels[i].hash_offset, levels[i].data_offset, levels[i].data_size, levels[i].hash_block_size);
+        nca_append_corruption(&next, &ctx->corruption[i]);
+        corruption_list_free(affected);
+        *affected = next;
+    }
+}
+
+typedef struct {
+    corruption_ctx_t *map;
+    const char *source;
+    const corruption_list_t *affected;
+    romfs_direntry_t *directories;
+    uint64_t dir_table_size;
+    romfs_fentry_t *files;
+    uint64_t file_table_size;
+    uint64_t data_offset;
+    uint64_t budget; /* Damaged tables may link in circles. */
+} nca_romfs_walk_t;
+
+/* Entry names are bounds-checked, since the tables themselves may be damaged. */
+static int nca_romfs_walk_name(uint64_t table_size, uint64_t entry_offset, uint64_t entry_size, uint32_t name_size) {
+    uint64_t avail = table_size - entry_offset - entry_size;
+    if (avail > MAX_PATH - 1) {
+        avail = MAX_PATH - 1;
+    }
+    return name_size > avail ? (int)avail : (int)name_size;
+}
+
+static void nca_map_romfs_files(nca_romfs_walk_t *walk, uint32_t file_offset, const char *dir_path) {
+    while (file_offset != ROMFS_ENTRY_EMPTY && walk->budget) {
+        walk->budget--;
+        if ((uint64_t)file_offset + sizeof(romfs_fentry_t) > walk->file_table_size) {
+            return;
+        }
+        romfs_fentry_t *entry = romfs_get_fentry(walk->files, file_offset);
+        uint64_t start = walk->data_offset + entry->offset;
+        if (entry->size && corruption_list_overlaps(walk->affected, start, start + entry->size)) {
+            char path[MAX_PATH];
+            int name_size = nca_romfs_walk_name(walk->file_table_size, file_offset, sizeof(romfs_fentry_t), entry->name_size);
+            /* Overlong paths are cut short, which still identifies the file. */
+            if (snprintf(path, sizeof(path), "%s/%.*s", dir_path, name_size, entry->name) < 0) {
+                return;
+            }
+            corruption_write_file(walk->map, walk->source, path);
+        }
+        file_offset = entry->sibling;
+    }
+}
+
+static void nca_map_romfs_dir(nca_romfs_walk_t *walk, uint32_t dir_offset, const char *parent_path) {
+    while (dir_offset != ROMFS_ENTRY_EMPTY && walk->budget) {
+        walk->budget--;
+        if ((uint64_t)dir_offset + sizeof(romfs_direntry_t) > walk->dir_table_size) {
+            return;
+        }
+        romfs_direntry_t *entry = romfs_get_direntry(walk->directories, dir_offset);
+        char path[MAX_PATH];
+        int name_size = nca_romfs_walk_name(walk->dir_table_size, dir_offset, sizeof(romfs_direntry_t), entry->name_size);
+        snprintf(path, sizeof(path), "%s%s%.*s", parent_path, name_size ? "/" : "", name_size, entry->name);
+        nca_map_romfs_files(walk, entry->file, path);
+        nca_map_romfs_dir(walk, entry->child, path);
+        dir_offset = entry->sibling;
+    }
+}
+
+/* Read a RomFS table for mapping, unless it is too damaged to make sense of. */
+static void *nca_read_romfs_table(nca_section_ctx_t *ctx, uint64_t offset, uint64_t size) {
+    if (size == 0 || size > ctx->size) {
+        return NULL;
+    }
+    void *table = calloc(1, size);
+    if (table == NULL) {
+        fprintf(stderr, "Failed to allocate RomFS table!\n");
+        fatal_exit();
+    }
+    nca_section_fseek(ctx, offset);
+    if (nca_section_fread(ctx, table, size) != size) {
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+static void nca_map_romfs_corruption(nca_section_ctx_t *ctx, const char *source, const corruption_list_t *affected) {
+    corruption_ctx_t *map = ctx->tool_ctx->corruption;
+    if (ctx->type == ROMFS) {
+        nca_section_load_romfs(ctx);
+    }
+    romfs_hdr_t *header = ctx->type == ROMFS ? &ctx->romfs_ctx.header : &ctx->bktr_ctx.header;
+    uint64_t romfs_offset = ctx->type == ROMFS ? ctx->romfs_ctx.romfs_offset : ctx->bktr_ctx.romfs_offset;
+    if (header->header_size != ROMFS_HEADER_SIZE) {
+        corruption_write_file(map, source, "(RomFS header unreadable)");
+        return;
+    }
+    if (corruption_list_overlaps(affected, romfs_offset, romfs_offset + header->data_offset)) {
+        corruption_write_file(map, source, "(RomFS metadata)");
+    }
+
+    nca_romfs_walk_t walk;
+    memset(&walk, 0, sizeof(walk));
+    walk.map = map;
+    walk.source = source;
+    walk.affected = affected;
+    walk.directories = ctx->type == ROMFS ? ctx->romfs_ctx.directories : ctx->bktr_ctx.directories;
+    walk.files = ctx->type == ROMFS ? ctx->romfs_ctx.files : ctx->bktr_ctx.files;
+    walk.dir_table_size = header->dir_meta_table_size;
+    walk.file_table_size = header->file_meta_table_size;
+    walk.data_offset = romfs_offset + header->data_offset;
+    walk.budget = walk.dir_table_size / sizeof(romfs_direntry_t) + walk.file_table_size / sizeof(romfs_fentry_t);
+
+    /* Tables are only cached when extracting or listing. */
+    romfs_direntry_t *directories = NULL;
+    romfs_fentry_t *files = NULL;
+    if (walk.directories == NULL) {
+        /* Switch RomFS has actual entries at table offset + 4 for no good reason. */
+        walk.directories = directories = nca_read_romfs_table(ctx, romfs_offset + header->dir_meta_table_offset + 4, header->dir_meta_table_size);
+    }
+    if (walk.files == NULL) {
+        walk.files = files = nca_read_romfs_table(ctx, romfs_offset + header->file_meta_table_offset, header->file_meta_table_size);
+    }
+    if (walk.directories == NULL || walk.files == NULL) {
+        corruption_write_file(map, source, "(RomFS metadata unreadable)");
+    } else {
+        nca_map_romfs_dir(&walk, 0, "");
+    }
+    free(directories);
+    free(files);
+}
+
+static void nca_map_pfs0_corruption(nca_section_ctx_t *ctx, const char *source, const corruption_list_t *affected) {
+    corruption_ctx_t *map = ctx->tool_ctx->corruption;
+    pfs0_header_t *header = nca_section_get_pfs0_header(ctx);
+    if (header == NULL) {
+        corruption_write_file(map, source, "(PFS0 header unreadable)");
+        return;
+    }
+    uint64_t pfs0_offset = ctx->pfs0_ctx.superblock->pfs0_offset;
+    uint64_t data_offset = pfs0_offset + pfs0_get_header_size(header);
+    if (corruption_list_overlaps(affected, pfs0_offset, data_offset)) {
+        corruption_write_file(map, source, "(PFS0 header)");
+    }
+    for (unsigned int i = 0; i < header->num_files; i++) {
+        pfs0_file_entry_t *cur_file = pfs0_get_file_entry(header, i);
+        uint64_t start = data_offset + cur_file->offset;
+        if (cur_file->size && corruption_list_overlaps(affected, start, start + cur_file->size)) {
+            corruption_write_file(map, source, pfs0_get_file_name(header, i));
+        }
+    }
+}
+
+/* Record each section's failing blocks, and the files they land in. */
+static void nca_write_corruption_map(nca_ctx_t *ctx) {
+    corruption_ctx_t *map = ctx->tool_ctx->corruption;
     for (unsigned int i = 0; i < 4; i++) {
-        if (ctx->header.section_entries[i].media_start_offset) { /* Section exists. */
-            ctx->section_contexts[i].is_present = 1;
-            ctx->section_contexts[i].is_decrypted = ctx->is_decrypted;
-            ctx->section_contexts[i].tool_ctx = ctx->tool_ctx;
-            ctx->section_contexts[i].file = ctx->file;
-            ctx->section_contexts[i].section_num = i;
-            ctx->section_contexts[i].offset = media_to_real(ctx->header.section_entries[i].media_start_offset);
-            ctx->section_contexts[i].size = media_to_real(ctx->header.section_entries[i].media_end_offset) - ctx->section_contexts[i].offset;
-            ctx->section_contexts[i].header = &ctx->header.fs_headers[i];
-            if (ctx->section_contexts[i].header->partition_type == PARTITION_PFS0 && ctx->section_contexts[i].header->fs_type == FS_TYPE_PFS0) {
-                ctx->section_contexts[i].type = PFS0;
-                ctx->section_contexts[i].pfs0_ctx.superblock = &ctx->section_contexts[i].header->pfs0_superblock;
-            } else if (ctx->section_contexts[i].header->partition_type == PARTITION_ROMFS && ctx->section_contexts[i].header->fs_type == FS_TYPE_ROMFS) {
-                if (ctx->section_contexts[i].header->crypt_type == CRYPT_BKTR) {
-                    ctx->section_contexts[i].type = BKTR;
-                    ctx->section_contexts[i].bktr_ctx.superblock = &ctx->section_contexts[i].header->bktr_superblock;
-                } else {
-                    ctx->section_contexts[i].type = ROMFS;
-                    ctx->section_contexts[i].romfs_ctx.superblock = &ctx->section_contexts[i].header->romfs_superblock;
-                }
+        nca_section_ctx_t *section = &ctx->section_contexts[i];
+        if (!section->is_present || section->corruption == NULL || section->type == INVALID) {
+            continue;
+        }
+        char source[MAX_PATH + 0x10];
+        snprintf(source, sizeof(source), "%s:section%"PRIu32, ctx->file_name != NULL ? ctx->file_name : "nca", i);
+
+        unsigned int num_levels = section->type == PFS0 ? 2 : IVFC_MAX_LEVEL;
+        for (unsigned int j = 0; j < num_levels; j++) {
+            char level[0x10];
+            if (section->type == PFS0) {
+                snprintf(level, sizeof(level), "%s", j == 0 ? "hashtable" : "pfs0");
             } else {
-                ctx->section_contexts[i].type = INVALID;
+                snprintf(level, sizeof(level), "level%"PRIu32, j);
             }
-            uint64_t ofs = ctx->section_contexts[i].offset >> 4;
-            for (unsigned int j = 0; j < 0x8; j++) {
-                ctx->section_contexts[i].ctr[j] = ctx->section_contexts[i].header->section_ctr[0x8-j-1];
-                ctx->section_contexts[i].ctr[0x10-j-1] = (unsigned char)(ofs & 0xFF);
-                ofs >>= 8;
+            corruption_write_level(map, source, level, &section->corruption[j]);
+        }
+
+        corruption_list_t affected;
+        nca_get_affected_data(section, &affected);
+        if (affected.num_ranges) {
+            if (section->type == PFS0) {
+                nca_map_pfs0_corruption(section, source, &affected);
+            } else {
+                nca_map_romfs_corruption(section, source, &affected);
             }
-            ctx->section_contexts[i].sector_num = 0;
-            ctx->section_contexts[i].sector_ofs = 0;
+        }
+        corruption_list_free(&affected);
+    }
+}
 
-            if (ctx->section_contexts[i].header->crypt_type == CRYPT_NONE) {
-                ctx->section_contexts[i].is_decrypted = 1;
+/* Cached results may only stand in for a full verification of the very same bytes. */
+static int nca_is_verify_cacheable(nca_ctx_t *ctx) {
+    if (ctx->tool_ctx->vcache == NULL || !(ctx->tool_ctx->action & ACTION_VERIFY) || ctx->tool_ctx->corruption != NULL) {
+        return 0;
+    }
+    for (unsigned int i = 0; i < 4; i++) {
+        /* BKTR results depend on the base NCA, too. */
+        if (ctx->header.section_entries[i].media_start_offset && ctx->header.fs_headers[i].crypt_type == CRYPT_BKTR) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void nca_apply_verify_cache(nca_ctx_t *ctx, const vcache_entry_t *entry) {
+    for (unsigned int i = 0; i < 4; i++) {
+        nca_section_ctx_t *section = &ctx->section_contexts[i];
+        if (!section->is_present) {
+            continue;
+        }
+        if (section->type == PFS0) {
+            section->pfs0_ctx.hash_table_validity = (validity_t)entry->level_validity[i][0];
+        } else if (section->type == ROMFS) {
+            for (unsigned int j = 0; j < IVFC_MAX_LEVEL; j++) {
+                section->romfs_ctx.ivfc_levels[j].hash_validity = (validity_t)entry->level_validity[i][j];
             }
+        }
+    }
+    if (entry->has_content_hash && !ctx->has_content_hash) {
+        memcpy(ctx->content_hash, entry->content_hash, sizeof(ctx->content_hash));
+        ctx->has_content_hash = 1;
+        ctx->content_id_validity = (validity_t)entry->content_id_validity;
+    }
+}
 
-            if (ctx->tool_ctx->settings.has_contentkey) {
-                ctx->section_contexts[i].aes = new_aes_ctx(ctx->tool_ctx->settings.contentkey, 16, AES_MODE_CTR);
-            } else {
-                if (ctx->has_rights_id) {
-                    ctx->section_contexts[i].aes = new_aes_ctx(ctx->tool_ctx->settings.dec_titlekey, 16, AES_MODE_CTR);
-                } else {
-                    if (ctx->section_contexts[i].header->crypt_type == CRYPT_CTR || ctx->section_contexts[i].header->crypt_type == CRYPT_BKTR) {
-                        ctx->section_contexts[i].aes = new_aes_ctx(ctx->decrypted_keys[2], 16, AES_MODE_CTR);
-                    } else if (ctx->section_contexts[i].header->crypt_type == CRYPT_XTS) {
-                        ctx->section_contexts[i].aes = new_aes_ctx(ctx->decrypted_keys[0], 32, AES_MODE_XTS);
-                    }
-                }
+static void nca_store_verify_cache(nca_ctx_t *ctx, vcache_entry_t *entry) {
+    for (unsigned int i = 0; i < 4; i++) {
+        nca_section_ctx_t *section = &ctx->section_contexts[i];
+        if (!section->is_present) {
+            continue;
+        }
+        if (section->type == PFS0) {
+            entry->level_validity[i][0] = (uint8_t)section->pfs0_ctx.hash_table_validity;
+        } else if (section->type == ROMFS) {
+            for (unsigned int j = 0; j < IVFC_MAX_LEVEL; j++) {
+                entry->level_validity[i][j] = (uint8_t)section->romfs_ctx.ivfc_levels[j].hash_validity;
             }
+        }
+    }
+    if (ctx->has_content_hash) {
+        memcpy(entry->content_hash, ctx->content_hash, sizeof(entry->content_hash));
+        entry->has_content_hash = 1;
+        entry->content_id_validity = (uint8_t)ctx->content_id_validity;
+    }
+    vcache_store(ctx->tool_ctx->vcache, entry);
+}
 
-            if (ctx->tool_ctx->action & ACTION_VERIFY) {
-                printf("Verifying section %"PRId32"...\n", i);
+/* Count every check that failed, including those nothing printed. */
+static void nca_add_results(nca_ctx_t *ctx) {
+    hactool_results_t *results = ctx->tool_ctx->results;
+    results_add_check(results, nca_get_fixed_sig_validity(ctx));
+    results_add_check(results, nca_get_npdm_sig_validity(ctx));
+    results_add_check(results, ctx->content_id_validity);
+    for (unsigned int i = 0; i < 4; i++) {
+        nca_section_ctx_t *section = &ctx->section_contexts[i];
+        if (!section->is_present) {
+            continue;
+        }
+        if (section->type == PFS0) {
+            results_add_check(results, nca_section_get_superblock_validity(section));
+            results_add_check(results, section->pfs0_ctx.hash_table_validity);
+        } else if (section->type == ROMFS) {
+            results_add_check(results, nca_section_get_superblock_validity(section));
+            for (unsigned int j = 0; j < IVFC_MAX_LEVEL; j++) {
+                results_add_check(results, section->romfs_ctx.ivfc_levels[j].hash_validity);
+            }
+        } else if (section->type == BKTR && ctx->tool_ctx->base_file != NULL) {
+            results_add_check(results, section->superblock_hash_validity);
+            for (unsigned int j = 0; j < IVFC_MAX_LEVEL; j++) {
+                results_add_check(results, section->bktr_ctx.ivfc_levels[j].hash_validity);
+            }
+        }
+    }
+}
+
+void nca_process(nca_ctx_t *ctx) {
+    stats_scope_t scope = stats_enter(STATS_PHASE_HEADER, STATS_NO_SECTION);
+    trace_span_t span;
+
+    /* First things first, decrypt header. */
+    trace_begin(&span);
+    if (!nca_decrypt_header(ctx)) {
+        fprintf(stderr, "Invalid NCA header!\n");
+        results_add_error(ctx->tool_ctx->results);
+        stats_leave(scope);
+        return;
+    }
+    trace_end(&span, "header decrypt", TRACE_NO_SECTION, NULL);
+
+    trace_begin(&span);
+    nca_init_keys(ctx);
+    trace_end(&span, "key derivation", TRACE_NO_SECTION, NULL);
+
+    /* Unchanged NCAs can take their hash results from the verification cache. */
+    vcache_entry_t cache_entry;
+    memset(&cache_entry, 0, sizeof(cache_entry));
+    int use_cache = nca_is_verify_cacheable(ctx) && vcache_get_key(&cache_entry.key, ctx->file, ctx->file_offset, &ctx->header, 0xC00);
+    if (use_cache) {
+        ctx->verify_cached = vcache_lookup(ctx->tool_ctx->vcache, &cache_entry.key, &cache_entry);
+    }
+
+    /* Extraction and verification can share one read of the NCA, if the layout allows it. */
+    int use_fanout = nca_fanout_supported(ctx);
+
+    /* Parse sections. */
+    for (unsigned int i = 0; i < 4; i++) {
+        if (ctx->header.section_entries[i].media_start_offset) { /* Section exists. */
+            stats_enter(STATS_PHASE_VERIFY, i);
+            trace_begin(&span);
+            nca_init_section(ctx, i);
+            ctx->section_contexts[i].verify_deferred = use_fanout && ctx->tool_ctx->settings.verify_tier == VERIFY_TIER_FULL && ctx->tool_ctx->corruption == NULL && !ctx->verify_cached;
+            if (ctx->verify_cached) {
+                /* Cached results are always from a full verification. */
+                ctx->section_contexts[i].verify_cached = 1;
+                ctx->section_contexts[i].verify_tier = VERIFY_TIER_FULL;
+                nca_output_printf(nca_get_verify_output(ctx), "Using cached verification of section %"PRId32"...\n", i);
+            } else if (ctx->tool_ctx->action & ACTION_VERIFY) {
+                nca_output_printf(nca_get_verify_output(ctx), "Verifying section %"PRId32"...\n", i);
             }
 
             switch (ctx->section_contexts[i].type) {
                 case PFS0:
                     nca_process_pfs0_section(&ctx->section_contexts[i]);
-                    /* Verify NPDM sig now, if we can... */
-                    if (ctx->section_contexts[i].pfs0_ctx.is_exefs) {
-                        ctx->npdm = ctx->section_contexts[i].pfs0_ctx.npdm;
-                        if (rsa2048_pss_verify(&ctx->header.magic, 0x200, ctx->header.npdm_key_sig, npdm_get_acid(ctx->npdm)->modulus)) {
-                            ctx->npdm_sig_validity = VALIDITY_VALID;
-                        } else {
-                            ctx->npdm_sig_validity = VALIDITY_INVALID;
-                        }
-                    }
                     break;
                 case ROMFS:
                     nca_process_ivfc_section(&ctx->section_contexts[i]);
@@ -482,21 +1018,109 @@ void nca_process(nca_ctx_t *ctx) {
                 default:
                     break;
             }
+            trace_end(&span, "process section", i, NULL);
         }
     }
 
-    if (ctx->tool_ctx->action & ACTION_INFO) {
+    stats_enter(STATS_PHASE_PASS, STATS_NO_SECTION);
+
+    if (use_fanout) {
+        trace_begin(&span);
+        nca_fanout_process(ctx);
+        trace_end(&span, "shared pass", TRACE_NO_SECTION, NULL);
+    }
+
+    if (ctx->tool_ctx->corruption != NULL) {
+        nca_write_corruption_map(ctx);
+    }
+
+    if (ctx->verify_cached) {
+        nca_apply_verify_cache(ctx, &cache_entry);
+    } else if (use_cache && ctx->tool_ctx->settings.verify_tier == VERIFY_TIER_FULL) {
+        nca_store_verify_cache(ctx, &cache_entry);
+    }
+
+    if ((ctx->tool_ctx->action & ACTION_INFO) && !ctx->defer_print) {
         nca_print(ctx);
     }
 
     if (ctx->tool_ctx->action & ACTION_EXTRACT) {
         nca_save(ctx);
     }
+
+    if (ctx->tool_ctx->results != NULL && (ctx->tool_ctx->action & ACTION_VERIFY)) {
+        nca_add_results(ctx);
+    }
+    stats_leave(scope);
+}
+
+static void nca_nested_worker(void *arg) {
+    nca_nested_pool_t *pool = arg;
+    uint32_t i;
+    while (!atomic_load(&pool->stop) && (i = atomic_fetch_add(&pool->next_nca, 1)) < pool->num_ncas) {
+        nca_nested_t *nested = &pool->ncas[i];
+        if ((nested->file = split_fopen(pool->path)) == NULL) {
+            fprintf(stderr, "Failed to open %s!\n", pool->path);
+            fatal_exit();
+        }
+        nested->tool_ctx.file = nested->file;
+        /* The pool already keeps every thread busy, so corruption scans stay on this one. */
+        nested->tool_ctx.settings.jobs = 1;
+        nested->nca_ctx.file = nested->file;
+        nested->nca_ctx.defer_print = 1;
+        nca_process(&nested->nca_ctx);
+    }
+}
+
+/* Process the NCAs of the container at path, each labelled by prefix and its name. Workers read
+ * through handles of their own, and hold back their messages, so that every NCA's are printed in
+ * order once all are done. Without a path to open, with a single job, or when extracting into a
+ * tar archive, which takes one member at a time, they are processed one by one through their file. */
+void nca_process_nested(nca_nested_t *ncas, uint32_t num_ncas, uint32_t num_jobs, const char *path, const char *prefix) {
+    uint32_t num_threads = num_ncas < num_jobs ? num_ncas : num_jobs;
+    for (uint32_t i = 0; i < num_ncas; i++) {
+        ncas[i].nca_ctx.file_path = path;
+    }
+    int has_tar = num_ncas && (ncas[0].tool_ctx.romfs_tar != NULL || ncas[0].tool_ctx.pfs0_tar != NULL);
+    if (path == NULL || num_threads <= 1 || has_tar) {
+        for (uint32_t i = 0; i < num_ncas; i++) {
+            printf("\n%s%s\n", prefix, ncas[i].nca_ctx.file_name);
+            nca_process(&ncas[i].nca_ctx);
+        }
+        return;
+    }
+
+    nca_nested_pool_t pool;
+    pool.ncas = ncas;
+    pool.num_ncas = num_ncas;
+    pool.path = path;
+    atomic_init(&pool.next_nca, 0);
+    atomic_init(&pool.stop, 0);
+    run_workers(num_threads, nca_nested_worker, &pool, &pool.stop);
+
+    for (uint32_t i = 0; i < num_ncas; i++) {
+        nca_ctx_t *nca_ctx = &ncas[i].nca_ctx;
+        printf("\n%s%s\n", prefix, nca_ctx->file_name);
+        nca_output_flush(&nca_ctx->verify_output);
+        if ((nca_ctx->tool_ctx->action & ACTION_INFO) && nca_ctx->header.magic == MAGIC_NCA3) {
+            nca_print(nca_ctx);
+        }
+        nca_output_flush(&nca_ctx->save_output);
+    }
+}
+
+void nca_free_nested(nca_nested_t *ncas, uint32_t num_ncas) {
+    for (uint32_t i = 0; i < num_ncas; i++) {
+        nca_free_section_contexts(&ncas[i].nca_ctx);
+        if (ncas[i].file != NULL) {
+            fclose(ncas[i].file);
+        }
+    }
 }
 
 /* Decrypt NCA header. */
 int nca_decrypt_header(nca_ctx_t *ctx) {
-    fseeko64(ctx->file, 0, SEEK_SET);
+    fseeko64(ctx->file, ctx->file_offset, SEEK_SET);
     if (fread(&ctx->header, 1, 0xC00, ctx->file) != 0xC00) {
         fprintf(stderr, "Failed to read NCA header!\n");
         return 0;
@@ -593,7 +1217,7 @@ void nca_print_key_area(nca_ctx_t *ctx) {
 char *nca_get_section_type(nca_section_ctx_t *meta) {
     switch (meta->type) {
         case PFS0: {
-            if (meta->pfs0_ctx.is_exefs) return "ExeFS";
+            if (nca_section_get_pfs0_header(meta) != NULL && meta->pfs0_ctx.is_exefs) return "ExeFS";
             return "PFS0";
         }
         case ROMFS:     return "RomFS";
@@ -613,7 +1237,13 @@ void nca_print_sections(nca_ctx_t *ctx) {
             printf("        Offset:                     0x%012"PRIx64"\n", ctx->section_contexts[i].offset);
             printf("        Size:                       0x%012"PRIx64"\n", ctx->section_contexts[i].size);
             printf("        Partition Type:             %s\n", nca_get_section_type(&ctx->section_contexts[i]));
-            memdump(stdout, "        Section CTR:                ", &ctx->section_contexts[i].ctr, 16);
+            /* Show the section's starting counter, not wherever the last read left it. */
+            unsigned char ctr[0x10];
+            for (unsigned int j = 0; j < 0x8; j++) {
+                ctr[j] = ctx->section_contexts[i].header->section_ctr[0x8-j-1];
+            }
+            nca_update_ctr(ctr, ctx->section_contexts[i].offset);
+            memdump(stdout, "        Section CTR:                ", ctr, 16);
             switch (ctx->section_contexts[i].type) {
                 case PFS0:     {
                     nca_print_pfs0_section(&ctx->section_contexts[i]);
@@ -638,11 +1268,47 @@ void nca_print_sections(nca_ctx_t *ctx) {
 }
 
 /* Print out information about the NCA. */
+/* Like section facts, signatures and the NPDM are only looked at when something prints them. */
+validity_t nca_get_fixed_sig_validity(nca_ctx_t *ctx) {
+    if (ctx->fixed_sig_validity == VALIDITY_UNCHECKED) {
+        if (rsa2048_pss_verify(&ctx->header.magic, 0x200, ctx->header.fixed_key_sig, ctx->tool_ctx->settings.keyset.nca_hdr_fixed_key_modulus)) {
+            ctx->fixed_sig_validity = VALIDITY_VALID;
+        } else {
+            ctx->fixed_sig_validity = VALIDITY_INVALID;
+        }
+    }
+    return ctx->fixed_sig_validity;
+}
+
+npdm_t *nca_get_npdm(nca_ctx_t *ctx) {
+    if (!ctx->did_find_npdm) {
+        ctx->did_find_npdm = 1;
+        for (unsigned int i = 0; i < 4; i++) {
+            nca_section_ctx_t *section = &ctx->section_contexts[i];
+            if (section->is_present && section->type == PFS0 && nca_section_get_pfs0_header(section) != NULL && section->pfs0_ctx.is_exefs) {
+                ctx->npdm = section->pfs0_ctx.npdm;
+            }
+        }
+    }
+    return ctx->npdm;
+}
+
+validity_t nca_get_npdm_sig_validity(nca_ctx_t *ctx) {
+    if (ctx->npdm_sig_validity == VALIDITY_UNCHECKED && nca_get_npdm(ctx) != NULL) {
+        if (rsa2048_pss_verify(&ctx->header.magic, 0x200, ctx->header.npdm_key_sig, npdm_get_acid(ctx->npdm)->modulus)) {
+            ctx->npdm_sig_validity = VALIDITY_VALID;
+        } else {
+            ctx->npdm_sig_validity = VALIDITY_INVALID;
+        }
+    }
+    return ctx->npdm_sig_validity;
+}
+
 void nca_print(nca_ctx_t *ctx) {
     printf("\nNCA:\n");
     print_magic("Magic:                         ", ctx->header.magic);
 
-    if (ctx->tool_ctx->action & ACTION_VERIFY && ctx->fixed_sig_validity != VALIDITY_UNCHECKED) {
+    if (ctx->tool_ctx->action & ACTION_VERIFY && nca_get_fixed_sig_validity(ctx) != VALIDITY_UNCHECKED) {
         if (ctx->fixed_sig_validity == VALIDITY_VALID) {
             memdump(stdout, "Fixed-Key Signature (GOOD):         ", &ctx->header.fixed_key_sig, 0x100);
         } else {
@@ -651,7 +1317,7 @@ void nca_print(nca_ctx_t *ctx) {
     } else {
         memdump(stdout, "Fixed-Key Signature:                ", &ctx->header.fixed_key_sig, 0x100);
     }
-    if (ctx->tool_ctx->action & ACTION_VERIFY && ctx->npdm_sig_validity != VALIDITY_UNCHECKED) {
+    if (ctx->tool_ctx->action & ACTION_VERIFY && nca_get_npdm_sig_validity(ctx) != VALIDITY_UNCHECKED) {
         if (ctx->npdm_sig_validity == VALIDITY_VALID) {
             memdump(stdout, "NPDM Signature (GOOD):              ", &ctx->header.npdm_key_sig, 0x100);
         } else {
@@ -661,6 +1327,13 @@ void nca_print(nca_ctx_t *ctx) {
          memdump(stdout, "NPDM Signature:                     ", &ctx->header.npdm_key_sig, 0x100);
     }
     printf("Content Size:                       0x%012"PRIx64"\n", ctx->header.nca_size);
+    if ((ctx->tool_ctx->action & ACTION_VERIFY) && ctx->has_content_hash) {
+        /* Only verification reports it, so that plain info and extraction print as they always have. */
+        memdump(stdout, "Content Hash:                       ", ctx->content_hash, 0x20);
+        if (ctx->content_id_validity != VALIDITY_UNCHECKED) {
+            printf("Content ID:                         %s\n", GET_VALIDITY_STR(ctx->content_id_validity));
+        }
+    }
     printf("Title ID:                           %016"PRIx64"\n", ctx->header.title_id);
     printf("SDK Version:                        %"PRId8".%"PRId8".%"PRId8".%"PRId8"\n", ctx->header.sdk_major, ctx->header.sdk_minor, ctx->header.sdk_micro, ctx->header.sdk_revision);
     printf("Distribution type:                  %s\n", nca_get_distribution_type(ctx));
@@ -679,7 +1352,7 @@ void nca_print(nca_ctx_t *ctx) {
         nca_print_key_area(ctx);
     }
 
-    if (ctx->npdm) {
+    if (nca_get_npdm(ctx)) {
         npdm_print(ctx->npdm, ctx->tool_ctx);
     }
 
@@ -688,7 +1361,109 @@ void nca_print(nca_ctx_t *ctx) {
     printf("\n");
 }
 
-validity_t nca_section_check_external_hash_table(nca_section_ctx_t *ctx, unsigned char *hash_table, uint64_t data_ofs, uint64_t data_len, uint64_t block_size, int full_block) {
+/* Pick a reproducible subset of blocks for sampled verification. */
+static int nca_is_sampled_block(nca_section_ctx_t *ctx, uint64_t block, uint32_t sample_percent) {
+    uint64_t x = ctx->tool_ctx->settings.sample_seed ^ (ctx->offset + block * 0x9E3779B97F4A7C15ULL);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x % 100 < sample_percent;
+}
+
+static void nca_scan_worker(void *arg) {
+    nca_scan_ctx_t *scan = arg;
+    /* Reads move the section's file position and CTR, so each thread reads through a copy of its own. */
+    nca_section_ctx_t section = *scan->section;
+    if ((section.file = split_fopen(section.nca->file_path)) == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", section.nca->file_path);
+        fatal_exit();
+    }
+    section.aes = nca_new_section_aes_ctx(section.nca, section.section_num);
+    unsigned char *block = malloc(scan->block_size);
+    if (block == NULL) {
+        fprintf(stderr, "Failed to allocate hash block!\n");
+        fatal_exit();
+    }
+    unsigned char cur_hash[0x20];
+    uint64_t c;
+    while (!atomic_load(&scan->stop) && (c = atomic_fetch_add(&scan->next_chunk, 1)) < scan->num_chunks) {
+        uint64_t end_block = (c + 1) * scan->chunk_blocks < scan->num_blocks ? (c + 1) * scan->chunk_blocks : scan->num_blocks;
+        for (uint64_t b = c * scan->chunk_blocks; b < end_block; b++) {
+            if (scan->sample_percent < 100 && !nca_is_sampled_block(&section, b, scan->sample_percent)) {
+                continue;
+            }
+            uint64_t ofs = b * scan->block_size;
+            uint64_t read_size = scan->data_len - ofs < scan->block_size ? scan->data_len - ofs : scan->block_size;
+            if (read_size < scan->block_size) {
+                memset(block, 0, scan->block_size);
+            }
+            nca_section_fseek(&section, scan->data_ofs + ofs);
+            if (nca_section_fread(&section, block, read_size) != read_size) {
+                fprintf(stderr, "Failed to read section!\n");
+                fatal_exit();
+            }
+            sha256_hash_buffer(cur_hash, block, scan->full_block ? scan->block_size : read_size);
+            scan->is_bad[b] = memcmp(cur_hash, scan->hash_table + b * 0x20, 0x20) != 0;
+            atomic_fetch_add(&scan->num_checked, 1);
+        }
+    }
+    free(block);
+    if (section.aes != NULL) {
+        free_aes_ctx(section.aes);
+    }
+    fclose(section.file);
+}
+
+/* Map every failing block of a hash level on --jobs threads. Returns 0, without checking anything,
+ * if the section can't be read by more than one. */
+static int nca_section_scan_hash_table(nca_section_ctx_t *ctx, unsigned char *hash_table, uint64_t data_ofs, uint64_t data_len, uint64_t block_size, int full_block, uint32_t sample_percent, corruption_list_t *damage, validity_t *result) {
+    uint32_t num_jobs = ctx->tool_ctx->settings.jobs ? ctx->tool_ctx->settings.jobs : HACTOOL_DEFAULT_JOBS;
+    if (num_jobs <= 1 || ctx->nca == NULL || ctx->nca->file_path == NULL || ctx->type == BKTR) {
+        return 0;
+    }
+    nca_scan_ctx_t scan;
+    memset(&scan, 0, sizeof(scan));
+    scan.section = ctx;
+    scan.hash_table = hash_table;
+    scan.data_ofs = data_ofs;
+    scan.data_len = data_len;
+    scan.block_size = block_size;
+    scan.full_block = full_block;
+    scan.sample_percent = sample_percent;
+    scan.num_blocks = (data_len + block_size - 1) / block_size;
+    scan.chunk_blocks = block_size < NCA_SCAN_CHUNK_SIZE ? NCA_SCAN_CHUNK_SIZE / block_size : 1;
+    scan.num_chunks = (scan.num_blocks + scan.chunk_blocks - 1) / scan.chunk_blocks;
+    if (scan.num_chunks <= 1) {
+        return 0;
+    }
+    if ((scan.is_bad = calloc(scan.num_blocks, 1)) == NULL) {
+        fprintf(stderr, "Failed to allocate corruption scan!\n");
+        fatal_exit();
+    }
+    atomic_init(&scan.num_checked, 0);
+    atomic_init(&scan.next_chunk, 0);
+    atomic_init(&scan.stop, 0);
+    run_workers(scan.num_chunks < num_jobs ? (uint32_t)scan.num_chunks : num_jobs, nca_scan_worker, &scan, &scan.stop);
+
+    /* Ranges are added in order, so they coalesce as they would in a serial scan. */
+    *result = VALIDITY_VALID;
+    damage->block_size = block_size;
+    damage->num_blocks += atomic_load(&scan.num_checked);
+    for (uint64_t b = 0; b < scan.num_blocks; b++) {
+        if (scan.is_bad[b]) {
+            uint64_t ofs = b * block_size;
+            uint64_t read_size = data_len - ofs < block_size ? data_len - ofs : block_size;
+            *result = VALIDITY_INVALID;
+            damage->num_bad_blocks++;
+            corruption_list_add(damage, data_ofs + ofs, data_ofs + ofs + read_size);
+        }
+    }
+    free(scan.is_bad);
+    return 1;
+}
+
+/* Check blocks against a hash table. With sample_percent below 100, only that share of blocks is hashed. */
+validity_t nca_section_check_external_hash_table(nca_section_ctx_t *ctx, unsigned char *hash_table, uint64_t data_ofs, uint64_t data_len, uint64_t block_size, int full_block, uint32_t sample_percent, corruption_list_t *damage) {
     if (block_size == 0) {
         /* Block size of 0 is always invalid. */
         return VALIDITY_INVALID;
@@ -698,12 +1473,24 @@ validity_t nca_section_check_external_hash_table(nca_section_ctx_t *ctx, unsigne
     unsigned char *block = malloc(block_size);
     if (block == NULL) {
         fprintf(stderr, "Failed to allocate hash block!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     validity_t result = VALIDITY_VALID;
+    if (damage != NULL) {
+        /* A corruption map needs every block checked, which several threads can share. */
+        if (nca_section_scan_hash_table(ctx, hash_table, data_ofs, data_len, block_size, full_block, sample_percent, damage, &result)) {
+            free(block);
+            return result;
+        }
+        damage->block_size = block_size;
+    }
     unsigned char *cur_hash_table_entry = hash_table;
     for (uint64_t ofs = 0; ofs < data_len; ofs += read_size) {
+        if (sample_percent < 100 && !nca_is_sampled_block(ctx, ofs / block_size, sample_percent)) {
+            cur_hash_table_entry += 0x20;
+            continue;
+        }
         nca_section_fseek(ctx, ofs + data_ofs);
         if (ofs + read_size > data_len) {
             /* Last block... */
@@ -716,12 +1503,21 @@ validity_t nca_section_check_external_hash_table(nca_section_ctx_t *ctx, unsigne
             fprintf(stderr, "%012"PRIx64" %012"PRIx64" %08"PRIx64"\n", ofs, data_len, r);
             fprintf(stderr, "%d %d\n", ctx->is_decrypted, ctx->section_num);
             fprintf(stderr, "Failed to read section!\n");
-            exit(EXIT_FAILURE);
+            free(block);
+            fatal_exit();
         }        
         sha256_hash_buffer(cur_hash, block, full_block ? block_size : read_size);
+        if (damage != NULL) {
+            damage->num_blocks++;
+        }
         if (memcmp(cur_hash, cur_hash_table_entry, 0x20) != 0) {
             result = VALIDITY_INVALID;
-            break;
+            if (damage == NULL) {
+                break;
+            }
+            /* Mapping corruption: record the block and keep going. */
+            damage->num_bad_blocks++;
+            corruption_list_add(damage, data_ofs + ofs, data_ofs + ofs + read_size);
         }
         cur_hash_table_entry += 0x20;
     }
@@ -731,7 +1527,7 @@ validity_t nca_section_check_external_hash_table(nca_section_ctx_t *ctx, unsigne
 
 }
 
-validity_t nca_section_check_hash_table(nca_section_ctx_t *ctx, uint64_t hash_ofs, uint64_t data_ofs, uint64_t data_len, uint64_t block_size, int full_block) {
+validity_t nca_section_check_hash_table(nca_section_ctx_t *ctx, uint64_t hash_ofs, uint64_t data_ofs, uint64_t data_len, uint64_t block_size, int full_block, uint32_t sample_percent, corruption_list_t *damage) {
     if (block_size == 0) {
         /* Block size of 0 is always invalid. */
         return VALIDITY_INVALID;
@@ -742,76 +1538,154 @@ validity_t nca_section_check_hash_table(nca_section_ctx_t *ctx, uint64_t hash_of
     unsigned char *hash_table = malloc(hash_table_size);
     if (hash_table == NULL) {
         fprintf(stderr, "Failed to allocate hash table!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     nca_section_fseek(ctx, hash_ofs);
     if (nca_section_fread(ctx, hash_table, hash_table_size) != hash_table_size) {
         fprintf(stderr, "Failed to read section!\n");
-        exit(EXIT_FAILURE);
+        free(hash_table);
+        fatal_exit();
     }
 
-    validity_t result = nca_section_check_external_hash_table(ctx, hash_table, data_ofs, data_len, block_size, full_block);
+    validity_t result = nca_section_check_external_hash_table(ctx, hash_table, data_ofs, data_len, block_size, full_block, sample_percent, damage);
 
     free(hash_table);
 
     return result;
 }
 
+/* Where a hash level records failing blocks, or NULL when not mapping corruption. */
+static corruption_list_t *nca_get_corruption_list(nca_section_ctx_t *ctx, unsigned int level) {
+    return ctx->corruption != NULL ? &ctx->corruption[level] : NULL;
+}
+
+/* Share of data blocks to hash under the section's verification tier. */
+static uint32_t nca_get_sample_percent(nca_section_ctx_t *ctx) {
+    return ctx->verify_tier == VERIFY_TIER_SAMPLED ? ctx->tool_ctx->settings.sample_percent : 100;
+}
+
+/* Upper IVFC levels are always checked in full; the tier only decides how much of the data level is hashed. */
+static validity_t nca_section_check_ivfc_level(nca_section_ctx_t *ctx, ivfc_level_ctx_t *level, unsigned int i) {
+    uint32_t sample_percent = 100;
+    if (i == IVFC_MAX_LEVEL - 1) {
+        if (ctx->verify_tier == VERIFY_TIER_QUICK) {
+            return VALIDITY_UNCHECKED;
+        }
+        sample_percent = nca_get_sample_percent(ctx);
+    }
+    if (sample_percent < 100) {
+        nca_output_printf(nca_get_verify_output(ctx->nca), "    Verifying IVFC Level %"PRId32" (sampled %"PRIu32"%%)...\n", i, sample_percent);
+    } else {
+        nca_output_printf(nca_get_verify_output(ctx->nca), "    Verifying IVFC Level %"PRId32"...\n", i);
+    }
+    trace_span_t span;
+    trace_begin(&span);
+    validity_t validity = nca_section_check_hash_table(ctx, level->hash_offset, level->data_offset, level->data_size, level->hash_block_size, 1, sample_percent, nca_get_corruption_list(ctx, i));
+    trace_end(&span, "IVFC verify", ctx->section_num, "level %u", i);
+    return validity;
+}
+
+/* Describe a data-level result together with the tier that produced it. */
+static const char *nca_get_tier_validity_str(nca_section_ctx_t *ctx, validity_t validity, char *buf, size_t buf_size) {
+    switch (ctx->verify_tier) {
+        case VERIFY_TIER_QUICK:
+            return "UNCHECKED, quick";
+        case VERIFY_TIER_SAMPLED:
+            snprintf(buf, buf_size, "%s, sampled %"PRIu32"%%", GET_VALIDITY_STR(validity), ctx->tool_ctx->settings.sample_percent);
+            return buf;
+        default:
+            return GET_VALIDITY_STR(validity);
+    }
+}
+
 void nca_save_pfs0_file(nca_section_ctx_t *ctx, uint32_t i, filepath_t *dirpath) {
     if (i >= ctx->pfs0_ctx.header->num_files) {
         fprintf(stderr, "Could not save file %"PRId32"!\n", i);
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     pfs0_file_entry_t *cur_file = pfs0_get_file_entry(ctx->pfs0_ctx.header, i);
     if (cur_file->size >= ctx->size) {
         fprintf(stderr, "File %"PRId32" too big in PFS0 (section %"PRId32")!\n", i, ctx->section_num);
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     if (strlen(pfs0_get_file_name(ctx->pfs0_ctx.header, i)) >= MAX_PATH - strlen(dirpath->char_path) - 1) {
         fprintf(stderr, "Filename too long in PFS0!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     filepath_t filepath;
     filepath_copy(&filepath, dirpath);
     filepath_append(&filepath, "%s", pfs0_get_file_name(ctx->pfs0_ctx.header, i));
 
-    printf("Saving %s to %s...\n", pfs0_get_file_name(ctx->pfs0_ctx.header, i), filepath.char_path);
     uint64_t ofs = ctx->pfs0_ctx.superblock->pfs0_offset + pfs0_get_header_size(ctx->pfs0_ctx.header) + cur_file->offset;
-    nca_save_section_file(ctx, ofs, cur_file->size, &filepath);
+    if (ctx->tool_ctx->pfs0_tar != NULL) {
+        unsigned char hash[0x20];
+        nca_output_printf(nca_get_save_output(ctx->nca), "Archiving %s...\n", pfs0_get_file_name(ctx->pfs0_ctx.header, i));
+        if (ctx->fanout != NULL) {
+            fanout_add_tar_file(ctx->fanout, ctx, ofs, cur_file->size, ctx->tool_ctx->pfs0_tar, filepath.char_path);
+            return;
+        }
+        trace_span_t span;
+        trace_begin(&span);
+        tar_begin_file(ctx->tool_ctx->pfs0_tar, filepath.char_path, cur_file->size);
+        nca_write_section_file(ctx, ofs, cur_file->size, ctx->tool_ctx->pfs0_tar->file, ctx->tool_ctx->manifest != NULL ? hash : NULL, 0);
+        manifest_add(ctx->tool_ctx->manifest, ctx->tool_ctx->pfs0_tar->cur_name, cur_file->size, hash);
+        tar_end_file(ctx->tool_ctx->pfs0_tar);
+        trace_end(&span, "extract file", ctx->section_num, "%s", filepath.char_path);
+    } else {
+        nca_output_printf(nca_get_save_output(ctx->nca), "Saving %s to %s...\n", pfs0_get_file_name(ctx->pfs0_ctx.header, i), filepath.char_path);
+        nca_save_section_file(ctx, ofs, cur_file->size, &filepath, 0);
+    }
 }
 
 
-void nca_process_pfs0_section(nca_section_ctx_t *ctx) {
-    pfs0_superblock_t *sb = ctx->pfs0_ctx.superblock;
-    ctx->superblock_hash_validity = nca_section_check_external_hash_table(ctx, sb->master_hash, sb->hash_table_offset, sb->hash_table_size, sb->hash_table_size, 0);    
-    if (ctx->tool_ctx->action & ACTION_VERIFY) {
-        /* Verify actual PFS0... */
-        ctx->pfs0_ctx.hash_table_validity = nca_section_check_hash_table(ctx, sb->hash_table_offset, sb->pfs0_offset, sb->pfs0_size, sb->block_size, 0);
+/* Section facts below are computed on first use, so that each action only reads what it needs. */
+validity_t nca_section_get_superblock_validity(nca_section_ctx_t *ctx) {
+    if (ctx->superblock_hash_validity != VALIDITY_UNCHECKED) {
+        return ctx->superblock_hash_validity;
     }
+    if (ctx->type == PFS0) {
+        pfs0_superblock_t *sb = ctx->pfs0_ctx.superblock;
+        ctx->superblock_hash_validity = nca_section_check_external_hash_table(ctx, sb->master_hash, sb->hash_table_offset, sb->hash_table_size, sb->hash_table_size, 0, 100, nca_get_corruption_list(ctx, 0));
+    } else if (ctx->type == ROMFS) {
+        /* Hash table is the superblock hash. */
+        romfs_superblock_t *sb = ctx->romfs_ctx.superblock;
+        ivfc_level_ctx_t *level = &ctx->romfs_ctx.ivfc_levels[0];
+        ctx->superblock_hash_validity = nca_section_check_external_hash_table(ctx, sb->ivfc_header.master_hash, level->data_offset, level->data_size, level->hash_block_size, 1, 100, nca_get_corruption_list(ctx, 0));
+        level->hash_validity = ctx->superblock_hash_validity;
+    }
+    return ctx->superblock_hash_validity;
+}
 
-    if (ctx->superblock_hash_validity != VALIDITY_VALID) return;
+/* Read the PFS0 header, and the NPDM if this is an ExeFS. Returns NULL if the superblock is bad. */
+pfs0_header_t *nca_section_get_pfs0_header(nca_section_ctx_t *ctx) {
+    if (ctx->did_load_meta) {
+        return ctx->pfs0_ctx.header;
+    }
+    ctx->did_load_meta = 1;
+    pfs0_superblock_t *sb = ctx->pfs0_ctx.superblock;
+    if (nca_section_get_superblock_validity(ctx) != VALIDITY_VALID) return NULL;
 
     /* Read *just* safe amount. */
     pfs0_header_t raw_header; 
     nca_section_fseek(ctx, sb->pfs0_offset);
     if (nca_section_fread(ctx, &raw_header, sizeof(raw_header)) != sizeof(raw_header)) {
         fprintf(stderr, "Failed to read PFS0 header!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     uint64_t header_size = pfs0_get_header_size(&raw_header);
     ctx->pfs0_ctx.header = malloc(header_size);
     if (ctx->pfs0_ctx.header == NULL) {
         fprintf(stderr, "Failed to get PFS0 header size!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     nca_section_fseek(ctx, sb->pfs0_offset);
     if (nca_section_fread(ctx, ctx->pfs0_ctx.header, header_size) != header_size) {
         fprintf(stderr, "Failed to read PFS0 header!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     for (unsigned int i = 0; i < ctx->pfs0_ctx.header->num_files; i++) {
@@ -820,18 +1694,18 @@ void nca_process_pfs0_section(nca_section_ctx_t *ctx) {
             /* We might have found the exefs... */
             if (cur_file->size >= sb->pfs0_size) {
                 fprintf(stderr, "NPDM too big!\n");
-                exit(EXIT_FAILURE);
+                fatal_exit();
             }
 
             ctx->pfs0_ctx.npdm = malloc(cur_file->size);
             if (ctx->pfs0_ctx.npdm == NULL) {
                 fprintf(stderr, "Failed to allocate NPDM!\n");
-                exit(EXIT_FAILURE);
+                fatal_exit();
             }
             nca_section_fseek(ctx, sb->pfs0_offset + pfs0_get_header_size(ctx->pfs0_ctx.header) + cur_file->offset);
             if (nca_section_fread(ctx, ctx->pfs0_ctx.npdm, cur_file->size) != cur_file->size) {
                 fprintf(stderr, "Failed to read NPDM!\n");
-                exit(EXIT_FAILURE);
+                fatal_exit();
             }
 
             if (ctx->pfs0_ctx.npdm->magic == MAGIC_META) {
@@ -839,63 +1713,91 @@ void nca_process_pfs0_section(nca_section_ctx_t *ctx) {
             }
         }
     }
+    return ctx->pfs0_ctx.header;
 }
 
-
-void nca_process_ivfc_section(nca_section_ctx_t *ctx) {
-    romfs_superblock_t *sb = ctx->romfs_ctx.superblock;
-    for (unsigned int i = 0; i < IVFC_MAX_LEVEL; i++) {
-        /* Load in the current level's header data. */
-        ivfc_level_ctx_t *cur_level = &ctx->romfs_ctx.ivfc_levels[i];
-        cur_level->data_offset = sb->ivfc_header.level_headers[i].logical_offset;
-        cur_level->data_size = sb->ivfc_header.level_headers[i].hash_data_size;
-        cur_level->hash_block_size = 1 << sb->ivfc_header.level_headers[i].block_size;
-
-        if (i != 0) {
-            /* Hash table is previous level's data. */
-            cur_level->hash_offset = ctx->romfs_ctx.ivfc_levels[i-1].data_offset;
-        } else {
-            /* Hash table is the superblock hash. Always check the superblock hash. */
-            ctx->superblock_hash_validity = nca_section_check_external_hash_table(ctx, sb->ivfc_header.master_hash, cur_level->data_offset, cur_level->data_size, cur_level->hash_block_size, 1);
-            cur_level->hash_validity = ctx->superblock_hash_validity;
-        }
-        if (ctx->tool_ctx->action & ACTION_VERIFY && i != 0) {
-            /* Actually check the table. */
-            printf("    Verifying IVFC Level %"PRId32"...\n", i);
-            cur_level->hash_validity = nca_section_check_hash_table(ctx, cur_level->hash_offset, cur_level->data_offset, cur_level->data_size, cur_level->hash_block_size, 1);
-        }
+/* Read the RomFS header, and its directory and file tables if the header is sane. */
+void nca_section_load_romfs(nca_section_ctx_t *ctx) {
+    if (ctx->did_load_meta) {
+        return;
     }
-
-    ctx->romfs_ctx.romfs_offset = ctx->romfs_ctx.ivfc_levels[IVFC_MAX_LEVEL - 1].data_offset;
+    ctx->did_load_meta = 1;
     nca_section_fseek(ctx, ctx->romfs_ctx.romfs_offset);
     if (nca_section_fread(ctx, &ctx->romfs_ctx.header, sizeof(romfs_hdr_t)) != sizeof(romfs_hdr_t)) {
         fprintf(stderr, "Failed to read RomFS header!\n");
     }
 
-    if ((ctx->tool_ctx->action & (ACTION_EXTRACT | ACTION_LISTROMFS)) && ctx->romfs_ctx.header.header_size == ROMFS_HEADER_SIZE) {
+    if (ctx->romfs_ctx.header.header_size == ROMFS_HEADER_SIZE) {
         /* Pre-load the file/data entry caches. */
         ctx->romfs_ctx.directories = calloc(1, ctx->romfs_ctx.header.dir_meta_table_size);
         if (ctx->romfs_ctx.directories == NULL) {
             fprintf(stderr, "Failed to allocate RomFS directory cache!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
 
         /* Switch RomFS has actual entries at table offset + 4 for no good reason. */
         nca_section_fseek(ctx, ctx->romfs_ctx.romfs_offset + ctx->romfs_ctx.header.dir_meta_table_offset + 4);
         if (nca_section_fread(ctx, ctx->romfs_ctx.directories, ctx->romfs_ctx.header.dir_meta_table_size) != ctx->romfs_ctx.header.dir_meta_table_size) {
             fprintf(stderr, "Failed to read RomFS directory cache!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
 
         ctx->romfs_ctx.files = calloc(1, ctx->romfs_ctx.header.file_meta_table_size);
         if (ctx->romfs_ctx.files == NULL) {
             fprintf(stderr, "Failed to allocate RomFS file cache!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
         nca_section_fseek(ctx, ctx->romfs_ctx.romfs_offset + ctx->romfs_ctx.header.file_meta_table_offset);
         if (nca_section_fread(ctx, ctx->romfs_ctx.files, ctx->romfs_ctx.header.file_meta_table_size) != ctx->romfs_ctx.header.file_meta_table_size) {
             fprintf(stderr, "Failed to read RomFS file cache!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
+        }
+    }
+}
+
+void nca_process_pfs0_section(nca_section_ctx_t *ctx) {
+    pfs0_superblock_t *sb = ctx->pfs0_ctx.superblock;
+    if (ctx->tool_ctx->action & ACTION_VERIFY) {
+        nca_section_get_superblock_validity(ctx);
+        if (!ctx->verify_deferred && !ctx->verify_cached && ctx->verify_tier != VERIFY_TIER_QUICK) {
+            /* Verify actual PFS0... */
+            trace_span_t span;
+            trace_begin(&span);
+            ctx->pfs0_ctx.hash_table_validity = nca_section_check_hash_table(ctx, sb->hash_table_offset, sb->pfs0_offset, sb->pfs0_size, sb->block_size, 0, nca_get_sample_percent(ctx), nca_get_corruption_list(ctx, 1));
+            trace_end(&span, "PFS0 verify", ctx->section_num, NULL);
+        }
+    }
+}
+
+void nca_process_ivfc_section(nca_section_ctx_t *ctx) {
+    romfs_superblock_t *sb = ctx->romfs_ctx.superblock;
+    for (unsigned int i = 0; i < IVFC_MAX_LEVEL; i++) {
+        /* Load in the current level's header data. */
+        ivfc_level_ctx_t *cur_level = &ctx->romfs_ctx.ivfc_levels[i];
+        cur_level->data_offset = sb->ivfc_header.level_headers[i].logical_offset;
+        cur_level->data_size = sb->ivfc_header.level_headers[i].hash_data_size;
+        cur_level->hash_block_size = 1 << sb->ivfc_header.level_headers[i].block_size;
+
+        if (i != 0) {
+            /* Hash table is previous level's data. */
+            cur_level->hash_offset = ctx->romfs_ctx.ivfc_levels[i-1].data_offset;
+        }
+    }
+    ctx->romfs_ctx.romfs_offset = ctx->romfs_ctx.ivfc_levels[IVFC_MAX_LEVEL - 1].data_offset;
+
+    if (ctx->tool_ctx->action & ACTION_VERIFY) {
+        nca_section_get_superblock_validity(ctx);
+        if (ctx->verify_deferred) {
+            /* Checked in full by the fan-out pass. */
+            for (unsigned int i = 1; i < IVFC_MAX_LEVEL; i++) {
+                nca_output_printf(nca_get_verify_output(ctx->nca), "    Verifying IVFC Level %"PRId32"...\n", i);
+            }
+        } else if (!ctx->verify_cached) {
+            for (unsigned int i = 1; i < IVFC_MAX_LEVEL; i++) {
+                /* Actually check the table. */
+                ivfc_level_ctx_t *cur_level = &ctx->romfs_ctx.ivfc_levels[i];
+                cur_level->hash_validity = nca_section_check_ivfc_level(ctx, cur_level, i);
+            }
         }
     }
 }
@@ -907,29 +1809,29 @@ void nca_process_bktr_section(nca_section_ctx_t *ctx) {
         if (sb->relocation_header.offset + sb->relocation_header.size != sb->subsection_header.offset ||
             sb->subsection_header.offset + sb->subsection_header.size != ctx->size) {
             fprintf(stderr, "Invalid BKTR layout!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
         /* Allocate space for an extra (fake) relocation entry, to simplify our logic. */
         void *relocs = calloc(1, sb->relocation_header.size + sizeof(bktr_relocation_entry_t));
         if (relocs == NULL) {
             fprintf(stderr, "Failed to allocate relocation header!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
         /* Allocate space for an extra (fake) subsection entry, to simplify our logic. */
         void *subs = calloc(1, sb->subsection_header.size + sizeof(bktr_subsection_entry_t));
         if (subs == NULL) {
             fprintf(stderr, "Failed to allocate subsection header!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
         nca_section_fseek(ctx, sb->relocation_header.offset);
         if (nca_section_fread(ctx, relocs, sb->relocation_header.size) != sb->relocation_header.size) {
             fprintf(stderr, "Failed to read relocation header!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
         nca_section_fseek(ctx, sb->subsection_header.offset);
         if (nca_section_fread(ctx, subs, sb->subsection_header.size) != sb->subsection_header.size) {
             fprintf(stderr, "Failed to read subsection header!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
         
         /* NOTE: Setting these variables changes the way fseek/fread work! */
@@ -955,13 +1857,12 @@ void nca_process_bktr_section(nca_section_ctx_t *ctx) {
                 cur_level->hash_offset = ctx->bktr_ctx.ivfc_levels[i-1].data_offset;
             } else if (ctx->tool_ctx->base_file != NULL) {
                 /* Hash table is the superblock hash. Always check the superblock hash. */
-                ctx->superblock_hash_validity = nca_section_check_external_hash_table(ctx, sb->ivfc_header.master_hash, cur_level->data_offset, cur_level->data_size, cur_level->hash_block_size, 1);
+                ctx->superblock_hash_validity = nca_section_check_external_hash_table(ctx, sb->ivfc_header.master_hash, cur_level->data_offset, cur_level->data_size, cur_level->hash_block_size, 1, 100, nca_get_corruption_list(ctx, 0));
                 cur_level->hash_validity = ctx->superblock_hash_validity;
             }
             if (ctx->tool_ctx->action & ACTION_VERIFY && i != 0) {
                 /* Actually check the table. */
-                printf("    Verifying IVFC Level %"PRId32"...\n", i);
-                cur_level->hash_validity = nca_section_check_hash_table(ctx, cur_level->hash_offset, cur_level->data_offset, cur_level->data_size, cur_level->hash_block_size, 1);
+                cur_level->hash_validity = nca_section_check_ivfc_level(ctx, cur_level, i);
             }
         }
 
@@ -977,24 +1878,24 @@ void nca_process_bktr_section(nca_section_ctx_t *ctx) {
                 ctx->bktr_ctx.directories = calloc(1, ctx->bktr_ctx.header.dir_meta_table_size);
                 if (ctx->bktr_ctx.directories == NULL) {
                     fprintf(stderr, "Failed to allocate RomFS directory cache!\n");
-                    exit(EXIT_FAILURE);
+                    fatal_exit();
                 }
 
                 /* Switch RomFS has actual entries at table offset + 4 for no good reason. */
                 nca_section_fseek(ctx, ctx->bktr_ctx.romfs_offset + ctx->bktr_ctx.header.dir_meta_table_offset + 4);
                 if (nca_section_fread(ctx, ctx->bktr_ctx.directories, ctx->bktr_ctx.header.dir_meta_table_size) != ctx->bktr_ctx.header.dir_meta_table_size) {
                     fprintf(stderr, "Failed to read RomFS directory cache!\n");
-                    exit(EXIT_FAILURE);
+                    fatal_exit();
                 }
                 ctx->bktr_ctx.files = calloc(1, ctx->bktr_ctx.header.file_meta_table_size);
                 if (ctx->bktr_ctx.files == NULL) {
                     fprintf(stderr, "Failed to allocate RomFS file cache!\n");
-                    exit(EXIT_FAILURE);
+                    fatal_exit();
                 }
                 nca_section_fseek(ctx, ctx->bktr_ctx.romfs_offset + ctx->bktr_ctx.header.file_meta_table_offset);
                 if (nca_section_fread(ctx, ctx->bktr_ctx.files, ctx->bktr_ctx.header.file_meta_table_size) != ctx->bktr_ctx.header.file_meta_table_size) {
                     fprintf(stderr, "Failed to read RomFS file cache!\n");
-                    exit(EXIT_FAILURE);
+                    fatal_exit();
                 }
             }
         }
@@ -1003,12 +1904,13 @@ void nca_process_bktr_section(nca_section_ctx_t *ctx) {
 
 void nca_print_pfs0_section(nca_section_ctx_t *ctx) {
     if (ctx->tool_ctx->action & ACTION_VERIFY) {
-        if (ctx->superblock_hash_validity == VALIDITY_VALID) {
+        if (nca_section_get_superblock_validity(ctx) == VALIDITY_VALID) {
             memdump(stdout, "        Superblock Hash (GOOD):     ", &ctx->pfs0_ctx.superblock->master_hash, 0x20);
         } else {
             memdump(stdout, "        Superblock Hash (FAIL):     ", &ctx->pfs0_ctx.superblock->master_hash, 0x20);
         }
-        printf("        Hash Table (%s):\n", GET_VALIDITY_STR(ctx->pfs0_ctx.hash_table_validity));
+        char tier_str[0x40];
+        printf("        Hash Table (%s):\n", nca_get_tier_validity_str(ctx, ctx->pfs0_ctx.hash_table_validity, tier_str, sizeof(tier_str)));
     } else {
         memdump(stdout, "        Superblock Hash:            ", &ctx->pfs0_ctx.superblock->master_hash, 0x20);
         printf("        Hash Table:\n");
@@ -1022,7 +1924,7 @@ void nca_print_pfs0_section(nca_section_ctx_t *ctx) {
 
 void nca_print_ivfc_section(nca_section_ctx_t *ctx) {
     if (ctx->tool_ctx->action & ACTION_VERIFY) {
-        if (ctx->superblock_hash_validity == VALIDITY_VALID) {
+        if (nca_section_get_superblock_validity(ctx) == VALIDITY_VALID) {
             memdump(stdout, "        Superblock Hash (GOOD):     ",  &ctx->romfs_ctx.superblock->ivfc_header.master_hash, 0x20);
         } else {
             memdump(stdout, "        Superblock Hash (FAIL):     ",  &ctx->romfs_ctx.superblock->ivfc_header.master_hash, 0x20);
@@ -1034,7 +1936,12 @@ void nca_print_ivfc_section(nca_section_ctx_t *ctx) {
     printf("        ID:                         %08"PRIx32"\n", ctx->romfs_ctx.superblock->ivfc_header.id);
     for (unsigned int i = 0; i < IVFC_MAX_LEVEL; i++) {
         if (ctx->tool_ctx->action & ACTION_VERIFY) {
-            printf("        Level %"PRId32" (%s):\n", i, GET_VALIDITY_STR(ctx->romfs_ctx.ivfc_levels[i].hash_validity));
+            char tier_str[0x40];
+            const char *validity_str = GET_VALIDITY_STR(ctx->romfs_ctx.ivfc_levels[i].hash_validity);
+            if (i == IVFC_MAX_LEVEL - 1) {
+                validity_str = nca_get_tier_validity_str(ctx, ctx->romfs_ctx.ivfc_levels[i].hash_validity, tier_str, sizeof(tier_str));
+            }
+            printf("        Level %"PRId32" (%s):\n", i, validity_str);
         } else {
             printf("        Level %"PRId32":\n", i);
         }
@@ -1064,7 +1971,12 @@ void nca_print_bktr_section(nca_section_ctx_t *ctx) {
     printf("        ID:                         %08"PRIx32"\n", ctx->bktr_ctx.superblock->ivfc_header.id);
     for (unsigned int i = 0; i < IVFC_MAX_LEVEL; i++) {
         if (did_verify) {
-            printf("        Level %"PRId32" (%s):\n", i, GET_VALIDITY_STR(ctx->bktr_ctx.ivfc_levels[i].hash_validity));
+            char tier_str[0x40];
+            const char *validity_str = GET_VALIDITY_STR(ctx->bktr_ctx.ivfc_levels[i].hash_validity);
+            if (i == IVFC_MAX_LEVEL - 1) {
+                validity_str = nca_get_tier_validity_str(ctx, ctx->bktr_ctx.ivfc_levels[i].hash_validity, tier_str, sizeof(tier_str));
+            }
+            printf("        Level %"PRId32" (%s):\n", i, validity_str);
         } else {
             printf("        Level %"PRId32":\n", i);
         }
@@ -1075,39 +1987,94 @@ void nca_print_bktr_section(nca_section_ctx_t *ctx) {
     }
 }
 
-void nca_save_section_file(nca_section_ctx_t *ctx, uint64_t ofs, uint64_t total_size, filepath_t *filepath) {    
-    FILE *f_out = os_fopen(filepath->os_path, OS_MODE_WRITE);
-
-    if (f_out == NULL) {
-        fprintf(stderr, "Failed to open %s!\n", filepath->char_path);
-        return;
-    }
-
+/* Write decrypted section data to f_out, optionally hashing it on the way. Sparse output must start at offset 0. */
+void nca_write_section_file(nca_section_ctx_t *ctx, uint64_t ofs, uint64_t total_size, FILE *f_out, unsigned char *hash, int sparse) {
     uint64_t read_size = 0x400000; /* 4 MB buffer. */
     unsigned char *buf = malloc(read_size);
     if (buf == NULL) {
         fprintf(stderr, "Failed to allocate file-save buffer!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     memset(buf, 0xCC, read_size); /* Debug in case I fuck this up somehow... */
+    sha_ctx_t *sha_ctx = hash != NULL ? new_sha_ctx(HASH_TYPE_SHA256, 0) : NULL;
+    uint64_t start_ofs = ofs;
     uint64_t end_ofs = ofs + total_size;
     nca_section_fseek(ctx, ofs);
     while (ofs < end_ofs) {       
         if (ofs + read_size >= end_ofs) read_size = end_ofs - ofs;
         if (nca_section_fread(ctx, buf, read_size) != read_size) {
             fprintf(stderr, "Failed to read file!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
+        }
+        if (sha_ctx != NULL) {
+            sha_update(sha_ctx, buf, read_size);
         }
-        if (fwrite(buf, 1, read_size, f_out) != read_size) {
+        size_t written;
+        if (sparse) {
+            written = fwrite_sparse(buf, read_size, ofs - start_ofs, f_out);
+        } else {
+            stats_span_t span;
+            stats_begin(&span);
+            written = fwrite(buf, 1, read_size, f_out);
+            stats_end(&span, STATS_WRITE, written);
+        }
+        if (written != read_size) {
             fprintf(stderr, "Failed to write file!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
         ofs += read_size;
     }
+    if (sparse && !finish_sparse_file(f_out, total_size)) {
+        fprintf(stderr, "Failed to write file!\n");
+        fatal_exit();
+    }
+
+    if (sha_ctx != NULL) {
+        sha_get_hash(sha_ctx, hash);
+        free_sha_ctx(sha_ctx);
+    }
+    free(buf);
+}
+
+/* Save decrypted section data to a file. Sparse files get holes for zeroed blocks; others are preallocated. */
+void nca_save_section_file(nca_section_ctx_t *ctx, uint64_t ofs, uint64_t total_size, filepath_t *filepath, int sparse) {    
+    if (ctx->fanout != NULL) {
+        /* Written during the fan-out pass. */
+        fanout_add_file(ctx->fanout, ctx, ofs, total_size, filepath->char_path, sparse);
+        return;
+    }
+
+    trace_span_t span;
+    trace_begin(&span);
+    FILE *f_out = os_fopen(filepath->os_path, OS_MODE_WRITE);
+
+    if (f_out == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", filepath->char_path);
+        return;
+    }
+
+    if (!sparse) {
+        preallocate_file(f_out, total_size);
+    }
+
+    unsigned char hash[0x20];
+    manifest_ctx_t *manifest = ctx->tool_ctx->manifest;
+    nca_write_section_file(ctx, ofs, total_size, f_out, manifest != NULL ? hash : NULL, sparse);
+    manifest_add(manifest, filepath->char_path, total_size, hash);
 
     fclose(f_out);
+    trace_end(&span, "extract file", ctx->section_num, "%s", filepath->char_path);
+}
 
-    free(buf);
+static int nca_is_override_set(const override_filepath_t *override) {
+    return override->enabled && override->path.valid == VALIDITY_VALID;
+}
+
+/* Whether a RomFS section is to be listed or extracted to a directory or tar. */
+static int nca_section_wants_romfs_output(nca_section_ctx_t *ctx) {
+    hactool_settings_t *settings = &ctx->tool_ctx->settings;
+    return (ctx->tool_ctx->action & ACTION_LISTROMFS) || ctx->tool_ctx->romfs_tar != NULL ||
+        nca_is_override_set(&settings->romfs_dir_path) || settings->section_dir_paths[ctx->section_num].valid == VALIDITY_VALID;
 }
 
 void nca_save_section(nca_section_ctx_t *ctx) {
@@ -1139,14 +2106,14 @@ void nca_save_section(nca_section_ctx_t *ctx) {
     filepath_t *secpath = &ctx->tool_ctx->settings.section_paths[ctx->section_num];
 
     /* Handle overrides. */
-    if (ctx->type == PFS0 && ctx->pfs0_ctx.is_exefs && ctx->tool_ctx->settings.exefs_path.enabled && ctx->tool_ctx->settings.exefs_path.path.valid == VALIDITY_VALID) {
+    if (ctx->type == PFS0 && nca_is_override_set(&ctx->tool_ctx->settings.exefs_path) && nca_section_get_pfs0_header(ctx) != NULL && ctx->pfs0_ctx.is_exefs) {
         secpath = &ctx->tool_ctx->settings.exefs_path.path;
-    } else if (ctx->type == ROMFS && ctx->tool_ctx->settings.romfs_path.enabled && ctx->tool_ctx->settings.romfs_path.path.valid == VALIDITY_VALID) {
+    } else if (ctx->type == ROMFS && nca_is_override_set(&ctx->tool_ctx->settings.romfs_path)) {
         secpath = &ctx->tool_ctx->settings.romfs_path.path;
     }
     if (secpath != NULL && secpath->valid == VALIDITY_VALID) {
-        printf("Saving Section %"PRId32" to %s...\n", ctx->section_num, secpath->char_path);
-        nca_save_section_file(ctx, offset, size, secpath);
+        nca_output_printf(nca_get_save_output(ctx->nca), "Saving Section %"PRId32" to %s...\n", ctx->section_num, secpath->char_path);
+        nca_save_section_file(ctx, offset, size, secpath, 1);
     }
 
     switch (ctx->type) {
@@ -1169,7 +2136,12 @@ void nca_save_section(nca_section_ctx_t *ctx) {
 }
 
 void nca_save_pfs0_section(nca_section_ctx_t *ctx) {
-    if (ctx->superblock_hash_validity == VALIDITY_VALID && ctx->pfs0_ctx.header->magic == MAGIC_PFS0) {
+    /* Without anywhere to put the files, leave the superblock and header unread. */
+    hactool_settings_t *settings = &ctx->tool_ctx->settings;
+    if (ctx->tool_ctx->pfs0_tar == NULL && !nca_is_override_set(&settings->exefs_dir_path) && settings->section_dir_paths[ctx->section_num].valid != VALIDITY_VALID) {
+        return;
+    }
+    if (nca_section_get_pfs0_header(ctx) != NULL && ctx->pfs0_ctx.header->magic == MAGIC_PFS0) {
         /* Extract to directory. */
         filepath_t *dirpath = NULL;
         if (ctx->pfs0_ctx.is_exefs && ctx->tool_ctx->settings.exefs_dir_path.enabled) {
@@ -1178,7 +2150,14 @@ void nca_save_pfs0_section(nca_section_ctx_t *ctx) {
         if (dirpath == NULL || dirpath->valid != VALIDITY_VALID) {
             dirpath = &ctx->tool_ctx->settings.section_dir_paths[ctx->section_num];
         }
-        if (dirpath != NULL && dirpath->valid == VALIDITY_VALID) {
+        if (ctx->tool_ctx->pfs0_tar != NULL) {
+            filepath_t fakepath;
+            filepath_init(&fakepath);
+            filepath_set(&fakepath, "");
+            for (uint32_t i = 0; i < ctx->pfs0_ctx.header->num_files; i++) {
+                nca_save_pfs0_file(ctx, i, &fakepath);
+            }
+        } else if (dirpath != NULL && dirpath->valid == VALIDITY_VALID) {
             os_makedir(dirpath->os_path);
             for (uint32_t i = 0; i < ctx->pfs0_ctx.header->num_files; i++) {
                 nca_save_pfs0_file(ctx, i, dirpath);
@@ -1201,7 +2180,7 @@ void nca_visit_romfs_file(nca_section_ctx_t *ctx, uint32_t file_offset, filepath
     filepath_t *cur_path = calloc(1, sizeof(filepath_t));
     if (cur_path == NULL) {
         fprintf(stderr, "Failed to allocate filepath!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     filepath_copy(cur_path, dir_path);
@@ -1211,14 +2190,30 @@ void nca_visit_romfs_file(nca_section_ctx_t *ctx, uint32_t file_offset, filepath
 
     /* If we're extracting... */
     if ((ctx->tool_ctx->action & ACTION_LISTROMFS) == 0) {
-        printf("Saving %s...\n", cur_path->char_path);
         uint64_t phys_offset;
         if (ctx->type == ROMFS) {
             phys_offset = ctx->romfs_ctx.romfs_offset + ctx->romfs_ctx.header.data_offset + entry->offset;
         } else {
             phys_offset = ctx->bktr_ctx.romfs_offset + ctx->bktr_ctx.header.data_offset + entry->offset;
         }
-        nca_save_section_file(ctx, phys_offset, entry->size, cur_path);
+        if (ctx->tool_ctx->romfs_tar != NULL) {
+            unsigned char hash[0x20];
+            nca_output_printf(nca_get_save_output(ctx->nca), "Archiving %s...\n", cur_path->char_path);
+            if (ctx->fanout != NULL) {
+                fanout_add_tar_file(ctx->fanout, ctx, phys_offset, entry->size, ctx->tool_ctx->romfs_tar, cur_path->char_path);
+            } else {
+                trace_span_t span;
+                trace_begin(&span);
+                tar_begin_file(ctx->tool_ctx->romfs_tar, cur_path->char_path, entry->size);
+                nca_write_section_file(ctx, phys_offset, entry->size, ctx->tool_ctx->romfs_tar->file, ctx->tool_ctx->manifest != NULL ? hash : NULL, 0);
+                manifest_add(ctx->tool_ctx->manifest, ctx->tool_ctx->romfs_tar->cur_name, entry->size, hash);
+                tar_end_file(ctx->tool_ctx->romfs_tar);
+                trace_end(&span, "extract file", ctx->section_num, "%s", cur_path->char_path);
+            }
+        } else {
+            nca_output_printf(nca_get_save_output(ctx->nca), "Saving %s...\n", cur_path->char_path);
+            nca_save_section_file(ctx, phys_offset, entry->size, cur_path, 0);
+        }
     } else {
         printf("rom:%s\n", cur_path->char_path);
     }
@@ -1240,7 +2235,7 @@ void nca_visit_romfs_dir(nca_section_ctx_t *ctx, uint32_t dir_offset, filepath_t
     filepath_t *cur_path = calloc(1, sizeof(filepath_t));
     if (cur_path == NULL) {
         fprintf(stderr, "Failed to allocate filepath!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     filepath_copy(cur_path, parent_path);
@@ -1250,7 +2245,11 @@ void nca_visit_romfs_dir(nca_section_ctx_t *ctx, uint32_t dir_offset, filepath_t
 
     /* If we're actually extracting the romfs, make directory. */
     if ((ctx->tool_ctx->action & ACTION_LISTROMFS) == 0) {
-        os_makedir(cur_path->os_path);
+        if (ctx->tool_ctx->romfs_tar != NULL) {
+            tar_add_directory(ctx->tool_ctx->romfs_tar, cur_path->char_path);
+        } else {
+            os_makedir(cur_path->os_path);
+        }
     }
 
     if (entry->file != ROMFS_ENTRY_EMPTY) {
@@ -1268,9 +2267,14 @@ void nca_visit_romfs_dir(nca_section_ctx_t *ctx, uint32_t dir_offset, filepath_t
 
 
 void nca_save_ivfc_section(nca_section_ctx_t *ctx) {
-    if (ctx->superblock_hash_validity == VALIDITY_VALID) {
+    /* Without anywhere to put the files, leave the superblock and tables unread. */
+    if (!nca_section_wants_romfs_output(ctx)) {
+        return;
+    }
+    if (nca_section_get_superblock_validity(ctx) == VALIDITY_VALID) {
+        nca_section_load_romfs(ctx);
         if (ctx->romfs_ctx.header.header_size == ROMFS_HEADER_SIZE) {
-            if (ctx->tool_ctx->action & ACTION_LISTROMFS) {
+            if (ctx->tool_ctx->action & ACTION_LISTROMFS || ctx->tool_ctx->romfs_tar != NULL) {
                 filepath_t fakepath;
                 filepath_init(&fakepath);
                 filepath_set(&fakepath, "");
@@ -1298,9 +2302,12 @@ void nca_save_ivfc_section(nca_section_ctx_t *ctx) {
 }
 
 void nca_save_bktr_section(nca_section_ctx_t *ctx) {
+    if (!nca_section_wants_romfs_output(ctx)) {
+        return;
+    }
     if (ctx->superblock_hash_validity == VALIDITY_VALID) {
         if (ctx->bktr_ctx.header.header_size == ROMFS_HEADER_SIZE) {
-            if (ctx->tool_ctx->action & ACTION_LISTROMFS) {
+            if (ctx->tool_ctx->action & ACTION_LISTROMFS || ctx->tool_ctx->romfs_tar != NULL) {
                 filepath_t fakepath;
                 filepath_init(&fakepath);
                 filepath_set(&fakepath, "");
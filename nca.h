@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 #include "types.h"
 #include "settings.h"
 #include "aes.h"
@@ -10,6 +11,7 @@
 #include "pfs0.h"
 #include "ivfc.h"
 #include "bktr.h"
+#include "corruption.h"
 
 #define MAGIC_NCA3 0x3341434E /* "NCA3" */
 
@@ -120,10 +122,21 @@ enum nca_section_type {
     INVALID
 };
 
+/* Messages held back so that they still come out in the usual order, e.g. those of a fan-out pass. */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t size;
+} nca_output_t;
+
+struct fanout_ctx; /* This will get re-defined by fanout.h. */
+struct nca_ctx;
+
 typedef struct {
     int is_present;
     enum nca_section_type type;
     FILE *file; /* Pointer to file. */
+    uint64_t file_offset; /* Start of the NCA within file. */
     uint64_t offset;
     uint64_t size;
     uint32_t section_num;
@@ -131,6 +144,7 @@ typedef struct {
     int is_decrypted;
     aes_ctx_t *aes; /* AES context for the section. */
     hactool_ctx_t *tool_ctx;
+    struct nca_ctx *nca; /* The NCA the section belongs to. */
     union {
         pfs0_ctx_t pfs0_ctx;
         romfs_ctx_t romfs_ctx;
@@ -142,11 +156,20 @@ typedef struct {
     size_t sector_num;
     uint32_t sector_ofs;
     int physical_reads; /* Should reads be forced physical? */
+    int verify_deferred; /* Hash tables are checked by the fan-out pass instead. */
+    int verify_cached; /* Hash table results come from the verification cache. */
+    int did_load_meta; /* PFS0 header and NPDM, or RomFS header and tables, are read on first use. */
+    verify_tier_t verify_tier; /* How much of the data level gets hashed. */
+    corruption_list_t *corruption; /* Failing blocks per hash level, when mapping corruption. */
+    struct fanout_ctx *fanout; /* Set while queueing outputs for the fan-out pass. */
 } nca_section_ctx_t;
 
 typedef struct nca_ctx {
     FILE *file; /* File for this NCA. */
-    size_t file_size;   
+    const char *file_name; /* Name of the NCA, for checking its content ID. */
+    const char *file_path; /* Of file, for workers to open their own handles; NULL if unknown. */
+    uint64_t file_offset; /* Start of the NCA within file, when nested in a container. */
+    uint64_t file_size; /* Size of a nested NCA; zero means it runs to the end of file. */
     unsigned char crypto_type;
     int has_rights_id;
     int is_decrypted;
@@ -157,23 +180,91 @@ typedef struct nca_ctx {
     unsigned char title_key[0x10];
     nca_section_ctx_t section_contexts[4];
     npdm_t *npdm;
+    int did_fanout; /* Sections were saved in a single pass. */
+    int hold_save_output; /* Save messages go to save_output instead of stdout. */
+    nca_output_t save_output; /* Printed by nca_save, after the info, or by the caller if printing is deferred. */
+    nca_output_t verify_output; /* Verification messages, held back with the info if printing is deferred. */
+    int did_find_npdm; /* The NPDM is looked up on first use. */
+    int verify_cached; /* Hash results came from the verification cache. */
+    int defer_print; /* Info is printed by the caller once every NCA of its container is done. */
+    int has_content_hash;
+    unsigned char content_hash[0x20]; /* SHA-256 of the whole NCA. */
+    validity_t content_id_validity;
     nca_header_t header;
 } nca_ctx_t;
 
+/* One of the NCAs of a container, set up by nca_init_nested on its two contexts. */
+typedef struct {
+    hactool_ctx_t tool_ctx;
+    nca_ctx_t nca_ctx;
+    FILE *file; /* The worker's own handle on the container, if processed by one. */
+} nca_nested_t;
+
+typedef struct {
+    nca_nested_t *ncas;
+    uint32_t num_ncas;
+    const char *path; /* Of the container. */
+    atomic_uint_fast32_t next_nca;
+    atomic_int stop; /* Set when a worker fails. */
+} nca_nested_pool_t;
+
+#define NCA_SCAN_CHUNK_SIZE 0x400000 /* Bytes of a hash level checked by a corruption scan worker at a time. */
+
+/* A hash level checked in full by several workers, for a corruption map. */
+typedef struct {
+    nca_section_ctx_t *section;
+    const unsigned char *hash_table;
+    uint64_t data_ofs;
+    uint64_t data_len;
+    uint64_t block_size;
+    int full_block;
+    uint32_t sample_percent;
+    uint64_t num_blocks;
+    uint64_t chunk_blocks;
+    uint8_t *is_bad; /* Per block. */
+    atomic_uint_fast64_t num_checked;
+    atomic_uint_fast64_t next_chunk;
+    uint64_t num_chunks;
+    atomic_int stop; /* Set when a worker fails. */
+} nca_scan_ctx_t;
+
 void nca_init(nca_ctx_t *ctx);
+void nca_init_nested(nca_ctx_t *ctx, hactool_ctx_t *tool_ctx, hactool_ctx_t *parent, FILE *file, uint64_t offset, uint64_t size, const char *name);
+void nca_init_keys(nca_ctx_t *ctx);
+void nca_init_section(nca_ctx_t *ctx, unsigned int i);
+aes_ctx_t *nca_new_section_aes_ctx(nca_ctx_t *ctx, unsigned int i);
 void nca_process(nca_ctx_t *ctx);
+void nca_process_nested(nca_nested_t *ncas, uint32_t num_ncas, uint32_t num_jobs, const char *path, const char *prefix);
+void nca_free_nested(nca_nested_t *ncas, uint32_t num_ncas);
 int nca_decrypt_header(nca_ctx_t *ctx);
 void nca_decrypt_key_area(nca_ctx_t *ctx);
 void nca_print(nca_ctx_t *ctx);
 
+void nca_output_printf(nca_output_t *out, const char *fmt, ...);
+void nca_output_flush(nca_output_t *out);
+
+char *nca_get_distribution_type(nca_ctx_t *ctx);
+char *nca_get_content_type(nca_ctx_t *ctx);
+
+validity_t nca_get_fixed_sig_validity(nca_ctx_t *ctx);
+npdm_t *nca_get_npdm(nca_ctx_t *ctx);
+validity_t nca_get_npdm_sig_validity(nca_ctx_t *ctx);
+
 void nca_free_section_contexts(nca_ctx_t *ctx);
 
+void nca_update_ctr(unsigned char *ctr, uint64_t ofs);
+
 void nca_section_fseek(nca_section_ctx_t *ctx, uint64_t offset);
 size_t nca_section_fread(nca_section_ctx_t *ctx, void *buffer, size_t count);
+void nca_decrypt_section_data(nca_section_ctx_t *ctx, void *buf, uint64_t ofs, uint64_t size);
 
-void nca_save_section_file(nca_section_ctx_t *ctx, uint64_t ofs, uint64_t total_size, filepath_t *filepath);
+void nca_write_section_file(nca_section_ctx_t *ctx, uint64_t ofs, uint64_t total_size, FILE *f_out, unsigned char *hash, int sparse);
+void nca_save_section_file(nca_section_ctx_t *ctx, uint64_t ofs, uint64_t total_size, filepath_t *filepath, int sparse);
 
 /* These have to be in nca.c, sadly... */
+validity_t nca_section_get_superblock_validity(nca_section_ctx_t *ctx);
+pfs0_header_t *nca_section_get_pfs0_header(nca_section_ctx_t *ctx);
+void nca_section_load_romfs(nca_section_ctx_t *ctx);
 void nca_process_pfs0_section(nca_section_ctx_t *ctx);
 void nca_process_ivfc_section(nca_section_ctx_t *ctx);
 void nca_process_bktr_section(nca_section_ctx_t *ctx);
@@ -0,0 +1,544 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "ncapack.h"
+#include "romfsbuild.h"
+#include "aes.h"
+#include "rsa.h"
+#include "sha.h"
+#include "stats.h"
+#include "trace.h"
+#include "utils.h"
+
+/* Sections are laid out as official tools do: hashes first, then the PFS0 or RomFS they cover.
+ * Since every size is known up front, the hashed region is streamed straight into place by
+ * several threads, a chunk at a time: each reads its chunk, hashes the blocks in it, encrypts it
+ * and writes it. The hash table or IVFC levels are written ahead of it afterwards, then the header
+ * last, so that an interrupted pack is never mistaken for a good one. */
+
+#ifdef _WIN32
+typedef struct _stat64 nca_pack_stat_t;
+#define nca_pack_stat _stat64
+#else
+typedef struct stat nca_pack_stat_t;
+#define nca_pack_stat stat
+#endif
+
+static void nca_pack_add_piece(nca_pack_section_t *section, const char *path, const unsigned char *data, uint64_t offset, uint64_t size) {
+    if ((section->pieces = realloc(section->pieces, (section->num_pieces + 1) * sizeof(nca_pack_piece_t))) == NULL) {
+        fprintf(stderr, "Failed to allocate NCA section!\n");
+        fatal_exit();
+    }
+    nca_pack_piece_t *piece = &section->pieces[section->num_pieces++];
+    piece->path = path;
+    piece->data = data;
+    piece->offset = offset;
+    piece->size = size;
+}
+
+static nca_pack_section_t *nca_pack_add_section(nca_pack_ctx_t *ctx, section_partition_type_t partition_type, section_fs_type_t fs_type) {
+    nca_pack_section_t *section = &ctx->sections[ctx->num_sections];
+    memset(section, 0, sizeof(*section));
+    section->header._0x0 = 2;
+    section->header.partition_type = (uint8_t)partition_type;
+    section->header.fs_type = (uint8_t)fs_type;
+    section->header.crypt_type = CRYPT_CTR;
+    section->header.section_ctr_low = ctx->num_sections;
+    ctx->num_sections++;
+    return section;
+}
+
+static int nca_pack_compare_names(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/* The ExeFS is a PFS0 of the regular files in dir, in name order. */
+static void nca_pack_add_exefs(nca_pack_ctx_t *ctx, const char *dir) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        fprintf(stderr, "Failed to open directory %s!\n", dir);
+        fatal_exit();
+    }
+    char **names = NULL;
+    uint32_t num_names = 0, max_names = 0;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+            continue;
+        }
+        if (num_names == max_names) {
+            max_names = max_names ? max_names * 2 : 0x20;
+            if ((names = realloc(names, max_names * sizeof(char *))) == NULL) {
+                fprintf(stderr, "Failed to allocate directory listing!\n");
+                fatal_exit();
+            }
+        }
+        if ((names[num_names++] = strdup(ent->d_name)) == NULL) {
+            fprintf(stderr, "Failed to allocate directory listing!\n");
+            fatal_exit();
+        }
+    }
+    closedir(d);
+    qsort(names, num_names, sizeof(char *), nca_pack_compare_names);
+
+    ctx->exefs_paths = calloc(num_names ? num_names : 1, sizeof(char *));
+    ctx->exefs_names = calloc(num_names ? num_names : 1, sizeof(char *));
+    ctx->exefs_sizes = calloc(num_names ? num_names : 1, sizeof(uint64_t));
+    if (ctx->exefs_paths == NULL || ctx->exefs_names == NULL || ctx->exefs_sizes == NULL) {
+        fprintf(stderr, "Failed to allocate ExeFS files!\n");
+        fatal_exit();
+    }
+    for (uint32_t i = 0; i < num_names; i++) {
+        char path[MAX_PATH];
+        int len = snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        nca_pack_stat_t st;
+        if (len < 0 || len >= (int)sizeof(path) || nca_pack_stat(path, &st) != 0) {
+            fprintf(stderr, "Failed to stat %s/%s!\n", dir, names[i]);
+            fatal_exit();
+        }
+        if (!S_ISREG(st.st_mode)) {
+            free(names[i]);
+            continue;
+        }
+        uint32_t j = ctx->num_exefs_files++;
+        if ((ctx->exefs_paths[j] = strdup(path)) == NULL) {
+            fprintf(stderr, "Failed to allocate ExeFS files!\n");
+            fatal_exit();
+        }
+        ctx->exefs_names[j] = names[i];
+        ctx->exefs_sizes[j] = (uint64_t)st.st_size;
+    }
+    free(names);
+
+    ctx->pfs0_header = pfs0_build_header(ctx->num_exefs_files, (const char *const *)ctx->exefs_names, ctx->exefs_sizes);
+    uint64_t header_size = pfs0_get_header_size(ctx->pfs0_header);
+    nca_pack_section_t *section = nca_pack_add_section(ctx, PARTITION_PFS0, FS_TYPE_PFS0);
+    nca_pack_add_piece(section, NULL, (const unsigned char *)ctx->pfs0_header, 0, header_size);
+    uint64_t data_size = header_size;
+    for (uint32_t i = 0; i < ctx->num_exefs_files; i++) {
+        nca_pack_add_piece(section, ctx->exefs_paths[i], NULL, data_size, ctx->exefs_sizes[i]);
+        data_size += ctx->exefs_sizes[i];
+    }
+
+    section->block_size = NCA_PACK_PFS0_BLOCK_SIZE;
+    section->data_size = data_size;
+    uint64_t hash_table_size = (data_size + NCA_PACK_PFS0_BLOCK_SIZE - 1) / NCA_PACK_PFS0_BLOCK_SIZE * 0x20;
+    section->data_offset = align64(hash_table_size, MEDIA_SIZE);
+    section->size = align64(section->data_offset + data_size, MEDIA_SIZE);
+
+    pfs0_superblock_t *superblock = &section->header.pfs0_superblock;
+    superblock->block_size = NCA_PACK_PFS0_BLOCK_SIZE;
+    superblock->always_2 = 2;
+    superblock->hash_table_offset = 0;
+    superblock->hash_table_size = hash_table_size;
+    superblock->pfs0_offset = section->data_offset;
+    superblock->pfs0_size = data_size;
+}
+
+/* The size of a RomFS image is where its last table or file ends, which allows trailing data,
+ * such as the hash levels written by --build-romfs. */
+static uint64_t nca_pack_get_romfs_size(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", path);
+        fatal_exit();
+    }
+    romfs_hdr_t header;
+    if (fread(&header, 1, sizeof(header), f) != sizeof(header) || header.header_size != ROMFS_HEADER_SIZE) {
+        fprintf(stderr, "%s is not a RomFS image!\n", path);
+        fatal_exit();
+    }
+    uint64_t size = header.data_offset;
+    uint64_t table_ends[4] = {
+        header.dir_hash_table_offset + header.dir_hash_table_size,
+        header.dir_meta_table_offset + header.dir_meta_table_size,
+        header.file_hash_table_offset + header.file_hash_table_size,
+        header.file_meta_table_offset + header.file_meta_table_size
+    };
+    for (unsigned int i = 0; i < 4; i++) {
+        if (table_ends[i] > size) {
+            size = table_ends[i];
+        }
+    }
+
+    unsigned char *files = malloc(header.file_meta_table_size ? header.file_meta_table_size : 1);
+    if (files == NULL) {
+        fprintf(stderr, "Failed to allocate RomFS file table!\n");
+        fatal_exit();
+    }
+    fseeko64(f, header.file_meta_table_offset, SEEK_SET);
+    if (fread(files, 1, header.file_meta_table_size, f) != header.file_meta_table_size) {
+        fprintf(stderr, "Failed to read RomFS file table of %s!\n", path);
+        fatal_exit();
+    }
+    for (uint64_t ofs = 0; ofs + sizeof(romfs_fentry_t) <= header.file_meta_table_size;) {
+        romfs_fentry_t *entry = (romfs_fentry_t *)(files + ofs);
+        uint64_t end = header.data_offset + entry->offset + entry->size;
+        if (end > size) {
+            size = end;
+        }
+        ofs += sizeof(romfs_fentry_t) + align(entry->name_size, 4);
+    }
+    free(files);
+
+    fseeko64(f, 0, SEEK_END);
+    if ((uint64_t)ftello(f) < size) {
+        fprintf(stderr, "RomFS image %s is truncated!\n", path);
+        fatal_exit();
+    }
+    fclose(f);
+    return size;
+}
+
+/* IVFC levels come first, level 0 at the start, each aligned to a block, then the RomFS. */
+static void nca_pack_add_romfs(nca_pack_ctx_t *ctx, const char *path) {
+    uint64_t romfs_size = nca_pack_get_romfs_size(path);
+    nca_pack_section_t *section = nca_pack_add_section(ctx, PARTITION_ROMFS, FS_TYPE_ROMFS);
+    nca_pack_add_piece(section, path, NULL, 0, romfs_size);
+
+    ivfc_hdr_t *ivfc_header = &section->header.romfs_superblock.ivfc_header;
+    ivfc_header->magic = MAGIC_IVFC;
+    ivfc_header->id = 0x20000;
+    ivfc_header->master_hash_size = 0x20;
+    ivfc_header->num_levels = IVFC_MAX_LEVEL + 1;
+    uint64_t level_sizes[IVFC_MAX_LEVEL];
+    level_sizes[IVFC_MAX_LEVEL - 1] = romfs_size;
+    for (int i = IVFC_MAX_LEVEL - 2; i >= 0; i--) {
+        level_sizes[i] = (level_sizes[i + 1] + NCA_PACK_IVFC_BLOCK_SIZE - 1) / NCA_PACK_IVFC_BLOCK_SIZE * 0x20;
+    }
+    uint64_t offset = 0;
+    for (unsigned int i = 0; i < IVFC_MAX_LEVEL; i++) {
+        ivfc_level_hdr_t *level = &ivfc_header->level_headers[i];
+        level->logical_offset = align64(offset, NCA_PACK_IVFC_BLOCK_SIZE);
+        level->hash_data_size = level_sizes[i];
+        level->block_size = NCA_PACK_IVFC_BLOCK_SIZE_LOG2;
+        offset = level->logical_offset + level->hash_data_size;
+    }
+
+    section->block_size = NCA_PACK_IVFC_BLOCK_SIZE;
+    section->pad_last_block = 1;
+    section->data_offset = ivfc_header->level_headers[IVFC_MAX_LEVEL - 1].logical_offset;
+    section->data_size = romfs_size;
+    section->size = align64(section->data_offset + romfs_size, MEDIA_SIZE);
+}
+
+static void nca_pack_encrypt(aes_ctx_t *aes_ctx, const nca_pack_section_t *section, unsigned char *data, uint64_t size, uint64_t nca_offset) {
+    unsigned char ctr[0x10];
+    memset(ctr, 0, sizeof(ctr));
+    for (unsigned int j = 0; j < 4; j++) {
+        ctr[j] = (unsigned char)(section->header.section_ctr_high >> (24 - 8 * j));
+        ctr[4 + j] = (unsigned char)(section->header.section_ctr_low >> (24 - 8 * j));
+    }
+    nca_update_ctr(ctr, nca_offset);
+    aes_setiv(aes_ctx, ctr, 0x10);
+    aes_encrypt(aes_ctx, data, data, (size_t)size);
+}
+
+static void nca_pack_write(FILE *f, const char *path, const void *data, uint64_t size, uint64_t offset) {
+    stats_span_t span;
+    stats_begin(&span);
+    fseeko64(f, offset, SEEK_SET);
+    if (fwrite(data, 1, size, f) != size) {
+        fprintf(stderr, "Failed to write %s!\n", path);
+        fatal_exit();
+    }
+    stats_end(&span, STATS_WRITE, size);
+}
+
+/* Assembles bytes [start, start + size) of a section's hashed region from its pieces. */
+static void nca_pack_read_chunk(const nca_pack_section_t *section, unsigned char *chunk, uint64_t start, uint64_t size, FILE **in, const nca_pack_piece_t **in_piece) {
+    uint64_t end = start + size;
+    for (uint32_t i = 0; i < section->num_pieces; i++) {
+        const nca_pack_piece_t *piece = &section->pieces[i];
+        if (piece->offset >= end || piece->offset + piece->size <= start) {
+            continue;
+        }
+        uint64_t from = piece->offset > start ? piece->offset : start;
+        uint64_t to = piece->offset + piece->size < end ? piece->offset + piece->size : end;
+        if (piece->path == NULL) {
+            memcpy(chunk + (from - start), piece->data + (from - piece->offset), to - from);
+            continue;
+        }
+        if (*in_piece != piece) {
+            if (*in != NULL) {
+                fclose(*in);
+            }
+            if ((*in = fopen(piece->path, "rb")) == NULL) {
+                fprintf(stderr, "Failed to open %s!\n", piece->path);
+                fatal_exit();
+            }
+            *in_piece = piece;
+        }
+        stats_span_t span;
+        stats_begin(&span);
+        fseeko64(*in, from - piece->offset, SEEK_SET);
+        if (fread(chunk + (from - start), 1, to - from, *in) != to - from) {
+            fprintf(stderr, "Failed to read %s; did it change while packing?\n", piece->path);
+            fatal_exit();
+        }
+        stats_end(&span, STATS_READ, to - from);
+    }
+}
+
+static void nca_pack_worker(void *arg) {
+    nca_pack_ctx_t *ctx = arg;
+    unsigned char *chunk = malloc(NCA_PACK_CHUNK_SIZE);
+    FILE *out = fopen(ctx->out_path, "r+b");
+    if (chunk == NULL || out == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", ctx->out_path);
+        fatal_exit();
+    }
+    aes_ctx_t *aes_ctx = new_aes_ctx(ctx->keys[2], 16, AES_MODE_CTR);
+    FILE *in = NULL;
+    const nca_pack_piece_t *in_piece = NULL;
+    uint64_t c;
+    while (!atomic_load(&ctx->stop) && (c = atomic_fetch_add(&ctx->next_chunk, 1)) < ctx->num_chunks) {
+        const nca_pack_section_t *section = &ctx->sections[0];
+        while (c >= section->first_chunk + section->num_chunks) {
+            section++;
+        }
+        /* The last chunk runs on to the end of the section, padding included. */
+        uint64_t start = (c - section->first_chunk) * NCA_PACK_CHUNK_SIZE;
+        uint64_t region_size = section->size - section->data_offset;
+        uint64_t size = region_size - start < NCA_PACK_CHUNK_SIZE ? region_size - start : NCA_PACK_CHUNK_SIZE;
+        memset(chunk, 0, NCA_PACK_CHUNK_SIZE);
+        nca_pack_read_chunk(section, chunk, start, size, &in, &in_piece);
+
+        for (uint64_t ofs = start; ofs < start + size && ofs < section->data_size; ofs += section->block_size) {
+            uint64_t block_size = section->block_size;
+            if (!section->pad_last_block && section->data_size - ofs < block_size) {
+                block_size = section->data_size - ofs;
+            }
+            sha256_hash_buffer(section->hashes + ofs / section->block_size * 0x20, chunk + (ofs - start), (size_t)block_size);
+        }
+
+        uint64_t nca_offset = section->offset + section->data_offset + start;
+        nca_pack_encrypt(aes_ctx, section, chunk, size, nca_offset);
+        nca_pack_write(out, ctx->out_path, chunk, size, nca_offset);
+    }
+    if (in != NULL) {
+        fclose(in);
+    }
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Failed to write %s!\n", ctx->out_path);
+        fatal_exit();
+    }
+    free_aes_ctx(aes_ctx);
+    free(chunk);
+}
+
+static void nca_pack_run_workers(nca_pack_ctx_t *ctx) {
+    uint32_t num_threads = ctx->num_chunks < ctx->num_jobs ? (uint32_t)ctx->num_chunks : ctx->num_jobs;
+    atomic_store(&ctx->next_chunk, 0);
+    atomic_store(&ctx->stop, 0);
+    run_workers(num_threads, nca_pack_worker, ctx, &ctx->stop);
+}
+
+/* Builds the plaintext of everything ahead of a section's hashed region, and finishes its superblock. */
+static unsigned char *nca_pack_build_hashes(nca_pack_section_t *section) {
+    unsigned char *meta = calloc(1, section->data_offset ? section->data_offset : 1);
+    if (meta == NULL) {
+        fprintf(stderr, "Failed to allocate NCA section hashes!\n");
+        fatal_exit();
+    }
+    uint64_t num_blocks = (section->data_size + section->block_size - 1) / section->block_size;
+    if (section->header.fs_type == FS_TYPE_PFS0) {
+        pfs0_superblock_t *superblock = &section->header.pfs0_superblock;
+        memcpy(meta + superblock->hash_table_offset, section->hashes, num_blocks * 0x20);
+        sha256_hash_buffer(superblock->master_hash, section->hashes, (size_t)(num_blocks * 0x20));
+        return meta;
+    }
+
+    /* Each IVFC level hashes the one after it, zero-padded to whole blocks. */
+    ivfc_hdr_t *ivfc_header = &section->header.romfs_superblock.ivfc_header;
+    ivfc_level_hdr_t *levels = ivfc_header->level_headers;
+    memcpy(meta + levels[IVFC_MAX_LEVEL - 2].logical_offset, section->hashes, num_blocks * 0x20);
+    unsigned char *block = malloc(NCA_PACK_IVFC_BLOCK_SIZE);
+    if (block == NULL) {
+        fprintf(stderr, "Failed to allocate NCA section hashes!\n");
+        fatal_exit();
+    }
+    for (int i = IVFC_MAX_LEVEL - 3; i >= -1; i--) {
+        const unsigned char *data = meta + levels[i + 1].logical_offset;
+        unsigned char *hashes = i >= 0 ? meta + levels[i].logical_offset : ivfc_header->master_hash;
+        for (uint64_t ofs = 0; ofs < levels[i + 1].hash_data_size; ofs += NCA_PACK_IVFC_BLOCK_SIZE) {
+            uint64_t size = levels[i + 1].hash_data_size - ofs < NCA_PACK_IVFC_BLOCK_SIZE ? levels[i + 1].hash_data_size - ofs : NCA_PACK_IVFC_BLOCK_SIZE;
+            memset(block, 0, NCA_PACK_IVFC_BLOCK_SIZE);
+            memcpy(block, data + ofs, (size_t)size);
+            sha256_hash_buffer(hashes + ofs / NCA_PACK_IVFC_BLOCK_SIZE * 0x20, block, NCA_PACK_IVFC_BLOCK_SIZE);
+        }
+    }
+    free(block);
+    return meta;
+}
+
+static void nca_pack_init_keys(nca_pack_ctx_t *ctx, uint32_t key_generation) {
+    hactool_settings_t *settings = &ctx->tool_ctx->settings;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    if (mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, (const unsigned char *)"hactool", 7) != 0 ||
+        mbedtls_ctr_drbg_random(&drbg, &ctx->keys[0][0], sizeof(ctx->keys)) != 0) {
+        fprintf(stderr, "Failed to generate NCA keys!\n");
+        fatal_exit();
+    }
+    mbedtls_ctr_drbg_free(&drbg);
+    mbedtls_entropy_free(&entropy);
+    if (settings->has_contentkey) {
+        memcpy(ctx->keys[2], settings->contentkey, 0x10);
+    }
+
+    /* Master key 0 is crypto type 0 or 1, and later ones are one less than the crypto type. */
+    unsigned char crypto_type = key_generation ? (unsigned char)(key_generation + 1) : 0;
+    ctx->header.crypto_type = crypto_type < 2 ? crypto_type : 2;
+    ctx->header.crypto_type2 = crypto_type > 2 ? crypto_type : 0;
+    ctx->header.kaek_ind = 0;
+    const unsigned char *key_area_key = settings->keyset.key_area_keys[key_generation][ctx->header.kaek_ind];
+    static const unsigned char zeroes[0x10] = {0};
+    if (memcmp(key_area_key, zeroes, 0x10) == 0) {
+        fprintf(stderr, "Key area key for master key %"PRIu32" is not available!\n", key_generation);
+        fatal_exit();
+    }
+    aes_ctx_t *aes_ctx = new_aes_ctx(key_area_key, 16, AES_MODE_ECB);
+    aes_encrypt(aes_ctx, ctx->header.encrypted_keys, ctx->keys, sizeof(ctx->keys));
+    free_aes_ctx(aes_ctx);
+}
+
+static void nca_pack_free(nca_pack_ctx_t *ctx) {
+    for (unsigned int i = 0; i < ctx->num_sections; i++) {
+        free(ctx->sections[i].pieces);
+        free(ctx->sections[i].hashes);
+    }
+    for (uint32_t i = 0; i < ctx->num_exefs_files; i++) {
+        free(ctx->exefs_paths[i]);
+        free(ctx->exefs_names[i]);
+    }
+    free(ctx->exefs_paths);
+    free(ctx->exefs_names);
+    free(ctx->exefs_sizes);
+    free(ctx->pfs0_header);
+}
+
+int nca_pack(hactool_ctx_t *tool_ctx, const char *out_path) {
+    hactool_settings_t *settings = &tool_ctx->settings;
+    nca_pack_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.tool_ctx = tool_ctx;
+    ctx.out_path = out_path;
+    ctx.num_jobs = settings->build_jobs ? settings->build_jobs : ROMFS_BUILD_DEFAULT_JOBS;
+
+    static const unsigned char zeroes[0x20] = {0};
+    if (memcmp(settings->keyset.header_key, zeroes, 0x20) == 0) {
+        fprintf(stderr, "NCA header key is not available!\n");
+        return 0;
+    }
+    unsigned char private_exponent[0x100];
+    int is_signed = settings->pack_sign_key_path.valid == VALIDITY_VALID;
+    if (is_signed) {
+        FILE *f = fopen(settings->pack_sign_key_path.char_path, "rb");
+        if (f == NULL || fread(private_exponent, 1, sizeof(private_exponent), f) != sizeof(private_exponent)) {
+            fprintf(stderr, "Failed to read %#x-byte private exponent from %s!\n", (unsigned int)sizeof(private_exponent), settings->pack_sign_key_path.char_path);
+            return 0;
+        }
+        fclose(f);
+    }
+
+    trace_span_t trace_span;
+    trace_begin(&trace_span);
+    if (settings->pack_exefs_dir_path.valid == VALIDITY_VALID) {
+        nca_pack_add_exefs(&ctx, settings->pack_exefs_dir_path.char_path);
+    }
+    if (settings->pack_romfs_path.valid == VALIDITY_VALID) {
+        nca_pack_add_romfs(&ctx, settings->pack_romfs_path.char_path);
+    }
+    trace_end(&trace_span, "NCA pack scan", TRACE_NO_SECTION, "%s", out_path);
+
+    ctx.header.magic = MAGIC_NCA3;
+    ctx.header.title_id = settings->pack_title_id;
+    if (settings->has_pack_content_type) {
+        ctx.header.content_type = settings->pack_content_type;
+    } else {
+        ctx.header.content_type = settings->pack_exefs_dir_path.valid == VALIDITY_VALID ? 0 : 4; /* Program or Data. */
+    }
+    nca_pack_init_keys(&ctx, settings->pack_key_generation);
+
+    uint64_t offset = sizeof(nca_header_t);
+    for (unsigned int i = 0; i < ctx.num_sections; i++) {
+        nca_pack_section_t *section = &ctx.sections[i];
+        uint64_t num_blocks = (section->data_size + section->block_size - 1) / section->block_size;
+        if ((section->hashes = calloc(num_blocks ? num_blocks : 1, 0x20)) == NULL) {
+            fprintf(stderr, "Failed to allocate NCA section hashes!\n");
+            fatal_exit();
+        }
+        section->offset = offset;
+        section->first_chunk = ctx.num_chunks;
+        section->num_chunks = (section->size - section->data_offset + NCA_PACK_CHUNK_SIZE - 1) / NCA_PACK_CHUNK_SIZE;
+        ctx.num_chunks += section->num_chunks;
+        ctx.header.section_entries[i].media_start_offset = (uint32_t)(offset / MEDIA_SIZE);
+        offset += section->size;
+        ctx.header.section_entries[i].media_end_offset = (uint32_t)(offset / MEDIA_SIZE);
+    }
+    ctx.header.nca_size = offset;
+
+    /* Checked before the output is opened, since opening it truncates it. */
+    for (unsigned int i = 0; i < ctx.num_sections; i++) {
+        for (uint32_t j = 0; j < ctx.sections[i].num_pieces; j++) {
+            const char *path = ctx.sections[i].pieces[j].path;
+            if (path != NULL && is_same_file(path, out_path)) {
+                fprintf(stderr, "%s can't be packed into itself!\n", out_path);
+                nca_pack_free(&ctx);
+                return 0;
+            }
+        }
+    }
+
+    FILE *out = fopen(out_path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", out_path);
+        nca_pack_free(&ctx);
+        return 0;
+    }
+    preallocate_file(out, ctx.header.nca_size);
+    fflush(out);
+
+    trace_begin(&trace_span);
+    nca_pack_run_workers(&ctx);
+    trace_end(&trace_span, "NCA pack data", TRACE_NO_SECTION, "%"PRIu64" chunks", ctx.num_chunks);
+
+    trace_begin(&trace_span);
+    aes_ctx_t *aes_ctx = new_aes_ctx(ctx.keys[2], 16, AES_MODE_CTR);
+    for (unsigned int i = 0; i < ctx.num_sections; i++) {
+        nca_pack_section_t *section = &ctx.sections[i];
+        unsigned char *meta = nca_pack_build_hashes(section);
+        nca_pack_encrypt(aes_ctx, section, meta, section->data_offset, section->offset);
+        nca_pack_write(out, out_path, meta, section->data_offset, section->offset);
+        free(meta);
+        ctx.header.fs_headers[i] = section->header;
+        sha256_hash_buffer(ctx.header.section_hashes[i], &ctx.header.fs_headers[i], sizeof(nca_fs_header_t));
+    }
+    free_aes_ctx(aes_ctx);
+    trace_end(&trace_span, "NCA pack hashes", TRACE_NO_SECTION, NULL);
+
+    if (is_signed && !rsa2048_pss_sign(ctx.header.fixed_key_sig, &ctx.header.magic, 0x200, settings->keyset.nca_hdr_fixed_key_modulus, private_exponent)) {
+        fprintf(stderr, "Failed to sign NCA header!\n");
+        fatal_exit();
+    }
+    nca_header_t encrypted_header;
+    aes_ctx = new_aes_ctx(settings->keyset.header_key, 32, AES_MODE_XTS);
+    aes_xts_encrypt(aes_ctx, &encrypted_header, &ctx.header, sizeof(nca_header_t), 0, 0x200);
+    free_aes_ctx(aes_ctx);
+    nca_pack_write(out, out_path, &encrypted_header, sizeof(encrypted_header), 0);
+    if (!fsync_file(out) || fclose(out) != 0) {
+        fprintf(stderr, "Failed to write %s!\n", out_path);
+        fatal_exit();
+    }
+
+    printf("NCA: %u section(s), %"PRIu64" bytes%s, written to %s.\n", ctx.num_sections, ctx.header.nca_size, is_signed ? ", signed" : "", out_path);
+    nca_pack_free(&ctx);
+    return 1;
+}
@@ -0,0 +1,58 @@
+#ifndef HACTOOL_NCAPACK_H
+#define HACTOOL_NCAPACK_H
+
+#include <stdatomic.h>
+#include "types.h"
+#include "settings.h"
+#include "nca.h"
+
+#define NCA_PACK_CHUNK_SIZE 0x100000 /* Bytes read, hashed, encrypted and written by a worker at a time. */
+#define NCA_PACK_PFS0_BLOCK_SIZE 0x10000
+#define NCA_PACK_IVFC_BLOCK_SIZE 0x4000
+#define NCA_PACK_IVFC_BLOCK_SIZE_LOG2 14
+
+/* Part of the hashed region of a section, from memory or from a file. */
+typedef struct {
+    const char *path; /* NULL if the bytes are in data. */
+    const unsigned char *data;
+    uint64_t offset; /* Within the hashed region. */
+    uint64_t size;
+} nca_pack_piece_t;
+
+typedef struct {
+    nca_fs_header_t header;
+    uint64_t offset; /* Within the NCA. */
+    uint64_t size;
+    uint64_t data_offset; /* Of the hashed region, the PFS0 or RomFS, within the section. */
+    uint64_t data_size;
+    uint32_t block_size;
+    int pad_last_block; /* IVFC hashes a short last block zero-padded, PFS0 as it is. */
+    nca_pack_piece_t *pieces; /* In order. */
+    uint32_t num_pieces;
+    unsigned char *hashes; /* Of every block of the hashed region. */
+    uint64_t first_chunk; /* Chunks are numbered across sections. */
+    uint64_t num_chunks;
+} nca_pack_section_t;
+
+typedef struct {
+    hactool_ctx_t *tool_ctx;
+    const char *out_path;
+    nca_header_t header;
+    nca_pack_section_t sections[4];
+    unsigned int num_sections;
+    pfs0_header_t *pfs0_header;
+    char **exefs_paths;
+    char **exefs_names;
+    uint64_t *exefs_sizes;
+    uint32_t num_exefs_files;
+    unsigned char keys[4][0x10]; /* Plaintext key area. */
+    uint32_t num_jobs;
+    atomic_uint_fast64_t next_chunk;
+    atomic_int stop; /* Set when a worker fails. */
+    uint64_t num_chunks;
+} nca_pack_ctx_t;
+
+/* Pack an ExeFS directory and a RomFS image, given in settings, into an NCA at out_path. */
+int nca_pack(hactool_ctx_t *tool_ctx, const char *out_path);
+
+#endif
@@ -306,7 +306,7 @@ void kac_print(uint32_t *descriptors, uint32_t num_descriptors) {
                     cur_mmio = calloc(1, sizeof(kac_mmio_t));
                     if (cur_mmio == NULL) {
                         fprintf(stderr, "Failed to allocate MMIO descriptor!\n");
-                        exit(EXIT_FAILURE);
+                        fatal_exit();
                     }
                     cur_mmio->address = (desc & 0xFFFFFF) << 12;
                     cur_mmio->is_ro = desc >> 24;
@@ -321,7 +321,7 @@ void kac_print(uint32_t *descriptors, uint32_t num_descriptors) {
                 page_mmio = calloc(1, sizeof(kac_mmio_t));
                 if (page_mmio == NULL) {
                     fprintf(stderr, "Failed to allocate MMIO descriptor!\n");
-                    exit(EXIT_FAILURE);
+                    fatal_exit();
                 }
                 page_mmio->address = desc << 12;
                 page_mmio->size = 0x1000;
@@ -335,7 +335,7 @@ void kac_print(uint32_t *descriptors, uint32_t num_descriptors) {
                 cur_irq = calloc(1, sizeof(kac_irq_t));
                 if (cur_irq == NULL) {
                     fprintf(stderr, "Failed to allocate IRQ descriptor!\n");
-                    exit(EXIT_FAILURE);
+                    fatal_exit();
                 }
                 cur_irq->irq0 = desc & 0x3FF;
                 cur_irq->irq1 = (desc >> 10) & 0x3FF;
@@ -618,6 +618,7 @@ void npdm_print(npdm_t *npdm, hactool_ctx_t *tool_ctx) {
             memdump(stdout, "        Signature (GOOD):           ", &acid->signature, 0x100);
         } else {
             memdump(stdout, "        Signature (FAIL):           ", &acid->signature, 0x100);
+            results_add_check(tool_ctx->results, VALIDITY_INVALID);
         }
     } else {
         memdump(stdout, "        Signature:                  ", &acid->signature, 0x100);
@@ -0,0 +1,312 @@
+#include <string.h>
+#include "nsp.h"
+#include "nca.h"
+
+static uint64_t nsp_get_file_offset(nsp_ctx_t *ctx, uint32_t i) {
+    return pfs0_get_header_size(ctx->pfs0_ctx.header) + pfs0_get_file_entry(ctx->pfs0_ctx.header, i)->offset;
+}
+
+static int nsp_has_suffix(const char *name, const char *suffix) {
+    size_t name_len = strlen(name);
+    size_t suffix_len = strlen(suffix);
+    return name_len >= suffix_len && !strcmp(name + name_len - suffix_len, suffix);
+}
+
+static uint64_t ticket_get_body_offset(uint32_t sig_type) {
+    switch (sig_type) {
+        case SIGTYPE_RSA4096_SHA1:
+        case SIGTYPE_RSA4096_SHA256:
+            return 0x240;
+        case SIGTYPE_RSA2048_SHA1:
+        case SIGTYPE_RSA2048_SHA256:
+            return 0x140;
+        case SIGTYPE_ECDSA_SHA1:
+        case SIGTYPE_ECDSA_SHA256:
+            return 0x80;
+        default:
+            return 0;
+    }
+}
+
+/* Read common title keys from every ticket in the NSP, keeping them in memory. */
+static void nsp_load_tickets(nsp_ctx_t *ctx) {
+    for (uint32_t i = 0; i < ctx->pfs0_ctx.header->num_files; i++) {
+        char *cur_name = pfs0_get_file_name(ctx->pfs0_ctx.header, i);
+        if (!nsp_has_suffix(cur_name, ".tik")) {
+            continue;
+        }
+
+        uint32_t sig_type;
+        ticket_body_t body;
+        fseeko64(ctx->file, nsp_get_file_offset(ctx, i), SEEK_SET);
+        if (fread(&sig_type, 1, sizeof(sig_type), ctx->file) != sizeof(sig_type)) {
+            fprintf(stderr, "Failed to read ticket %s!\n", cur_name);
+            fatal_exit();
+        }
+        uint64_t body_ofs = ticket_get_body_offset(sig_type);
+        if (body_ofs == 0 || body_ofs + sizeof(body) > pfs0_get_file_entry(ctx->pfs0_ctx.header, i)->size) {
+            fprintf(stderr, "Warning: ticket %s is invalid!\n", cur_name);
+            results_add_error(ctx->tool_ctx->results);
+            continue;
+        }
+        fseeko64(ctx->file, nsp_get_file_offset(ctx, i) + body_ofs, SEEK_SET);
+        if (fread(&body, 1, sizeof(body), ctx->file) != sizeof(body)) {
+            fprintf(stderr, "Failed to read ticket %s!\n", cur_name);
+            fatal_exit();
+        }
+        if (body.titlekey_type != TITLEKEY_COMMON) {
+            fprintf(stderr, "Warning: ticket %s has a personalized title key, which is not supported!\n", cur_name);
+            continue;
+        }
+
+        ctx->titlekeys = realloc(ctx->titlekeys, (ctx->num_titlekeys + 1) * sizeof(*ctx->titlekeys));
+        if (ctx->titlekeys == NULL) {
+            fprintf(stderr, "Failed to allocate title keys!\n");
+            fatal_exit();
+        }
+        memcpy(ctx->titlekeys[ctx->num_titlekeys].rights_id, body.rights_id, 0x10);
+        memcpy(ctx->titlekeys[ctx->num_titlekeys].titlekey, body.titlekey_block, 0x10);
+        ctx->num_titlekeys++;
+    }
+}
+
+/* Pull the CNMT out of a processed Meta NCA. */
+static void nsp_read_cnmt(nsp_ctx_t *ctx, nca_ctx_t *nca_ctx, const char *meta_name) {
+    nca_section_ctx_t *section = &nca_ctx->section_contexts[0];
+    if (!section->is_present || section->type != PFS0 || nca_section_get_pfs0_header(section) == NULL || section->pfs0_ctx.header->magic != MAGIC_PFS0) {
+        fprintf(stderr, "Warning: failed to read content meta from %s!\n", meta_name);
+        results_add_error(ctx->tool_ctx->results);
+        return;
+    }
+
+    pfs0_header_t *pfs0_header = section->pfs0_ctx.header;
+    for (uint32_t i = 0; i < pfs0_header->num_files; i++) {
+        if (!nsp_has_suffix(pfs0_get_file_name(pfs0_header, i), ".cnmt")) {
+            continue;
+        }
+        pfs0_file_entry_t *cur_file = pfs0_get_file_entry(pfs0_header, i);
+        if (cur_file->size < sizeof(cnmt_header_t)) {
+            break;
+        }
+        unsigned char *cnmt = malloc(cur_file->size);
+        if (cnmt == NULL) {
+            fprintf(stderr, "Failed to allocate content meta!\n");
+            fatal_exit();
+        }
+        nca_section_fseek(section, section->pfs0_ctx.superblock->pfs0_offset + pfs0_get_header_size(pfs0_header) + cur_file->offset);
+        if (nca_section_fread(section, cnmt, cur_file->size) != cur_file->size) {
+            fprintf(stderr, "Failed to read content meta!\n");
+            fatal_exit();
+        }
+
+        cnmt_header_t *header = (cnmt_header_t *)cnmt;
+        uint64_t records_ofs = sizeof(cnmt_header_t) + header->extended_header_size;
+        if (records_ofs + (uint64_t)header->content_count * sizeof(cnmt_content_record_t) > cur_file->size) {
+            fprintf(stderr, "Warning: content meta in %s is corrupt!\n", meta_name);
+            free(cnmt);
+            break;
+        }
+
+        ctx->cnmts = realloc(ctx->cnmts, (ctx->num_cnmts + 1) * sizeof(*ctx->cnmts));
+        if (ctx->cnmts == NULL) {
+            fprintf(stderr, "Failed to allocate content meta!\n");
+            fatal_exit();
+        }
+        nsp_cnmt_ctx_t *cur_cnmt = &ctx->cnmts[ctx->num_cnmts++];
+        memset(cur_cnmt, 0, sizeof(*cur_cnmt));
+        cur_cnmt->meta_name = meta_name;
+        cur_cnmt->header = *header;
+        cur_cnmt->records = malloc(header->content_count * sizeof(cnmt_content_record_t) + 1);
+        cur_cnmt->is_present = calloc(header->content_count + 1, sizeof(int));
+        cur_cnmt->hash_validity = calloc(header->content_count + 1, sizeof(validity_t));
+        if (cur_cnmt->records == NULL || cur_cnmt->is_present == NULL || cur_cnmt->hash_validity == NULL) {
+            fprintf(stderr, "Failed to allocate content meta!\n");
+            fatal_exit();
+        }
+        memcpy(cur_cnmt->records, cnmt + records_ofs, header->content_count * sizeof(cnmt_content_record_t));
+        free(cnmt);
+        break;
+    }
+}
+
+/* Set up an NCA stored in the NSP, decrypting with the title keys of its tickets. */
+static void nsp_init_nca(nsp_ctx_t *ctx, nca_nested_t *nested, uint32_t i) {
+    nca_init_nested(&nested->nca_ctx, &nested->tool_ctx, ctx->tool_ctx, ctx->file, nsp_get_file_offset(ctx, i), pfs0_get_file_entry(ctx->pfs0_ctx.header, i)->size, pfs0_get_file_name(ctx->pfs0_ctx.header, i));
+    nested->tool_ctx.titlekeys = ctx->titlekeys;
+    nested->tool_ctx.num_titlekeys = ctx->num_titlekeys;
+}
+
+static int nsp_find_content(nsp_ctx_t *ctx, const uint8_t *content_id) {
+    char name[0x30];
+    for (unsigned int i = 0; i < 0x10; i++) {
+        sprintf(name + i * 2, "%02x", content_id[i]);
+    }
+    strcpy(name + 0x20, ".nca");
+    for (uint32_t i = 0; i < ctx->pfs0_ctx.header->num_files; i++) {
+        if (!strcmp(pfs0_get_file_name(ctx->pfs0_ctx.header, i), name)) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+void nsp_process(nsp_ctx_t *ctx) {
+    ctx->pfs0_ctx.file = ctx->file;
+    ctx->pfs0_ctx.tool_ctx = ctx->tool_ctx;
+    pfs0_process(&ctx->pfs0_ctx);
+
+    nsp_load_tickets(ctx);
+
+    uint32_t num_files = ctx->pfs0_ctx.header->num_files;
+    uint32_t num_jobs = ctx->tool_ctx->settings.jobs ? ctx->tool_ctx->settings.jobs : HACTOOL_DEFAULT_JOBS;
+    int *is_processed = calloc(num_files + 1, sizeof(int));
+    nca_nested_t *ncas = calloc(num_files + 1, sizeof(nca_nested_t));
+    /* The CNMT record each content NCA is checked against. */
+    nsp_cnmt_ctx_t **nca_cnmts = calloc(num_files + 1, sizeof(nsp_cnmt_ctx_t *));
+    uint32_t *nca_records = calloc(num_files + 1, sizeof(uint32_t));
+    if (is_processed == NULL || ncas == NULL || nca_cnmts == NULL || nca_records == NULL) {
+        fprintf(stderr, "Failed to allocate NSP context!\n");
+        fatal_exit();
+    }
+
+    /* Meta NCAs come first, since their CNMTs say which NCAs make up the title. */
+    uint32_t num_ncas = 0;
+    for (uint32_t i = 0; i < num_files; i++) {
+        if (nsp_has_suffix(pfs0_get_file_name(ctx->pfs0_ctx.header, i), ".cnmt.nca")) {
+            nsp_init_nca(ctx, &ncas[num_ncas++], i);
+            is_processed[i] = 1;
+        }
+    }
+    nca_process_nested(ncas, num_ncas, num_jobs, ctx->file_name, "nsp:/");
+    for (uint32_t n = 0; n < num_ncas; n++) {
+        nsp_read_cnmt(ctx, &ncas[n].nca_ctx, ncas[n].nca_ctx.file_name);
+    }
+    nca_free_nested(ncas, num_ncas);
+
+    num_ncas = 0;
+    for (uint32_t c = 0; c < ctx->num_cnmts; c++) {
+        nsp_cnmt_ctx_t *cur_cnmt = &ctx->cnmts[c];
+        for (uint32_t j = 0; j < cur_cnmt->header.content_count; j++) {
+            int i = nsp_find_content(ctx, cur_cnmt->records[j].content_id);
+            if (i < 0) {
+                continue;
+            }
+            cur_cnmt->is_present[j] = 1;
+            if (is_processed[i]) {
+                continue;
+            }
+            nca_cnmts[num_ncas] = cur_cnmt;
+            nca_records[num_ncas] = j;
+            nsp_init_nca(ctx, &ncas[num_ncas++], (uint32_t)i);
+            is_processed[i] = 1;
+        }
+    }
+
+    /* Without content meta, every NCA in the NSP is processed. */
+    if (ctx->num_cnmts == 0) {
+        for (uint32_t i = 0; i < num_files; i++) {
+            if (!is_processed[i] && nsp_has_suffix(pfs0_get_file_name(ctx->pfs0_ctx.header, i), ".nca")) {
+                nsp_init_nca(ctx, &ncas[num_ncas++], i);
+            }
+        }
+    }
+    nca_process_nested(ncas, num_ncas, num_jobs, ctx->file_name, "nsp:/");
+
+    for (uint32_t n = 0; n < num_ncas; n++) {
+        nca_ctx_t *nca_ctx = &ncas[n].nca_ctx;
+        nsp_cnmt_ctx_t *cur_cnmt = nca_cnmts[n];
+        if (cur_cnmt != NULL && nca_ctx->has_content_hash) {
+            uint32_t j = nca_records[n];
+            cur_cnmt->hash_validity[j] = memcmp(nca_ctx->content_hash, cur_cnmt->records[j].hash, 0x20) ? VALIDITY_INVALID : VALIDITY_VALID;
+            results_add_check(ctx->tool_ctx->results, cur_cnmt->hash_validity[j]);
+        }
+    }
+    nca_free_nested(ncas, num_ncas);
+    free(nca_records);
+    free(nca_cnmts);
+    free(ncas);
+    free(is_processed);
+
+    if (ctx->tool_ctx->action & ACTION_INFO) {
+        nsp_print(ctx);
+    }
+}
+
+static const char *nsp_get_content_type(uint8_t type) {
+    switch (type) {
+        case CONTENT_TYPE_META: return "Meta";
+        case CONTENT_TYPE_PROGRAM: return "Program";
+        case CONTENT_TYPE_DATA: return "Data";
+        case CONTENT_TYPE_CONTROL: return "Control";
+        case CONTENT_TYPE_HTMLDOCUMENT: return "HtmlDocument";
+        case CONTENT_TYPE_LEGALINFORMATION: return "LegalInformation";
+        case CONTENT_TYPE_DELTAFRAGMENT: return "DeltaFragment";
+        default: return "Unknown";
+    }
+}
+
+static const char *nsp_get_meta_type(uint8_t type) {
+    switch (type) {
+        case 0x01: return "SystemProgram";
+        case 0x02: return "SystemData";
+        case 0x03: return "SystemUpdate";
+        case 0x04: return "BootImagePackage";
+        case 0x05: return "BootImagePackageSafe";
+        case 0x80: return "Application";
+        case 0x81: return "Patch";
+        case 0x82: return "AddOnContent";
+        case 0x83: return "Delta";
+        default: return "Unknown";
+    }
+}
+
+void nsp_print(nsp_ctx_t *ctx) {
+    printf("\nNSP:\n");
+    printf("Tickets:                            %"PRId32"\n", ctx->num_titlekeys);
+    for (uint32_t i = 0; i < ctx->num_titlekeys; i++) {
+        memdump(stdout, "    Rights ID:                      ", ctx->titlekeys[i].rights_id, 0x10);
+    }
+
+    for (uint32_t c = 0; c < ctx->num_cnmts; c++) {
+        nsp_cnmt_ctx_t *cur_cnmt = &ctx->cnmts[c];
+        printf("Content Meta:                       %s\n", cur_cnmt->meta_name);
+        printf("    Title ID:                       %016"PRIx64"\n", cur_cnmt->header.title_id);
+        printf("    Title Version:                  v%"PRId32"\n", cur_cnmt->header.title_version);
+        printf("    Type:                           %s\n", nsp_get_meta_type(cur_cnmt->header.type));
+        printf("    Contents:");
+        if (cur_cnmt->header.content_count == 0) {
+            printf("\n");
+        }
+        for (uint32_t j = 0; j < cur_cnmt->header.content_count; j++) {
+            cnmt_content_record_t *rec = &cur_cnmt->records[j];
+            uint64_t size = 0;
+            for (unsigned int k = 0; k < 6; k++) {
+                size |= (uint64_t)rec->size[k] << (8 * k);
+            }
+            printf("%s", j == 0 ? "                       " : "                                    ");
+            for (unsigned int k = 0; k < 0x10; k++) {
+                printf("%02x", rec->content_id[k]);
+            }
+            printf(" %-16s %012"PRIx64, nsp_get_content_type(rec->type), size);
+            if (!cur_cnmt->is_present[j]) {
+                printf(" (MISSING)\n");
+            } else if (cur_cnmt->hash_validity[j] != VALIDITY_UNCHECKED) {
+                printf(" (%s)\n", GET_VALIDITY_STR(cur_cnmt->hash_validity[j]));
+            } else {
+                printf("\n");
+            }
+        }
+    }
+}
+
+void nsp_free(nsp_ctx_t *ctx) {
+    for (uint32_t c = 0; c < ctx->num_cnmts; c++) {
+        free(ctx->cnmts[c].records);
+        free(ctx->cnmts[c].is_present);
+        free(ctx->cnmts[c].hash_validity);
+    }
+    free(ctx->cnmts);
+    free(ctx->titlekeys);
+    free(ctx->pfs0_ctx.header);
+    free(ctx->pfs0_ctx.npdm);
+}
@@ -0,0 +1,96 @@
+#ifndef HACTOOL_NSP_H
+#define HACTOOL_NSP_H
+
+#include "types.h"
+#include "settings.h"
+#include "pfs0.h"
+
+typedef enum {
+    SIGTYPE_RSA4096_SHA1 = 0x10000,
+    SIGTYPE_RSA2048_SHA1 = 0x10001,
+    SIGTYPE_ECDSA_SHA1 = 0x10002,
+    SIGTYPE_RSA4096_SHA256 = 0x10003,
+    SIGTYPE_RSA2048_SHA256 = 0x10004,
+    SIGTYPE_ECDSA_SHA256 = 0x10005
+} signature_type_t;
+
+typedef enum {
+    TITLEKEY_COMMON = 0,
+    TITLEKEY_PERSONALIZED = 1
+} titlekey_type_t;
+
+/* Ticket body, following the signature block. */
+typedef struct {
+    char issuer[0x40];
+    uint8_t titlekey_block[0x100];
+    uint8_t format_version;
+    uint8_t titlekey_type;
+    uint16_t ticket_version;
+    uint8_t license_type;
+    uint8_t master_key_revision;
+    uint16_t properties;
+    uint8_t _0x148[0x8]; /* Padding. */
+    uint64_t ticket_id;
+    uint64_t device_id;
+    uint8_t rights_id[0x10];
+    uint32_t account_id;
+    uint8_t _0x174[0xC]; /* Padding. */
+} ticket_body_t;
+
+typedef enum {
+    CONTENT_TYPE_META = 0,
+    CONTENT_TYPE_PROGRAM = 1,
+    CONTENT_TYPE_DATA = 2,
+    CONTENT_TYPE_CONTROL = 3,
+    CONTENT_TYPE_HTMLDOCUMENT = 4,
+    CONTENT_TYPE_LEGALINFORMATION = 5,
+    CONTENT_TYPE_DELTAFRAGMENT = 6
+} cnmt_content_type_t;
+
+/* Packaged content meta header. */
+typedef struct {
+    uint64_t title_id;
+    uint32_t title_version;
+    uint8_t type;
+    uint8_t _0xD; /* Padding. */
+    uint16_t extended_header_size;
+    uint16_t content_count;
+    uint16_t content_meta_count;
+    uint8_t attributes;
+    uint8_t _0x15[0x3]; /* Padding. */
+    uint32_t required_system_version;
+    uint8_t _0x1C[0x4]; /* Padding. */
+} cnmt_header_t;
+
+typedef struct {
+    uint8_t hash[0x20]; /* SHA-256 of the whole NCA. */
+    uint8_t content_id[0x10];
+    uint8_t size[0x6];
+    uint8_t type;
+    uint8_t id_offset;
+} cnmt_content_record_t;
+
+typedef struct {
+    const char *meta_name; /* Name of the Meta NCA this came from. */
+    cnmt_header_t header;
+    cnmt_content_record_t *records;
+    int *is_present;
+    validity_t *hash_validity;
+} nsp_cnmt_ctx_t;
+
+typedef struct {
+    FILE *file;
+    const char *file_name; /* Path of file, for NCA workers to open their own; NULL to process NCAs one by one. */
+    hactool_ctx_t *tool_ctx;
+    pfs0_ctx_t pfs0_ctx;
+    titlekey_entry_t *titlekeys;
+    uint32_t num_titlekeys;
+    nsp_cnmt_ctx_t *cnmts;
+    uint32_t num_cnmts;
+} nsp_ctx_t;
+
+void nsp_process(nsp_ctx_t *ctx);
+void nsp_print(nsp_ctx_t *ctx);
+void nsp_free(nsp_ctx_t *ctx);
+
+#endif
@@ -1,5 +1,6 @@
 #include <string.h>
 #include "pfs0.h"
+#include "tar.h"
 
 void pfs0_process(pfs0_ctx_t *ctx) {
     /* Read *just* safe amount. */
@@ -7,25 +8,25 @@ void pfs0_process(pfs0_ctx_t *ctx) {
     fseeko64(ctx->file, 0, SEEK_SET);
     if (fread(&raw_header, 1, sizeof(raw_header), ctx->file) != sizeof(raw_header)) {
         fprintf(stderr, "Failed to read PFS0 header!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     
     if (raw_header.magic != MAGIC_PFS0) {
         printf("Error: PFS0 is corrupt!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     uint64_t header_size = pfs0_get_header_size(&raw_header);
     ctx->header = malloc(header_size);
     if (ctx->header == NULL) {
         fprintf(stderr, "Failed to allocate PFS0 header!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     
     fseeko64(ctx->file, 0, SEEK_SET);
     if (fread(ctx->header, 1, header_size, ctx->file) != header_size) {
         fprintf(stderr, "Failed to read PFS0 header!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     
     /* Weak file validation. */
@@ -36,7 +37,7 @@ void pfs0_process(pfs0_ctx_t *ctx) {
         pfs0_file_entry_t *cur_file = pfs0_get_file_entry(ctx->header, i);
         if (cur_file->offset != cur_ofs) {
             printf("Error: PFS0 is corrupt!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
         cur_ofs += cur_file->size;
     }
@@ -49,12 +50,12 @@ void pfs0_process(pfs0_ctx_t *ctx) {
             ctx->npdm = malloc(cur_file->size);
             if (ctx->npdm == NULL) {
                 fprintf(stderr, "Failed to allocate NPDM!\n");
-                exit(EXIT_FAILURE);
+                fatal_exit();
             }
             fseeko64(ctx->file, pfs0_get_header_size(ctx->header) + cur_file->offset, SEEK_SET);
             if (fread(ctx->npdm, 1, cur_file->size, ctx->file) != cur_file->size) {
                 fprintf(stderr, "Failed to read NPDM!\n");
-                exit(EXIT_FAILURE);
+                fatal_exit();
             }
 
             if (ctx->npdm->magic == MAGIC_META) {
@@ -76,13 +77,13 @@ void pfs0_process(pfs0_ctx_t *ctx) {
 void pfs0_save_file(pfs0_ctx_t *ctx, uint32_t i, filepath_t *dirpath) {
     if (i >= ctx->header->num_files) {
         fprintf(stderr, "Could not save file %"PRId32"!\n", i);
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     pfs0_file_entry_t *cur_file = pfs0_get_file_entry(ctx->header, i);
 
     if (strlen(pfs0_get_file_name(ctx->header, i)) >= MAX_PATH - strlen(dirpath->char_path) - 1) {
         fprintf(stderr, "Filename too long in PFS0!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     filepath_t filepath;
@@ -91,7 +92,7 @@ void pfs0_save_file(pfs0_ctx_t *ctx, uint32_t i, filepath_t *dirpath) {
 
     printf("Saving %s to %s...\n", pfs0_get_file_name(ctx->header, i), filepath.char_path);
     uint64_t ofs = pfs0_get_header_size(ctx->header) + cur_file->offset;
-    save_file_section(ctx->file, ofs, cur_file->size, &filepath);
+    save_file_section(ctx->file, ofs, cur_file->size, &filepath, ctx->tool_ctx->manifest);
 }
 
 
@@ -107,7 +108,13 @@ void pfs0_save(pfs0_ctx_t *ctx) {
     if (dirpath == NULL || dirpath->valid != VALIDITY_VALID) {
         dirpath = &ctx->tool_ctx->settings.pfs0_dir_path;
     }
-    if (dirpath != NULL && dirpath->valid == VALIDITY_VALID) {
+    if (ctx->tool_ctx->pfs0_tar != NULL) {
+        for (uint32_t i = 0; i < ctx->header->num_files; i++) {
+            pfs0_file_entry_t *cur_file = pfs0_get_file_entry(ctx->header, i);
+            printf("Archiving %s...\n", pfs0_get_file_name(ctx->header, i));
+            tar_save_file_section(ctx->tool_ctx->pfs0_tar, ctx->file, pfs0_get_header_size(ctx->header) + cur_file->offset, cur_file->size, pfs0_get_file_name(ctx->header, i), ctx->tool_ctx->manifest);
+        }
+    } else if (dirpath != NULL && dirpath->valid == VALIDITY_VALID) {
         os_makedir(dirpath->os_path);
         for (uint32_t i = 0; i < ctx->header->num_files; i++) {
             pfs0_save_file(ctx, i, dirpath);
@@ -132,4 +139,35 @@ void pfs0_print(pfs0_ctx_t *ctx) {
     if (ctx->is_exefs) {
         npdm_print(ctx->npdm, ctx->tool_ctx);
     }
-}
\ No newline at end of file
+}
+/* The string table is padded so that file data starts aligned. */
+pfs0_header_t *pfs0_build_header(uint32_t num_files, const char *const *names, const uint64_t *sizes) {
+    uint32_t names_size = 0;
+    for (uint32_t i = 0; i < num_files; i++) {
+        names_size += (uint32_t)strlen(names[i]) + 1;
+    }
+    uint64_t header_size = sizeof(pfs0_header_t) + num_files * sizeof(pfs0_file_entry_t) + names_size;
+    uint64_t padded_size = align64(header_size, PFS0_HEADER_ALIGN);
+    pfs0_header_t *header = calloc(1, padded_size);
+    if (header == NULL) {
+        fprintf(stderr, "Failed to allocate PFS0 header!\n");
+        fatal_exit();
+    }
+    header->magic = MAGIC_PFS0;
+    header->num_files = num_files;
+    header->string_table_size = names_size + (uint32_t)(padded_size - header_size);
+
+    char *string_table = pfs0_get_string_table(header);
+    uint64_t data_offset = 0;
+    uint32_t name_offset = 0;
+    for (uint32_t i = 0; i < num_files; i++) {
+        pfs0_file_entry_t *entry = pfs0_get_file_entry(header, i);
+        entry->offset = data_offset;
+        entry->size = sizes[i];
+        entry->string_table_offset = name_offset;
+        strcpy(string_table + name_offset, names[i]);
+        data_offset += sizes[i];
+        name_offset += (uint32_t)strlen(names[i]) + 1;
+    }
+    return header;
+}
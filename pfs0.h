@@ -6,6 +6,7 @@
 #include "npdm.h"
 
 #define MAGIC_PFS0 0x30534650
+#define PFS0_HEADER_ALIGN 0x20 /* File data starts aligned to this. */
 
 typedef struct {
     uint32_t magic;
@@ -64,4 +65,7 @@ void pfs0_process(pfs0_ctx_t *ctx);
 void pfs0_save(pfs0_ctx_t *ctx);
 void pfs0_print(pfs0_ctx_t *ctx);
 
+/* Builds the header of a PFS0 holding files of the given names and sizes, in that order. */
+pfs0_header_t *pfs0_build_header(uint32_t num_files, const char *const *names, const uint64_t *sizes);
+
 #endif
@@ -0,0 +1,243 @@
+#ifdef __linux__
+#define _GNU_SOURCE /* For copy_file_range. */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+#include "pfs0pack.h"
+#include "romfsbuild.h"
+#include "stats.h"
+#include "trace.h"
+#include "utils.h"
+
+/* Every offset in a PFS0 follows from the sizes of its files, so the header is written first and
+ * each file is then copied straight to its place, a chunk at a time by several threads. On Linux,
+ * copy_file_range lets the kernel move the data, which filesystems with reflinks can share instead
+ * of copying; elsewhere, or across filesystems that can't, it goes through a buffer per thread. */
+
+#ifdef _WIN32
+typedef struct _stat64 pfs0_pack_stat_t;
+#define pfs0_pack_stat _stat64
+#else
+typedef struct stat pfs0_pack_stat_t;
+#define pfs0_pack_stat stat
+#endif
+
+static const char *pfs0_pack_get_name(const char *path) {
+    const char *name = path;
+    for (const char *p = path; *p; p++) {
+        if (*p == '/' || *p == '\\') {
+            name = p + 1;
+        }
+    }
+    return name;
+}
+
+/* Copies bytes [start, start + size) of a file through memory, from wherever the kernel left off. */
+static void pfs0_pack_copy_buffered(pfs0_pack_ctx_t *ctx, uint32_t i, FILE *in, FILE *out, uint64_t start, uint64_t size, uint64_t out_offset, unsigned char **buf) {
+    if (*buf == NULL && (*buf = malloc(PFS0_PACK_BUFFER_SIZE)) == NULL) {
+        fprintf(stderr, "Failed to allocate PFS0 copy buffer!\n");
+        fatal_exit();
+    }
+    fseeko64(in, start, SEEK_SET);
+    fseeko64(out, out_offset, SEEK_SET);
+    for (uint64_t ofs = 0; ofs < size; ofs += PFS0_PACK_BUFFER_SIZE) {
+        uint64_t read_size = size - ofs < PFS0_PACK_BUFFER_SIZE ? size - ofs : PFS0_PACK_BUFFER_SIZE;
+        stats_span_t span;
+        stats_begin(&span);
+        if (fread(*buf, 1, read_size, in) != read_size) {
+            fprintf(stderr, "Failed to read %s; did it change while packing?\n", ctx->in_paths[i]);
+            fatal_exit();
+        }
+        stats_end(&span, STATS_READ, read_size);
+        stats_begin(&span);
+        if (fwrite(*buf, 1, read_size, out) != read_size) {
+            fprintf(stderr, "Failed to write %s!\n", ctx->out_path);
+            fatal_exit();
+        }
+        stats_end(&span, STATS_WRITE, read_size);
+    }
+}
+
+#ifdef __linux__
+/* Returns how much the kernel copied, which is all of it unless it can't copy between these files. */
+static uint64_t pfs0_pack_copy_kernel(pfs0_pack_ctx_t *ctx, uint32_t i, FILE *in, FILE *out, uint64_t start, uint64_t size, uint64_t out_offset) {
+    loff_t in_offset = (loff_t)start;
+    loff_t out_ofs = (loff_t)out_offset;
+    uint64_t copied = 0;
+    stats_span_t span;
+    stats_begin(&span);
+    while (copied < size) {
+        ssize_t n = copy_file_range(fileno(in), &in_offset, fileno(out), &out_ofs, (size_t)(size - copied), 0);
+        if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+            break;
+        }
+        if (n <= 0) {
+            fprintf(stderr, "Failed to copy %s; did it change while packing?\n", ctx->in_paths[i]);
+            fatal_exit();
+        }
+        copied += (uint64_t)n;
+    }
+    stats_end(&span, STATS_WRITE, copied);
+    atomic_fetch_add(&ctx->num_kernel_bytes, copied);
+    return copied;
+}
+#endif
+
+static void pfs0_pack_worker(void *arg) {
+    pfs0_pack_ctx_t *ctx = arg;
+    FILE *out = fopen(ctx->out_path, "r+b");
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", ctx->out_path);
+        fatal_exit();
+    }
+    unsigned char *buf = NULL;
+    FILE *in = NULL;
+    uint32_t in_index = UINT32_MAX;
+#ifdef __linux__
+    int use_kernel = 1;
+#endif
+    uint64_t c;
+    while (!atomic_load(&ctx->stop) && (c = atomic_fetch_add(&ctx->next_chunk, 1)) < ctx->num_chunks) {
+        /* Find the file the chunk belongs to; empty files have none. */
+        uint32_t lo = 0, hi = ctx->num_files - 1;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (ctx->first_chunks[mid + 1] <= c) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        uint32_t i = lo;
+        uint64_t start = (c - ctx->first_chunks[i]) * PFS0_PACK_CHUNK_SIZE;
+        uint64_t size = ctx->sizes[i] - start < PFS0_PACK_CHUNK_SIZE ? ctx->sizes[i] - start : PFS0_PACK_CHUNK_SIZE;
+        uint64_t out_offset = ctx->data_offset + pfs0_get_file_entry(ctx->header, i)->offset + start;
+        if (in_index != i) {
+            if (in != NULL) {
+                fclose(in);
+            }
+            if ((in = fopen(ctx->in_paths[i], "rb")) == NULL) {
+                fprintf(stderr, "Failed to open %s!\n", ctx->in_paths[i]);
+                fatal_exit();
+            }
+            in_index = i;
+        }
+
+        uint64_t copied = 0;
+#ifdef __linux__
+        if (use_kernel) {
+            copied = pfs0_pack_copy_kernel(ctx, i, in, out, start, size, out_offset);
+            use_kernel = copied == size;
+        }
+#endif
+        if (copied < size) {
+            pfs0_pack_copy_buffered(ctx, i, in, out, start + copied, size - copied, out_offset + copied, &buf);
+        }
+    }
+    if (in != NULL) {
+        fclose(in);
+    }
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Failed to write %s!\n", ctx->out_path);
+        fatal_exit();
+    }
+    free(buf);
+}
+
+static void pfs0_pack_run_workers(pfs0_pack_ctx_t *ctx) {
+    uint32_t num_threads = ctx->num_chunks < ctx->num_jobs ? (uint32_t)ctx->num_chunks : ctx->num_jobs;
+    atomic_store(&ctx->next_chunk, 0);
+    atomic_store(&ctx->stop, 0);
+    run_workers(num_threads, pfs0_pack_worker, ctx, &ctx->stop);
+}
+
+static void pfs0_pack_free(pfs0_pack_ctx_t *ctx) {
+    free(ctx->names);
+    free(ctx->sizes);
+    free(ctx->first_chunks);
+    free(ctx->header);
+}
+
+int pfs0_pack(hactool_ctx_t *tool_ctx, const char *out_path, char **in_paths, uint32_t num_files) {
+    pfs0_pack_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.tool_ctx = tool_ctx;
+    ctx.out_path = out_path;
+    ctx.in_paths = in_paths;
+    ctx.num_files = num_files;
+    ctx.num_jobs = tool_ctx->settings.build_jobs ? tool_ctx->settings.build_jobs : ROMFS_BUILD_DEFAULT_JOBS;
+    ctx.names = calloc(num_files ? num_files : 1, sizeof(char *));
+    ctx.sizes = calloc(num_files ? num_files : 1, sizeof(uint64_t));
+    ctx.first_chunks = calloc(num_files + 1, sizeof(uint64_t));
+    if (ctx.names == NULL || ctx.sizes == NULL || ctx.first_chunks == NULL) {
+        fprintf(stderr, "Failed to allocate PFS0 files!\n");
+        fatal_exit();
+    }
+
+    for (uint32_t i = 0; i < num_files; i++) {
+        pfs0_pack_stat_t st;
+        /* Checked before the output is opened, since opening it truncates it. */
+        if (is_same_file(in_paths[i], out_path)) {
+            fprintf(stderr, "%s can't be packed into itself!\n", out_path);
+            pfs0_pack_free(&ctx);
+            return 0;
+        }
+        if (pfs0_pack_stat(in_paths[i], &st) != 0 || !S_ISREG(st.st_mode)) {
+            fprintf(stderr, "Failed to stat %s, or it is not a file!\n", in_paths[i]);
+            pfs0_pack_free(&ctx);
+            return 0;
+        }
+        ctx.names[i] = pfs0_pack_get_name(in_paths[i]);
+        for (uint32_t j = 0; j < i; j++) {
+            if (!strcmp(ctx.names[i], ctx.names[j])) {
+                fprintf(stderr, "%s and %s have the same name!\n", in_paths[j], in_paths[i]);
+                pfs0_pack_free(&ctx);
+                return 0;
+            }
+        }
+        ctx.sizes[i] = (uint64_t)st.st_size;
+        ctx.first_chunks[i] = ctx.num_chunks;
+        ctx.num_chunks += (ctx.sizes[i] + PFS0_PACK_CHUNK_SIZE - 1) / PFS0_PACK_CHUNK_SIZE;
+    }
+    ctx.first_chunks[num_files] = ctx.num_chunks;
+    ctx.header = pfs0_build_header(num_files, (const char *const *)ctx.names, ctx.sizes);
+    ctx.data_offset = pfs0_get_header_size(ctx.header);
+    uint64_t total_size = ctx.data_offset;
+    for (uint32_t i = 0; i < num_files; i++) {
+        total_size += ctx.sizes[i];
+    }
+
+    FILE *out = fopen(out_path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", out_path);
+        pfs0_pack_free(&ctx);
+        return 0;
+    }
+    preallocate_file(out, total_size);
+    if (fwrite(ctx.header, 1, ctx.data_offset, out) != ctx.data_offset || fflush(out) != 0) {
+        fprintf(stderr, "Failed to write %s!\n", out_path);
+        fatal_exit();
+    }
+
+    trace_span_t trace_span;
+    trace_begin(&trace_span);
+    pfs0_pack_run_workers(&ctx);
+    trace_end(&trace_span, "PFS0 pack", TRACE_NO_SECTION, "%"PRIu32" files", num_files);
+
+    /* Empty files at the end leave the size to be set here. */
+    if (!finish_sparse_file(out, total_size) || !fsync_file(out) || fclose(out) != 0) {
+        fprintf(stderr, "Failed to write %s!\n", out_path);
+        fatal_exit();
+    }
+
+    printf("PFS0: %"PRIu32" file(s), %"PRIu64" bytes (%"PRIu64" copied by the kernel), written to %s.\n",
+           num_files, total_size, (uint64_t)atomic_load(&ctx.num_kernel_bytes), out_path);
+    pfs0_pack_free(&ctx);
+    return 1;
+}
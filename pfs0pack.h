@@ -0,0 +1,32 @@
+#ifndef HACTOOL_PFS0PACK_H
+#define HACTOOL_PFS0PACK_H
+
+#include <stdatomic.h>
+#include "types.h"
+#include "settings.h"
+#include "pfs0.h"
+
+#define PFS0_PACK_CHUNK_SIZE 0x4000000 /* Bytes of a file copied by a worker at a time. */
+#define PFS0_PACK_BUFFER_SIZE 0x400000 /* For copies that can't be made by the kernel. */
+
+typedef struct {
+    hactool_ctx_t *tool_ctx;
+    const char *out_path;
+    char **in_paths;
+    const char **names; /* Within in_paths. */
+    uint64_t *sizes;
+    uint64_t *first_chunks; /* Chunks are numbered across files. */
+    uint32_t num_files;
+    pfs0_header_t *header;
+    uint64_t data_offset; /* Of the first file in the output. */
+    uint32_t num_jobs;
+    atomic_uint_fast64_t next_chunk;
+    atomic_int stop; /* Set when a worker fails. */
+    uint64_t num_chunks;
+    atomic_uint_fast64_t num_kernel_bytes; /* Copied without passing through memory. */
+} pfs0_pack_ctx_t;
+
+/* Write the files at in_paths, named by their file names, into a PFS0 at out_path. */
+int pfs0_pack(hactool_ctx_t *tool_ctx, const char *out_path, char **in_paths, uint32_t num_files);
+
+#endif
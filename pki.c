@@ -303,6 +303,157 @@ const nca_keyset_t nca_keys_dev = {
     }
 };
 
+/* Keys for synthetic test content, e.g. from hactool-gen. They protect nothing, and must never match real keys. */
+const nca_keyset_t nca_keys_test = {
+    {
+        {0x7A, 0x93, 0xF2, 0x70, 0x3E, 0x17, 0x44, 0xB6, 0xC0, 0xC8, 0x39, 0x77, 0x93, 0x95, 0x25, 0xF7}, /* Master Key 00 */
+        ZEROES_KEY, /* Master Key 01 */
+        ZEROES_KEY, /* Master Key 02 */
+        ZEROES_KEY, /* Master Key 03 */
+        ZEROES_KEY, /* Master Key 04 */
+        ZEROES_KEY, /* Master Key 05 */
+        ZEROES_KEY, /* Master Key 06 */
+        ZEROES_KEY, /* Master Key 07 */
+        ZEROES_KEY, /* Master Key 08 */
+        ZEROES_KEY, /* Master Key 09 */
+        ZEROES_KEY, /* Master Key 10 */
+        ZEROES_KEY, /* Master Key 11 */
+        ZEROES_KEY, /* Master Key 12 */
+        ZEROES_KEY, /* Master Key 13 */
+        ZEROES_KEY, /* Master Key 14 */
+        ZEROES_KEY, /* Master Key 15 */
+        ZEROES_KEY, /* Master Key 16 */
+        ZEROES_KEY, /* Master Key 17 */
+        ZEROES_KEY, /* Master Key 18 */
+        ZEROES_KEY, /* Master Key 19 */
+        ZEROES_KEY, /* Master Key 20 */
+        ZEROES_KEY, /* Master Key 21 */
+        ZEROES_KEY, /* Master Key 22 */
+        ZEROES_KEY, /* Master Key 23 */
+        ZEROES_KEY, /* Master Key 24 */
+        ZEROES_KEY, /* Master Key 25 */
+        ZEROES_KEY, /* Master Key 26 */
+        ZEROES_KEY, /* Master Key 27 */
+        ZEROES_KEY, /* Master Key 28 */
+        ZEROES_KEY, /* Master Key 29 */
+        ZEROES_KEY, /* Master Key 30 */
+        ZEROES_KEY  /* Master Key 31 */
+    },
+    {0x3B, 0x8C, 0x25, 0x69, 0x62, 0x3A, 0xFD, 0x1E, 0x8A, 0xD2, 0xE8, 0x5D, 0xFC, 0x74, 0x67, 0x89}, /* Generate Aes Kek Source */
+    {0x11, 0x35, 0x9A, 0x4C, 0x49, 0x84, 0x35, 0x43, 0x30, 0xE6, 0x39, 0xE3, 0x08, 0x82, 0xD0, 0x5E}, /* Generate Aes Key Source */
+    {0x02, 0x51, 0xC0, 0x10, 0x57, 0xD8, 0x41, 0xD5, 0x71, 0xD2, 0x26, 0xAD, 0x5C, 0x7A, 0xE8, 0xE6}, /* Key Area Encryption Key Source Application */
+    {0x3E, 0xD7, 0xD6, 0x4E, 0xA6, 0xB8, 0xB8, 0x06, 0xE0, 0xFF, 0x0F, 0x23, 0xB0, 0xD4, 0x6A, 0xC1}, /* Key Area Encryption Key Source Ocean */
+    {0xA0, 0x4C, 0x67, 0x10, 0xEC, 0x27, 0x82, 0xFE, 0x5C, 0x4A, 0x90, 0x93, 0xBD, 0x6C, 0x1A, 0x84}, /* Key Area Encryption Key Source System */
+    {0x6C, 0xAB, 0x96, 0xD7, 0x41, 0x38, 0xCD, 0x5F, 0xA8, 0x04, 0x8F, 0xA4, 0x07, 0x2E, 0x4F, 0x0B}, /* Titlekek Source */
+    {0x88, 0xB2, 0x11, 0x2A, 0x58, 0x3A, 0xB5, 0x0C, 0xA5, 0x02, 0xA6, 0x96, 0xCE, 0x5E, 0x37, 0x9F}, /* Headerkek Source */
+    {0x48, 0xF8, 0x98, 0x63, 0x62, 0x9E, 0xC2, 0x8B, 0xE6, 0xBF, 0x54, 0x6C, 0x6F, 0x8C, 0x38, 0x65, 0xDC, 0xB3, 0xE3, 0x77, 0x15, 0xAE, 0x65, 0xD9, 0x97, 0x60, 0xDB, 0x9E, 0x81, 0x71, 0xB7, 0x1B}, /* Encrypted Header Key */
+    ZEROES_XTS_KEY, /* Header key */
+    {
+        ZEROES_KEY, /* Titlekek 00 */
+        ZEROES_KEY, /* Titlekek 01 */
+        ZEROES_KEY, /* Titlekek 02 */
+        ZEROES_KEY, /* Titlekek 03 */
+        ZEROES_KEY, /* Titlekek 04 */
+        ZEROES_KEY, /* Titlekek 05 */
+        ZEROES_KEY, /* Titlekek 06 */
+        ZEROES_KEY, /* Titlekek 07 */
+        ZEROES_KEY, /* Titlekek 08 */
+        ZEROES_KEY, /* Titlekek 09 */
+        ZEROES_KEY, /* Titlekek 10 */
+        ZEROES_KEY, /* Titlekek 11 */
+        ZEROES_KEY, /* Titlekek 12 */
+        ZEROES_KEY, /* Titlekek 13 */
+        ZEROES_KEY, /* Titlekek 14 */
+        ZEROES_KEY, /* Titlekek 15 */
+        ZEROES_KEY, /* Titlekek 16 */
+        ZEROES_KEY, /* Titlekek 17 */
+        ZEROES_KEY, /* Titlekek 18 */
+        ZEROES_KEY, /* Titlekek 19 */
+        ZEROES_KEY, /* Titlekek 20 */
+        ZEROES_KEY, /* Titlekek 21 */
+        ZEROES_KEY, /* Titlekek 22 */
+        ZEROES_KEY, /* Titlekek 23 */
+        ZEROES_KEY, /* Titlekek 24 */
+        ZEROES_KEY, /* Titlekek 25 */
+        ZEROES_KEY, /* Titlekek 26 */
+        ZEROES_KEY, /* Titlekek 27 */
+        ZEROES_KEY, /* Titlekek 28 */
+        ZEROES_KEY, /* Titlekek 29 */
+        ZEROES_KEY, /* Titlekek 30 */
+        ZEROES_KEY  /* Titlekek 31 */
+    },
+    {
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 00 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 01 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 02 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 03 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 04 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 05 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 06 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 07 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 08 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 09 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 10 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 11 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 12 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 13 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 14 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 15 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 16 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 17 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 18 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 19 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 20 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 21 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 22 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 23 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 24 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 25 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 26 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 27 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 28 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 29 */
+        ZEROES_KAEKS, /* Key Area Encryption Keyset 30 */
+        ZEROES_KAEKS  /* Key Area Encryption Keyset 31 */
+    },
+    { /* Test RSA key used to sign NCA signature 0. */
+        0xA8, 0xEF, 0x80, 0xC7, 0x75, 0x4D, 0xF7, 0xA6, 0xEE, 0x37, 0xDF, 0x68, 0x53, 0x0F, 0xEB, 0x6D,
+        0x1C, 0xDB, 0x1D, 0x8B, 0x01, 0x67, 0x52, 0x3B, 0xF1, 0xD2, 0x5A, 0x20, 0xBD, 0x29, 0x57, 0x54,
+        0x6B, 0x8A, 0xAF, 0x31, 0x5D, 0xF2, 0x93, 0xE4, 0xB5, 0x37, 0x00, 0xC6, 0x65, 0xC2, 0x0A, 0xB7,
+        0xCC, 0x53, 0x54, 0x30, 0x80, 0x8B, 0xFA, 0x0F, 0x6F, 0x0E, 0xE6, 0x4C, 0x8A, 0x71, 0x81, 0xB7,
+        0xA5, 0xE7, 0x03, 0x19, 0xB8, 0x00, 0x71, 0x7A, 0xCF, 0xCE, 0xAC, 0x0C, 0x43, 0xFF, 0x96, 0x02,
+        0x7C, 0x17, 0xB8, 0xF3, 0x1C, 0x25, 0xC8, 0x36, 0xC6, 0x02, 0x27, 0x6B, 0x7D, 0xF0, 0xCE, 0xD5,
+        0x0B, 0x67, 0xC9, 0x62, 0x44, 0xD9, 0x06, 0x68, 0x30, 0xCB, 0xA9, 0xFC, 0x8F, 0x37, 0x7E, 0x07,
+        0x2C, 0xB2, 0x82, 0x95, 0xC2, 0xB4, 0x64, 0x7F, 0x90, 0xAA, 0x4A, 0x61, 0xB0, 0xAB, 0xCC, 0x04,
+        0xD6, 0xE5, 0x28, 0x37, 0xDF, 0x1C, 0xD4, 0xEF, 0x11, 0x50, 0xBF, 0x3A, 0x13, 0x58, 0x5D, 0xE8,
+        0x65, 0x43, 0x49, 0x7C, 0xE0, 0x40, 0xD6, 0x8E, 0x96, 0x3D, 0xC5, 0x11, 0x4A, 0x1D, 0xBE, 0x2D,
+        0x35, 0xB7, 0x89, 0x03, 0x19, 0xF4, 0xB8, 0x10, 0x46, 0xDA, 0x81, 0x62, 0x14, 0x6A, 0x82, 0x02,
+        0x82, 0x65, 0x79, 0x96, 0x20, 0xA0, 0x1B, 0xCA, 0xB2, 0x64, 0xE0, 0xE2, 0x8A, 0xBF, 0x6E, 0x6F,
+        0xD1, 0xDE, 0xC8, 0x47, 0xFA, 0x94, 0xDC, 0xEF, 0x8F, 0xC2, 0xFA, 0xB8, 0x1F, 0x18, 0x0C, 0x3E,
+        0xA9, 0x79, 0xF7, 0xB1, 0x0A, 0x4D, 0x94, 0x80, 0x03, 0x7B, 0x04, 0x00, 0x49, 0x31, 0x36, 0xEE,
+        0x0B, 0x77, 0x30, 0xCF, 0x6B, 0x52, 0xDD, 0x97, 0xFB, 0x59, 0x0A, 0x42, 0x2D, 0x5A, 0x3F, 0x33,
+        0x20, 0x8D, 0xA4, 0xD5, 0xB1, 0x2A, 0x8F, 0x90, 0x2F, 0x21, 0x12, 0xF1, 0x40, 0x34, 0xF9, 0x0F
+    },
+    { /* Test RSA key used to sign ACID signatures. */
+        0xA8, 0xEF, 0x80, 0xC7, 0x75, 0x4D, 0xF7, 0xA6, 0xEE, 0x37, 0xDF, 0x68, 0x53, 0x0F, 0xEB, 0x6D,
+        0x1C, 0xDB, 0x1D, 0x8B, 0x01, 0x67, 0x52, 0x3B, 0xF1, 0xD2, 0x5A, 0x20, 0xBD, 0x29, 0x57, 0x54,
+        0x6B, 0x8A, 0xAF, 0x31, 0x5D, 0xF2, 0x93, 0xE4, 0xB5, 0x37, 0x00, 0xC6, 0x65, 0xC2, 0x0A, 0xB7,
+        0xCC, 0x53, 0x54, 0x30, 0x80, 0x8B, 0xFA, 0x0F, 0x6F, 0x0E, 0xE6, 0x4C, 0x8A, 0x71, 0x81, 0xB7,
+        0xA5, 0xE7, 0x03, 0x19, 0xB8, 0x00, 0x71, 0x7A, 0xCF, 0xCE, 0xAC, 0x0C, 0x43, 0xFF, 0x96, 0x02,
+        0x7C, 0x17, 0xB8, 0xF3, 0x1C, 0x25, 0xC8, 0x36, 0xC6, 0x02, 0x27, 0x6B, 0x7D, 0xF0, 0xCE, 0xD5,
+        0x0B, 0x67, 0xC9, 0x62, 0x44, 0xD9, 0x06, 0x68, 0x30, 0xCB, 0xA9, 0xFC, 0x8F, 0x37, 0x7E, 0x07,
+        0x2C, 0xB2, 0x82, 0x95, 0xC2, 0xB4, 0x64, 0x7F, 0x90, 0xAA, 0x4A, 0x61, 0xB0, 0xAB, 0xCC, 0x04,
+        0xD6, 0xE5, 0x28, 0x37, 0xDF, 0x1C, 0xD4, 0xEF, 0x11, 0x50, 0xBF, 0x3A, 0x13, 0x58, 0x5D, 0xE8,
+        0x65, 0x43, 0x49, 0x7C, 0xE0, 0x40, 0xD6, 0x8E, 0x96, 0x3D, 0xC5, 0x11, 0x4A, 0x1D, 0xBE, 0x2D,
+        0x35, 0xB7, 0x89, 0x03, 0x19, 0xF4, 0xB8, 0x10, 0x46, 0xDA, 0x81, 0x62, 0x14, 0x6A, 0x82, 0x02,
+        0x82, 0x65, 0x79, 0x96, 0x20, 0xA0, 0x1B, 0xCA, 0xB2, 0x64, 0xE0, 0xE2, 0x8A, 0xBF, 0x6E, 0x6F,
+        0xD1, 0xDE, 0xC8, 0x47, 0xFA, 0x94, 0xDC, 0xEF, 0x8F, 0xC2, 0xFA, 0xB8, 0x1F, 0x18, 0x0C, 0x3E,
+        0xA9, 0x79, 0xF7, 0xB1, 0x0A, 0x4D, 0x94, 0x80, 0x03, 0x7B, 0x04, 0x00, 0x49, 0x31, 0x36, 0xEE,
+        0x0B, 0x77, 0x30, 0xCF, 0x6B, 0x52, 0xDD, 0x97, 0xFB, 0x59, 0x0A, 0x42, 0x2D, 0x5A, 0x3F, 0x33,
+        0x20, 0x8D, 0xA4, 0xD5, 0xB1, 0x2A, 0x8F, 0x90, 0x2F, 0x21, 0x12, 0xF1, 0x40, 0x34, 0xF9, 0x0F
+    }
+};
+
 
 void generate_kek(unsigned char *dst, const unsigned char *src, const unsigned char *master_key, const unsigned char *kek_seed, const unsigned char *key_seed) {
     unsigned char kek[0x10];
@@ -373,6 +524,9 @@ void pki_initialize_keyset(nca_keyset_t *keyset, keyset_variant_t variant) {
         case KEYSET_RETAIL:
             memcpy(keyset, &nca_keys_retail, sizeof(*keyset));
             break;
+        case KEYSET_TEST:
+            memcpy(keyset, &nca_keys_test, sizeof(*keyset));
+            break;
         default:
             memset(keyset, 0, sizeof(*keyset));
             break;
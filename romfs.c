@@ -2,6 +2,7 @@
 #include "types.h"
 #include "utils.h"
 #include "ivfc.h"
+#include "tar.h"
 
 /* RomFS functions... */
 void romfs_visit_file(romfs_ctx_t *ctx, uint32_t file_offset, filepath_t *dir_path) {
@@ -9,7 +10,7 @@ void romfs_visit_file(romfs_ctx_t *ctx, uint32_t file_offset, filepath_t *dir_pa
     filepath_t *cur_path = calloc(1, sizeof(filepath_t));
     if (cur_path == NULL) {
         fprintf(stderr, "Failed to allocate filepath!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     filepath_copy(cur_path, dir_path);
@@ -19,8 +20,13 @@ void romfs_visit_file(romfs_ctx_t *ctx, uint32_t file_offset, filepath_t *dir_pa
 
     /* If we're extracting... */
     if ((ctx->tool_ctx->action & ACTION_LISTROMFS) == 0) {
-        printf("Saving %s...\n", cur_path->char_path);
-        save_file_section(ctx->file, ctx->romfs_offset + ctx->header.data_offset + entry->offset, entry->size, cur_path);
+        if (ctx->tool_ctx->romfs_tar != NULL) {
+            printf("Archiving %s...\n", cur_path->char_path);
+            tar_save_file_section(ctx->tool_ctx->romfs_tar, ctx->file, ctx->romfs_offset + ctx->header.data_offset + entry->offset, entry->size, cur_path->char_path, ctx->tool_ctx->manifest);
+        } else {
+            printf("Saving %s...\n", cur_path->char_path);
+            save_file_section(ctx->file, ctx->romfs_offset + ctx->header.data_offset + entry->offset, entry->size, cur_path, ctx->tool_ctx->manifest);
+        }
     } else {
         printf("rom:%s\n", cur_path->char_path);
     }
@@ -37,7 +43,7 @@ void romfs_visit_dir(romfs_ctx_t *ctx, uint32_t dir_offset, filepath_t *parent_p
     filepath_t *cur_path = calloc(1, sizeof(filepath_t));
     if (cur_path == NULL) {
         fprintf(stderr, "Failed to allocate filepath!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     filepath_copy(cur_path, parent_path);
@@ -47,7 +53,11 @@ void romfs_visit_dir(romfs_ctx_t *ctx, uint32_t dir_offset, filepath_t *parent_p
 
     /* If we're actually extracting the romfs, make directory. */
     if ((ctx->tool_ctx->action & ACTION_LISTROMFS) == 0) {
-        os_makedir(cur_path->os_path);
+        if (ctx->tool_ctx->romfs_tar != NULL) {
+            tar_add_directory(ctx->tool_ctx->romfs_tar, cur_path->char_path);
+        } else {
+            os_makedir(cur_path->os_path);
+        }
     }
 
     if (entry->file != ROMFS_ENTRY_EMPTY) {
@@ -76,25 +86,25 @@ void romfs_process(romfs_ctx_t *ctx) {
         ctx->directories = calloc(1, ctx->header.dir_meta_table_size);
         if (ctx->directories == NULL) {
             fprintf(stderr, "Failed to allocate RomFS directory cache!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
 
         /* Switch RomFS has actual entries at table offset + 4 for no good reason. */
         fseeko64(ctx->file, ctx->romfs_offset + ctx->header.dir_meta_table_offset + 4, SEEK_SET);
         if (fread(ctx->directories, 1, ctx->header.dir_meta_table_size, ctx->file) != ctx->header.dir_meta_table_size) {
             fprintf(stderr, "Failed to read RomFS directory cache!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
 
         ctx->files = calloc(1, ctx->header.file_meta_table_size);
         if (ctx->files == NULL) {
             fprintf(stderr, "Failed to allocate RomFS file cache!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
         fseeko64(ctx->file, ctx->romfs_offset + ctx->header.file_meta_table_offset, SEEK_SET);
         if (fread(ctx->files, 1, ctx->header.file_meta_table_size, ctx->file) != ctx->header.file_meta_table_size) {
             fprintf(stderr, "Failed to read RomFS file cache!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
     }
     
@@ -112,7 +122,7 @@ void romfs_process(romfs_ctx_t *ctx) {
 }
 
 void romfs_save(romfs_ctx_t *ctx) {
-    if (ctx->tool_ctx->action & ACTION_LISTROMFS) {
+    if (ctx->tool_ctx->action & ACTION_LISTROMFS || ctx->tool_ctx->romfs_tar != NULL) {
         filepath_t fakepath;
         filepath_init(&fakepath);
         filepath_set(&fakepath, "");
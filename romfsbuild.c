@@ -0,0 +1,683 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "romfsbuild.h"
+#include "sha.h"
+#include "stats.h"
+#include "trace.h"
+#include "utils.h"
+
+/* The RomFS comes first in the output, so it can also be read as a plain RomFS, and its hash levels
+ * follow at the offsets given in the IVFC header. Entries are in name order, with the subdirectories
+ * of a directory listed together, and its files and their data too. File data is read, hashed and
+ * written by several threads, a chunk of blocks at a time; the hash levels above are then computed
+ * from the bottom up, each split between the same threads. */
+
+#ifdef _WIN32
+typedef struct _stat64 romfs_build_stat_t;
+#define romfs_build_stat _stat64
+#else
+typedef struct stat romfs_build_stat_t;
+#define romfs_build_stat stat
+#endif
+
+#define ROMFS_BUILD_HASH_CHUNK_BLOCKS 0x40
+#define ROMFS_BUILD_DATA_OFFSET 0x200
+
+static char *romfs_build_strdup(const char *str) {
+    char *copy = strdup(str);
+    if (copy == NULL) {
+        fprintf(stderr, "Failed to allocate RomFS build path!\n");
+        fatal_exit();
+    }
+    return copy;
+}
+
+static uint32_t romfs_build_add_dir(romfs_build_ctx_t *ctx, const char *path, const char *rel_path, uint32_t parent) {
+    if (ctx->num_dirs == ctx->max_dirs) {
+        ctx->max_dirs = ctx->max_dirs ? ctx->max_dirs * 2 : 0x40;
+        if ((ctx->dirs = realloc(ctx->dirs, ctx->max_dirs * sizeof(romfs_build_dir_t))) == NULL) {
+            fprintf(stderr, "Failed to allocate RomFS directories!\n");
+            fatal_exit();
+        }
+    }
+    romfs_build_dir_t *dir = &ctx->dirs[ctx->num_dirs];
+    memset(dir, 0, sizeof(*dir));
+    dir->path = romfs_build_strdup(path);
+    dir->rel_path = romfs_build_strdup(rel_path);
+    dir->name = strrchr(dir->rel_path, '/') != NULL ? strrchr(dir->rel_path, '/') + 1 : dir->rel_path;
+    dir->parent = parent;
+    dir->sibling = ROMFS_ENTRY_EMPTY;
+    dir->child = ROMFS_ENTRY_EMPTY;
+    dir->file = ROMFS_ENTRY_EMPTY;
+    return ctx->num_dirs++;
+}
+
+static void romfs_build_add_file(romfs_build_ctx_t *ctx, const char *path, const char *rel_path, uint32_t parent, const romfs_build_stat_t *st) {
+    if (ctx->num_files == ctx->max_files) {
+        ctx->max_files = ctx->max_files ? ctx->max_files * 2 : 0x100;
+        if ((ctx->files = realloc(ctx->files, ctx->max_files * sizeof(romfs_build_file_t))) == NULL) {
+            fprintf(stderr, "Failed to allocate RomFS files!\n");
+            fatal_exit();
+        }
+    }
+    romfs_build_file_t *file = &ctx->files[ctx->num_files++];
+    memset(file, 0, sizeof(*file));
+    file->path = romfs_build_strdup(path);
+    file->name = strrchr(file->path, '/') + 1;
+    file->parent = parent;
+    file->sibling = ROMFS_ENTRY_EMPTY;
+    get_file_stamp(&file->stamp, st);
+    sha256_hash_buffer(file->path_hash, rel_path, strlen(rel_path));
+}
+
+static int romfs_build_compare_names(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/* Adds the files of a directory, then its subdirectories, then recurses into each of them. */
+static void romfs_build_scan_dir(romfs_build_ctx_t *ctx, uint32_t dir_index) {
+    char *dir_path = ctx->dirs[dir_index].path;
+    DIR *d = opendir(dir_path);
+    if (d == NULL) {
+        fprintf(stderr, "Failed to open directory %s!\n", dir_path);
+        fatal_exit();
+    }
+    char **names = NULL;
+    uint32_t num_names = 0, max_names = 0;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+            continue;
+        }
+        if (num_names == max_names) {
+            max_names = max_names ? max_names * 2 : 0x20;
+            if ((names = realloc(names, max_names * sizeof(char *))) == NULL) {
+                fprintf(stderr, "Failed to allocate directory listing!\n");
+                fatal_exit();
+            }
+        }
+        names[num_names++] = romfs_build_strdup(ent->d_name);
+    }
+    closedir(d);
+    qsort(names, num_names, sizeof(char *), romfs_build_compare_names);
+
+    char full_path[MAX_PATH];
+    char rel_path[MAX_PATH];
+    uint8_t *is_dir = calloc(num_names ? num_names : 1, 1);
+    if (is_dir == NULL) {
+        fprintf(stderr, "Failed to allocate directory listing!\n");
+        fatal_exit();
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t prev = ROMFS_ENTRY_EMPTY;
+        for (uint32_t i = 0; i < num_names; i++) {
+            const char *parent_rel_path = ctx->dirs[dir_index].rel_path;
+            int full_len = snprintf(full_path, sizeof(full_path), "%s/%s", ctx->dirs[dir_index].path, names[i]);
+            int rel_len = *parent_rel_path ? snprintf(rel_path, sizeof(rel_path), "%s/%s", parent_rel_path, names[i]) : snprintf(rel_path, sizeof(rel_path), "%s", names[i]);
+            if (full_len < 0 || full_len >= (int)sizeof(full_path) || rel_len < 0 || rel_len >= (int)sizeof(rel_path)) {
+                fprintf(stderr, "Path of %s/%s is too long!\n", ctx->dirs[dir_index].path, names[i]);
+                fatal_exit();
+            }
+            if (pass == 1) {
+                if (!is_dir[i]) {
+                    continue;
+                }
+                uint32_t index = romfs_build_add_dir(ctx, full_path, rel_path, dir_index);
+                if (prev == ROMFS_ENTRY_EMPTY) {
+                    ctx->dirs[dir_index].child = index;
+                } else {
+                    ctx->dirs[prev].sibling = index;
+                }
+                prev = index;
+                continue;
+            }
+
+            romfs_build_stat_t st;
+            if (romfs_build_stat(full_path, &st) != 0) {
+                fprintf(stderr, "Failed to stat %s!\n", full_path);
+                fatal_exit();
+            }
+#ifndef _WIN32
+            /* Don't follow directory symlinks, which could loop. */
+            struct stat lst;
+            if (S_ISDIR(st.st_mode) && (lstat(full_path, &lst) != 0 || S_ISLNK(lst.st_mode))) {
+                continue;
+            }
+#endif
+            if (S_ISDIR(st.st_mode)) {
+                is_dir[i] = 1;
+            } else if (S_ISREG(st.st_mode) && strcmp(full_path, ctx->out_path) && (ctx->cache_path == NULL || strcmp(full_path, ctx->cache_path))) {
+                romfs_build_add_file(ctx, full_path, rel_path, dir_index, &st);
+                uint32_t index = ctx->num_files - 1;
+                if (prev == ROMFS_ENTRY_EMPTY) {
+                    ctx->dirs[dir_index].file = index;
+                } else {
+                    ctx->files[prev].sibling = index;
+                }
+                prev = index;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < num_names; i++) {
+        free(names[i]);
+    }
+    free(names);
+    free(is_dir);
+
+    for (uint32_t child = ctx->dirs[dir_index].child; child != ROMFS_ENTRY_EMPTY; child = ctx->dirs[child].sibling) {
+        romfs_build_scan_dir(ctx, child);
+    }
+}
+
+static uint32_t romfs_build_name_hash(uint32_t parent, const char *name) {
+    uint32_t hash = parent ^ 123456789;
+    for (; *name; name++) {
+        hash = (hash >> 5) | (hash << 27);
+        hash ^= (unsigned char)*name;
+    }
+    return hash;
+}
+
+/* Bucket counts as chosen by official tools: small odd counts, or a number with no small factors. */
+static uint32_t romfs_build_bucket_count(uint32_t num_entries) {
+    if (num_entries < 3) {
+        return 3;
+    }
+    if (num_entries < 19) {
+        return num_entries | 1;
+    }
+    uint32_t count = num_entries;
+    while (count % 2 == 0 || count % 3 == 0 || count % 5 == 0 || count % 7 == 0 || count % 11 == 0 || count % 13 == 0 || count % 17 == 0) {
+        count++;
+    }
+    return count;
+}
+
+static unsigned char *romfs_build_put_entry(unsigned char *p, const uint32_t *fields, uint32_t num_fields, const char *name) {
+    uint32_t name_size = (uint32_t)strlen(name);
+    memcpy(p, fields, num_fields * 4);
+    memcpy(p + num_fields * 4, &name_size, 4);
+    memcpy(p + num_fields * 4 + 4, name, name_size);
+    return p + num_fields * 4 + 4 + align(name_size, 4);
+}
+
+/* Assigns entry and data offsets, and builds the header and tables. */
+static void romfs_build_layout(romfs_build_ctx_t *ctx) {
+    uint32_t dir_table_size = 0, file_table_size = 0;
+    for (uint32_t i = 0; i < ctx->num_dirs; i++) {
+        ctx->dirs[i].entry_offset = dir_table_size;
+        dir_table_size += 0x18 + align((uint32_t)strlen(ctx->dirs[i].name), 4);
+    }
+    uint64_t data_end = ROMFS_BUILD_DATA_OFFSET;
+    for (uint32_t i = 0; i < ctx->num_files; i++) {
+        ctx->files[i].entry_offset = file_table_size;
+        file_table_size += 0x20 + align((uint32_t)strlen(ctx->files[i].name), 4);
+        ctx->files[i].offset = align64(data_end, 0x10);
+        data_end = ctx->files[i].offset + ctx->files[i].stamp.size;
+    }
+
+    uint32_t num_dir_buckets = romfs_build_bucket_count(ctx->num_dirs);
+    uint32_t num_file_buckets = romfs_build_bucket_count(ctx->num_files);
+    memset(&ctx->header, 0, sizeof(ctx->header));
+    ctx->header.header_size = ROMFS_HEADER_SIZE;
+    ctx->header.data_offset = ROMFS_BUILD_DATA_OFFSET;
+    ctx->tables_offset = align64(data_end, 4);
+    ctx->header.dir_hash_table_offset = ctx->tables_offset;
+    ctx->header.dir_hash_table_size = num_dir_buckets * 4;
+    ctx->header.dir_meta_table_offset = ctx->header.dir_hash_table_offset + ctx->header.dir_hash_table_size;
+    ctx->header.dir_meta_table_size = dir_table_size;
+    ctx->header.file_hash_table_offset = ctx->header.dir_meta_table_offset + dir_table_size;
+    ctx->header.file_hash_table_size = num_file_buckets * 4;
+    ctx->header.file_meta_table_offset = ctx->header.file_hash_table_offset + ctx->header.file_hash_table_size;
+    ctx->header.file_meta_table_size = file_table_size;
+    ctx->romfs_size = ctx->header.file_meta_table_offset + file_table_size;
+
+    uint64_t tables_size = ctx->romfs_size - ctx->tables_offset;
+    if ((ctx->tables = calloc(1, tables_size)) == NULL) {
+        fprintf(stderr, "Failed to allocate RomFS tables!\n");
+        fatal_exit();
+    }
+    uint32_t *dir_buckets = (uint32_t *)ctx->tables;
+    unsigned char *dir_table = ctx->tables + (ctx->header.dir_meta_table_offset - ctx->tables_offset);
+    uint32_t *file_buckets = (uint32_t *)(ctx->tables + (ctx->header.file_hash_table_offset - ctx->tables_offset));
+    unsigned char *file_table = ctx->tables + (ctx->header.file_meta_table_offset - ctx->tables_offset);
+    memset(dir_buckets, 0xFF, num_dir_buckets * 4);
+    memset(file_buckets, 0xFF, num_file_buckets * 4);
+
+    unsigned char *p = dir_table;
+    for (uint32_t i = 0; i < ctx->num_dirs; i++) {
+        romfs_build_dir_t *dir = &ctx->dirs[i];
+        uint32_t parent = ctx->dirs[dir->parent].entry_offset;
+        uint32_t bucket = romfs_build_name_hash(parent, dir->name) % num_dir_buckets;
+        uint32_t fields[5] = {
+            parent,
+            dir->sibling != ROMFS_ENTRY_EMPTY ? ctx->dirs[dir->sibling].entry_offset : ROMFS_ENTRY_EMPTY,
+            dir->child != ROMFS_ENTRY_EMPTY ? ctx->dirs[dir->child].entry_offset : ROMFS_ENTRY_EMPTY,
+            dir->file != ROMFS_ENTRY_EMPTY ? ctx->files[dir->file].entry_offset : ROMFS_ENTRY_EMPTY,
+            dir_buckets[bucket]
+        };
+        dir_buckets[bucket] = dir->entry_offset;
+        p = romfs_build_put_entry(p, fields, 5, dir->name);
+    }
+    p = file_table;
+    for (uint32_t i = 0; i < ctx->num_files; i++) {
+        romfs_build_file_t *file = &ctx->files[i];
+        uint32_t parent = ctx->dirs[file->parent].entry_offset;
+        uint32_t bucket = romfs_build_name_hash(parent, file->name) % num_file_buckets;
+        uint64_t data_offset = file->offset - ctx->header.data_offset;
+        uint32_t fields[7] = {
+            parent,
+            file->sibling != ROMFS_ENTRY_EMPTY ? ctx->files[file->sibling].entry_offset : ROMFS_ENTRY_EMPTY,
+            (uint32_t)data_offset, (uint32_t)(data_offset >> 32),
+            (uint32_t)file->stamp.size, (uint32_t)(file->stamp.size >> 32),
+            file_buckets[bucket]
+        };
+        file_buckets[bucket] = file->entry_offset;
+        p = romfs_build_put_entry(p, fields, 7, file->name);
+    }
+
+    /* Hash levels follow the RomFS, each hashing the one after it; level 0 is hashed by the master hash. */
+    ctx->level_sizes[IVFC_MAX_LEVEL - 1] = ctx->romfs_size;
+    for (int i = IVFC_MAX_LEVEL - 2; i >= 0; i--) {
+        ctx->level_sizes[i] = (ctx->level_sizes[i + 1] + ROMFS_BUILD_BLOCK_SIZE - 1) / ROMFS_BUILD_BLOCK_SIZE * 0x20;
+    }
+    memset(&ctx->ivfc_header, 0, sizeof(ctx->ivfc_header));
+    ctx->ivfc_header.magic = MAGIC_IVFC;
+    ctx->ivfc_header.id = 0x20000;
+    ctx->ivfc_header.master_hash_size = 0x20;
+    ctx->ivfc_header.num_levels = IVFC_MAX_LEVEL + 1;
+    uint64_t offset = ctx->romfs_size;
+    for (unsigned int i = 0; i < IVFC_MAX_LEVEL; i++) {
+        ivfc_level_hdr_t *level = &ctx->ivfc_header.level_headers[i];
+        level->logical_offset = i == IVFC_MAX_LEVEL - 1 ? 0 : align64(offset, ROMFS_BUILD_BLOCK_SIZE);
+        level->hash_data_size = ctx->level_sizes[i];
+        level->block_size = ROMFS_BUILD_BLOCK_SIZE_LOG2;
+        if (i < IVFC_MAX_LEVEL - 1) {
+            offset = level->logical_offset + level->hash_data_size;
+            if ((ctx->levels[i] = calloc(1, align64(ctx->level_sizes[i], ROMFS_BUILD_BLOCK_SIZE))) == NULL) {
+                fprintf(stderr, "Failed to allocate IVFC level %u!\n", i);
+                fatal_exit();
+            }
+        }
+    }
+    ctx->image_size = align64(offset, MEDIA_SIZE);
+}
+
+static int romfs_build_compare_cache_files(const void *a, const void *b) {
+    return memcmp(a, b, 0x20);
+}
+
+/* Loads the previous build's cache, if any. A missing or outdated cache means building from scratch. */
+static void romfs_build_load_cache(romfs_build_ctx_t *ctx) {
+    FILE *f = fopen(ctx->cache_path, "rb");
+    if (f == NULL) {
+        return;
+    }
+    romfs_build_cache_header_t header;
+    if (fread(&header, 1, sizeof(header), f) != sizeof(header) || header.magic != MAGIC_HRBC ||
+        header.version != ROMFS_BUILD_CACHE_VERSION || header.block_size != ROMFS_BUILD_BLOCK_SIZE) {
+        printf("Discarding outdated RomFS build cache %s.\n", ctx->cache_path);
+        fclose(f);
+        return;
+    }
+    uint64_t hashes_size = header.num_blocks * 0x20;
+    if ((ctx->old_files = malloc((header.num_files ? header.num_files : 1) * sizeof(romfs_build_cache_file_t))) == NULL) {
+        fprintf(stderr, "Failed to allocate RomFS build cache!\n");
+        fatal_exit();
+    }
+    unsigned char *old_hashes = malloc(hashes_size ? hashes_size : 1);
+    if (old_hashes == NULL) {
+        fprintf(stderr, "Failed to allocate RomFS build cache!\n");
+        fatal_exit();
+    }
+    if (fread(ctx->old_files, sizeof(romfs_build_cache_file_t), header.num_files, f) != header.num_files ||
+        fread(old_hashes, 1, hashes_size, f) != hashes_size) {
+        printf("Discarding truncated RomFS build cache %s.\n", ctx->cache_path);
+        free(old_hashes);
+        fclose(f);
+        return;
+    }
+    fclose(f);
+    ctx->old_header = header;
+
+    for (uint32_t i = 0; i < ctx->num_files; i++) {
+        romfs_build_file_t *file = &ctx->files[i];
+        const romfs_build_cache_file_t *old = bsearch(file->path_hash, ctx->old_files, header.num_files, sizeof(romfs_build_cache_file_t), romfs_build_compare_cache_files);
+        /* Timestamps are only as fine as the filesystem keeps them, so a file written in the same tick
+         * as the previous build read it would keep its stamp. Those are read again, to be sure. */
+        file->is_unchanged = old != NULL && is_same_file_stamp(&old->stamp, &file->stamp) && old->offset == file->offset &&
+                             old->stamp.mtime_ns < (header.scan_time - 1) * 1000000000;
+    }
+
+    /* A block is unchanged if every file in it is. Data is packed, so any other bytes are padding, which
+     * only changes when the files around it do. The first block holds the header, and later ones may
+     * hold tables, which are always rebuilt. */
+    uint64_t num_blocks = ctx->level_sizes[IVFC_MAX_LEVEL - 2] / 0x20;
+    uint64_t tables_offset = ctx->tables_offset < header.tables_offset ? ctx->tables_offset : header.tables_offset;
+    uint64_t num_clean = tables_offset / ROMFS_BUILD_BLOCK_SIZE;
+    if (num_clean > header.num_blocks) {
+        num_clean = header.num_blocks;
+    }
+    for (uint64_t b = 1; b < num_clean; b++) {
+        ctx->is_clean[b] = 1;
+    }
+    for (uint32_t i = 0; i < ctx->num_files; i++) {
+        romfs_build_file_t *file = &ctx->files[i];
+        if (file->is_unchanged || file->stamp.size == 0) {
+            continue;
+        }
+        for (uint64_t b = file->offset / ROMFS_BUILD_BLOCK_SIZE; b <= (file->offset + file->stamp.size - 1) / ROMFS_BUILD_BLOCK_SIZE && b < num_blocks; b++) {
+            ctx->is_clean[b] = 0;
+        }
+    }
+    for (uint64_t b = 0; b < num_clean; b++) {
+        if (ctx->is_clean[b]) {
+            memcpy(ctx->levels[IVFC_MAX_LEVEL - 2] + b * 0x20, old_hashes + b * 0x20, 0x20);
+        }
+    }
+    free(old_hashes);
+
+    /* The RomFS never moves, so if the output is as the previous build left it, clean blocks can stay. */
+    romfs_build_stat_t st;
+    file_stamp_t image_stamp;
+    if (romfs_build_stat(ctx->out_path, &st) == 0) {
+        get_file_stamp(&image_stamp, &st);
+        ctx->in_place = is_same_file_stamp(&image_stamp, &header.image_stamp);
+    }
+}
+
+static void romfs_build_save_cache(romfs_build_ctx_t *ctx) {
+    romfs_build_stat_t st;
+    if (romfs_build_stat(ctx->out_path, &st) != 0) {
+        fprintf(stderr, "Failed to stat %s!\n", ctx->out_path);
+        fatal_exit();
+    }
+    romfs_build_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MAGIC_HRBC;
+    header.version = ROMFS_BUILD_CACHE_VERSION;
+    header.block_size = ROMFS_BUILD_BLOCK_SIZE;
+    header.num_files = ctx->num_files;
+    header.num_blocks = ctx->level_sizes[IVFC_MAX_LEVEL - 2] / 0x20;
+    header.tables_offset = ctx->tables_offset;
+    header.scan_time = ctx->scan_time;
+    get_file_stamp(&header.image_stamp, &st);
+
+    romfs_build_cache_file_t *files = calloc(ctx->num_files ? ctx->num_files : 1, sizeof(romfs_build_cache_file_t));
+    if (files == NULL) {
+        fprintf(stderr, "Failed to allocate RomFS build cache!\n");
+        fatal_exit();
+    }
+    for (uint32_t i = 0; i < ctx->num_files; i++) {
+        memcpy(files[i].path_hash, ctx->files[i].path_hash, 0x20);
+        files[i].offset = ctx->files[i].offset;
+        files[i].stamp = ctx->files[i].stamp;
+    }
+    qsort(files, ctx->num_files, sizeof(romfs_build_cache_file_t), romfs_build_compare_cache_files);
+
+    char tmp_path[MAX_PATH + 0x10];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", ctx->cache_path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (f == NULL || fwrite(&header, 1, sizeof(header), f) != sizeof(header) ||
+        fwrite(files, sizeof(romfs_build_cache_file_t), ctx->num_files, f) != ctx->num_files ||
+        fwrite(ctx->levels[IVFC_MAX_LEVEL - 2], 0x20, header.num_blocks, f) != header.num_blocks || !fsync_file(f)) {
+        fprintf(stderr, "Failed to write RomFS build cache %s!\n", tmp_path);
+        fatal_exit();
+    }
+    fclose(f);
+    free(files);
+#ifdef _WIN32
+    remove(ctx->cache_path);
+#endif
+    if (rename(tmp_path, ctx->cache_path) != 0) {
+        fprintf(stderr, "Failed to replace RomFS build cache %s!\n", ctx->cache_path);
+        fatal_exit();
+    }
+}
+
+/* Assembles RomFS bytes [start, start + size) from the header, file data and tables. */
+static void romfs_build_read_chunk(romfs_build_ctx_t *ctx, unsigned char *chunk, uint64_t start, uint64_t size, FILE **in, uint32_t *in_index) {
+    uint64_t end = start + size;
+    memset(chunk, 0, size);
+    if (start < sizeof(ctx->header)) {
+        memcpy(chunk, (unsigned char *)&ctx->header + start, sizeof(ctx->header) - start);
+    }
+    if (end > ctx->tables_offset) {
+        uint64_t from = start > ctx->tables_offset ? start : ctx->tables_offset;
+        memcpy(chunk + (from - start), ctx->tables + (from - ctx->tables_offset), end - from);
+    }
+
+    /* Files are in data order; find the first one ending after start. */
+    uint32_t lo = 0, hi = ctx->num_files;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ctx->files[mid].offset + ctx->files[mid].stamp.size <= start) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (uint32_t i = lo; i < ctx->num_files && ctx->files[i].offset < end; i++) {
+        romfs_build_file_t *file = &ctx->files[i];
+        if (file->stamp.size == 0) {
+            continue;
+        }
+        uint64_t from = file->offset > start ? file->offset : start;
+        uint64_t to = file->offset + file->stamp.size < end ? file->offset + file->stamp.size : end;
+        if (*in_index != i) {
+            if (*in != NULL) {
+                fclose(*in);
+            }
+            if ((*in = fopen(file->path, "rb")) == NULL) {
+                fprintf(stderr, "Failed to open %s!\n", file->path);
+                fatal_exit();
+            }
+            *in_index = i;
+        }
+        stats_span_t span;
+        stats_begin(&span);
+        fseeko64(*in, from - file->offset, SEEK_SET);
+        if (fread(chunk + (from - start), 1, to - from, *in) != to - from) {
+            fprintf(stderr, "Failed to read %s; did it change during the build?\n", file->path);
+            fatal_exit();
+        }
+        stats_end(&span, STATS_READ, to - from);
+    }
+}
+
+static void romfs_build_data_worker(void *arg) {
+    romfs_build_ctx_t *ctx = arg;
+    const uint64_t chunk_size = ROMFS_BUILD_CHUNK_BLOCKS * ROMFS_BUILD_BLOCK_SIZE;
+    unsigned char *chunk = malloc(chunk_size);
+    FILE *out = fopen(ctx->out_path, "r+b");
+    if (chunk == NULL || out == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", ctx->out_path);
+        fatal_exit();
+    }
+    FILE *in = NULL;
+    uint32_t in_index = ROMFS_ENTRY_EMPTY;
+    uint64_t num_blocks = ctx->level_sizes[IVFC_MAX_LEVEL - 2] / 0x20;
+    unsigned char *hashes = ctx->levels[IVFC_MAX_LEVEL - 2];
+    uint64_t c;
+    while (!atomic_load(&ctx->stop) && (c = atomic_fetch_add(&ctx->next_chunk, 1)) < ctx->num_chunks) {
+        uint64_t first_block = c * ROMFS_BUILD_CHUNK_BLOCKS;
+        uint64_t end_block = first_block + ROMFS_BUILD_CHUNK_BLOCKS < num_blocks ? first_block + ROMFS_BUILD_CHUNK_BLOCKS : num_blocks;
+        uint64_t num_dirty = 0;
+        for (uint64_t b = first_block; b < end_block; b++) {
+            num_dirty += !ctx->is_clean[b];
+        }
+        if (num_dirty == 0 && ctx->in_place) {
+            continue;
+        }
+
+        uint64_t start = first_block * ROMFS_BUILD_BLOCK_SIZE;
+        uint64_t size = (end_block * ROMFS_BUILD_BLOCK_SIZE < ctx->romfs_size ? end_block * ROMFS_BUILD_BLOCK_SIZE : ctx->romfs_size) - start;
+        /* The last block is hashed padded with zeroes, which the chunk already is. */
+        memset(chunk + size, 0, chunk_size - size);
+        romfs_build_read_chunk(ctx, chunk, start, size, &in, &in_index);
+        for (uint64_t b = first_block; b < end_block; b++) {
+            if (!ctx->is_clean[b]) {
+                sha256_hash_buffer(hashes + b * 0x20, chunk + (b - first_block) * ROMFS_BUILD_BLOCK_SIZE, ROMFS_BUILD_BLOCK_SIZE);
+            }
+        }
+        atomic_fetch_add(&ctx->num_hashed_blocks, num_dirty);
+
+        stats_span_t span;
+        stats_begin(&span);
+        fseeko64(out, start, SEEK_SET);
+        if (fwrite(chunk, 1, size, out) != size) {
+            fprintf(stderr, "Failed to write %s!\n", ctx->out_path);
+            fatal_exit();
+        }
+        stats_end(&span, STATS_WRITE, size);
+    }
+    if (in != NULL) {
+        fclose(in);
+    }
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Failed to write %s!\n", ctx->out_path);
+        fatal_exit();
+    }
+    free(chunk);
+}
+
+/* Hashes the blocks of level hash_level + 1 into level hash_level. Levels are zero-padded to whole blocks. */
+static void romfs_build_hash_worker(void *arg) {
+    romfs_build_ctx_t *ctx = arg;
+    const unsigned char *data = ctx->levels[ctx->hash_level + 1];
+    unsigned char *hashes = ctx->levels[ctx->hash_level];
+    uint64_t num_blocks = ctx->level_sizes[ctx->hash_level] / 0x20;
+    uint64_t c;
+    while (!atomic_load(&ctx->stop) && (c = atomic_fetch_add(&ctx->next_chunk, 1)) < ctx->num_chunks) {
+        uint64_t first_block = c * ROMFS_BUILD_HASH_CHUNK_BLOCKS;
+        for (uint64_t b = first_block; b < first_block + ROMFS_BUILD_HASH_CHUNK_BLOCKS && b < num_blocks; b++) {
+            sha256_hash_buffer(hashes + b * 0x20, data + b * ROMFS_BUILD_BLOCK_SIZE, ROMFS_BUILD_BLOCK_SIZE);
+        }
+    }
+}
+
+static void romfs_build_run_workers(romfs_build_ctx_t *ctx, void (*worker)(void *), uint64_t num_chunks) {
+    uint32_t num_threads = num_chunks < ctx->num_jobs ? (uint32_t)num_chunks : ctx->num_jobs;
+    atomic_store(&ctx->next_chunk, 0);
+    atomic_store(&ctx->stop, 0);
+    ctx->num_chunks = num_chunks;
+    run_workers(num_threads, worker, ctx, &ctx->stop);
+}
+
+static void romfs_build_free(romfs_build_ctx_t *ctx) {
+    for (uint32_t i = 0; i < ctx->num_dirs; i++) {
+        free(ctx->dirs[i].path);
+        free(ctx->dirs[i].rel_path);
+    }
+    for (uint32_t i = 0; i < ctx->num_files; i++) {
+        free(ctx->files[i].path);
+    }
+    for (unsigned int i = 0; i < IVFC_MAX_LEVEL - 1; i++) {
+        free(ctx->levels[i]);
+    }
+    free(ctx->dirs);
+    free(ctx->files);
+    free(ctx->tables);
+    free(ctx->old_files);
+    free(ctx->is_clean);
+}
+
+int romfs_build(hactool_ctx_t *tool_ctx, const char *dir, const char *out_path) {
+    romfs_build_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.tool_ctx = tool_ctx;
+    ctx.out_path = out_path;
+    if (tool_ctx->settings.build_cache_path.valid == VALIDITY_VALID) {
+        ctx.cache_path = tool_ctx->settings.build_cache_path.char_path;
+    }
+    ctx.num_jobs = tool_ctx->settings.build_jobs ? tool_ctx->settings.build_jobs : ROMFS_BUILD_DEFAULT_JOBS;
+
+    trace_span_t trace_span;
+    trace_begin(&trace_span);
+    size_t dir_len = strlen(dir);
+    while (dir_len > 1 && (dir[dir_len - 1] == '/' || dir[dir_len - 1] == '\\')) {
+        dir_len--;
+    }
+    char root[MAX_PATH];
+    snprintf(root, sizeof(root), "%.*s", (int)dir_len, dir);
+    romfs_build_add_dir(&ctx, root, "", 0);
+    ctx.scan_time = (int64_t)time(NULL);
+    romfs_build_scan_dir(&ctx, 0);
+    romfs_build_layout(&ctx);
+    trace_end(&trace_span, "RomFS scan", TRACE_NO_SECTION, "%s", root);
+
+    uint64_t num_blocks = ctx.level_sizes[IVFC_MAX_LEVEL - 2] / 0x20;
+    if ((ctx.is_clean = calloc(num_blocks ? num_blocks : 1, 1)) == NULL) {
+        fprintf(stderr, "Failed to allocate RomFS build state!\n");
+        fatal_exit();
+    }
+    if (ctx.cache_path != NULL) {
+        romfs_build_load_cache(&ctx);
+        /* The cache no longer describes the output once writing starts. */
+        remove(ctx.cache_path);
+    }
+    FILE *out = fopen(out_path, ctx.in_place ? "r+b" : "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", out_path);
+        romfs_build_free(&ctx);
+        return 0;
+    }
+    preallocate_file(out, ctx.image_size);
+    fflush(out);
+
+    trace_begin(&trace_span);
+    romfs_build_run_workers(&ctx, romfs_build_data_worker, (num_blocks + ROMFS_BUILD_CHUNK_BLOCKS - 1) / ROMFS_BUILD_CHUNK_BLOCKS);
+    trace_end(&trace_span, "RomFS data", TRACE_NO_SECTION, "%"PRIu64" blocks", num_blocks);
+
+    trace_begin(&trace_span);
+    for (int i = IVFC_MAX_LEVEL - 3; i >= 0; i--) {
+        uint64_t level_blocks = ctx.level_sizes[i] / 0x20;
+        ctx.hash_level = (uint32_t)i;
+        romfs_build_run_workers(&ctx, romfs_build_hash_worker, (level_blocks + ROMFS_BUILD_HASH_CHUNK_BLOCKS - 1) / ROMFS_BUILD_HASH_CHUNK_BLOCKS);
+    }
+    sha256_hash_buffer(ctx.ivfc_header.master_hash, ctx.levels[0], ROMFS_BUILD_BLOCK_SIZE);
+    trace_end(&trace_span, "RomFS hash levels", TRACE_NO_SECTION, NULL);
+
+    for (unsigned int i = 0; i < IVFC_MAX_LEVEL - 1; i++) {
+        const ivfc_level_hdr_t *level = &ctx.ivfc_header.level_headers[i];
+        uint64_t gap_start = i == 0 ? ctx.romfs_size : ctx.ivfc_header.level_headers[i - 1].logical_offset + ctx.level_sizes[i - 1];
+        uint64_t padded_size = level->logical_offset - gap_start + level->hash_data_size;
+        unsigned char *padded = calloc(1, padded_size);
+        if (padded == NULL) {
+            fprintf(stderr, "Failed to allocate IVFC level %u!\n", i);
+            fatal_exit();
+        }
+        memcpy(padded + (level->logical_offset - gap_start), ctx.levels[i], level->hash_data_size);
+        fseeko64(out, gap_start, SEEK_SET);
+        if (fwrite(padded, 1, padded_size, out) != padded_size) {
+            fprintf(stderr, "Failed to write %s!\n", out_path);
+            fatal_exit();
+        }
+        free(padded);
+    }
+    if (!finish_sparse_file(out, ctx.image_size) || !fsync_file(out) || fclose(out) != 0) {
+        fprintf(stderr, "Failed to write %s!\n", out_path);
+        fatal_exit();
+    }
+
+    if (tool_ctx->settings.ivfc_header_path.valid == VALIDITY_VALID) {
+        FILE *f = fopen(tool_ctx->settings.ivfc_header_path.char_path, "wb");
+        if (f == NULL || fwrite(&ctx.ivfc_header, 1, sizeof(ctx.ivfc_header), f) != sizeof(ctx.ivfc_header) || fclose(f) != 0) {
+            fprintf(stderr, "Failed to write %s!\n", tool_ctx->settings.ivfc_header_path.char_path);
+            fatal_exit();
+        }
+    }
+    if (ctx.cache_path != NULL) {
+        romfs_build_save_cache(&ctx);
+    }
+
+    printf("RomFS: %"PRIu32" file(s) in %"PRIu32" directories, %"PRIu64" of %"PRIu64" blocks hashed%s, written to %s.\n",
+           ctx.num_files, ctx.num_dirs, (uint64_t)atomic_load(&ctx.num_hashed_blocks), num_blocks, ctx.in_place ? " in place" : "", out_path);
+    memdump(stdout, "IVFC Master Hash:                   ", ctx.ivfc_header.master_hash, 0x20);
+    romfs_build_free(&ctx);
+    return 1;
+}
@@ -0,0 +1,94 @@
+#ifndef HACTOOL_ROMFSBUILD_H
+#define HACTOOL_ROMFSBUILD_H
+
+#include <stdatomic.h>
+#include "types.h"
+#include "settings.h"
+#include "ivfc.h"
+#include "utils.h"
+
+#define MAGIC_HRBC 0x43425248 /* "HRBC" */
+#define ROMFS_BUILD_CACHE_VERSION 2
+#define ROMFS_BUILD_BLOCK_SIZE 0x4000
+#define ROMFS_BUILD_BLOCK_SIZE_LOG2 14
+#define ROMFS_BUILD_CHUNK_BLOCKS 0x10 /* Blocks read, hashed and written by a worker at a time. */
+#define ROMFS_BUILD_DEFAULT_JOBS 4
+#define ROMFS_BUILD_MAX_JOBS 64
+
+typedef struct {
+    char *path; /* On disk. */
+    const char *name; /* Within path. */
+    uint32_t parent; /* Index of the parent directory. */
+    uint32_t sibling; /* Index of the next file in the same directory, or ROMFS_ENTRY_EMPTY. */
+    file_stamp_t stamp;
+    uint64_t offset; /* Of the data, from the start of the RomFS. */
+    uint32_t entry_offset;
+    int is_unchanged; /* Same stamp and offset as in the previous build. */
+    uint8_t path_hash[0x20]; /* SHA-256 of the path relative to the built directory. */
+} romfs_build_file_t;
+
+typedef struct {
+    char *path;
+    const char *name;
+    uint32_t parent;
+    uint32_t sibling; /* Indices, or ROMFS_ENTRY_EMPTY. */
+    uint32_t child;
+    uint32_t file;
+    uint32_t entry_offset;
+    char *rel_path;
+} romfs_build_dir_t;
+
+/* The build cache is a romfs_build_cache_header_t, the files of the build sorted by path hash, and
+ * the hashes of every RomFS block. A later build reuses the hashes of blocks whose files are unchanged. */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t num_files;
+    uint64_t num_blocks;
+    uint64_t tables_offset; /* Blocks from here on cover the RomFS tables. */
+    int64_t scan_time; /* When the files were read. Files modified around then may have changed unseen. */
+    file_stamp_t image_stamp; /* Of the output, to tell whether it can be updated in place. */
+} romfs_build_cache_header_t;
+
+typedef struct {
+    uint8_t path_hash[0x20];
+    uint64_t offset;
+    file_stamp_t stamp;
+} romfs_build_cache_file_t;
+
+typedef struct {
+    hactool_ctx_t *tool_ctx;
+    const char *out_path;
+    const char *cache_path;
+    romfs_build_dir_t *dirs;
+    uint32_t num_dirs;
+    uint32_t max_dirs;
+    romfs_build_file_t *files; /* In table order, which is also data order. */
+    uint32_t num_files;
+    uint32_t max_files;
+    romfs_hdr_t header;
+    unsigned char *tables; /* Everything from header.dir_hash_table_offset on. */
+    uint64_t tables_offset;
+    uint64_t romfs_size;
+    ivfc_hdr_t ivfc_header;
+    unsigned char *levels[IVFC_MAX_LEVEL - 1]; /* Hash levels; the last hashes the RomFS blocks. */
+    uint64_t level_sizes[IVFC_MAX_LEVEL];
+    uint64_t image_size;
+    int64_t scan_time;
+    romfs_build_cache_header_t old_header;
+    romfs_build_cache_file_t *old_files;
+    uint8_t *is_clean; /* Per RomFS block: hash reusable from the previous build. */
+    int in_place; /* Clean blocks are already in the output, and are not rewritten. */
+    uint32_t num_jobs;
+    uint32_t hash_level; /* Level being computed by the hash workers. */
+    atomic_uint_fast64_t next_chunk;
+    atomic_int stop; /* Set when a worker fails. */
+    uint64_t num_chunks;
+    atomic_uint_fast64_t num_hashed_blocks;
+} romfs_build_ctx_t;
+
+/* Build a RomFS of dir into out_path, followed by its IVFC hash levels. */
+int romfs_build(hactool_ctx_t *tool_ctx, const char *dir, const char *out_path);
+
+#endif
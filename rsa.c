@@ -8,36 +8,173 @@
 #define RSA_2048_BYTES 0x100
 #define RSA_2048_BITS (RSA_2048_BYTES*8)
 
-/* Perform an RSA-PSS verify operation on data, with signature and N. */
-int rsa2048_pss_verify(const void *data, size_t len, const unsigned char *signature, const unsigned char *modulus) {
-    mbedtls_mpi signature_mpi;
+/* Montgomery arithmetic works on the widest limbs the compiler can multiply out in full. */
+#ifdef __SIZEOF_INT128__
+typedef uint64_t rsa_word_t;
+__extension__ typedef unsigned __int128 rsa_dword_t;
+#else
+typedef uint32_t rsa_word_t;
+typedef uint64_t rsa_dword_t;
+#endif
+#define RSA_WORD_BYTES sizeof(rsa_word_t)
+#define RSA_WORD_BITS (RSA_WORD_BYTES*8)
+#define RSA_2048_WORDS (RSA_2048_BYTES/RSA_WORD_BYTES)
+#define RSA_KEY_CACHE_SIZE 8
+
+/* Montgomery state for one modulus, with words stored least significant first. */
+typedef struct {
+    unsigned char modulus[RSA_2048_BYTES];
+    rsa_word_t n[RSA_2048_WORDS];
+    rsa_word_t rr[RSA_2048_WORDS]; /* R^2 mod N, with R = 2^2048. */
+    rsa_word_t n0_inv; /* -N^-1 mod 2^RSA_WORD_BITS. */
+    int is_valid;
+} rsa2048_key_t;
+
+/* Every NCA header is checked against the same few moduli, so their setup is kept around (per thread). */
+static _Thread_local rsa2048_key_t g_rsa_key_cache[RSA_KEY_CACHE_SIZE];
+static _Thread_local unsigned int g_rsa_key_cache_next;
+
+static void rsa2048_read_words(rsa_word_t *words, const unsigned char *bytes) {
+    for (unsigned int i = 0; i < RSA_2048_WORDS; i++) {
+        const unsigned char *b = bytes + RSA_2048_BYTES - RSA_WORD_BYTES * (i + 1);
+        words[i] = 0;
+        for (unsigned int j = 0; j < RSA_WORD_BYTES; j++) {
+            words[i] = (words[i] << 8) | b[j];
+        }
+    }
+}
+
+static void rsa2048_write_words(unsigned char *bytes, const rsa_word_t *words) {
+    for (unsigned int i = 0; i < RSA_2048_WORDS; i++) {
+        unsigned char *b = bytes + RSA_2048_BYTES - RSA_WORD_BYTES * (i + 1);
+        for (unsigned int j = 0; j < RSA_WORD_BYTES; j++) {
+            b[j] = (unsigned char)(words[i] >> (RSA_WORD_BITS - 8 * (j + 1)));
+        }
+    }
+}
+
+static const rsa2048_key_t *rsa2048_get_key(const unsigned char *modulus) {
+    for (unsigned int i = 0; i < RSA_KEY_CACHE_SIZE; i++) {
+        if (g_rsa_key_cache[i].is_valid && memcmp(g_rsa_key_cache[i].modulus, modulus, RSA_2048_BYTES) == 0) {
+            return &g_rsa_key_cache[i];
+        }
+    }
+
+    rsa2048_key_t *key = &g_rsa_key_cache[g_rsa_key_cache_next];
+    g_rsa_key_cache_next = (g_rsa_key_cache_next + 1) % RSA_KEY_CACHE_SIZE;
+    memcpy(key->modulus, modulus, RSA_2048_BYTES);
+    rsa2048_read_words(key->n, modulus);
+
+    /* Newton's iteration doubles the correct low bits each round; N is odd for any real key. */
+    rsa_word_t inv = key->n[0];
+    for (unsigned int i = 0; i < 5; i++) {
+        inv *= 2 - key->n[0] * inv;
+    }
+    key->n0_inv = (rsa_word_t)0 - inv;
+
+    /* R^2 mod N is only needed once per modulus, so the generic bignum code does. */
+    unsigned char rr_buf[RSA_2048_BYTES];
+    mbedtls_mpi rr_mpi;
     mbedtls_mpi modulus_mpi;
-    mbedtls_mpi e_mpi;
-    mbedtls_mpi message_mpi;
-    
-    mbedtls_mpi_init(&signature_mpi);
+    mbedtls_mpi_init(&rr_mpi);
     mbedtls_mpi_init(&modulus_mpi);
-    mbedtls_mpi_init(&e_mpi);
-    mbedtls_mpi_init(&message_mpi);
-    mbedtls_mpi_lset(&message_mpi, RSA_2048_BITS);
+    if (mbedtls_mpi_read_binary(&modulus_mpi, modulus, RSA_2048_BYTES) != 0 ||
+        mbedtls_mpi_lset(&rr_mpi, 1) != 0 ||
+        mbedtls_mpi_shift_l(&rr_mpi, 2 * RSA_2048_BITS) != 0 ||
+        mbedtls_mpi_mod_mpi(&rr_mpi, &rr_mpi, &modulus_mpi) != 0 ||
+        mbedtls_mpi_write_binary(&rr_mpi, rr_buf, RSA_2048_BYTES) != 0) {
+        memset(rr_buf, 0, sizeof(rr_buf));
+    }
+    mbedtls_mpi_free(&rr_mpi);
+    mbedtls_mpi_free(&modulus_mpi);
+    rsa2048_read_words(key->rr, rr_buf);
 
-    unsigned char m_buf[RSA_2048_BYTES];
-    unsigned char h_buf[0x24];
-    const unsigned char E[3] = {1, 0, 1};
-    
-    mbedtls_mpi_read_binary(&e_mpi, E, 3);
-    mbedtls_mpi_read_binary(&signature_mpi, signature, RSA_2048_BYTES);
-    mbedtls_mpi_read_binary(&modulus_mpi, modulus, RSA_2048_BYTES);
-    mbedtls_mpi_exp_mod(&message_mpi, &signature_mpi, &e_mpi, &modulus_mpi, NULL);
+    key->is_valid = 1;
+    return key;
+}
+
+/* out = a * b / R mod N. Inputs must be below R, and b below N. */
+static void rsa2048_mont_mul(rsa_word_t *out, const rsa_word_t *a, const rsa_word_t *b, const rsa2048_key_t *key) {
+    rsa_word_t t[RSA_2048_WORDS + 2];
+    memset(t, 0, sizeof(t));
+    for (unsigned int i = 0; i < RSA_2048_WORDS; i++) {
+        rsa_dword_t c = 0;
+        for (unsigned int j = 0; j < RSA_2048_WORDS; j++) {
+            c += (rsa_dword_t)a[j] * b[i] + t[j];
+            t[j] = (rsa_word_t)c;
+            c >>= RSA_WORD_BITS;
+        }
+        c += t[RSA_2048_WORDS];
+        t[RSA_2048_WORDS] = (rsa_word_t)c;
+        t[RSA_2048_WORDS + 1] = (rsa_word_t)(c >> RSA_WORD_BITS);
 
-    if (mbedtls_mpi_write_binary(&message_mpi, m_buf, RSA_2048_BYTES) != 0) {
-        FATAL_ERROR("Failed to export exponentiated RSA message!");
+        rsa_word_t m = t[0] * key->n0_inv;
+        c = ((rsa_dword_t)m * key->n[0] + t[0]) >> RSA_WORD_BITS;
+        for (unsigned int j = 1; j < RSA_2048_WORDS; j++) {
+            c += (rsa_dword_t)m * key->n[j] + t[j];
+            t[j - 1] = (rsa_word_t)c;
+            c >>= RSA_WORD_BITS;
+        }
+        c += t[RSA_2048_WORDS];
+        t[RSA_2048_WORDS - 1] = (rsa_word_t)c;
+        t[RSA_2048_WORDS] = t[RSA_2048_WORDS + 1] + (rsa_word_t)(c >> RSA_WORD_BITS);
     }
 
-    mbedtls_mpi_free(&signature_mpi);
-    mbedtls_mpi_free(&modulus_mpi);
-    mbedtls_mpi_free(&e_mpi);
-    mbedtls_mpi_free(&message_mpi);
+    /* The result is below 2N; one conditional subtraction finishes the reduction. */
+    int ge = t[RSA_2048_WORDS] != 0;
+    if (!ge) {
+        ge = 1;
+        for (unsigned int i = RSA_2048_WORDS; i-- > 0; ) {
+            if (t[i] != key->n[i]) {
+                ge = t[i] > key->n[i];
+                break;
+            }
+        }
+    }
+    if (ge) {
+        rsa_word_t borrow = 0;
+        for (unsigned int i = 0; i < RSA_2048_WORDS; i++) {
+            rsa_word_t d = t[i] - key->n[i] - borrow;
+            borrow = (t[i] < key->n[i]) || (t[i] == key->n[i] && borrow);
+            t[i] = d;
+        }
+    }
+    memcpy(out, t, RSA_2048_BYTES);
+}
+
+/* m = s^65537 mod N: into Montgomery form, sixteen squarings, one multiply, and back out. */
+static void rsa2048_public_op(unsigned char *m_buf, const unsigned char *signature, const unsigned char *modulus) {
+    const rsa2048_key_t *key = rsa2048_get_key(modulus);
+    if ((key->n[0] & 1) == 0) {
+        /* Not an RSA modulus, e.g. a key missing from the keyset. Nothing will verify. */
+        memset(m_buf, 0, RSA_2048_BYTES);
+        return;
+    }
+    rsa_word_t s[RSA_2048_WORDS];
+    rsa_word_t s_mont[RSA_2048_WORDS];
+    rsa_word_t x[RSA_2048_WORDS];
+    rsa_word_t one[RSA_2048_WORDS];
+
+    rsa2048_read_words(s, signature);
+    rsa2048_mont_mul(s_mont, s, key->rr, key);
+    memcpy(x, s_mont, sizeof(x));
+    for (unsigned int i = 0; i < 16; i++) {
+        rsa2048_mont_mul(x, x, x, key);
+    }
+    rsa2048_mont_mul(x, x, s_mont, key);
+
+    memset(one, 0, sizeof(one));
+    one[0] = 1;
+    rsa2048_mont_mul(x, x, one, key);
+    rsa2048_write_words(m_buf, x);
+}
+
+/* Perform an RSA-PSS verify operation on data, with signature and N. */
+int rsa2048_pss_verify(const void *data, size_t len, const unsigned char *signature, const unsigned char *modulus) {
+    unsigned char m_buf[RSA_2048_BYTES];
+    unsigned char h_buf[0x24];
+
+    rsa2048_public_op(m_buf, signature, modulus);
 
     /* There's no automated PSS verification as far as I can tell. */
     if (m_buf[RSA_2048_BYTES-1] != 0xBC) {
@@ -80,36 +217,63 @@ int rsa2048_pss_verify(const void *data, size_t len, const unsigned char *signat
     return memcmp(h_buf, validate_hash, 0x20) == 0;
 }
 
+/* Sign data with RSA-PSS, given N and the private exponent D. The salt is the data's hash, so signatures are
+ * reproducible; this is only meant for test keys. Returns 0 on failure. */
+int rsa2048_pss_sign(unsigned char *signature, const void *data, size_t len, const unsigned char *modulus, const unsigned char *private_exponent) {
+    unsigned char m_buf[RSA_2048_BYTES];
+    unsigned char salt[0x20];
+    unsigned char h_buf[0x24];
+
+    /* H = SHA-256(8 zero bytes || SHA-256(data) || salt), as checked by rsa2048_pss_verify. */
+    unsigned char hash_buf[8 + 0x20 + 0x20];
+    memset(hash_buf, 0, sizeof(hash_buf));
+    sha256_hash_buffer(&hash_buf[8], data, len);
+    memcpy(salt, &hash_buf[8], 0x20);
+    memcpy(&hash_buf[0x28], salt, 0x20);
+    memset(h_buf, 0, sizeof(h_buf));
+    sha256_hash_buffer(h_buf, hash_buf, sizeof(hash_buf));
+
+    /* EM = (DB ^ MGF1(H)) || H || 0xBC, with DB = zeroes || 0x01 || salt. */
+    memset(m_buf, 0, RSA_2048_BYTES);
+    m_buf[RSA_2048_BYTES - 0x20 - 0x20 - 1 - 1] = 1;
+    memcpy(&m_buf[RSA_2048_BYTES - 0x20 - 0x20 - 1], salt, 0x20);
+    unsigned char seed = 0;
+    unsigned char mgf1_buf[0x20];
+    for (unsigned int ofs = 0; ofs < RSA_2048_BYTES - 0x20 - 1; ofs += 0x20) {
+        h_buf[0x23] = seed++;
+        sha256_hash_buffer(mgf1_buf, h_buf, 0x24);
+        for (unsigned int i = ofs; i < ofs + 0x20 && i < RSA_2048_BYTES - 0x20 - 1; i++) {
+            m_buf[i] ^= mgf1_buf[i - ofs];
+        }
+    }
+    m_buf[0] &= 0x7F;
+    memcpy(&m_buf[RSA_2048_BYTES - 0x20 - 1], h_buf, 0x20);
+    m_buf[RSA_2048_BYTES - 1] = 0xBC;
+
+    /* s = EM^D mod N. Speed doesn't matter here, so the generic bignum code does. */
+    mbedtls_mpi m_mpi, s_mpi, d_mpi, n_mpi;
+    mbedtls_mpi_init(&m_mpi);
+    mbedtls_mpi_init(&s_mpi);
+    mbedtls_mpi_init(&d_mpi);
+    mbedtls_mpi_init(&n_mpi);
+    int ok = mbedtls_mpi_read_binary(&m_mpi, m_buf, RSA_2048_BYTES) == 0 &&
+        mbedtls_mpi_read_binary(&d_mpi, private_exponent, RSA_2048_BYTES) == 0 &&
+        mbedtls_mpi_read_binary(&n_mpi, modulus, RSA_2048_BYTES) == 0 &&
+        mbedtls_mpi_exp_mod(&s_mpi, &m_mpi, &d_mpi, &n_mpi, NULL) == 0 &&
+        mbedtls_mpi_write_binary(&s_mpi, signature, RSA_2048_BYTES) == 0;
+    mbedtls_mpi_free(&m_mpi);
+    mbedtls_mpi_free(&s_mpi);
+    mbedtls_mpi_free(&d_mpi);
+    mbedtls_mpi_free(&n_mpi);
+    return ok;
+}
+
 /* Perform an RSA-PKCS1 verify operation on data, with signature and N. */
 int rsa2048_pkcs1_verify(const void *data, size_t len, const unsigned char *signature, const unsigned char *modulus) {
-    mbedtls_mpi signature_mpi;
-    mbedtls_mpi modulus_mpi;
-    mbedtls_mpi e_mpi;
-    mbedtls_mpi message_mpi;
-    
-    mbedtls_mpi_init(&signature_mpi);
-    mbedtls_mpi_init(&modulus_mpi);
-    mbedtls_mpi_init(&e_mpi);
-    mbedtls_mpi_init(&message_mpi);
-    mbedtls_mpi_lset(&message_mpi, RSA_2048_BITS);
-
     unsigned char m_buf[RSA_2048_BYTES];
     unsigned char h_buf[0x20];
-    const unsigned char E[3] = {1, 0, 1};
-    
-    mbedtls_mpi_read_binary(&e_mpi, E, 3);
-    mbedtls_mpi_read_binary(&signature_mpi, signature, RSA_2048_BYTES);
-    mbedtls_mpi_read_binary(&modulus_mpi, modulus, RSA_2048_BYTES);
-    mbedtls_mpi_exp_mod(&message_mpi, &signature_mpi, &e_mpi, &modulus_mpi, NULL);
-
-    if (mbedtls_mpi_write_binary(&message_mpi, m_buf, RSA_2048_BYTES) != 0) {
-        FATAL_ERROR("Failed to export exponentiated RSA message!");
-    }
 
-    mbedtls_mpi_free(&signature_mpi);
-    mbedtls_mpi_free(&modulus_mpi);
-    mbedtls_mpi_free(&e_mpi);
-    mbedtls_mpi_free(&message_mpi);
+    rsa2048_public_op(m_buf, signature, modulus);
     
     /* For RSA-2048, this prefix is just a constant. */
     const unsigned char pkcs1_hash_prefix[0xE0] = {
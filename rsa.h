@@ -4,6 +4,7 @@
 #include "mbedtls/rsa.h"
 
 int rsa2048_pss_verify(const void *data, size_t len, const unsigned char *signature, const unsigned char *modulus);
+int rsa2048_pss_sign(unsigned char *signature, const void *data, size_t len, const unsigned char *modulus, const unsigned char *private_exponent);
 int rsa2048_pkcs1_verify(const void *data, size_t len, const unsigned char *signature, const unsigned char *modulus);
 
 #endif
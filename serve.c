@@ -0,0 +1,1115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#include "serve.h"
+#include "utils.h"
+
+/* A long-running server on a Unix socket. Clients send tab-separated request lines:
+ *   <id> info <type> <path>
+ *   <id> list <type> <path> [section]
+ *   <id> read <type> <path> <section> <file> [offset [size]]
+ *   <id> extract <type> <path> <section> <file> <out path>
+ *   <id> cancel <request id>
+ *   <id> limit <bytes>
+ * where type is nca, xci, pfs0 or romfs, sections are numbered as by hactool_get_section() and files are
+ * paths within their section. Every line of the response starts with the request's id:
+ *   <id> info <key>=<value>...
+ *   <id> section <section> <index> <type> <offset> <size> <files> [name]
+ *   <id> file <section> <file number> <size> <path>
+ *   <id> data <length>, followed by that many bytes
+ * and it ends with "<id> ok [bytes]" or "<id> error <message>". Requests run interleaved, a step at a time,
+ * so the answers to several requests may be mixed. One thread reads requests and writes answers; the steps,
+ * opening inputs and moving up to a slice of data each, run on --jobs workers, so a slow input only holds
+ * up the requests for it. A step of a request only starts while its connection holds less than the
+ * request's limit, counting both response data waiting to be sent and the buffers of steps in progress,
+ * and fills at most what is left; limit sets this for the connection's later requests. Opened inputs stay
+ * open with their tables parsed, and are reopened when they change on disk. */
+
+#ifdef _WIN32
+int serve_run(hactool_ctx_t *tool_ctx, const char *path) {
+    (void)tool_ctx;
+    (void)path;
+    fprintf(stderr, "--serve is not supported on this platform!\n");
+    return 0;
+}
+#else
+
+enum serve_command {
+    SERVE_INFO,
+    SERVE_LIST,
+    SERVE_READ,
+    SERVE_EXTRACT
+};
+
+typedef struct {
+    char *data;
+    size_t pos; /* Sent so far. */
+    size_t len;
+    size_t size;
+} serve_buf_t;
+
+/* Set up by the loop. While a step runs, only its worker touches the request, except for the fields
+ * the loop schedules it with. */
+struct serve_request {
+    char *id;
+    enum serve_command command;
+    serve_conn_t *conn;
+    hactool_type_t type;
+    char *path; /* Of the input, opened by the first step. */
+    char *file_path; /* Within the section, of a read or extract. */
+    serve_input_t *input;
+    uint32_t section;
+    uint32_t file;
+    uint32_t end_section; /* Of a listing. */
+    int has_section; /* A listing of one section. */
+    int is_described; /* The listing's current section line has been sent. */
+    uint64_t start; /* Until the first step, the offset asked for. */
+    uint64_t offset; /* Next byte to read. */
+    uint64_t end;
+    uint64_t size; /* Of a read, as asked for. */
+    uint64_t limit;
+    uint64_t reserved; /* Most the running step may add to its connection's memory. */
+    serve_buf_t out; /* Written by the running step, then moved to the connection. */
+    int is_running;
+    int is_locked; /* The running step holds its input's lock. */
+    int is_finished; /* Answered; freed once delivered. */
+    int is_cancelled; /* Answered by the loop; freed once its step is back. */
+    FILE *f_out;
+    char *out_path;
+    serve_request_t *next; /* In its connection's requests. */
+    serve_request_t *next_step; /* In the queue of steps, or of finished ones. */
+};
+
+struct serve_conn {
+    int fd;
+    char in[SERVE_MAX_LINE];
+    size_t in_len;
+    serve_buf_t out;
+    uint64_t limit;
+    uint64_t reserved; /* By its running steps. */
+    uint32_t num_running; /* Including cancelled ones. */
+    int is_eof; /* The client has sent everything; close once answered. */
+    int is_broken;
+    serve_request_t *requests; /* Stepped round-robin. */
+    serve_conn_t *next;
+};
+
+static atomic_int g_serve_stop; /* Set on the thread that takes the signal, read by the loop. */
+static int g_serve_wake_fd = -1;
+
+static void serve_handle_signal(int sig) {
+    (void)sig;
+    atomic_store(&g_serve_stop, 1);
+    /* Any thread may take the signal, so wake the loop from its poll. */
+    if (write(g_serve_wake_fd, "", 1) < 0) {
+        return;
+    }
+}
+
+static void serve_reserve(serve_buf_t *buf, size_t size) {
+    if (buf->pos && buf->pos == buf->len) {
+        buf->pos = buf->len = 0;
+    }
+    if (buf->len + size <= buf->size) {
+        return;
+    }
+    if (buf->pos) {
+        memmove(buf->data, buf->data + buf->pos, buf->len - buf->pos);
+        buf->len -= buf->pos;
+        buf->pos = 0;
+    }
+    while (buf->len + size > buf->size) {
+        buf->size = buf->size ? buf->size * 2 : 0x10000;
+    }
+    if ((buf->data = realloc(buf->data, buf->size)) == NULL) {
+        fprintf(stderr, "Failed to allocate response buffer!\n");
+        fatal_exit();
+    }
+}
+
+static void serve_printf(serve_buf_t *buf, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    serve_reserve(buf, (size_t)len + 1);
+    va_start(args, fmt);
+    vsnprintf(buf->data + buf->len, (size_t)len + 1, fmt, args);
+    va_end(args);
+    buf->len += (size_t)len;
+}
+
+static void serve_free_buf(serve_buf_t *buf) {
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+static size_t serve_pending(serve_conn_t *conn) {
+    return conn->out.len - conn->out.pos;
+}
+
+static void serve_wake(serve_ctx_t *ctx) {
+    /* The pipe is non-blocking; if it is full, the loop is awake already. */
+    if (write(ctx->wake_fds[1], "", 1) < 0) {
+        return;
+    }
+}
+
+/* Tell the loop and the workers to finish. */
+static void serve_stop(serve_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    atomic_store(&ctx->stop, 1);
+    pthread_cond_broadcast(&ctx->cond);
+    pthread_mutex_unlock(&ctx->lock);
+    serve_wake(ctx);
+}
+
+static void serve_push_step(serve_request_t **head, serve_request_t **tail, serve_request_t *req) {
+    req->next_step = NULL;
+    if (*head == NULL) {
+        *head = req;
+    } else {
+        (*tail)->next_step = req;
+    }
+    *tail = req;
+}
+
+static int serve_parse_type(const char *s, hactool_type_t *type) {
+    if (!strcmp(s, "nca")) {
+        *type = HACTOOL_TYPE_NCA;
+    } else if (!strcmp(s, "xci") || !strcmp(s, "gamecard") || !strcmp(s, "gc")) {
+        *type = HACTOOL_TYPE_XCI;
+    } else if (!strcmp(s, "pfs0") || !strcmp(s, "exefs")) {
+        *type = HACTOOL_TYPE_PFS0;
+    } else if (!strcmp(s, "romfs")) {
+        *type = HACTOOL_TYPE_ROMFS;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static int serve_parse_u64(const char *s, uint64_t *out) {
+    char *end;
+    if (*s == '\0' || *s == '-') {
+        return 0;
+    }
+    errno = 0;
+    *out = strtoull(s, &end, 0);
+    return errno == 0 && *end == '\0';
+}
+
+static int serve_parse_u32(const char *s, uint32_t *out) {
+    uint64_t num;
+    if (!serve_parse_u64(s, &num) || num > UINT32_MAX) {
+        return 0;
+    }
+    *out = (uint32_t)num;
+    return 1;
+}
+
+static void serve_free_input(serve_input_t *input) {
+    if (input->handle != NULL) {
+        hactool_close(input->handle);
+    }
+    pthread_mutex_destroy(&input->lock);
+    free(input->path);
+    free(input);
+}
+
+/* The remaining functions on inputs are called with ctx->lock held. */
+static void serve_remove_input(serve_ctx_t *ctx, uint32_t i) {
+    serve_free_input(ctx->inputs[i]);
+    ctx->inputs[i] = ctx->inputs[--ctx->num_inputs];
+}
+
+/* Close least recently used inputs that no request holds, until few enough are open. */
+static void serve_evict_inputs(serve_ctx_t *ctx) {
+    while (ctx->num_inputs > SERVE_MAX_INPUTS) {
+        uint32_t victim = ctx->num_inputs;
+        for (uint32_t i = 0; i < ctx->num_inputs; i++) {
+            if (ctx->inputs[i]->refs == 0 && (victim == ctx->num_inputs || ctx->inputs[i]->last_used < ctx->inputs[victim]->last_used)) {
+                victim = i;
+            }
+        }
+        if (victim == ctx->num_inputs) {
+            return;
+        }
+        serve_remove_input(ctx, victim);
+    }
+}
+
+static void serve_release_input_locked(serve_ctx_t *ctx, serve_input_t *input) {
+    if (--input->refs || !input->is_stale) {
+        return;
+    }
+    for (uint32_t i = 0; i < ctx->num_inputs; i++) {
+        if (ctx->inputs[i] == input) {
+            serve_remove_input(ctx, i);
+            return;
+        }
+    }
+}
+
+static void serve_release_input(serve_ctx_t *ctx, serve_input_t *input) {
+    pthread_mutex_lock(&ctx->lock);
+    serve_release_input_locked(ctx, input);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+/* Find an input, or add one, taking a reference to it. */
+static serve_input_t *serve_find_input(serve_ctx_t *ctx, const char *path, hactool_type_t type, const struct stat *st, serve_input_t *new_input) {
+    file_stamp_t stamp;
+    get_file_stamp(&stamp, st);
+    for (uint32_t i = 0; i < ctx->num_inputs; i++) {
+        serve_input_t *input = ctx->inputs[i];
+        if (input->is_stale || input->type != type || strcmp(input->path, path)) {
+            continue;
+        }
+        if (!is_same_file_stamp(&input->stamp, &stamp)) {
+            input->is_stale = 1;
+            if (input->refs == 0) {
+                serve_remove_input(ctx, i);
+            }
+            break;
+        }
+        input->last_used = ++ctx->clock;
+        input->refs++;
+        return input;
+    }
+
+    new_input->type = type;
+    new_input->stamp = stamp;
+    new_input->last_used = ++ctx->clock;
+    new_input->refs = 1;
+    ctx->inputs[ctx->num_inputs++] = new_input;
+    serve_evict_inputs(ctx);
+    return new_input;
+}
+
+/* Find or open an input, taking a reference to it. Inputs are opened outside ctx->lock, under their own,
+ * so that a slow open only holds up the requests for that input. */
+static int serve_get_input(serve_ctx_t *ctx, const char *path, hactool_type_t type, serve_input_t **out) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return HACTOOL_ERROR_OPEN;
+    }
+    /* Allocated up front, so that nothing fails with ctx->lock held. */
+    serve_input_t *new_input = calloc(1, sizeof(*new_input));
+    if (new_input == NULL || (new_input->path = strdup(path)) == NULL) {
+        fprintf(stderr, "Failed to allocate input!\n");
+        fatal_exit();
+    }
+    pthread_mutex_init(&new_input->lock, NULL);
+
+    pthread_mutex_lock(&ctx->lock);
+    if (ctx->num_inputs == ctx->max_inputs) {
+        uint32_t max_inputs = ctx->max_inputs ? ctx->max_inputs * 2 : SERVE_MAX_INPUTS * 2;
+        serve_input_t **inputs = realloc(ctx->inputs, max_inputs * sizeof(*ctx->inputs));
+        if (inputs == NULL) {
+            pthread_mutex_unlock(&ctx->lock);
+            fprintf(stderr, "Failed to allocate inputs!\n");
+            fatal_exit();
+        }
+        ctx->inputs = inputs;
+        ctx->max_inputs = max_inputs;
+    }
+    serve_input_t *input = serve_find_input(ctx, path, type, &st, new_input);
+    pthread_mutex_unlock(&ctx->lock);
+    if (input != new_input) {
+        serve_free_input(new_input);
+    }
+
+    pthread_mutex_lock(&input->lock);
+    if (!input->is_opened) {
+        input->result = hactool_open(&input->handle, path, type, &ctx->options);
+        input->is_opened = 1;
+    }
+    int result = input->result;
+    pthread_mutex_unlock(&input->lock);
+    if (result != HACTOOL_OK) {
+        /* Let a later request try again. */
+        pthread_mutex_lock(&ctx->lock);
+        input->is_stale = 1;
+        serve_release_input_locked(ctx, input);
+        pthread_mutex_unlock(&ctx->lock);
+        return result;
+    }
+    *out = input;
+    return HACTOOL_OK;
+}
+
+static const char *serve_section_type_name(hactool_section_type_t type) {
+    switch (type) {
+        case HACTOOL_SECTION_PFS0:
+            return "pfs0";
+        case HACTOOL_SECTION_ROMFS:
+            return "romfs";
+        case HACTOOL_SECTION_BKTR:
+            return "bktr";
+        case HACTOOL_SECTION_HFS0:
+            return "hfs0";
+        case HACTOOL_SECTION_INVALID:
+        default:
+            return "invalid";
+    }
+}
+
+static void serve_print_section(serve_buf_t *out, const char *id, hactool_handle_t *handle, uint32_t section) {
+    hactool_section_info_t info;
+    if (hactool_get_section(handle, section, &info) != HACTOOL_OK) {
+        return;
+    }
+    serve_printf(out, "%s\tsection\t%"PRIu32"\t%"PRIu32"\t%s\t%"PRIu64"\t%"PRIu64"\t%"PRIu32"%s%s\n", id, section, info.index,
+        serve_section_type_name(info.type), info.offset, info.size, info.num_files, info.name ? "\t" : "", info.name ? info.name : "");
+}
+
+static void serve_print_info(serve_buf_t *out, const char *id, hactool_handle_t *handle) {
+    static const char * const type_names[] = {"nca", "xci", "pfs0", "romfs"};
+    hactool_info_t info;
+    hactool_get_info(handle, &info);
+    serve_printf(out, "%s\tinfo\ttype=%s\tsections=%"PRIu32, id, type_names[info.type], info.num_sections);
+    if (info.type == HACTOOL_TYPE_NCA) {
+        serve_printf(out, "\ttitle_id=%016"PRIx64"\tcontent_size=%"PRIu64"\tcontent_type=%u\tdistribution=%u\tmaster_key_revision=%u\tsdk_version=%u.%u.%u.%u",
+            info.title_id, info.content_size, info.content_type, info.distribution, info.master_key_revision,
+            info.sdk_version[0], info.sdk_version[1], info.sdk_version[2], info.sdk_version[3]);
+        if (info.has_rights_id) {
+            serve_printf(out, "\trights_id=");
+            for (unsigned int i = 0; i < 0x10; i++) {
+                serve_printf(out, "%02X", info.rights_id[i]);
+            }
+        }
+    }
+    serve_printf(out, "\n");
+    for (uint32_t i = 0; i < info.num_sections; i++) {
+        serve_print_section(out, id, handle, i);
+    }
+}
+
+static void serve_free_request(serve_ctx_t *ctx, serve_request_t *req) {
+    if (req->f_out != NULL) {
+        /* Unfinished extractions leave nothing behind. */
+        fclose(req->f_out);
+        remove(req->out_path);
+    }
+    if (req->input != NULL) {
+        serve_release_input(ctx, req->input);
+    }
+    serve_free_buf(&req->out);
+    free(req->out_path);
+    free(req->file_path);
+    free(req->path);
+    free(req->id);
+    free(req);
+}
+
+static void serve_finish_request(serve_request_t *req, int result) {
+    if (result == HACTOOL_OK) {
+        if (req->f_out != NULL) {
+            FILE *f_out = req->f_out;
+            req->f_out = NULL;
+            if (fclose(f_out) != 0) {
+                remove(req->out_path);
+                result = HACTOOL_ERROR_IO;
+            }
+        }
+    }
+    if (result == HACTOOL_OK) {
+        if (req->command == SERVE_INFO || req->command == SERVE_LIST) {
+            serve_printf(&req->out, "%s\tok\n", req->id);
+        } else {
+            serve_printf(&req->out, "%s\tok\t%"PRIu64"\n", req->id, req->offset - req->start);
+        }
+    } else {
+        serve_printf(&req->out, "%s\terror\t%s\n", req->id, hactool_error_string(result));
+    }
+    req->is_finished = 1;
+}
+
+/* Set up the byte range of a read or extract to cover the whole file. */
+static int serve_find_file(serve_request_t *req) {
+    int result = hactool_find_file(req->input->handle, req->section, req->file_path, &req->file);
+    if (result != HACTOOL_OK) {
+        return result;
+    }
+    hactool_file_info_t info;
+    if ((result = hactool_get_file(req->input->handle, req->section, req->file, &info)) != HACTOOL_OK) {
+        return result;
+    }
+    req->end = info.size;
+    return HACTOOL_OK;
+}
+
+/* Check a request's arguments against its newly opened input. */
+static int serve_start_request(serve_request_t *req) {
+    hactool_handle_t *handle = req->input->handle;
+    int result = HACTOOL_OK;
+    switch (req->command) {
+        case SERVE_INFO:
+            serve_print_info(&req->out, req->id, handle);
+            break;
+        case SERVE_LIST: {
+            hactool_info_t info;
+            hactool_get_info(handle, &info);
+            if (!req->has_section) {
+                req->end_section = info.num_sections;
+            } else if (req->section < info.num_sections) {
+                req->end_section = req->section + 1;
+            } else {
+                result = HACTOOL_ERROR_ARGUMENT;
+            }
+            break;
+        }
+        case SERVE_READ:
+            if ((result = serve_find_file(req)) != HACTOOL_OK) {
+                break;
+            }
+            req->start = req->offset = req->start < req->end ? req->start : req->end;
+            if (req->size < req->end - req->offset) {
+                req->end = req->offset + req->size;
+            }
+            break;
+        case SERVE_EXTRACT:
+            if ((result = serve_find_file(req)) != HACTOOL_OK) {
+                break;
+            }
+            if ((req->f_out = fopen(req->out_path, "wb")) == NULL) {
+                result = HACTOOL_ERROR_OPEN;
+            }
+            break;
+    }
+    return result;
+}
+
+/* Move one slice of a request's data, within what the step has reserved. */
+static void serve_slice(serve_request_t *req) {
+    hactool_handle_t *handle = req->input->handle;
+    uint64_t chunk = req->reserved;
+    switch (req->command) {
+        case SERVE_INFO:
+            serve_finish_request(req, HACTOOL_OK);
+            break;
+        case SERVE_LIST:
+            while (req->out.len < chunk) {
+                if (req->section >= req->end_section) {
+                    serve_finish_request(req, HACTOOL_OK);
+                    return;
+                }
+                if (!req->is_described) {
+                    serve_print_section(&req->out, req->id, handle, req->section);
+                    req->is_described = 1;
+                }
+                hactool_file_info_t file;
+                if (hactool_get_file(handle, req->section, req->file, &file) == HACTOOL_OK) {
+                    serve_printf(&req->out, "%s\tfile\t%"PRIu32"\t%"PRIu32"\t%"PRIu64"\t%s\n", req->id, req->section, req->file, file.size, file.path);
+                    req->file++;
+                } else {
+                    /* Past the last file; sections that can't be listed were described as having none. */
+                    req->section++;
+                    req->file = 0;
+                    req->is_described = 0;
+                }
+            }
+            break;
+        case SERVE_READ: {
+            uint64_t size = req->end - req->offset;
+            if (size > chunk) size = chunk;
+            if (size == 0) {
+                serve_finish_request(req, HACTOOL_OK);
+                return;
+            }
+            char header[0x200];
+            int header_len = snprintf(header, sizeof(header), "%s\tdata\t%"PRIu64"\n", req->id, size);
+            serve_reserve(&req->out, (size_t)header_len + 1 + (size_t)size);
+            int64_t read = hactool_pread(handle, req->section, req->file, req->out.data + req->out.len + header_len, size, req->offset);
+            if (read < 0 || (uint64_t)read != size) {
+                serve_finish_request(req, read < 0 ? (int)read : HACTOOL_ERROR_IO);
+                return;
+            }
+            memcpy(req->out.data + req->out.len, header, (size_t)header_len);
+            req->out.len += (size_t)header_len + (size_t)size;
+            req->offset += size;
+            break;
+        }
+        case SERVE_EXTRACT: {
+            uint64_t size = req->end - req->offset;
+            if (size > chunk) size = chunk;
+            if (size == 0) {
+                serve_finish_request(req, HACTOOL_OK);
+                return;
+            }
+            /* The step's response buffer holds the data on its way to the file. */
+            serve_reserve(&req->out, (size_t)size);
+            int64_t read = hactool_pread(handle, req->section, req->file, req->out.data, size, req->offset);
+            if (read < 0 || (uint64_t)read != size) {
+                serve_finish_request(req, read < 0 ? (int)read : HACTOOL_ERROR_IO);
+                return;
+            }
+            if (fwrite(req->out.data, 1, (size_t)size, req->f_out) != size) {
+                serve_finish_request(req, HACTOOL_ERROR_IO);
+                return;
+            }
+            req->offset += size;
+            break;
+        }
+    }
+}
+
+/* Run one step of a request on a worker: open its input on the first, then a slice of its work. */
+static void serve_step(serve_ctx_t *ctx, serve_request_t *req) {
+    if (req->input == NULL) {
+        serve_input_t *input;
+        int result = serve_get_input(ctx, req->path, req->type, &input);
+        if (result != HACTOOL_OK) {
+            serve_finish_request(req, result);
+            return;
+        }
+        req->input = input;
+        pthread_mutex_lock(&input->lock);
+        req->is_locked = 1;
+        if ((result = serve_start_request(req)) != HACTOOL_OK) {
+            serve_finish_request(req, result);
+        }
+    } else {
+        pthread_mutex_lock(&req->input->lock);
+        req->is_locked = 1;
+    }
+    if (!req->is_finished) {
+        serve_slice(req);
+    }
+    req->is_locked = 0;
+    pthread_mutex_unlock(&req->input->lock);
+}
+
+static void serve_work(serve_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    while (1) {
+        while (ctx->queue == NULL && !atomic_load(&ctx->stop)) {
+            pthread_cond_wait(&ctx->cond, &ctx->lock);
+        }
+        if (atomic_load(&ctx->stop)) {
+            break;
+        }
+        serve_request_t *req = ctx->queue;
+        ctx->queue = req->next_step;
+        pthread_mutex_unlock(&ctx->lock);
+
+        /* Stop the loop and the other workers on a fatal error, rather than leave them waiting. */
+        jmp_buf trap;
+        jmp_buf *prev = fatal_set_trap(&trap);
+        if (setjmp(trap) == 0) {
+            serve_step(ctx, req);
+            fatal_set_trap(prev);
+        } else {
+            fatal_set_trap(prev);
+            if (req->is_locked) {
+                pthread_mutex_unlock(&req->input->lock);
+            }
+            serve_stop(ctx);
+            fatal_exit();
+        }
+
+        pthread_mutex_lock(&ctx->lock);
+        serve_push_step(&ctx->done, &ctx->done_tail, req);
+        serve_wake(ctx);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+static void serve_reply_error(serve_conn_t *conn, const char *id, const char *message) {
+    serve_printf(&conn->out, "%s\terror\t%s\n", id, message);
+}
+
+static void serve_unlink_request(serve_conn_t *conn, serve_request_t *req) {
+    for (serve_request_t **cur = &conn->requests; *cur != NULL; cur = &(*cur)->next) {
+        if (*cur == req) {
+            *cur = req->next;
+            return;
+        }
+    }
+}
+
+/* Answered now; a running step is freed when it comes back. */
+static void serve_drop_request(serve_ctx_t *ctx, serve_request_t *req) {
+    if (req->is_running) {
+        req->is_cancelled = 1;
+    } else {
+        serve_free_request(ctx, req);
+    }
+}
+
+static void serve_cancel_request(serve_ctx_t *ctx, serve_conn_t *conn, const char *id, const char *target) {
+    for (serve_request_t **cur = &conn->requests; *cur != NULL; cur = &(*cur)->next) {
+        serve_request_t *req = *cur;
+        if (!strcmp(req->id, target)) {
+            *cur = req->next;
+            serve_reply_error(conn, req->id, "Cancelled");
+            serve_drop_request(ctx, req);
+            serve_printf(&conn->out, "%s\tok\n", id);
+            return;
+        }
+    }
+    serve_reply_error(conn, id, "No such request");
+}
+
+/* Queue a step of each of a connection's idle requests, while it holds less than their limit. */
+static void serve_schedule(serve_ctx_t *ctx, serve_conn_t *conn) {
+    if (conn->is_broken) {
+        return;
+    }
+    for (serve_request_t *req = conn->requests; req != NULL; req = req->next) {
+        uint64_t held = serve_pending(conn) + conn->reserved;
+        if (req->is_running || held >= req->limit) {
+            continue;
+        }
+        req->reserved = req->limit - held < SERVE_SLICE ? req->limit - held : SERVE_SLICE;
+        req->is_running = 1;
+        conn->reserved += req->reserved;
+        conn->num_running++;
+        pthread_mutex_lock(&ctx->lock);
+        serve_push_step(&ctx->queue, &ctx->queue_tail, req);
+        pthread_cond_signal(&ctx->cond);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+}
+
+/* Move the output of finished steps to their connections. */
+static void serve_deliver(serve_ctx_t *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    serve_request_t *done = ctx->done;
+    ctx->done = NULL;
+    pthread_mutex_unlock(&ctx->lock);
+
+    while (done != NULL) {
+        serve_request_t *req = done;
+        serve_conn_t *conn = req->conn;
+        done = req->next_step;
+        conn->reserved -= req->reserved;
+        conn->num_running--;
+        req->reserved = 0;
+        req->is_running = 0;
+        if (req->is_cancelled) {
+            serve_free_request(ctx, req);
+            continue;
+        }
+        if (!conn->is_broken && req->out.len) {
+            serve_reserve(&conn->out, req->out.len);
+            memcpy(conn->out.data + conn->out.len, req->out.data, req->out.len);
+            conn->out.len += req->out.len;
+        }
+        /* Between steps, a request holds no buffers. */
+        serve_free_buf(&req->out);
+        if (req->is_finished) {
+            serve_unlink_request(conn, req);
+            serve_free_request(ctx, req);
+        }
+    }
+}
+
+static void serve_handle_line(serve_ctx_t *ctx, serve_conn_t *conn, char *line) {
+    char *fields[8];
+    unsigned int num_fields = 0;
+    for (char *field = line; num_fields < 8; ) {
+        fields[num_fields++] = field;
+        if ((field = strchr(field, '\t')) == NULL) {
+            break;
+        }
+        *field++ = '\0';
+    }
+    const char *id = fields[0];
+    if (num_fields == 1) {
+        if (*id != '\0') {
+            serve_reply_error(conn, id, "Missing command");
+        }
+        return;
+    }
+    const char *command = fields[1];
+
+    if (!strcmp(command, "cancel") && num_fields == 3) {
+        serve_cancel_request(ctx, conn, id, fields[2]);
+        return;
+    }
+    if (!strcmp(command, "limit") && num_fields == 3) {
+        uint64_t limit;
+        if (!serve_parse_u64(fields[2], &limit) || limit < SERVE_MIN_LIMIT) {
+            serve_reply_error(conn, id, "Invalid limit");
+            return;
+        }
+        conn->limit = limit;
+        serve_printf(&conn->out, "%s\tok\n", id);
+        return;
+    }
+
+    enum serve_command cmd;
+    unsigned int min_fields, max_fields;
+    if (!strcmp(command, "info")) {
+        cmd = SERVE_INFO;
+        min_fields = max_fields = 4;
+    } else if (!strcmp(command, "list")) {
+        cmd = SERVE_LIST;
+        min_fields = 4;
+        max_fields = 5;
+    } else if (!strcmp(command, "read")) {
+        cmd = SERVE_READ;
+        min_fields = 6;
+        max_fields = 8;
+    } else if (!strcmp(command, "extract")) {
+        cmd = SERVE_EXTRACT;
+        min_fields = max_fields = 7;
+    } else {
+        serve_reply_error(conn, id, "Unknown command");
+        return;
+    }
+    hactool_type_t type;
+    if (num_fields < min_fields || num_fields > max_fields || !serve_parse_type(fields[2], &type)) {
+        serve_reply_error(conn, id, "Invalid request");
+        return;
+    }
+
+    /* Anything that needs the input is checked by the request's first step. */
+    serve_request_t *req = calloc(1, sizeof(*req));
+    if (req == NULL || (req->id = strdup(id)) == NULL || (req->path = strdup(fields[3])) == NULL) {
+        fprintf(stderr, "Failed to allocate request!\n");
+        fatal_exit();
+    }
+    req->command = cmd;
+    req->conn = conn;
+    req->type = type;
+    req->limit = conn->limit;
+    req->size = UINT64_MAX;
+    int is_valid = 1;
+    switch (cmd) {
+        case SERVE_INFO:
+            break;
+        case SERVE_LIST:
+            if (num_fields == 5) {
+                req->has_section = 1;
+                is_valid = serve_parse_u32(fields[4], &req->section);
+            }
+            break;
+        case SERVE_READ:
+            is_valid = serve_parse_u32(fields[4], &req->section) && (num_fields <= 6 || serve_parse_u64(fields[6], &req->start)) &&
+                       (num_fields <= 7 || serve_parse_u64(fields[7], &req->size));
+            if ((req->file_path = strdup(fields[5])) == NULL) {
+                fprintf(stderr, "Failed to allocate request!\n");
+                fatal_exit();
+            }
+            break;
+        case SERVE_EXTRACT:
+            is_valid = serve_parse_u32(fields[4], &req->section);
+            if ((req->file_path = strdup(fields[5])) == NULL || (req->out_path = strdup(fields[6])) == NULL) {
+                fprintf(stderr, "Failed to allocate request!\n");
+                fatal_exit();
+            }
+            break;
+    }
+    if (!is_valid) {
+        serve_reply_error(conn, id, hactool_error_string(HACTOOL_ERROR_ARGUMENT));
+        serve_free_request(ctx, req);
+        return;
+    }
+    serve_request_t **tail = &conn->requests;
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+    }
+    *tail = req;
+}
+
+static void serve_read_conn(serve_ctx_t *ctx, serve_conn_t *conn) {
+    ssize_t read_size = read(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len);
+    if (read_size < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            conn->is_broken = 1;
+        }
+        return;
+    }
+    if (read_size == 0) {
+        conn->is_eof = 1;
+        return;
+    }
+    conn->in_len += (size_t)read_size;
+
+    size_t pos = 0;
+    char *eol;
+    while ((eol = memchr(conn->in + pos, '\n', conn->in_len - pos)) != NULL) {
+        *eol = '\0';
+        if (eol > conn->in + pos && eol[-1] == '\r') {
+            eol[-1] = '\0';
+        }
+        serve_handle_line(ctx, conn, conn->in + pos);
+        pos = (size_t)(eol - conn->in) + 1;
+    }
+    memmove(conn->in, conn->in + pos, conn->in_len - pos);
+    conn->in_len -= pos;
+    if (conn->in_len == sizeof(conn->in)) {
+        /* No way to tell where the next request starts. */
+        serve_reply_error(conn, "-", "Request too long");
+        conn->in_len = 0;
+        conn->is_eof = 1;
+    }
+}
+
+static void serve_write_conn(serve_conn_t *conn) {
+    ssize_t written = write(conn->fd, conn->out.data + conn->out.pos, serve_pending(conn));
+    if (written < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            conn->is_broken = 1;
+        }
+        return;
+    }
+    conn->out.pos += (size_t)written;
+}
+
+/* Drop a connection's requests, keeping it until the steps it has running are back. */
+static void serve_drop_requests(serve_ctx_t *ctx, serve_conn_t *conn) {
+    while (conn->requests != NULL) {
+        serve_request_t *req = conn->requests;
+        conn->requests = req->next;
+        serve_drop_request(ctx, req);
+    }
+}
+
+static void serve_close_conn(serve_ctx_t *ctx, serve_conn_t *conn) {
+    serve_drop_requests(ctx, conn);
+    close(conn->fd);
+    serve_free_buf(&conn->out);
+    free(conn);
+}
+
+static void serve_accept(serve_ctx_t *ctx) {
+    int fd = accept(ctx->listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    serve_conn_t *conn = calloc(1, sizeof(*conn));
+    if (conn == NULL) {
+        fprintf(stderr, "Failed to allocate connection!\n");
+        fatal_exit();
+    }
+    conn->fd = fd;
+    conn->limit = SERVE_DEFAULT_LIMIT;
+    conn->next = ctx->conns;
+    ctx->conns = conn;
+}
+
+static int serve_listen(serve_ctx_t *ctx) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(ctx->path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long!\n", ctx->path);
+        return 0;
+    }
+    strcpy(addr.sun_path, ctx->path);
+    if ((ctx->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        fprintf(stderr, "Failed to create socket: %s\n", strerror(errno));
+        return 0;
+    }
+    int is_bound = bind(ctx->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    if (!is_bound && errno == EADDRINUSE) {
+        /* Take over the socket of a server that is gone, but not of one still running. */
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        int is_live = probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (is_live) {
+            fprintf(stderr, "%s is in use by another server!\n", ctx->path);
+            close(ctx->listen_fd);
+            return 0;
+        }
+        unlink(ctx->path);
+        is_bound = bind(ctx->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    }
+    if (!is_bound || listen(ctx->listen_fd, 0x10) != 0) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", ctx->path, strerror(errno));
+        close(ctx->listen_fd);
+        return 0;
+    }
+    fcntl(ctx->listen_fd, F_SETFL, fcntl(ctx->listen_fd, F_GETFL) | O_NONBLOCK);
+    return 1;
+}
+
+/* Read requests and write answers for every connection, handing the work to the workers. */
+static void serve_loop(serve_ctx_t *ctx) {
+    jmp_buf trap;
+    jmp_buf *prev = fatal_set_trap(&trap);
+    if (setjmp(trap) != 0) {
+        fatal_set_trap(prev);
+        serve_stop(ctx);
+        fatal_exit();
+    }
+
+    struct pollfd *fds = NULL;
+    serve_conn_t **fd_conns = NULL;
+    uint32_t max_fds = 0;
+    while (!atomic_load(&g_serve_stop) && !atomic_load(&ctx->stop)) {
+        uint32_t num_fds = 2;
+        for (serve_conn_t *conn = ctx->conns; conn != NULL; conn = conn->next) {
+            num_fds++;
+        }
+        if (num_fds > max_fds) {
+            max_fds = num_fds * 2;
+            if ((fds = realloc(fds, max_fds * sizeof(*fds))) == NULL || (fd_conns = realloc(fd_conns, max_fds * sizeof(*fd_conns))) == NULL) {
+                fprintf(stderr, "Failed to allocate connections!\n");
+                fatal_exit();
+            }
+        }
+        fds[0].fd = ctx->listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = ctx->wake_fds[0];
+        fds[1].events = POLLIN;
+        num_fds = 2;
+        for (serve_conn_t *conn = ctx->conns; conn != NULL; conn = conn->next) {
+            /* Broken connections only wait for their running steps, which wake the loop when done. */
+            fds[num_fds].fd = conn->is_broken ? -1 : conn->fd;
+            fds[num_fds].events = (conn->is_eof ? 0 : POLLIN) | (serve_pending(conn) ? POLLOUT : 0);
+            fd_conns[num_fds++] = conn;
+        }
+        if (poll(fds, num_fds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Failed to wait for requests: %s\n", strerror(errno));
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            char drain[0x100];
+            while (read(ctx->wake_fds[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+        serve_deliver(ctx);
+        for (uint32_t i = 2; i < num_fds; i++) {
+            serve_conn_t *conn = fd_conns[i];
+            if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                conn->is_broken = 1;
+            } else {
+                if (fds[i].revents & POLLIN) {
+                    serve_read_conn(ctx, conn);
+                }
+                if (fds[i].revents & POLLOUT) {
+                    serve_write_conn(conn);
+                }
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            serve_accept(ctx);
+        }
+
+        for (serve_conn_t **cur = &ctx->conns; *cur != NULL; ) {
+            serve_conn_t *conn = *cur;
+            if (conn->is_broken) {
+                serve_drop_requests(ctx, conn);
+            }
+            if (conn->num_running == 0 && (conn->is_broken || (conn->is_eof && conn->requests == NULL && !serve_pending(conn)))) {
+                *cur = conn->next;
+                serve_close_conn(ctx, conn);
+            } else {
+                serve_schedule(ctx, conn);
+                cur = &conn->next;
+            }
+        }
+    }
+    free(fds);
+    free(fd_conns);
+    fatal_set_trap(prev);
+    serve_stop(ctx);
+}
+
+static void serve_thread(void *arg) {
+    serve_ctx_t *ctx = arg;
+    if (atomic_fetch_add(&ctx->next_thread, 1) == 0) {
+        serve_loop(ctx);
+    } else {
+        serve_work(ctx);
+    }
+}
+
+/* Free the steps the workers never got to, or that were not delivered; the others are with their connections. */
+static void serve_free_steps(serve_ctx_t *ctx, serve_request_t *req) {
+    while (req != NULL) {
+        serve_request_t *next = req->next_step;
+        req->is_running = 0;
+        if (req->is_cancelled) {
+            serve_free_request(ctx, req);
+        }
+        req = next;
+    }
+}
+
+/* Serve requests on the socket at path until interrupted. */
+int serve_run(hactool_ctx_t *tool_ctx, const char *path) {
+    serve_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.tool_ctx = tool_ctx;
+    ctx.path = path;
+    ctx.num_jobs = tool_ctx->settings.jobs ? tool_ctx->settings.jobs : HACTOOL_DEFAULT_JOBS;
+    ctx.options.use_dev_keys = tool_ctx->settings.use_dev_keys;
+    ctx.options.use_test_keys = tool_ctx->settings.use_test_keys;
+    ctx.options.has_titlekey = tool_ctx->settings.has_titlekey;
+    memcpy(ctx.options.titlekey, tool_ctx->settings.titlekey, sizeof(ctx.options.titlekey));
+    if (pipe(ctx.wake_fds) != 0) {
+        fprintf(stderr, "Failed to create wake pipe: %s\n", strerror(errno));
+        return 0;
+    }
+    for (unsigned int i = 0; i < 2; i++) {
+        fcntl(ctx.wake_fds[i], F_SETFL, fcntl(ctx.wake_fds[i], F_GETFL) | O_NONBLOCK);
+    }
+    if (!serve_listen(&ctx)) {
+        close(ctx.wake_fds[0]);
+        close(ctx.wake_fds[1]);
+        return 0;
+    }
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.cond, NULL);
+    atomic_init(&ctx.next_thread, 0);
+    atomic_init(&ctx.stop, 0);
+
+    g_serve_wake_fd = ctx.wake_fds[1];
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serve_handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+    printf("Serving requests on %s with %"PRIu32" worker(s).\n", path, ctx.num_jobs);
+    fflush(stdout);
+
+    run_workers(ctx.num_jobs + 1, serve_thread, &ctx, &ctx.stop);
+
+    serve_free_steps(&ctx, ctx.queue);
+    serve_free_steps(&ctx, ctx.done);
+    while (ctx.conns != NULL) {
+        serve_conn_t *conn = ctx.conns;
+        ctx.conns = conn->next;
+        serve_close_conn(&ctx, conn);
+    }
+    for (uint32_t i = 0; i < ctx.num_inputs; i++) {
+        serve_free_input(ctx.inputs[i]);
+    }
+    free(ctx.inputs);
+    pthread_cond_destroy(&ctx.cond);
+    pthread_mutex_destroy(&ctx.lock);
+    close(ctx.listen_fd);
+    close(ctx.wake_fds[0]);
+    close(ctx.wake_fds[1]);
+    g_serve_wake_fd = -1;
+    unlink(path);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef HACTOOL_SERVE_H
+#define HACTOOL_SERVE_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include "types.h"
+#include "settings.h"
+#include "hactool.h"
+#include "utils.h"
+
+#define SERVE_MAX_INPUTS 16 /* Opened inputs kept warm. */
+#define SERVE_MAX_LINE 0x4000
+#define SERVE_SLICE 0x100000 /* Most data moved for one request before the others get a turn. */
+#define SERVE_DEFAULT_LIMIT 0x1000000 /* Memory a request may have its connection hold: response data waiting for the client, and the buffers of steps in progress. */
+#define SERVE_MIN_LIMIT 0x1000
+
+/* An opened input, kept until it is the least recently used one of too many. */
+typedef struct {
+    char *path;
+    hactool_type_t type;
+    file_stamp_t stamp; /* When it was first asked for. */
+    hactool_handle_t *handle; /* Opened by the first request for it. */
+    int is_opened;
+    int result; /* Of opening it. */
+    uint64_t last_used;
+    uint32_t refs; /* Requests in progress. */
+    int is_stale; /* Changed on disk; freed once no request uses it. */
+    pthread_mutex_t lock; /* Held while a step uses the handle. */
+} serve_input_t;
+
+typedef struct serve_request serve_request_t;
+typedef struct serve_conn serve_conn_t;
+
+typedef struct {
+    hactool_ctx_t *tool_ctx;
+    hactool_options_t options;
+    const char *path;
+    int listen_fd;
+    int wake_fds[2]; /* Written to when a step finishes, to wake the loop. */
+    serve_input_t **inputs;
+    uint32_t num_inputs;
+    uint32_t max_inputs;
+    uint64_t clock; /* Bumped on every use of an input. */
+    serve_conn_t *conns; /* Only used by the loop. */
+    pthread_mutex_t lock; /* Guards the inputs and both queues of steps. */
+    pthread_cond_t cond; /* Signalled when a step is queued, or on stop. */
+    serve_request_t *queue; /* Steps waiting for a worker, oldest first. */
+    serve_request_t *queue_tail;
+    serve_request_t *done; /* Steps the workers have finished, for the loop to deliver. */
+    serve_request_t *done_tail;
+    uint32_t num_jobs;
+    atomic_uint next_thread; /* The first thread runs the loop, the others steps. */
+    atomic_int stop;
+} serve_ctx_t;
+
+int serve_run(hactool_ctx_t *tool_ctx, const char *path);
+
+#endif
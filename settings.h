@@ -1,12 +1,14 @@
 #ifndef HACTOOL_SETTINGS_H
 #define HACTOOL_SETTINGS_H
 #include <stdio.h>
+#include <stdatomic.h>
 #include "types.h"
 #include "filepath.h"
 
 typedef enum {
     KEYSET_DEV,
-    KEYSET_RETAIL
+    KEYSET_RETAIL,
+    KEYSET_TEST /* For synthetic content only. */
 } keyset_variant_t;
 
 typedef enum {
@@ -36,8 +38,21 @@ typedef struct {
     filepath_t path;
 } override_filepath_t;
 
+typedef enum {
+    VERIFY_TIER_FULL = 0, /* Hash everything. */
+    VERIFY_TIER_QUICK, /* Superblocks and upper hash levels only. */
+    VERIFY_TIER_SAMPLED /* Upper levels, plus a seeded sample of data blocks. */
+} verify_tier_t;
+
+typedef struct {
+    unsigned char rights_id[0x10];
+    unsigned char titlekey[0x10]; /* Still encrypted with the titlekek. */
+} titlekey_entry_t;
+
 typedef struct {
     nca_keyset_t keyset;
+    int use_dev_keys;
+    int use_test_keys;
     int has_titlekey;
     unsigned char titlekey[0x10];
     unsigned char dec_titlekey[0x10];
@@ -58,6 +73,40 @@ typedef struct {
     filepath_t normal_dir_path;
     filepath_t secure_dir_path;
     filepath_t header_path;
+    filepath_t romfs_tar_path;
+    filepath_t pfs0_tar_path;
+    filepath_t hfs0_tar_path;
+    filepath_t manifest_path;
+    filepath_t nca_dir_path;
+    filepath_t corruption_map_path;
+    filepath_t verify_cache_path;
+    int refresh_verify_cache;
+    filepath_t catalog_dir_path;
+    filepath_t serve_path;
+    filepath_t watch_dir_path;
+    filepath_t watch_catalog_path;
+    uint32_t watch_jobs;
+    uint32_t shard_index;
+    uint32_t shard_count;
+    filepath_t merge_path;
+    int print_stats;
+    filepath_t trace_path;
+    filepath_t build_romfs_dir_path;
+    uint32_t build_jobs;
+    uint32_t jobs;
+    filepath_t build_cache_path;
+    filepath_t ivfc_header_path;
+    filepath_t pack_exefs_dir_path;
+    filepath_t pack_romfs_path;
+    uint64_t pack_title_id;
+    uint32_t pack_key_generation;
+    int has_pack_content_type;
+    uint8_t pack_content_type;
+    filepath_t pack_sign_key_path;
+    filepath_t pack_pfs0_path;
+    verify_tier_t verify_tier;
+    uint32_t sample_percent;
+    uint64_t sample_seed;
 } hactool_settings_t;
 
 enum hactool_file_type
@@ -67,6 +116,7 @@ enum hactool_file_type
     FILETYPE_ROMFS,
     FILETYPE_HFS0,
     FILETYPE_XCI,
+    FILETYPE_NSP,
     /* FILETYPE_PACKAGE2, */
     /* FILETYPE_PACKAGE1, */
 };
@@ -76,8 +126,22 @@ enum hactool_file_type
 #define ACTION_VERIFY (1<<2)
 #define ACTION_RAW (1<<3)
 #define ACTION_LISTROMFS (1<<4)
+#define ACTION_DECRYPT_IN_PLACE (1<<5)
+
+#define HACTOOL_DEFAULT_JOBS 4 /* Threads for work on several NCAs at once, unless --jobs says otherwise. */
+#define HACTOOL_MAX_JOBS 64
+
+/* What went wrong while processing an input, for callers that need more than the printed report. */
+typedef struct hactool_results {
+    atomic_uint num_errors; /* Inputs, or parts of them, that couldn't be parsed. */
+    atomic_uint num_failed_checks; /* Signatures and hashes that didn't match. */
+} hactool_results_t;
 
 struct nca_ctx; /* This will get re-defined by nca.h. */
+struct tar_ctx; /* This will get re-defined by tar.h. */
+struct manifest_ctx; /* This will get re-defined by manifest.h. */
+struct corruption_ctx; /* This will get re-defined by corruption.h. */
+struct vcache_ctx; /* This will get re-defined by vcache.h. */
 
 typedef struct {
     enum hactool_file_type file_type;
@@ -85,6 +149,15 @@ typedef struct {
     FILE *base_file;
     hactool_basefile_t base_file_type;
     struct nca_ctx *base_nca_ctx;
+    struct tar_ctx *romfs_tar; /* Archive for RomFS extraction, if used. */
+    struct tar_ctx *pfs0_tar; /* Archive for PFS0 extraction, if used. */
+    struct tar_ctx *hfs0_tar; /* Archive for HFS0 extraction, if used. */
+    struct manifest_ctx *manifest; /* Hash manifest of extracted files, if used. */
+    struct corruption_ctx *corruption; /* Map of failing hash blocks, if used. */
+    struct vcache_ctx *vcache; /* Persistent verification results, if used. */
+    hactool_results_t *results; /* Shared with nested contexts, if used. */
+    titlekey_entry_t *titlekeys; /* Title keys read from tickets, if any. */
+    uint32_t num_titlekeys;
     hactool_settings_t settings;
     uint32_t action;
 } hactool_ctx_t;
@@ -3,6 +3,7 @@
 #include "sha.h"
 #include "types.h"
 #include "utils.h"
+#include "stats.h"
 
 /* Allocate new context. */
 sha_ctx_t *new_sha_ctx(hash_type_t type, int hmac) {
@@ -38,7 +39,10 @@ void free_sha_ctx(sha_ctx_t *ctx) {
 
 /* Update digest with new data. */
 void sha_update(sha_ctx_t *ctx, const void *data, size_t l) {
+    stats_span_t span;
+    stats_begin(&span);
     mbedtls_md_update(&ctx->digest, data, l);
+    stats_end(&span, STATS_SHA256, l);
 }
 
 /* Read hash from context. */
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shard.h"
+#include "catalog.h"
+#include "watch.h"
+#include "utils.h"
+
+/* Batch work is split between machines by a stable hash of each input's path, relative to the folder
+ * being processed, so every machine sharing the storage agrees on who handles what without talking to
+ * the others. Each shard's results go to its own file, which says which shard it holds; a shard that
+ * failed is simply run again, and --merge combines the files once all shards are there. */
+
+int shard_parse(uint32_t *index, uint32_t *count, const char *spec) {
+    char *end;
+    unsigned long i = strtoul(spec, &end, 10);
+    if (end == spec || *end != '/') {
+        return 0;
+    }
+    const char *count_str = end + 1;
+    unsigned long n = strtoul(count_str, &end, 10);
+    if (end == count_str || *end != '\0' || n == 0 || n > SHARD_MAX_COUNT || i == 0 || i > n) {
+        return 0;
+    }
+    *index = (uint32_t)i;
+    *count = (uint32_t)n;
+    return 1;
+}
+
+int shard_contains(uint32_t index, uint32_t count, const char *key) {
+    if (count == 0) {
+        return 1;
+    }
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (; *key; key++) {
+        hash = (hash ^ (uint8_t)*key) * 0x100000001B3ULL;
+    }
+    return hash % count == index - 1;
+}
+
+void shard_format_header(char *out, size_t out_size, const char *signature, uint32_t index, uint32_t count) {
+    if (count == 0) {
+        snprintf(out, out_size, "%s", signature);
+    } else {
+        snprintf(out, out_size, "%s shard %"PRIu32"/%"PRIu32, signature, index, count);
+    }
+}
+
+int shard_parse_header(const char *line, const char *signature, uint32_t *index, uint32_t *count) {
+    size_t len = strlen(signature);
+    if (strncmp(line, signature, len)) {
+        return 0;
+    }
+    line += len;
+    *index = *count = 0;
+    if (*line == '\0' || *line == '\n' || *line == '\r') {
+        return 1;
+    }
+    if (strncmp(line, " shard ", 7)) {
+        return 0;
+    }
+    char spec[0x20];
+    snprintf(spec, sizeof(spec), "%.*s", (int)strcspn(line + 7, "\r\n"), line + 7);
+    return shard_parse(index, count, spec);
+}
+
+/* Make sure a result file is for the shard being run, so that shards can't be mixed up. */
+int shard_check_header(const char *path, const char *line, const char *signature, uint32_t index, uint32_t count) {
+    uint32_t file_index, file_count;
+    if (!shard_parse_header(line, signature, &file_index, &file_count)) {
+        return 0;
+    }
+    if (file_index == index && file_count == count) {
+        return 1;
+    }
+    if (file_count == 0) {
+        fprintf(stderr, "%s holds unsharded results, not shard %"PRIu32"/%"PRIu32"!\n", path, index, count);
+    } else if (count == 0) {
+        fprintf(stderr, "%s holds shard %"PRIu32"/%"PRIu32"; use --shard, or --merge it with the other shards.\n", path, file_index, file_count);
+    } else {
+        fprintf(stderr, "%s holds shard %"PRIu32"/%"PRIu32", not %"PRIu32"/%"PRIu32"!\n", path, file_index, file_count, index, count);
+    }
+    return 0;
+}
+
+int shard_merge(hactool_ctx_t *tool_ctx, const char *out_path, char **paths, unsigned int num_paths) {
+    static const char * const signatures[2] = {CATALOG_SIGNATURE, WATCH_LOG_SIGNATURE};
+    unsigned int kind = 0;
+    uint32_t count = 0;
+    uint8_t *seen = NULL;
+    int result = 1;
+
+    for (unsigned int i = 0; i < num_paths && result; i++) {
+        char line[0x100];
+        FILE *f = fopen(paths[i], "r");
+        if (f == NULL) {
+            fprintf(stderr, "Failed to open %s!\n", paths[i]);
+            result = 0;
+            break;
+        }
+        if (fgets(line, sizeof(line), f) == NULL) {
+            line[0] = '\0';
+        }
+        fclose(f);
+
+        uint32_t file_index, file_count;
+        unsigned int file_kind;
+        for (file_kind = 0; file_kind < 2; file_kind++) {
+            if (shard_parse_header(line, signatures[file_kind], &file_index, &file_count)) {
+                break;
+            }
+        }
+        if (file_kind == 2) {
+            fprintf(stderr, "%s is neither a catalog nor a watch log!\n", paths[i]);
+            result = 0;
+        } else if (file_count == 0) {
+            fprintf(stderr, "%s does not hold the results of a shard!\n", paths[i]);
+            result = 0;
+        } else if (i == 0) {
+            kind = file_kind;
+            count = file_count;
+            if ((seen = calloc(count, 1)) == NULL) {
+                fprintf(stderr, "Failed to allocate shard list!\n");
+                fatal_exit();
+            }
+        } else if (file_kind != kind || file_count != count) {
+            fprintf(stderr, "%s does not belong with %s!\n", paths[i], paths[0]);
+            result = 0;
+        }
+        if (result) {
+            if (seen[file_index - 1]) {
+                fprintf(stderr, "Shard %"PRIu32"/%"PRIu32" is given twice!\n", file_index, file_count);
+                result = 0;
+            }
+            seen[file_index - 1] = 1;
+        }
+    }
+    for (uint32_t i = 0; i < count && result; i++) {
+        if (!seen[i]) {
+            fprintf(stderr, "Shard %"PRIu32"/%"PRIu32" is missing!\n", i + 1, count);
+            result = 0;
+        }
+    }
+    free(seen);
+    if (!result) {
+        return 0;
+    }
+
+    if (kind == 0) {
+        return catalog_merge(tool_ctx, out_path, paths, num_paths);
+    }
+    return watch_merge(out_path, paths, num_paths);
+}
@@ -0,0 +1,22 @@
+#ifndef HACTOOL_SHARD_H
+#define HACTOOL_SHARD_H
+
+#include <stddef.h>
+#include "types.h"
+#include "settings.h"
+
+#define SHARD_MAX_COUNT 0x10000
+
+/* A shard is index/count; a count of 0 means the work is not sharded. */
+int shard_parse(uint32_t *index, uint32_t *count, const char *spec);
+int shard_contains(uint32_t index, uint32_t count, const char *key);
+
+/* Result files start with a signature line, followed by " shard <index>/<count>" for partial results. */
+void shard_format_header(char *out, size_t out_size, const char *signature, uint32_t index, uint32_t count);
+int shard_parse_header(const char *line, const char *signature, uint32_t *index, uint32_t *count);
+int shard_check_header(const char *path, const char *line, const char *signature, uint32_t index, uint32_t count);
+
+/* Combine the partial results of every shard into out_path. */
+int shard_merge(hactool_ctx_t *tool_ctx, const char *out_path, char **paths, unsigned int num_paths);
+
+#endif
@@ -0,0 +1,171 @@
+#ifdef __linux__
+#define _GNU_SOURCE /* For fopencookie. */
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "splitfile.h"
+#include "utils.h"
+
+/* Dumps from FAT32 media come in parts of up to 4 GB. Supported namings:
+ *   dir/00, dir/01, ...         (NSP archive folders)
+ *   name.xc0, name.xc1, ...     (XCI, likewise .ns0 for NSP)
+ *   name.00, name.01, ... */
+
+static int split_is_dir(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* Build the path of part i, returning 0 if the path does not follow a split naming scheme. */
+static int split_get_part_path(char *out, size_t out_size, const char *path, uint32_t i) {
+    size_t len = strlen(path);
+    if (split_is_dir(path)) {
+        snprintf(out, out_size, "%s/%02"PRIu32, path, i);
+        return 1;
+    }
+    if (len >= 4 && path[len-1] == '0' && (!strcmp(path + len - 4, ".xc0") || !strcmp(path + len - 4, ".ns0"))) {
+        if (i >= 10) {
+            return 0;
+        }
+        snprintf(out, out_size, "%.*s%"PRIu32, (int)(len - 1), path, i);
+        return 1;
+    }
+    if (len >= 3 && !strcmp(path + len - 3, ".00")) {
+        snprintf(out, out_size, "%.*s%02"PRIu32, (int)(len - 2), path, i);
+        return 1;
+    }
+    return 0;
+}
+
+/* A path is split if it is a folder, or if its second part exists. */
+int split_is_split_input(const char *path) {
+    char part_path[MAX_PATH];
+    if (split_is_dir(path)) {
+        return 1;
+    }
+    if (!split_get_part_path(part_path, sizeof(part_path), path, 1)) {
+        return 0;
+    }
+    struct stat st;
+    return stat(part_path, &st) == 0;
+}
+
+/* Every read is positional: map the logical offset to a part, and continue into the next one at boundaries. */
+static size_t split_read_at(split_file_t *ctx, char *buf, size_t size) {
+    size_t total = 0;
+    while (total < size && ctx->pos < ctx->offsets[ctx->num_parts]) {
+        uint32_t lo = 0, hi = ctx->num_parts - 1;
+        while (lo < hi) {
+            uint32_t mid = (lo + hi + 1) / 2;
+            if (ctx->offsets[mid] <= ctx->pos) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        uint64_t avail = ctx->offsets[lo + 1] - ctx->pos;
+        size_t n = size - total;
+        if (n > avail) n = (size_t)avail;
+        fseeko64(ctx->files[lo], ctx->pos - ctx->offsets[lo], SEEK_SET);
+        size_t read = fread(buf + total, 1, n, ctx->files[lo]);
+        total += read;
+        ctx->pos += read;
+        if (read != n) {
+            break;
+        }
+    }
+    return total;
+}
+
+static int split_seek_to(split_file_t *ctx, int64_t offset, int whence) {
+    int64_t base = 0;
+    if (whence == SEEK_CUR) {
+        base = (int64_t)ctx->pos;
+    } else if (whence == SEEK_END) {
+        base = (int64_t)ctx->offsets[ctx->num_parts];
+    }
+    if (base + offset < 0) {
+        return -1;
+    }
+    ctx->pos = (uint64_t)(base + offset);
+    return 0;
+}
+
+static int split_close(void *cookie) {
+    split_file_t *ctx = cookie;
+    for (uint32_t i = 0; i < ctx->num_parts; i++) {
+        fclose(ctx->files[i]);
+    }
+    free(ctx);
+    return 0;
+}
+
+#ifdef __linux__
+static ssize_t split_cookie_read(void *cookie, char *buf, size_t size) {
+    return (ssize_t)split_read_at(cookie, buf, size);
+}
+
+static int split_cookie_seek(void *cookie, off64_t *offset, int whence) {
+    if (split_seek_to(cookie, *offset, whence) != 0) {
+        return -1;
+    }
+    *offset = (off64_t)((split_file_t *)cookie)->pos;
+    return 0;
+}
+#elif !defined(_WIN32)
+static int split_cookie_read(void *cookie, char *buf, int size) {
+    return (int)split_read_at(cookie, buf, (size_t)size);
+}
+
+static fpos_t split_cookie_seek(void *cookie, fpos_t offset, int whence) {
+    if (split_seek_to(cookie, offset, whence) != 0) {
+        return -1;
+    }
+    return (fpos_t)((split_file_t *)cookie)->pos;
+}
+#endif
+
+/* Open an input file for reading, presenting split dumps as a single file. */
+FILE *split_fopen(const char *path) {
+    if (!split_is_split_input(path)) {
+        return fopen(path, "rb");
+    }
+
+    split_file_t *ctx = calloc(1, sizeof(*ctx));
+    if (ctx == NULL) {
+        fprintf(stderr, "Failed to allocate split file context!\n");
+        fatal_exit();
+    }
+    char part_path[MAX_PATH];
+    while (ctx->num_parts < SPLIT_MAX_PARTS && split_get_part_path(part_path, sizeof(part_path), path, ctx->num_parts)) {
+        FILE *f = fopen(part_path, "rb");
+        if (f == NULL) {
+            break;
+        }
+        /* The joined stream does its own buffering. */
+        setvbuf(f, NULL, _IONBF, 0);
+        ctx->files[ctx->num_parts] = f;
+        ctx->offsets[ctx->num_parts + 1] = ctx->offsets[ctx->num_parts] + _fsize(part_path);
+        ctx->num_parts++;
+    }
+    if (ctx->num_parts == 0) {
+        free(ctx);
+        return NULL;
+    }
+#ifdef __linux__
+    cookie_io_functions_t funcs = {split_cookie_read, NULL, split_cookie_seek, split_close};
+    FILE *f = fopencookie(ctx, "rb", funcs);
+#elif !defined(_WIN32)
+    FILE *f = funopen(ctx, split_cookie_read, NULL, split_cookie_seek, split_close);
+#else
+    /* No way to hand a custom stream to the stdio-based readers here. */
+    FILE *f = NULL;
+    fprintf(stderr, "Split input files are not supported on this platform!\n");
+#endif
+    if (f == NULL) {
+        split_close(ctx);
+    }
+    return f;
+}
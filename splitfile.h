@@ -0,0 +1,20 @@
+#ifndef HACTOOL_SPLITFILE_H
+#define HACTOOL_SPLITFILE_H
+
+#include <stdio.h>
+#include "types.h"
+
+#define SPLIT_MAX_PARTS 100
+
+/* One logical file made of consecutive parts. */
+typedef struct {
+    FILE *files[SPLIT_MAX_PARTS];
+    uint64_t offsets[SPLIT_MAX_PARTS + 1]; /* Logical start of each part; the last entry is the total size. */
+    uint32_t num_parts;
+    uint64_t pos;
+} split_file_t;
+
+int split_is_split_input(const char *path);
+FILE *split_fopen(const char *path);
+
+#endif
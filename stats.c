@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+#include "stats.h"
+#include "utils.h"
+
+/* Each thread counts into its own block, so the hot paths never share a cache line or take a lock.
+ * Blocks are linked into a global list when first used, and kept after their thread exits, so that
+ * the totals still cover work done by threads that are gone. */
+
+static atomic_int g_stats_enabled;
+static _Atomic(stats_thread_t *) g_stats_threads;
+static _Thread_local stats_thread_t *t_stats_thread;
+static _Thread_local stats_scope_t t_stats_scope = {STATS_PHASE_OTHER, STATS_NO_SECTION};
+
+static const char * const g_stats_counter_names[STATS_MAX_COUNTER] = {"read", "aes", "sha256", "write", "mkdir"};
+static const char * const g_stats_phase_names[STATS_MAX_PHASE] = {"other", "header", "verify", "pass", "save"};
+
+void stats_enable(int enable) {
+    atomic_store_explicit(&g_stats_enabled, enable, memory_order_relaxed);
+}
+
+int stats_is_enabled(void) {
+    return atomic_load_explicit(&g_stats_enabled, memory_order_relaxed);
+}
+
+uint64_t stats_now_ns(void) {
+#ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)((double)count.QuadPart * 1000000000.0 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static stats_thread_t *stats_get_thread(void) {
+    if (t_stats_thread == NULL) {
+        stats_thread_t *thread = calloc(1, sizeof(*thread));
+        if (thread == NULL) {
+            fprintf(stderr, "Failed to allocate performance counters!\n");
+            fatal_exit();
+        }
+        thread->next = atomic_load(&g_stats_threads);
+        while (!atomic_compare_exchange_weak(&g_stats_threads, &thread->next, thread)) {
+        }
+        t_stats_thread = thread;
+    }
+    return t_stats_thread;
+}
+
+void stats_begin(stats_span_t *span) {
+    if (!stats_is_enabled()) {
+        span->thread = NULL;
+        return;
+    }
+    span->thread = stats_get_thread();
+    span->nested_ns = span->thread->nested_ns;
+    span->start_ns = stats_now_ns();
+}
+
+void stats_end(stats_span_t *span, stats_counter_t counter, uint64_t bytes) {
+    stats_thread_t *thread = span->thread;
+    if (thread == NULL) {
+        return;
+    }
+    uint64_t elapsed = stats_now_ns() - span->start_ns;
+    uint64_t nested = thread->nested_ns - span->nested_ns;
+    stats_total_t *total = &thread->totals[t_stats_scope.phase][t_stats_scope.section][counter];
+    total->calls++;
+    total->bytes += bytes;
+    total->ns += elapsed > nested ? elapsed - nested : 0;
+    /* Operations enclosing this one only count the time not already counted here. */
+    thread->nested_ns = span->nested_ns + elapsed;
+}
+
+stats_scope_t stats_enter(stats_phase_t phase, unsigned int section) {
+    stats_scope_t previous = t_stats_scope;
+    t_stats_scope.phase = phase;
+    t_stats_scope.section = section < STATS_NO_SECTION ? section : STATS_NO_SECTION;
+    return previous;
+}
+
+void stats_leave(stats_scope_t scope) {
+    t_stats_scope = scope;
+}
+
+void stats_collect(stats_total_t totals[STATS_MAX_PHASE][STATS_NO_SECTION + 1][STATS_MAX_COUNTER]) {
+    memset(totals, 0, sizeof(stats_total_t) * STATS_MAX_PHASE * (STATS_NO_SECTION + 1) * STATS_MAX_COUNTER);
+    for (stats_thread_t *thread = atomic_load(&g_stats_threads); thread != NULL; thread = thread->next) {
+        for (unsigned int p = 0; p < STATS_MAX_PHASE; p++) {
+            for (unsigned int s = 0; s <= STATS_NO_SECTION; s++) {
+                for (unsigned int c = 0; c < STATS_MAX_COUNTER; c++) {
+                    totals[p][s][c].calls += thread->totals[p][s][c].calls;
+                    totals[p][s][c].bytes += thread->totals[p][s][c].bytes;
+                    totals[p][s][c].ns += thread->totals[p][s][c].ns;
+                }
+            }
+        }
+    }
+}
+
+void stats_reset(void) {
+    for (stats_thread_t *thread = atomic_load(&g_stats_threads); thread != NULL; thread = thread->next) {
+        memset(thread->totals, 0, sizeof(thread->totals));
+    }
+}
+
+/* Peak resident memory of the process, in bytes, or 0 where unknown. */
+uint64_t stats_peak_memory(void) {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 0x400;
+#endif
+#endif
+}
+
+const char *stats_counter_name(stats_counter_t counter) {
+    return counter < STATS_MAX_COUNTER ? g_stats_counter_names[counter] : "?";
+}
+
+static void stats_print_row(FILE *f, const char *phase, const char *section, stats_counter_t counter, const stats_total_t *total) {
+    double ms = (double)total->ns / 1000000.0;
+    fprintf(f, "%-8s %-8s %-7s %10"PRIu64" %14"PRIu64" %11.3f", phase, section, stats_counter_name(counter), total->calls, total->bytes, ms);
+    if (counter != STATS_MKDIR && total->ns != 0) {
+        fprintf(f, " %10.1f\n", (double)total->bytes / (double)0x100000 / ((double)total->ns / 1000000000.0));
+    } else {
+        fprintf(f, " %10s\n", "-");
+    }
+}
+
+void stats_print(FILE *f, uint64_t wall_ns) {
+    static stats_total_t totals[STATS_MAX_PHASE][STATS_NO_SECTION + 1][STATS_MAX_COUNTER];
+    stats_total_t sums[STATS_MAX_COUNTER];
+    stats_collect(totals);
+    memset(sums, 0, sizeof(sums));
+
+    fprintf(f, "Performance counters:\n");
+    fprintf(f, "%-8s %-8s %-7s %10s %14s %11s %10s\n", "Phase", "Section", "Counter", "Calls", "Bytes", "Time (ms)", "MB/s");
+    for (unsigned int p = 0; p < STATS_MAX_PHASE; p++) {
+        for (unsigned int s = 0; s <= STATS_NO_SECTION; s++) {
+            char section[0x10];
+            if (s == STATS_NO_SECTION) {
+                snprintf(section, sizeof(section), "-");
+            } else {
+                snprintf(section, sizeof(section), "%u", s);
+            }
+            for (unsigned int c = 0; c < STATS_MAX_COUNTER; c++) {
+                stats_total_t *total = &totals[p][s][c];
+                if (total->calls == 0) {
+                    continue;
+                }
+                stats_print_row(f, g_stats_phase_names[p], section, (stats_counter_t)c, total);
+                sums[c].calls += total->calls;
+                sums[c].bytes += total->bytes;
+                sums[c].ns += total->ns;
+            }
+        }
+    }
+    for (unsigned int c = 0; c < STATS_MAX_COUNTER; c++) {
+        if (sums[c].calls != 0) {
+            stats_print_row(f, "total", "-", (stats_counter_t)c, &sums[c]);
+        }
+    }
+
+    fprintf(f, "Wall time:   %.3f ms\n", (double)wall_ns / 1000000.0);
+    uint64_t peak = stats_peak_memory();
+    if (peak != 0) {
+        fprintf(f, "Peak memory: %.1f MB\n", (double)peak / (double)0x100000);
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef HACTOOL_STATS_H
+#define HACTOOL_STATS_H
+
+#include <stdio.h>
+#include "types.h"
+
+typedef enum {
+    STATS_READ = 0,
+    STATS_AES = 1,
+    STATS_SHA256 = 2,
+    STATS_WRITE = 3,
+    STATS_MKDIR = 4,
+    STATS_MAX_COUNTER = 5
+} stats_counter_t;
+
+typedef enum {
+    STATS_PHASE_OTHER = 0,
+    STATS_PHASE_HEADER = 1, /* Decrypting the NCA header and working out its keys. */
+    STATS_PHASE_VERIFY = 2, /* Parsing and checking sections. */
+    STATS_PHASE_PASS = 3, /* Setting up and running the single read of an NCA shared by verification and extraction. */
+    STATS_PHASE_SAVE = 4,
+    STATS_MAX_PHASE = 5
+} stats_phase_t;
+
+#define STATS_NO_SECTION 4 /* Work not tied to one NCA section. */
+
+typedef struct {
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t ns; /* Excluding time spent in other counted operations, e.g. AES done within a read. */
+} stats_total_t;
+
+typedef struct stats_thread {
+    stats_total_t totals[STATS_MAX_PHASE][STATS_NO_SECTION + 1][STATS_MAX_COUNTER];
+    uint64_t nested_ns; /* Time counted so far by the current thread. */
+    struct stats_thread *next;
+} stats_thread_t;
+
+typedef struct {
+    stats_thread_t *thread; /* NULL when counting is off. */
+    uint64_t start_ns;
+    uint64_t nested_ns;
+} stats_span_t;
+
+typedef struct {
+    stats_phase_t phase;
+    unsigned int section;
+} stats_scope_t;
+
+/* Counting is off until enabled, and costs a single check per operation while off. */
+void stats_enable(int enable);
+int stats_is_enabled(void);
+
+/* Count one operation, from stats_begin to stats_end, against the current thread's scope. */
+void stats_begin(stats_span_t *span);
+void stats_end(stats_span_t *span, stats_counter_t counter, uint64_t bytes);
+
+/* Returns the previous scope, to be restored with stats_leave. */
+stats_scope_t stats_enter(stats_phase_t phase, unsigned int section);
+void stats_leave(stats_scope_t scope);
+
+/* Sum the counters of every thread. They should be idle, or the totals may be slightly off. */
+void stats_collect(stats_total_t totals[STATS_MAX_PHASE][STATS_NO_SECTION + 1][STATS_MAX_COUNTER]);
+void stats_reset(void);
+
+uint64_t stats_now_ns(void);
+uint64_t stats_peak_memory(void);
+const char *stats_counter_name(stats_counter_t counter);
+
+void stats_print(FILE *f, uint64_t wall_ns);
+
+#endif
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+#include "tar.h"
+#include "manifest.h"
+#include "stats.h"
+
+#define TAR_MAX_OCTAL_SIZE 077777777777ULL
+#define TAR_NAME_SIZE 100
+#define TAR_PREFIX_SIZE 155
+
+/* Normalize a hactool path into a relative, '/'-separated archive path. */
+static void tar_normalize_path(char *dst, const char *src, int is_dir) {
+    while (*src == '/' || *src == '\\') {
+        src++;
+    }
+    size_t len = 0;
+    for (; *src && len < MAX_PATH; src++) {
+        dst[len++] = (*src == '\\') ? '/' : *src;
+    }
+    if (is_dir && len < MAX_PATH && (len == 0 || dst[len-1] != '/')) {
+        dst[len++] = '/';
+    }
+    dst[len] = '\0';
+}
+
+/* Find where a long name can be split between the ustar prefix and name fields. */
+static const char *tar_find_split(const char *name) {
+    size_t name_len = strlen(name);
+    if (name_len <= TAR_NAME_SIZE) {
+        return NULL;
+    }
+    for (const char *p = name; *p && (size_t)(p - name) <= TAR_PREFIX_SIZE; p++) {
+        if (*p == '/' && p[1] != '\0' && name_len - (size_t)(p - name) - 1 <= TAR_NAME_SIZE) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static void tar_write_octal(char *field, size_t field_size, uint64_t value) {
+    snprintf(field, field_size, "%0*"PRIo64, (int)(field_size - 1), value);
+}
+
+static void tar_write_block(tar_ctx_t *ctx, const void *data, size_t size) {
+    stats_span_t span;
+    stats_begin(&span);
+    if (fwrite(data, 1, size, ctx->file) != size) {
+        fprintf(stderr, "Failed to write to %s!\n", ctx->path);
+        fatal_exit();
+    }
+    stats_end(&span, STATS_WRITE, size);
+}
+
+static void tar_write_padding(tar_ctx_t *ctx, uint64_t size) {
+    static const char zeroes[TAR_BLOCK_SIZE];
+    uint64_t padding = align64(size, TAR_BLOCK_SIZE) - size;
+    if (padding) {
+        tar_write_block(ctx, zeroes, padding);
+    }
+}
+
+static void tar_write_header(tar_ctx_t *ctx, const char *name, char typeflag, uint64_t size) {
+    tar_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+
+    /* Names that fit in ustar are split into prefix/name; anything else is carried by a pax record. */
+    const char *split = tar_find_split(name);
+    if (split != NULL) {
+        memcpy(hdr.prefix, name, split - name);
+        memcpy(hdr.name, split + 1, strlen(split + 1));
+    } else {
+        memcpy(hdr.name, name, strlen(name) < sizeof(hdr.name) ? strlen(name) : sizeof(hdr.name));
+    }
+
+    tar_write_octal(hdr.mode, sizeof(hdr.mode), typeflag == '5' ? 0755 : 0644);
+    tar_write_octal(hdr.uid, sizeof(hdr.uid), 0);
+    tar_write_octal(hdr.gid, sizeof(hdr.gid), 0);
+    tar_write_octal(hdr.size, sizeof(hdr.size), size > TAR_MAX_OCTAL_SIZE ? 0 : size);
+    tar_write_octal(hdr.mtime, sizeof(hdr.mtime), ctx->mtime);
+    hdr.typeflag = typeflag;
+    memcpy(hdr.magic, "ustar", 6);
+    memcpy(hdr.version, "00", 2);
+
+    /* Checksum is computed with the checksum field set to spaces. */
+    memset(hdr.checksum, ' ', sizeof(hdr.checksum));
+    uint32_t checksum = 0;
+    for (unsigned int i = 0; i < sizeof(hdr); i++) {
+        checksum += ((unsigned char *)&hdr)[i];
+    }
+    snprintf(hdr.checksum, sizeof(hdr.checksum), "%06"PRIo32, checksum);
+    hdr.checksum[7] = ' ';
+
+    tar_write_block(ctx, &hdr, sizeof(hdr));
+}
+
+static size_t tar_append_pax_record(char *out, size_t out_ofs, const char *key, const char *value) {
+    /* Record length includes its own decimal representation. */
+    size_t payload = 1 + strlen(key) + 1 + strlen(value) + 1;
+    size_t len = payload + 1;
+    while (len < payload + snprintf(NULL, 0, "%zu", len)) {
+        len++;
+    }
+    sprintf(out + out_ofs, "%zu %s=%s\n", len, key, value);
+    return out_ofs + len;
+}
+
+static void tar_write_entry_header(tar_ctx_t *ctx, const char *name, char typeflag, uint64_t size) {
+    int needs_pax = size > TAR_MAX_OCTAL_SIZE || (strlen(name) > TAR_NAME_SIZE && tar_find_split(name) == NULL);
+
+    if (needs_pax) {
+        char records[MAX_PATH + 0x80];
+        char size_str[0x20];
+        size_t records_size = 0;
+        records_size = tar_append_pax_record(records, records_size, "path", name);
+        if (size > TAR_MAX_OCTAL_SIZE) {
+            snprintf(size_str, sizeof(size_str), "%"PRIu64, size);
+            records_size = tar_append_pax_record(records, records_size, "size", size_str);
+        }
+        tar_write_header(ctx, "././@PaxHeader", 'x', records_size);
+        tar_write_block(ctx, records, records_size);
+        tar_write_padding(ctx, records_size);
+    }
+
+    tar_write_header(ctx, name, typeflag, size);
+    ctx->num_entries++;
+}
+
+/* Open an archive for writing. A path of "-" streams to stdout, moving regular output to stderr. */
+int tar_open(tar_ctx_t *ctx, const char *path) {
+    memset(ctx, 0, sizeof(*ctx));
+
+    if (!strcmp(path, "-")) {
+        fflush(stdout);
+#ifdef _WIN32
+        int out_fd = _dup(_fileno(stdout));
+        _setmode(out_fd, _O_BINARY);
+        _dup2(_fileno(stderr), _fileno(stdout));
+#else
+        int out_fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+#endif
+        if (out_fd < 0 || (ctx->file = fdopen(out_fd, "wb")) == NULL) {
+            fprintf(stderr, "Failed to open stdout for archive output!\n");
+            return 0;
+        }
+    } else if ((ctx->file = fopen(path, "wb")) == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", path);
+        return 0;
+    }
+
+    ctx->path = strdup(path);
+    ctx->buffer = malloc(TAR_BUFFER_SIZE);
+    if (ctx->path == NULL || ctx->buffer == NULL) {
+        fprintf(stderr, "Failed to allocate archive buffer!\n");
+        fatal_exit();
+    }
+    setvbuf(ctx->file, ctx->buffer, _IOFBF, TAR_BUFFER_SIZE);
+    ctx->mtime = (uint64_t)time(NULL);
+    return 1;
+}
+
+/* Write the end-of-archive marker and release the archive. */
+void tar_close(tar_ctx_t *ctx) {
+    if (ctx->file == NULL) {
+        return;
+    }
+
+    static const char zeroes[TAR_BLOCK_SIZE * 2];
+    tar_write_block(ctx, zeroes, sizeof(zeroes));
+    if (fclose(ctx->file) != 0) {
+        fprintf(stderr, "Failed to finish %s!\n", ctx->path);
+        fatal_exit();
+    }
+    free(ctx->buffer);
+    free(ctx->path);
+    ctx->file = NULL;
+}
+
+void tar_add_directory(tar_ctx_t *ctx, const char *path) {
+    char name[MAX_PATH + 2];
+    tar_normalize_path(name, path, 1);
+    if (name[0] == '/' && name[1] == '\0') {
+        /* Archive root has no entry. */
+        return;
+    }
+    tar_write_entry_header(ctx, name, '5', 0);
+}
+
+/* Start a regular file member; exactly size bytes must be written to ctx->file before tar_end_file. */
+void tar_begin_file(tar_ctx_t *ctx, const char *path, uint64_t size) {
+    tar_normalize_path(ctx->cur_name, path, 0);
+    tar_write_entry_header(ctx, ctx->cur_name, '0', size);
+    ctx->cur_size = size;
+}
+
+void tar_end_file(tar_ctx_t *ctx) {
+    tar_write_padding(ctx, ctx->cur_size);
+    ctx->cur_size = 0;
+}
+
+void tar_save_file_section(tar_ctx_t *ctx, FILE *f_in, uint64_t ofs, uint64_t total_size, const char *path, manifest_ctx_t *manifest) {
+    unsigned char hash[0x20];
+    tar_begin_file(ctx, path, total_size);
+    copy_file_section(f_in, ofs, total_size, ctx->file, manifest != NULL ? hash : NULL);
+    manifest_add(manifest, ctx->cur_name, total_size, hash);
+    tar_end_file(ctx);
+}
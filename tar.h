@@ -0,0 +1,53 @@
+#ifndef HACTOOL_TAR_H
+#define HACTOOL_TAR_H
+
+#include <stdio.h>
+#include "types.h"
+#include "utils.h"
+
+#define TAR_BLOCK_SIZE 0x200
+#define TAR_BUFFER_SIZE 0x400000 /* 4 MB of stdio buffering for the archive. */
+
+/* POSIX ustar header. */
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char _0x1F4[0xC];
+} tar_header_t;
+
+typedef struct tar_ctx {
+    FILE *file;
+    char *buffer;
+    char *path;
+    uint64_t mtime;
+    uint64_t cur_size; /* Size of the member currently being written. */
+    uint64_t num_entries;
+    char cur_name[MAX_PATH + 2]; /* Archive path of the member currently being written. */
+} tar_ctx_t;
+
+int tar_open(tar_ctx_t *ctx, const char *path);
+void tar_close(tar_ctx_t *ctx);
+
+void tar_add_directory(tar_ctx_t *ctx, const char *path);
+void tar_begin_file(tar_ctx_t *ctx, const char *path, uint64_t size);
+void tar_end_file(tar_ctx_t *ctx);
+
+struct manifest_ctx;
+
+void tar_save_file_section(tar_ctx_t *ctx, FILE *f_in, uint64_t ofs, uint64_t total_size, const char *path, struct manifest_ctx *manifest);
+
+#endif
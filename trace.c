@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#ifdef _WIN32
+#include <process.h>
+#define trace_getpid _getpid
+#else
+#include <unistd.h>
+#define trace_getpid getpid
+#endif
+#include "trace.h"
+#include "stats.h"
+#include "utils.h"
+
+/* Spans are kept in memory until the end of the run, in a buffer per thread, so recording one is
+ * a clock read and an append. Buffers are linked into a global list when first used, like the
+ * performance counters, and written out together as a Chrome trace (chrome://tracing, Perfetto). */
+
+static atomic_int g_trace_enabled;
+static uint64_t g_trace_origin_ns;
+static _Atomic(trace_thread_t *) g_trace_threads;
+static atomic_uint g_trace_num_threads;
+static atomic_uint g_trace_next_async_id;
+static _Thread_local trace_thread_t *t_trace_thread;
+
+void trace_enable(void) {
+    g_trace_origin_ns = stats_now_ns();
+    atomic_store(&g_trace_enabled, 1);
+}
+
+int trace_is_enabled(void) {
+    return atomic_load_explicit(&g_trace_enabled, memory_order_relaxed);
+}
+
+static trace_thread_t *trace_get_thread(void) {
+    if (t_trace_thread == NULL) {
+        trace_thread_t *thread = calloc(1, sizeof(*thread));
+        if (thread == NULL) {
+            fprintf(stderr, "Failed to allocate trace buffer!\n");
+            fatal_exit();
+        }
+        thread->id = atomic_fetch_add(&g_trace_num_threads, 1) + 1;
+        thread->next = atomic_load(&g_trace_threads);
+        while (!atomic_compare_exchange_weak(&g_trace_threads, &thread->next, thread)) {
+        }
+        t_trace_thread = thread;
+    }
+    return t_trace_thread;
+}
+
+void trace_begin(trace_span_t *span) {
+    if (!trace_is_enabled()) {
+        span->thread = NULL;
+        return;
+    }
+    span->thread = trace_get_thread();
+    span->start_ns = stats_now_ns();
+}
+
+static void trace_add(trace_span_t *span, const char *name, int section, uint32_t async_id, const char *detail_format, va_list args) {
+    trace_thread_t *thread = span->thread;
+    uint64_t end_ns = stats_now_ns();
+    if (thread->num_events == thread->max_events) {
+        uint32_t max_events = thread->max_events ? thread->max_events * 2 : 0x400;
+        trace_event_t *events = realloc(thread->events, max_events * sizeof(*events));
+        if (events == NULL) {
+            fprintf(stderr, "Failed to allocate trace buffer!\n");
+            fatal_exit();
+        }
+        thread->events = events;
+        thread->max_events = max_events;
+    }
+
+    trace_event_t *event = &thread->events[thread->num_events++];
+    event->name = name;
+    event->detail = NULL;
+    event->start_ns = span->start_ns;
+    event->duration_ns = end_ns - span->start_ns;
+    event->section = section;
+    event->async_id = async_id;
+    if (detail_format != NULL) {
+        char detail[MAX_PATH + 0x40];
+        vsnprintf(detail, sizeof(detail), detail_format, args);
+        if ((event->detail = malloc(strlen(detail) + 1)) == NULL) {
+            fprintf(stderr, "Failed to allocate trace buffer!\n");
+            fatal_exit();
+        }
+        strcpy(event->detail, detail);
+    }
+}
+
+void trace_end(trace_span_t *span, const char *name, int section, const char *detail_format, ...) {
+    if (span->thread == NULL) {
+        return;
+    }
+    va_list args;
+    va_start(args, detail_format);
+    trace_add(span, name, section, 0, detail_format, args);
+    va_end(args);
+}
+
+void trace_end_async(trace_span_t *span, const char *name, int section, const char *detail_format, ...) {
+    if (span->thread == NULL) {
+        return;
+    }
+    va_list args;
+    va_start(args, detail_format);
+    trace_add(span, name, section, atomic_fetch_add(&g_trace_next_async_id, 1) + 1, detail_format, args);
+    va_end(args);
+}
+
+static void trace_write_string(FILE *f, const char *str) {
+    fputc('"', f);
+    for (; *str; str++) {
+        unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\') {
+            fprintf(f, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/* Timestamps are in microseconds since tracing was enabled. */
+static void trace_write_time(FILE *f, uint64_t ns) {
+    fprintf(f, "%"PRIu64".%03"PRIu64, ns / 1000, ns % 1000);
+}
+
+static void trace_write_args(FILE *f, const trace_event_t *event) {
+    fprintf(f, ",\"args\":{");
+    if (event->section != TRACE_NO_SECTION) {
+        fprintf(f, "\"section\":%"PRId32"%s", event->section, event->detail != NULL ? "," : "");
+    }
+    if (event->detail != NULL) {
+        fprintf(f, "\"detail\":");
+        trace_write_string(f, event->detail);
+    }
+    fprintf(f, "}");
+}
+
+static void trace_write_event(FILE *f, const trace_event_t *event, long pid, uint32_t tid) {
+    uint64_t start_ns = event->start_ns - g_trace_origin_ns;
+    if (event->async_id == 0) {
+        fprintf(f, ",\n{\"name\":");
+        trace_write_string(f, event->name);
+        fprintf(f, ",\"cat\":\"hactool\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%"PRIu32",\"ts\":", pid, tid);
+        trace_write_time(f, start_ns);
+        fprintf(f, ",\"dur\":");
+        trace_write_time(f, event->duration_ns);
+        trace_write_args(f, event);
+        fprintf(f, "}");
+        return;
+    }
+    /* Overlapping spans are written as async begin and end pairs, which get their own tracks. */
+    fprintf(f, ",\n{\"name\":");
+    trace_write_string(f, event->name);
+    fprintf(f, ",\"cat\":\"hactool\",\"ph\":\"b\",\"id\":%"PRIu32",\"pid\":%ld,\"tid\":%"PRIu32",\"ts\":", event->async_id, pid, tid);
+    trace_write_time(f, start_ns);
+    trace_write_args(f, event);
+    fprintf(f, "},\n{\"name\":");
+    trace_write_string(f, event->name);
+    fprintf(f, ",\"cat\":\"hactool\",\"ph\":\"e\",\"id\":%"PRIu32",\"pid\":%ld,\"tid\":%"PRIu32",\"ts\":", event->async_id, pid, tid);
+    trace_write_time(f, start_ns + event->duration_ns);
+    fprintf(f, "}");
+}
+
+int trace_write(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", path);
+        return 0;
+    }
+
+    long pid = (long)trace_getpid();
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,\"args\":{\"name\":\"hactool\"}}", pid);
+    for (trace_thread_t *thread = atomic_load(&g_trace_threads); thread != NULL; thread = thread->next) {
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%"PRIu32",\"args\":{\"name\":\"thread %"PRIu32"\"}}", pid, thread->id, thread->id);
+        for (uint32_t i = 0; i < thread->num_events; i++) {
+            trace_write_event(f, &thread->events[i], pid, thread->id);
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    int failed = ferror(f);
+    if (fclose(f) != 0 || failed) {
+        fprintf(stderr, "Failed to write %s!\n", path);
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,43 @@
+#ifndef HACTOOL_TRACE_H
+#define HACTOOL_TRACE_H
+
+#include "types.h"
+
+#define TRACE_NO_SECTION -1
+
+typedef struct {
+    const char *name; /* A string literal. */
+    char *detail; /* NULL if none. */
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    int32_t section;
+    uint32_t async_id; /* Non-zero for spans that may overlap others on their thread. */
+} trace_event_t;
+
+typedef struct trace_thread {
+    trace_event_t *events;
+    uint32_t num_events;
+    uint32_t max_events;
+    uint32_t id;
+    struct trace_thread *next;
+} trace_thread_t;
+
+typedef struct {
+    trace_thread_t *thread; /* NULL when tracing is off. */
+    uint64_t start_ns;
+} trace_span_t;
+
+/* Tracing is off until enabled, and costs a single check per span while off. */
+void trace_enable(void);
+int trace_is_enabled(void);
+
+/* Record a span from trace_begin to trace_end. detail_format is printf-style, or NULL; it is
+ * only formatted when tracing. Spans on one thread must nest, unless ended with trace_end_async. */
+void trace_begin(trace_span_t *span);
+void trace_end(trace_span_t *span, const char *name, int section, const char *detail_format, ...);
+void trace_end_async(trace_span_t *span, const char *name, int section, const char *detail_format, ...);
+
+/* Write every thread's spans to path, in Chrome trace-event format. */
+int trace_write(const char *path);
+
+#endif
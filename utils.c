@@ -1,12 +1,115 @@
+#ifdef __linux__
+#define _GNU_SOURCE /* For fallocate. */
+#endif
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #ifdef _WIN32
 #include <direct.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 #include "utils.h"
+#include "settings.h"
 #include "filepath.h"
 #include "sha.h"
+#include "stats.h"
+#include "trace.h"
+#include "manifest.h"
+
+static _Thread_local jmp_buf *fatal_trap;
+
+void fatal_exit(void) {
+    if (fatal_trap != NULL) {
+        longjmp(*fatal_trap, 1);
+    }
+    exit(EXIT_FAILURE);
+}
+
+/* Returns the previous trap, for restoring once the trapped call is over. */
+jmp_buf *fatal_set_trap(jmp_buf *trap) {
+    jmp_buf *prev = fatal_trap;
+    fatal_trap = trap;
+    return prev;
+}
+
+typedef struct {
+    void (*worker)(void *arg);
+    void *arg;
+    atomic_int *stop;
+    atomic_int has_failed;
+} workers_ctx_t;
+
+static void *run_worker(void *arg) {
+    workers_ctx_t *ctx = arg;
+    jmp_buf trap;
+    fatal_set_trap(&trap);
+    if (setjmp(trap) == 0) {
+        ctx->worker(ctx->arg);
+    } else {
+        atomic_store(&ctx->has_failed, 1);
+        if (ctx->stop != NULL) {
+            atomic_store(ctx->stop, 1);
+        }
+    }
+    fatal_set_trap(NULL);
+    return NULL;
+}
+
+/* Run worker(arg) on num_threads threads and wait for all of them. A fatal error on one sets *stop, for the
+ * others to give up early, and is raised again on the calling thread, where a trap can catch it. */
+void run_workers(uint32_t num_threads, void (*worker)(void *arg), void *arg, atomic_int *stop) {
+    if (num_threads <= 1) {
+        if (num_threads == 1) {
+            worker(arg);
+        }
+        return;
+    }
+    workers_ctx_t ctx;
+    ctx.worker = worker;
+    ctx.arg = arg;
+    ctx.stop = stop;
+    atomic_init(&ctx.has_failed, 0);
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    if (threads == NULL) {
+        fprintf(stderr, "Failed to allocate worker threads!\n");
+        fatal_exit();
+    }
+    uint32_t num_started = 0;
+    for (; num_started < num_threads; num_started++) {
+        if (pthread_create(&threads[num_started], NULL, run_worker, &ctx) != 0) {
+            fprintf(stderr, "Failed to start worker thread!\n");
+            atomic_store(&ctx.has_failed, 1);
+            if (stop != NULL) {
+                atomic_store(stop, 1);
+            }
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < num_started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    if (atomic_load(&ctx.has_failed)) {
+        fatal_exit();
+    }
+}
+
+/* Both take NULL, for callers that don't keep results. */
+void results_add_error(hactool_results_t *results) {
+    if (results != NULL) {
+        atomic_fetch_add(&results->num_errors, 1);
+    }
+}
+
+void results_add_check(hactool_results_t *results, validity_t validity) {
+    if (results != NULL && validity == VALIDITY_INVALID) {
+        atomic_fetch_add(&results->num_failed_checks, 1);
+    }
+}
 
 uint32_t align(uint32_t offset, uint32_t alignment) {
     uint32_t mask = ~(alignment-1);
@@ -58,38 +161,209 @@ void memdump(FILE *f, const char *prefix, const void *data, size_t size) {
     }
 }
 
-void save_file_section(FILE *f_in, uint64_t ofs, uint64_t total_size, filepath_t *filepath) {
-    FILE *f_out = os_fopen(filepath->os_path, OS_MODE_WRITE);
+/* Check whether a buffer is entirely zero. Word-at-a-time, so the compiler can vectorize it. */
+int is_zero_block(const void *data, size_t size) {
+    const unsigned char *p = data;
+    uint64_t acc = 0;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, p + i, sizeof(word));
+        acc |= word;
+    }
+    for (; i < size; i++) {
+        acc |= p[i];
+    }
+    return acc == 0;
+}
 
-    if (f_out == NULL) {
-        fprintf(stderr, "Failed to open %s!\n", filepath->char_path);
-        return;
+static size_t fwrite_sparse_blocks(const void *data, size_t size, uint64_t file_ofs, FILE *f) {
+#ifdef _WIN32
+    /* NTFS files must be explicitly marked sparse, so just write the zeroes. */
+    return fwrite(data, 1, size, f);
+#else
+    const unsigned char *p = data;
+    size_t done = 0;
+    while (done < size) {
+        size_t n = SPARSE_BLOCK_SIZE - (size_t)((file_ofs + done) % SPARSE_BLOCK_SIZE);
+        if (n > size - done) n = size - done;
+        int is_hole = n == SPARSE_BLOCK_SIZE && is_zero_block(p + done, n);
+
+        /* Coalesce runs of the same kind into a single seek or write. */
+        while (done + n + SPARSE_BLOCK_SIZE <= size && is_zero_block(p + done + n, SPARSE_BLOCK_SIZE) == is_hole) {
+            n += SPARSE_BLOCK_SIZE;
+        }
+        if (is_hole) {
+            if (fseeko64(f, n, SEEK_CUR) != 0) {
+                return done;
+            }
+        } else if (fwrite(p + done, 1, n, f) != n) {
+            return done;
+        }
+        done += n;
     }
+    return done;
+#endif
+}
+
+/* Write data that lands at file_ofs, seeking over aligned all-zero blocks so they become holes. */
+/* The file's length must be set with finish_sparse_file once everything is written. */
+size_t fwrite_sparse(const void *data, size_t size, uint64_t file_ofs, FILE *f) {
+    stats_span_t span;
+    stats_begin(&span);
+    size_t written = fwrite_sparse_blocks(data, size, file_ofs, f);
+    stats_end(&span, STATS_WRITE, written);
+    return written;
+}
 
+/* Set a sparse file's length to size, its known total, in case it ends in a hole. */
+/* Sections aren't always written in order, so where the last write stopped is no guide. */
+int finish_sparse_file(FILE *f, uint64_t size) {
+    if (fflush(f) != 0) {
+        return 0;
+    }
+#ifdef _WIN32
+    return _chsize_s(_fileno(f), (__int64)size) == 0;
+#else
+    return ftruncate(fileno(f), (off_t)size) == 0;
+#endif
+}
+
+uint64_t _fsize(const char *filename) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(filename, &st) != 0) {
+        return 0;
+    }
+#else
+    struct stat st;
+    if (stat(filename, &st) != 0) {
+        return 0;
+    }
+#endif
+    return (uint64_t)st.st_size;
+}
+
+/* Whether two paths name the same existing file, through links or different spellings. */
+int is_same_file(const char *path, const char *other_path) {
+#ifdef _WIN32
+    /* Windows has no inode numbers to compare, so compare full paths instead. */
+    char full_path[MAX_PATH], other_full_path[MAX_PATH];
+    if (_fullpath(full_path, path, sizeof(full_path)) == NULL || _fullpath(other_full_path, other_path, sizeof(other_full_path)) == NULL) {
+        return !strcmp(path, other_path);
+    }
+    return !_stricmp(full_path, other_full_path);
+#else
+    struct stat st, other_st;
+    if (stat(path, &st) != 0 || stat(other_path, &other_st) != 0) {
+        return 0;
+    }
+    return st.st_dev == other_st.st_dev && st.st_ino == other_st.st_ino;
+#endif
+}
+
+void get_file_stamp(file_stamp_t *stamp, const file_stat_t *st) {
+    stamp->size = (uint64_t)st->st_size;
+    stamp->inode = (uint64_t)st->st_ino;
+#if defined(_WIN32)
+    stamp->mtime_ns = (int64_t)st->st_mtime * 1000000000;
+    stamp->ctime_ns = (int64_t)st->st_ctime * 1000000000;
+#elif defined(__APPLE__)
+    stamp->mtime_ns = (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+    stamp->ctime_ns = (int64_t)st->st_ctimespec.tv_sec * 1000000000 + st->st_ctimespec.tv_nsec;
+#else
+    stamp->mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+    stamp->ctime_ns = (int64_t)st->st_ctim.tv_sec * 1000000000 + st->st_ctim.tv_nsec;
+#endif
+}
+
+int is_same_file_stamp(const file_stamp_t *a, const file_stamp_t *b) {
+    return a->size == b->size && a->inode == b->inode && a->mtime_ns == b->mtime_ns && a->ctime_ns == b->ctime_ns;
+}
+
+/* Flush a file all the way to stable storage. */
+int fsync_file(FILE *f) {
+    if (fflush(f) != 0) {
+        return 0;
+    }
+#ifdef _WIN32
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+}
+
+/* Reserve space for a file that is about to be written, to keep large outputs contiguous. */
+void preallocate_file(FILE *f, uint64_t size) {
+#ifdef __linux__
+    /* Unlike posix_fallocate, this never falls back to writing zeroes on filesystems without support. */
+    if (size >= PREALLOCATE_MIN_SIZE) {
+        fallocate(fileno(f), FALLOC_FL_KEEP_SIZE, 0, (off_t)size);
+    }
+#else
+    (void)f;
+    (void)size;
+#endif
+}
+
+/* Copy a section of f_in to f_out, optionally hashing the data on its way out. */
+void copy_file_section(FILE *f_in, uint64_t ofs, uint64_t total_size, FILE *f_out, unsigned char *hash) {
     uint64_t read_size = 0x400000; /* 4 MB buffer. */
     unsigned char *buf = malloc(read_size);
     if (buf == NULL) {
         fprintf(stderr, "Failed to allocate file-save buffer!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     memset(buf, 0xCC, read_size); /* Debug in case I fuck this up somehow... */
+    sha_ctx_t *sha_ctx = hash != NULL ? new_sha_ctx(HASH_TYPE_SHA256, 0) : NULL;
     uint64_t end_ofs = ofs + total_size;
+    stats_span_t span;
     fseeko64(f_in, ofs, SEEK_SET);
     while (ofs < end_ofs) {       
         if (ofs + read_size >= end_ofs) read_size = end_ofs - ofs;
+        stats_begin(&span);
         if (fread(buf, 1, read_size, f_in) != read_size) {
             fprintf(stderr, "Failed to read file!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
-        fwrite(buf, 1, read_size, f_out);
+        stats_end(&span, STATS_READ, read_size);
+        if (sha_ctx != NULL) {
+            sha_update(sha_ctx, buf, read_size);
+        }
+        stats_begin(&span);
+        if (fwrite(buf, 1, read_size, f_out) != read_size) {
+            fprintf(stderr, "Failed to write file!\n");
+            fatal_exit();
+        }
+        stats_end(&span, STATS_WRITE, read_size);
         ofs += read_size;
     }
 
-    fclose(f_out);
-
+    if (sha_ctx != NULL) {
+        sha_get_hash(sha_ctx, hash);
+        free_sha_ctx(sha_ctx);
+    }
     free(buf);
 }
 
+void save_file_section(FILE *f_in, uint64_t ofs, uint64_t total_size, filepath_t *filepath, manifest_ctx_t *manifest) {
+    trace_span_t span;
+    trace_begin(&span);
+    FILE *f_out = os_fopen(filepath->os_path, OS_MODE_WRITE);
+
+    if (f_out == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", filepath->char_path);
+        return;
+    }
+
+    unsigned char hash[0x20];
+    copy_file_section(f_in, ofs, total_size, f_out, manifest != NULL ? hash : NULL);
+    manifest_add(manifest, filepath->char_path, total_size, hash);
+
+    fclose(f_out);
+    trace_end(&span, "extract file", TRACE_NO_SECTION, "%s", filepath->char_path);
+}
+
 
 validity_t check_memory_hash_table(FILE *f_in, unsigned char *hash_table, uint64_t data_ofs, uint64_t data_len, uint64_t block_size, int full_block) {
     if (block_size == 0) {
@@ -101,7 +375,7 @@ validity_t check_memory_hash_table(FILE *f_in, unsigned char *hash_table, uint64
     unsigned char *block = malloc(block_size);
     if (block == NULL) {
         fprintf(stderr, "Failed to allocate hash block!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     validity_t result = VALIDITY_VALID;
@@ -116,7 +390,7 @@ validity_t check_memory_hash_table(FILE *f_in, unsigned char *hash_table, uint64
         
         if (fread(block, 1, read_size, f_in) != read_size) {
             fprintf(stderr, "Failed to read file!\n");
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }        
         sha256_hash_buffer(cur_hash, block, full_block ? block_size : read_size);
         if (memcmp(cur_hash, cur_hash_table_entry, 0x20) != 0) {
@@ -142,13 +416,13 @@ validity_t check_file_hash_table(FILE *f_in, uint64_t hash_ofs, uint64_t data_of
     unsigned char *hash_table = malloc(hash_table_size);
     if (hash_table == NULL) {
         fprintf(stderr, "Failed to allocate hash table!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     fseeko64(f_in, hash_ofs, SEEK_SET);
     if (fread(hash_table, 1, hash_table_size, f_in) != hash_table_size) {
         fprintf(stderr, "Failed to read file!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
 
     validity_t result = check_memory_hash_table(f_in, hash_table, data_ofs, data_len, block_size, full_block);
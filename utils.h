@@ -3,9 +3,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
 #include "types.h"
 
 struct filepath;
+struct manifest_ctx;
+struct hactool_results;
 
 #ifdef _WIN32
 #define PATH_SEPERATOR '\\'
@@ -15,6 +20,9 @@ struct filepath;
 
 #define MEDIA_SIZE 0x200
 
+#define SPARSE_BLOCK_SIZE 0x1000 /* Granularity of holes in sparse output files. */
+#define PREALLOCATE_MIN_SIZE 0x100000 /* Smaller outputs aren't worth reserving space for. */
+
 /* On the switch, paths are limited to 0x300. Limit them to 0x400 - 1 on PC. */
 /* MAX_PATH is previously defined in "windef.h" on WIN32. */
 #ifndef MAX_PATH
@@ -23,19 +31,51 @@ struct filepath;
 
 #define FATAL_ERROR(msg) do {\
     fprintf(stderr, "Error: %s\n", msg);\
-    exit(EXIT_FAILURE);\
+    fatal_exit();\
 } while (0)
 
+#ifdef _WIN32
+typedef struct _stat64 file_stat_t;
+#else
+typedef struct stat file_stat_t;
+#endif
+
+/* What a file looked like when it was read, to tell whether it has changed since. */
+typedef struct {
+    uint64_t size;
+    uint64_t inode;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+} file_stamp_t;
+
+/* Fatal errors exit the process, unless the calling thread has set a trap for them (see hactool.c). */
+_Noreturn void fatal_exit(void);
+jmp_buf *fatal_set_trap(jmp_buf *trap);
+void run_workers(uint32_t num_threads, void (*worker)(void *arg), void *arg, atomic_int *stop);
+
 uint32_t align(uint32_t offset, uint32_t alignment);
 uint64_t align64(uint64_t offset, uint64_t alignment);
 
+void results_add_error(struct hactool_results *results);
+void results_add_check(struct hactool_results *results, validity_t validity);
+
 void print_magic(const char *prefix, uint32_t magic);
 
 void memdump(FILE *f, const char *prefix, const void *data, size_t size);
 
 uint64_t _fsize(const char *filename);
+int is_same_file(const char *path, const char *other_path);
+void get_file_stamp(file_stamp_t *stamp, const file_stat_t *st);
+int is_same_file_stamp(const file_stamp_t *a, const file_stamp_t *b);
+
+int is_zero_block(const void *data, size_t size);
+size_t fwrite_sparse(const void *data, size_t size, uint64_t file_ofs, FILE *f);
+int finish_sparse_file(FILE *f, uint64_t size);
+int fsync_file(FILE *f);
+void preallocate_file(FILE *f, uint64_t size);
 
-void save_file_section(FILE *f_in, uint64_t ofs, uint64_t total_size, struct filepath *filepath);
+void copy_file_section(FILE *f_in, uint64_t ofs, uint64_t total_size, FILE *f_out, unsigned char *hash);
+void save_file_section(FILE *f_in, uint64_t ofs, uint64_t total_size, struct filepath *filepath, struct manifest_ctx *manifest);
 
 validity_t check_memory_hash_table(FILE *f_in, unsigned char *hash_table, uint64_t data_ofs, uint64_t data_len, uint64_t block_size, int full_block);
 validity_t check_file_hash_table(FILE *f_in, uint64_t hash_ofs, uint64_t data_ofs, uint64_t data_len, uint64_t block_size, int full_block);
@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#define vcache_getpid _getpid
+#else
+#include <unistd.h>
+#include <sys/file.h>
+#define vcache_getpid getpid
+#endif
+#include "vcache.h"
+#include "sha.h"
+#include "utils.h"
+
+/* The cache file is a vcache_header_t followed by records, the first num_sorted of them sorted by key.
+ * It is read whole at startup. On exit, a run appends only the entries it added or touched, with one
+ * write and sync under an exclusive lock. Once the appended tail outgrows the sorted part, the run
+ * compacts the file instead, dropping stale entries and replacing it through a temporary file. */
+
+#ifdef _WIN32
+typedef struct _stat64 vcache_stat_t;
+#define vcache_fstat(f, st) _fstat64(_fileno(f), st)
+#define vcache_truncate(f, size) _chsize_s(_fileno(f), (__int64)(size))
+#else
+typedef struct stat vcache_stat_t;
+#define vcache_fstat(f, st) fstat(fileno(f), st)
+#define vcache_truncate(f, size) ftruncate(fileno(f), (off_t)(size))
+#endif
+
+static int vcache_compare_keys(const void *a, const void *b) {
+    return memcmp(a, b, sizeof(vcache_key_t));
+}
+
+/* Orders copies of one key most recently used first. */
+static int vcache_compare_entries(const void *a, const void *b) {
+    const vcache_entry_t *x = a;
+    const vcache_entry_t *y = b;
+    int cmp = vcache_compare_keys(&x->key, &y->key);
+    if (cmp) {
+        return cmp;
+    }
+    return (x->last_used < y->last_used) - (x->last_used > y->last_used);
+}
+
+static void vcache_grow(vcache_ctx_t *ctx, uint32_t num_entries) {
+    if (num_entries <= ctx->max_entries) {
+        return;
+    }
+    ctx->max_entries = ctx->max_entries ? ctx->max_entries : 0x100;
+    while (ctx->max_entries < num_entries) {
+        ctx->max_entries *= 2;
+    }
+    if ((ctx->entries = realloc(ctx->entries, ctx->max_entries * sizeof(vcache_entry_t))) == NULL ||
+        (ctx->is_pending = realloc(ctx->is_pending, ctx->max_entries)) == NULL) {
+        fprintf(stderr, "Failed to allocate verification cache!\n");
+        fatal_exit();
+    }
+}
+
+static void vcache_add(vcache_ctx_t *ctx, const vcache_entry_t *entry) {
+    vcache_grow(ctx, ctx->num_entries + 1);
+    memcpy(&ctx->entries[ctx->num_entries], entry, sizeof(*entry));
+    ctx->is_pending[ctx->num_entries++] = 0;
+}
+
+static void vcache_mark_pending(vcache_ctx_t *ctx, uint32_t index) {
+    if (!ctx->is_pending[index]) {
+        ctx->is_pending[index] = 1;
+        ctx->num_pending++;
+    }
+}
+
+/* Sorts the entries, keeping only the most recently used copy of each key. */
+static void vcache_sort(vcache_ctx_t *ctx) {
+    qsort(ctx->entries, ctx->num_entries, sizeof(vcache_entry_t), vcache_compare_entries);
+    uint32_t num_unique = 0;
+    for (uint32_t i = 0; i < ctx->num_entries; i++) {
+        if (num_unique > 0 && !vcache_compare_keys(&ctx->entries[num_unique - 1].key, &ctx->entries[i].key)) {
+            continue;
+        }
+        if (num_unique != i) {
+            memcpy(&ctx->entries[num_unique], &ctx->entries[i], sizeof(vcache_entry_t));
+        }
+        ctx->is_pending[num_unique++] = 0;
+    }
+    ctx->num_entries = ctx->num_sorted = num_unique;
+    ctx->num_pending = 0;
+}
+
+/* Drops entries unused for VCACHE_MAX_AGE, and those for older contents of the same place on disk. */
+static void vcache_evict(vcache_ctx_t *ctx) {
+    uint32_t num_kept = 0;
+    for (uint32_t i = 0; i < ctx->num_entries; i++) {
+        const vcache_entry_t *entry = &ctx->entries[i];
+        if (entry->last_used + VCACHE_MAX_AGE < ctx->now) {
+            continue;
+        }
+        if (num_kept > 0 && !memcmp(&ctx->entries[num_kept - 1].key, &entry->key, offsetof(vcache_key_t, size))) {
+            vcache_entry_t *kept = &ctx->entries[num_kept - 1];
+            if (entry->last_used > kept->last_used || (entry->last_used == kept->last_used && entry->key.mtime_ns > kept->key.mtime_ns)) {
+                memcpy(kept, entry, sizeof(*entry));
+            }
+            continue;
+        }
+        if (num_kept != i) {
+            memcpy(&ctx->entries[num_kept], entry, sizeof(*entry));
+        }
+        num_kept++;
+    }
+    ctx->num_entries = ctx->num_sorted = num_kept;
+}
+
+/* Returns 1 for a cache, 0 for an empty, truncated or outdated one, and -1 for anything else.
+ * Leaves f just past the header. */
+static int vcache_read_header(FILE *f, vcache_header_t *header, uint64_t *num_records) {
+    memset(header, 0, sizeof(*header));
+    *num_records = 0;
+    vcache_stat_t st;
+    if (vcache_fstat(f, &st) != 0 || fseek(f, 0, SEEK_SET) != 0) {
+        return -1;
+    }
+    if (st.st_size == 0) {
+        return 0;
+    }
+    if (fread(header, 1, sizeof(*header), f) != sizeof(*header) || header->magic != MAGIC_HVCA) {
+        return -1;
+    }
+    if (header->version != VCACHE_VERSION || header->record_size != sizeof(vcache_record_t)) {
+        return 0;
+    }
+    /* A partly written record at the end is left out. */
+    *num_records = ((uint64_t)st.st_size - sizeof(*header)) / sizeof(vcache_record_t);
+    return header->num_sorted <= *num_records;
+}
+
+/* Adds every intact record; callers sort afterwards. */
+static void vcache_load(vcache_ctx_t *ctx, FILE *f, uint64_t num_records) {
+    vcache_record_t record;
+    uint8_t hash[0x20];
+    for (uint64_t i = 0; i < num_records && fread(&record, sizeof(record), 1, f) == 1; i++) {
+        sha256_hash_buffer(hash, &record.entry, sizeof(record.entry));
+        if (!memcmp(hash, record.hash, sizeof(hash))) {
+            vcache_add(ctx, &record.entry);
+        }
+    }
+}
+
+int vcache_open(vcache_ctx_t *ctx, const char *path, int refresh) {
+    memset(ctx, 0, sizeof(*ctx));
+    pthread_mutex_init(&ctx->lock, NULL);
+    ctx->refresh = refresh;
+    ctx->now = (int64_t)time(NULL);
+    if ((ctx->path = strdup(path)) == NULL) {
+        fprintf(stderr, "Failed to allocate verification cache path!\n");
+        fatal_exit();
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        /* First run. */
+        return 1;
+    }
+    vcache_header_t header;
+    uint64_t num_records;
+    int status = vcache_read_header(f, &header, &num_records);
+    if (status < 0) {
+        fprintf(stderr, "%s is not a verification cache!\n", path);
+        fclose(f);
+        return 0;
+    }
+    if (status == 0 && header.magic == MAGIC_HVCA) {
+        /* Written by a different build; start over. */
+        printf("Discarding outdated verification cache %s.\n", path);
+    }
+    vcache_load(ctx, f, num_records);
+    fclose(f);
+    vcache_sort(ctx);
+    return 1;
+}
+
+/* Opens the cache file for appending, locked against other runs. */
+static FILE *vcache_lock(vcache_ctx_t *ctx) {
+    while (1) {
+        FILE *f = fopen(ctx->path, "a+b");
+#ifdef _WIN32
+        return f;
+#else
+        vcache_stat_t locked, current;
+        if (f == NULL) {
+            return NULL;
+        }
+        if (flock(fileno(f), LOCK_EX) != 0 || vcache_fstat(f, &locked) != 0) {
+            fclose(f);
+            return NULL;
+        }
+        /* Another run may have compacted the cache while this one waited. */
+        if (stat(ctx->path, &current) == 0 && current.st_dev == locked.st_dev && current.st_ino == locked.st_ino) {
+            return f;
+        }
+        fclose(f);
+#endif
+    }
+}
+
+static void vcache_fill_record(vcache_record_t *record, const vcache_entry_t *entry) {
+    memcpy(&record->entry, entry, sizeof(*entry));
+    sha256_hash_buffer(record->hash, &record->entry, sizeof(record->entry));
+}
+
+/* Appends the pending entries after the num_records intact ones, then closes f. */
+static void vcache_append(vcache_ctx_t *ctx, FILE *f, uint64_t num_records) {
+    vcache_record_t *records = malloc(ctx->num_pending * sizeof(vcache_record_t));
+    if (records == NULL) {
+        fprintf(stderr, "Failed to allocate verification cache!\n");
+        fatal_exit();
+    }
+    uint32_t num_pending = 0;
+    for (uint32_t i = 0; i < ctx->num_entries; i++) {
+        if (ctx->is_pending[i]) {
+            vcache_fill_record(&records[num_pending++], &ctx->entries[i]);
+        }
+    }
+
+    /* Cut off a record an interrupted run only partly wrote, so that the new ones line up. */
+    uint64_t size = sizeof(vcache_header_t) + num_records * sizeof(vcache_record_t);
+    if (vcache_truncate(f, size) != 0 || fseek(f, 0, SEEK_END) != 0 ||
+        fwrite(records, sizeof(vcache_record_t), num_pending, f) != num_pending || !fsync_file(f)) {
+        fprintf(stderr, "Failed to write verification cache %s!\n", ctx->path);
+        fatal_exit();
+    }
+    fclose(f);
+    free(records);
+}
+
+/* Merges the pending entries into what f holds now, and replaces the file with a sorted one. Closes f. */
+static void vcache_compact(vcache_ctx_t *ctx, FILE *f, uint64_t num_records) {
+    /* Start from what is on disk now, which includes what other runs added since this one started. */
+    uint32_t num_pending = 0;
+    for (uint32_t i = 0; i < ctx->num_entries; i++) {
+        if (ctx->is_pending[i]) {
+            if (num_pending != i) {
+                memcpy(&ctx->entries[num_pending], &ctx->entries[i], sizeof(vcache_entry_t));
+            }
+            num_pending++;
+        }
+    }
+    ctx->num_entries = num_pending;
+    vcache_load(ctx, f, num_records);
+    vcache_sort(ctx);
+    vcache_evict(ctx);
+
+    char tmp_path[MAX_PATH + 0x20];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", ctx->path, (long)vcache_getpid());
+    vcache_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MAGIC_HVCA;
+    header.version = VCACHE_VERSION;
+    header.record_size = sizeof(vcache_record_t);
+    header.num_sorted = ctx->num_entries;
+
+    FILE *out = fopen(tmp_path, "wb");
+    if (out == NULL || fwrite(&header, 1, sizeof(header), out) != sizeof(header)) {
+        fprintf(stderr, "Failed to write verification cache %s!\n", tmp_path);
+        fatal_exit();
+    }
+    vcache_record_t record;
+    for (uint32_t i = 0; i < ctx->num_entries; i++) {
+        vcache_fill_record(&record, &ctx->entries[i]);
+        if (fwrite(&record, sizeof(record), 1, out) != 1) {
+            fprintf(stderr, "Failed to write verification cache %s!\n", tmp_path);
+            fatal_exit();
+        }
+    }
+    if (!fsync_file(out)) {
+        fprintf(stderr, "Failed to write verification cache %s!\n", tmp_path);
+        fatal_exit();
+    }
+    fclose(out);
+#ifdef _WIN32
+    fclose(f);
+    remove(ctx->path);
+#endif
+    if (rename(tmp_path, ctx->path) != 0) {
+        fprintf(stderr, "Failed to replace verification cache %s!\n", ctx->path);
+        fatal_exit();
+    }
+#ifndef _WIN32
+    /* Runs waiting for the lock go on only now, and find the new file. */
+    fclose(f);
+#endif
+}
+
+void vcache_close(vcache_ctx_t *ctx) {
+    if (ctx->path == NULL) {
+        return;
+    }
+    if (ctx->num_pending) {
+        FILE *f = vcache_lock(ctx);
+        if (f == NULL) {
+            fprintf(stderr, "Failed to lock verification cache %s!\n", ctx->path);
+            fatal_exit();
+        }
+        vcache_header_t header;
+        uint64_t num_records;
+        int status = vcache_read_header(f, &header, &num_records);
+        if (status < 0) {
+            fprintf(stderr, "%s is not a verification cache!\n", ctx->path);
+            fatal_exit();
+        }
+        if (status == 0 || num_records - header.num_sorted + ctx->num_pending > header.num_sorted / 2 + VCACHE_COMPACT_MIN_RECORDS) {
+            vcache_compact(ctx, f, num_records);
+        } else {
+            vcache_append(ctx, f, num_records);
+        }
+    }
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx->entries);
+    free(ctx->is_pending);
+    free(ctx->path);
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+/* Returns 0 if the file cannot be identified, e.g. for split input. */
+int vcache_get_key(vcache_key_t *key, FILE *f, uint64_t offset, const void *header, uint64_t header_size) {
+    memset(key, 0, sizeof(*key));
+    vcache_stat_t st;
+    if (vcache_fstat(f, &st) != 0) {
+        return 0;
+    }
+    key->device = (uint64_t)st.st_dev;
+    key->inode = (uint64_t)st.st_ino;
+    key->offset = offset;
+    key->size = (uint64_t)st.st_size;
+#if defined(_WIN32)
+    key->mtime_ns = (int64_t)st.st_mtime * 1000000000;
+#elif defined(__APPLE__)
+    key->mtime_ns = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    key->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    sha256_hash_buffer(key->header_hash, header, header_size);
+    return 1;
+}
+
+static vcache_entry_t *vcache_find(vcache_ctx_t *ctx, const vcache_key_t *key) {
+    vcache_entry_t *entry = bsearch(key, ctx->entries, ctx->num_sorted, sizeof(vcache_entry_t), vcache_compare_keys);
+    if (entry != NULL) {
+        return entry;
+    }
+    for (uint32_t i = ctx->num_sorted; i < ctx->num_entries; i++) {
+        if (!vcache_compare_keys(&ctx->entries[i].key, key)) {
+            return &ctx->entries[i];
+        }
+    }
+    return NULL;
+}
+
+int vcache_lookup(vcache_ctx_t *ctx, const vcache_key_t *key, vcache_entry_t *entry) {
+    if (ctx == NULL || ctx->refresh) {
+        return 0;
+    }
+    pthread_mutex_lock(&ctx->lock);
+    vcache_entry_t *found = vcache_find(ctx, key);
+    if (found != NULL) {
+        /* Keep used entries from being evicted, without writing on every run. */
+        if (found->last_used + VCACHE_TOUCH_INTERVAL <= ctx->now) {
+            found->last_used = ctx->now;
+            vcache_mark_pending(ctx, (uint32_t)(found - ctx->entries));
+        }
+        memcpy(entry, found, sizeof(*entry));
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return found != NULL;
+}
+
+void vcache_store(vcache_ctx_t *ctx, const vcache_entry_t *entry) {
+    if (ctx == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&ctx->lock);
+    vcache_entry_t *existing = vcache_find(ctx, &entry->key);
+    if (existing == NULL) {
+        vcache_add(ctx, entry);
+        existing = &ctx->entries[ctx->num_entries - 1];
+    }
+    memcpy(existing, entry, sizeof(*entry));
+    existing->last_used = ctx->now;
+    vcache_mark_pending(ctx, (uint32_t)(existing - ctx->entries));
+    pthread_mutex_unlock(&ctx->lock);
+}
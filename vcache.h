@@ -0,0 +1,70 @@
+#ifndef HACTOOL_VCACHE_H
+#define HACTOOL_VCACHE_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "types.h"
+#include "ivfc.h"
+
+#define MAGIC_HVCA 0x41435648 /* "HVCA" */
+#define VCACHE_VERSION 2
+#define VCACHE_TOUCH_INTERVAL (24 * 60 * 60) /* Seconds before a hit is worth recording again. */
+#define VCACHE_MAX_AGE (30 * 24 * 60 * 60) /* Entries unused for longer are dropped when compacting. */
+#define VCACHE_COMPACT_MIN_RECORDS 0x100 /* Appended records allowed beyond half the sorted ones. */
+
+/* Identifies one NCA on disk. A change to any field invalidates the cached results.
+ * Device, inode and offset come first, so that the versions of one NCA sort next to each other. */
+typedef struct {
+    uint64_t device;
+    uint64_t inode;
+    uint64_t offset; /* Of the NCA within its file. */
+    uint64_t size; /* Of the file containing the NCA. */
+    int64_t mtime_ns;
+    uint8_t header_hash[0x20]; /* SHA-256 of the decrypted NCA header. */
+} vcache_key_t;
+
+/* Outcome of a full verification. */
+typedef struct {
+    vcache_key_t key;
+    int64_t last_used; /* Seconds since the epoch. */
+    uint8_t level_validity[4][IVFC_MAX_LEVEL]; /* Per section; PFS0 uses the first entry for its hash table. */
+    uint8_t has_content_hash;
+    uint8_t content_id_validity;
+    uint8_t content_hash[0x20];
+} vcache_entry_t;
+
+/* Every entry in the file is followed by a hash, so a torn append is skipped. */
+typedef struct {
+    vcache_entry_t entry;
+    uint8_t hash[0x20]; /* SHA-256 over the entry. */
+} vcache_record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t num_sorted; /* Records after these were appended by later runs. */
+} vcache_header_t;
+
+typedef struct vcache_ctx {
+    char *path;
+    vcache_entry_t *entries;
+    uint32_t num_entries;
+    uint32_t num_sorted; /* Entries loaded from disk are sorted; new ones are appended. */
+    uint32_t max_entries;
+    uint8_t *is_pending; /* Per entry: new or touched, and to be appended on close. */
+    uint32_t num_pending;
+    int64_t now;
+    int refresh; /* Ignore cached results, and replace them. */
+    pthread_mutex_t lock; /* Looked up and stored by several NCA workers at once. */
+} vcache_ctx_t;
+
+int vcache_open(vcache_ctx_t *ctx, const char *path, int refresh);
+void vcache_close(vcache_ctx_t *ctx);
+
+int vcache_get_key(vcache_key_t *key, FILE *f, uint64_t offset, const void *header, uint64_t header_size);
+/* Copies the entry for key out, returning 0 if there is none. */
+int vcache_lookup(vcache_ctx_t *ctx, const vcache_key_t *key, vcache_entry_t *entry);
+void vcache_store(vcache_ctx_t *ctx, const vcache_entry_t *entry);
+
+#endif
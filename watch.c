@@ -0,0 +1,554 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+#endif
+#include "watch.h"
+#include "catalog.h"
+#include "filepath.h"
+#include "shard.h"
+#include "utils.h"
+
+/* Watch a drop folder, and process every file written or moved into it, as if it had been given on the
+ * command line. Files are picked up once closed after writing (or renamed into place), queued, and handed
+ * to a bounded pool of worker processes. The log given as <file> gets one line per processed file:
+ *   <time> <status> <size> <mtime> <ctime> <inode> <name>
+ * where both file times are in nanoseconds, and status is ok, fail (a signature or hash didn't match), or
+ * error (the file couldn't be parsed, or the worker did not finish). Workers report which through their
+ * exit status. Files already in the log with the same size, times and inode are not processed again, so files that arrived while no watcher was
+ * running are picked up on start. Only *.nca, *.xci, *.nsp, *.pfs0, *.romfs and *.hfs0 files directly in the
+ * folder are processed; with --outdir, each one is extracted to its own <outdir>/<name>/. */
+
+static int watch_compare_lines(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Combine the logs of all shards into one, in time order. */
+int watch_merge(const char *out_path, char **paths, unsigned int num_paths) {
+    char **lines = NULL;
+    size_t num_lines = 0, max_lines = 0;
+    char buf[MAX_PATH + 0x100];
+    for (unsigned int i = 0; i < num_paths; i++) {
+        FILE *f = fopen(paths[i], "r");
+        if (f == NULL) {
+            fprintf(stderr, "Failed to open %s!\n", paths[i]);
+            return 0;
+        }
+        while (fgets(buf, sizeof(buf), f) != NULL) {
+            if (buf[0] == '#' || buf[0] == '\n' || buf[strlen(buf) - 1] != '\n') {
+                continue;
+            }
+            if (num_lines == max_lines) {
+                max_lines = max_lines ? max_lines * 2 : 0x400;
+                if ((lines = realloc(lines, max_lines * sizeof(char *))) == NULL) {
+                    fprintf(stderr, "Failed to allocate watch log!\n");
+                    fatal_exit();
+                }
+            }
+            if ((lines[num_lines++] = strdup(buf)) == NULL) {
+                fprintf(stderr, "Failed to allocate watch log!\n");
+                fatal_exit();
+            }
+        }
+        fclose(f);
+    }
+    /* Lines start with their UTC time, so they sort chronologically. */
+    qsort(lines, num_lines, sizeof(char *), watch_compare_lines);
+
+    char tmp_path[MAX_PATH + 0x10];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", out_path);
+    FILE *f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s!\n", tmp_path);
+        fatal_exit();
+    }
+    fprintf(f, "%s\n", WATCH_LOG_SIGNATURE);
+    for (size_t i = 0; i < num_lines; i++) {
+        fputs(lines[i], f);
+        free(lines[i]);
+    }
+    free(lines);
+    if (ferror(f) || !fsync_file(f) || fclose(f) != 0) {
+        fprintf(stderr, "Failed to write watch log %s!\n", tmp_path);
+        fatal_exit();
+    }
+#ifdef _WIN32
+    remove(out_path);
+#endif
+    if (rename(tmp_path, out_path) != 0) {
+        fprintf(stderr, "Failed to replace watch log %s!\n", out_path);
+        fatal_exit();
+    }
+    printf("Watch log: merged %u shard(s), %"PRIu64" record(s) in %s.\n", num_paths, (uint64_t)num_lines, out_path);
+    return 1;
+}
+
+#define WATCH_OLD_LOG_SIGNATURE "# hactool watch log v1" /* Had whole seconds of mtime only. */
+
+#ifndef __linux__
+int watch_run(hactool_ctx_t *tool_ctx, const char *dir, char *input_name, size_t input_size) {
+    (void)tool_ctx;
+    (void)dir;
+    (void)input_name;
+    (void)input_size;
+    fprintf(stderr, "--watch is not supported on this platform!\n");
+    return -1;
+}
+#else
+
+static volatile sig_atomic_t g_watch_stop;
+static int g_watch_wake_fds[2] = {-1, -1}; /* Written to by signal handlers, to end the wait for events. */
+
+static void watch_handle_signal(int sig) {
+    int saved_errno = errno;
+    if (sig != SIGCHLD) {
+        g_watch_stop = 1;
+    }
+    if (write(g_watch_wake_fds[1], "", 1) < 0) {
+        /* The pipe is full, so a wake-up is pending anyway. */
+    }
+    errno = saved_errno;
+}
+
+/* Returns the file type to process a name as, or -1 for names to ignore. */
+static int watch_get_file_type(const char *name) {
+    static const struct {
+        const char *extension;
+        enum hactool_file_type type;
+    } types[] = {
+        {".nca", FILETYPE_NCA},
+        {".xci", FILETYPE_XCI},
+        {".nsp", FILETYPE_NSP},
+        {".pfs0", FILETYPE_PFS0},
+        {".romfs", FILETYPE_ROMFS},
+        {".hfs0", FILETYPE_HFS0}
+    };
+    size_t len = strlen(name);
+    for (unsigned int i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        size_t ext_len = strlen(types[i].extension);
+        if (len > ext_len && !strcmp(name + len - ext_len, types[i].extension)) {
+            return (int)types[i].type;
+        }
+    }
+    return -1;
+}
+
+static uint32_t watch_hash(const char *key) {
+    uint32_t hash = 0x811C9DC5;
+    for (; *key; key++) {
+        hash = (hash ^ (uint8_t)*key) * 0x01000193;
+    }
+    return hash;
+}
+
+static char **watch_get_record_bucket(watch_ctx_t *ctx, const char *key) {
+    uint32_t mask = ctx->num_record_buckets - 1;
+    for (uint32_t i = watch_hash(key) & mask; ; i = (i + 1) & mask) {
+        if (ctx->records[i] == NULL || !strcmp(ctx->records[i], key)) {
+            return &ctx->records[i];
+        }
+    }
+}
+
+static void watch_make_record_key(char *key, size_t key_size, const char *name, const file_stamp_t *stamp) {
+    snprintf(key, key_size, "%s\t%"PRIu64"\t%"PRId64"\t%"PRId64"\t%"PRIu64, name, stamp->size, stamp->mtime_ns, stamp->ctime_ns, stamp->inode);
+}
+
+static void watch_add_record(watch_ctx_t *ctx, const char *key) {
+    if ((ctx->num_records + 1) * 2 > ctx->num_record_buckets) {
+        char **old = ctx->records;
+        uint32_t num_old = ctx->num_record_buckets;
+        ctx->num_record_buckets = num_old ? num_old * 2 : 0x400;
+        if ((ctx->records = calloc(ctx->num_record_buckets, sizeof(char *))) == NULL) {
+            fprintf(stderr, "Failed to allocate watch log records!\n");
+            fatal_exit();
+        }
+        for (uint32_t i = 0; i < num_old; i++) {
+            if (old[i] != NULL) {
+                *watch_get_record_bucket(ctx, old[i]) = old[i];
+            }
+        }
+        free(old);
+    }
+    char **bucket = watch_get_record_bucket(ctx, key);
+    if (*bucket == NULL) {
+        if ((*bucket = strdup(key)) == NULL) {
+            fprintf(stderr, "Failed to allocate watch log records!\n");
+            fatal_exit();
+        }
+        ctx->num_records++;
+    }
+}
+
+static int watch_has_record(watch_ctx_t *ctx, const char *key) {
+    return ctx->num_record_buckets && *watch_get_record_bucket(ctx, key) != NULL;
+}
+
+/* Remember which versions of which files the log already covers. */
+static int watch_load_log(watch_ctx_t *ctx, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return 1;
+    }
+    char line[MAX_PATH + 0x100];
+    if (fgets(line, sizeof(line), f) != NULL && line[0] == '#') {
+        uint32_t index, count;
+        if (shard_parse_header(line, WATCH_OLD_LOG_SIGNATURE, &index, &count)) {
+            fprintf(stderr, "%s is a watch log of an older version, which can't tell files rewritten within a second; start a new one.\n", path);
+            fclose(f);
+            return 0;
+        }
+        if (!shard_parse_header(line, WATCH_LOG_SIGNATURE, &index, &count)) {
+            fprintf(stderr, "%s is not a watch log!\n", path);
+            fclose(f);
+            return 0;
+        }
+        if (!shard_check_header(path, line, WATCH_LOG_SIGNATURE, ctx->tool_ctx->settings.shard_index, ctx->tool_ctx->settings.shard_count)) {
+            fclose(f);
+            return 0;
+        }
+    } else {
+        rewind(f);
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        char *fields[7];
+        char *cur = line;
+        unsigned int i;
+        for (i = 0; i < 7 && cur != NULL; i++) {
+            fields[i] = cur;
+            if ((cur = strchr(cur, '\t')) != NULL) {
+                *cur++ = '\0';
+            }
+        }
+        if (i == 7) {
+            file_stamp_t stamp;
+            stamp.size = strtoull(fields[2], NULL, 10);
+            stamp.mtime_ns = strtoll(fields[3], NULL, 10);
+            stamp.ctime_ns = strtoll(fields[4], NULL, 10);
+            stamp.inode = strtoull(fields[5], NULL, 10);
+            char key[MAX_PATH + 0x80];
+            watch_make_record_key(key, sizeof(key), fields[6], &stamp);
+            watch_add_record(ctx, key);
+        }
+    }
+    fclose(f);
+    return 1;
+}
+
+static void watch_log(watch_ctx_t *ctx, const char *status, const char *name, const file_stamp_t *stamp) {
+    char timestamp[0x20];
+    time_t now = time(NULL);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    fprintf(ctx->log, "%s\t%s\t%"PRIu64"\t%"PRId64"\t%"PRId64"\t%"PRIu64"\t%s\n", timestamp, status, stamp->size, stamp->mtime_ns, stamp->ctime_ns, stamp->inode, name);
+    fflush(ctx->log);
+    char key[MAX_PATH + 0x80];
+    watch_make_record_key(key, sizeof(key), name, stamp);
+    watch_add_record(ctx, key);
+}
+
+static int watch_stat(watch_ctx_t *ctx, const char *name, struct stat *st) {
+    char path[MAX_PATH];
+    snprintf(path, sizeof(path), "%s/%s", ctx->dir, name);
+    return stat(path, st) == 0 && S_ISREG(st->st_mode);
+}
+
+/* Queue a file, unless it is to be ignored or already waiting. */
+static void watch_enqueue(watch_ctx_t *ctx, const char *name) {
+    hactool_settings_t *settings = &ctx->tool_ctx->settings;
+    if (watch_get_file_type(name) < 0 || !shard_contains(settings->shard_index, settings->shard_count, name)) {
+        return;
+    }
+    for (uint32_t i = ctx->queue_start; i < ctx->queue_end; i++) {
+        if (!strcmp(ctx->queue[i], name)) {
+            return;
+        }
+    }
+    if (ctx->queue_end == ctx->max_queue) {
+        /* Reuse the space of entries already taken off the front. */
+        memmove(ctx->queue, ctx->queue + ctx->queue_start, (ctx->queue_end - ctx->queue_start) * sizeof(char *));
+        ctx->queue_end -= ctx->queue_start;
+        ctx->queue_start = 0;
+        if (ctx->queue_end == ctx->max_queue) {
+            ctx->max_queue = ctx->max_queue ? ctx->max_queue * 2 : 0x40;
+            if ((ctx->queue = realloc(ctx->queue, ctx->max_queue * sizeof(char *))) == NULL) {
+                fprintf(stderr, "Failed to allocate watch queue!\n");
+                fatal_exit();
+            }
+        }
+    }
+    if ((ctx->queue[ctx->queue_end++] = strdup(name)) == NULL) {
+        fprintf(stderr, "Failed to allocate watch queue!\n");
+        fatal_exit();
+    }
+}
+
+/* Queue every file in the folder that the log doesn't cover yet. */
+static void watch_scan(watch_ctx_t *ctx) {
+    DIR *dir = opendir(ctx->dir);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        struct stat st;
+        if (watch_get_file_type(entry->d_name) < 0 || !watch_stat(ctx, entry->d_name, &st)) {
+            continue;
+        }
+        file_stamp_t stamp;
+        get_file_stamp(&stamp, &st);
+        char key[MAX_PATH + 0x80];
+        watch_make_record_key(key, sizeof(key), entry->d_name, &stamp);
+        if (!watch_has_record(ctx, key)) {
+            watch_enqueue(ctx, entry->d_name);
+        }
+    }
+    closedir(dir);
+}
+
+static void watch_read_events(watch_ctx_t *ctx) {
+    char buf[0x4000] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(ctx->inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *cur = buf; cur < buf + len; ) {
+            struct inotify_event *event = (struct inotify_event *)cur;
+            if (event->mask & IN_Q_OVERFLOW) {
+                /* Events were lost. */
+                watch_scan(ctx);
+            } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                fprintf(stderr, "Watched folder %s went away!\n", ctx->dir);
+                g_watch_stop = 1;
+            } else if (event->len && !(event->mask & IN_ISDIR)) {
+                watch_enqueue(ctx, event->name);
+            }
+            cur += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+static void watch_free(watch_ctx_t *ctx) {
+    for (uint32_t i = ctx->queue_start; i < ctx->queue_end; i++) {
+        free(ctx->queue[i]);
+    }
+    free(ctx->queue);
+    for (uint32_t i = 0; i < ctx->num_record_buckets; i++) {
+        free(ctx->records[i]);
+    }
+    free(ctx->records);
+    for (uint32_t i = 0; i < ctx->num_workers; i++) {
+        free(ctx->workers[i].name);
+    }
+    if (ctx->inotify_fd >= 0) {
+        close(ctx->inotify_fd);
+    }
+    close(g_watch_wake_fds[0]);
+    close(g_watch_wake_fds[1]);
+    fclose(ctx->log);
+}
+
+/* The worker side of a fork: set up the settings to process the file as if given on the command line. */
+static void watch_become_worker(watch_ctx_t *ctx, watch_worker_t *worker, char *input_name, size_t input_size) {
+    hactool_ctx_t *tool_ctx = ctx->tool_ctx;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_DFL;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGCHLD, &sa, NULL);
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(input_name, input_size, "%s/%s", ctx->dir, worker->name);
+    tool_ctx->file_type = (enum hactool_file_type)watch_get_file_type(worker->name);
+    if (tool_ctx->settings.out_dir_path.enabled) {
+        /* Every file gets its own output folder, named like it without the extension. */
+        const char *ext = strrchr(worker->name, '.');
+        filepath_t dirpath;
+        filepath_copy(&dirpath, &tool_ctx->settings.out_dir_path.path);
+        filepath_append(&dirpath, "%.*s", (int)(ext - worker->name), worker->name);
+        if (tool_ctx->action & ACTION_EXTRACT) {
+            os_makedir(tool_ctx->settings.out_dir_path.path.os_path);
+            os_makedir(dirpath.os_path);
+        }
+        if (tool_ctx->file_type == FILETYPE_NCA) {
+            for (unsigned int i = 0; i < 4; i++) {
+                filepath_copy(&tool_ctx->settings.section_dir_paths[i], &dirpath);
+                filepath_append(&tool_ctx->settings.section_dir_paths[i], "section%"PRId32, i);
+            }
+        } else if (tool_ctx->file_type == FILETYPE_NSP) {
+            filepath_copy(&tool_ctx->settings.nca_dir_path, &dirpath);
+        } else {
+            filepath_copy(&tool_ctx->settings.out_dir_path.path, &dirpath);
+        }
+    }
+    watch_free(ctx);
+}
+
+static void watch_finish_worker(watch_ctx_t *ctx, uint32_t i, int status) {
+    watch_worker_t *worker = &ctx->workers[i];
+    if (worker->name != NULL) {
+        const char *result = "error";
+        if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+            result = "ok";
+        } else if (WIFEXITED(status) && WEXITSTATUS(status) == WATCH_EXIT_FAILED_CHECK) {
+            result = "fail";
+        }
+        watch_log(ctx, result, worker->name, &worker->stamp);
+        printf("%s: %s\n", worker->name, result);
+    } else if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        fprintf(stderr, "Failed to update catalog %s!\n", ctx->tool_ctx->settings.watch_catalog_path.char_path);
+    }
+    fflush(stdout);
+    free(worker->name);
+    ctx->workers[i] = ctx->workers[--ctx->num_workers];
+}
+
+static void watch_reap(watch_ctx_t *ctx, int options) {
+    int status;
+    pid_t pid;
+    while (ctx->num_workers && (pid = waitpid(-1, &status, options)) > 0) {
+        for (uint32_t i = 0; i < ctx->num_workers; i++) {
+            if (ctx->workers[i].pid == pid) {
+                watch_finish_worker(ctx, i, status);
+                break;
+            }
+        }
+    }
+}
+
+/* Start a worker for name, or for a catalog update if name is NULL. Returns 1 in the worker. */
+static int watch_start_worker(watch_ctx_t *ctx, char *name, char *input_name, size_t input_size) {
+    watch_worker_t *worker = &ctx->workers[ctx->num_workers];
+    memset(worker, 0, sizeof(*worker));
+    worker->name = name;
+    if (name != NULL) {
+        struct stat st;
+        if (!watch_stat(ctx, name, &st)) {
+            /* Gone again, or not a file. */
+            free(name);
+            return 0;
+        }
+        get_file_stamp(&worker->stamp, &st);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    if ((worker->pid = fork()) < 0) {
+        fprintf(stderr, "Failed to start worker: %s\n", strerror(errno));
+        free(name);
+        return 0;
+    }
+    if (worker->pid == 0) {
+        if (name == NULL) {
+            hactool_ctx_t *tool_ctx = ctx->tool_ctx;
+            if (freopen("/dev/null", "w", stdout) == NULL) {
+                exit(EXIT_FAILURE);
+            }
+            exit(catalog_update(tool_ctx, ctx->dir, tool_ctx->settings.watch_catalog_path.char_path) ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        watch_become_worker(ctx, worker, input_name, input_size);
+        return 1;
+    }
+    ctx->num_workers++;
+    return 0;
+}
+
+int watch_run(hactool_ctx_t *tool_ctx, const char *dir, char *input_name, size_t input_size) {
+    watch_ctx_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.tool_ctx = tool_ctx;
+    ctx.dir = dir;
+    ctx.inotify_fd = -1;
+    uint32_t jobs = tool_ctx->settings.watch_jobs ? tool_ctx->settings.watch_jobs : WATCH_DEFAULT_JOBS;
+
+    if (!watch_load_log(&ctx, input_name)) {
+        return -1;
+    }
+    int is_new = _fsize(input_name) == 0;
+    if ((ctx.log = fopen(input_name, "a")) == NULL) {
+        fprintf(stderr, "Failed to open watch log %s!\n", input_name);
+        return -1;
+    }
+    if (is_new) {
+        char header[0x40];
+        shard_format_header(header, sizeof(header), WATCH_LOG_SIGNATURE, tool_ctx->settings.shard_index, tool_ctx->settings.shard_count);
+        fprintf(ctx.log, "%s\n", header);
+        fflush(ctx.log);
+    }
+    if (pipe(g_watch_wake_fds) != 0) {
+        fprintf(stderr, "Failed to create pipe: %s\n", strerror(errno));
+        fclose(ctx.log);
+        return -1;
+    }
+    for (unsigned int i = 0; i < 2; i++) {
+        fcntl(g_watch_wake_fds[i], F_SETFL, fcntl(g_watch_wake_fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(g_watch_wake_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    /* Subscribe before the first scan, so that nothing arriving in between is missed. */
+    if ((ctx.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ||
+        inotify_add_watch(ctx.inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR) < 0) {
+        fprintf(stderr, "Failed to watch %s: %s\n", dir, strerror(errno));
+        watch_free(&ctx);
+        return -1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = watch_handle_signal;
+    sa.sa_flags = SA_NOCLDSTOP;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGCHLD, &sa, NULL);
+
+    watch_scan(&ctx);
+    printf("Watching %s with %"PRIu32" workers.\n", dir, jobs);
+    while (!g_watch_stop) {
+        watch_reap(&ctx, WNOHANG);
+        while (ctx.num_workers < jobs && ctx.queue_start < ctx.queue_end) {
+            ctx.is_catalog_due = 1;
+            if (watch_start_worker(&ctx, ctx.queue[ctx.queue_start++], input_name, input_size)) {
+                return 1;
+            }
+        }
+        if (ctx.is_catalog_due && tool_ctx->settings.watch_catalog_path.valid == VALIDITY_VALID && ctx.num_workers == 0 && ctx.queue_start == ctx.queue_end) {
+            /* Update the catalog once a batch of arrivals is through. */
+            ctx.is_catalog_due = 0;
+            if (watch_start_worker(&ctx, NULL, input_name, input_size)) {
+                return 1;
+            }
+        }
+
+        struct pollfd fds[2];
+        fds[0].fd = ctx.inotify_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = g_watch_wake_fds[0];
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            fprintf(stderr, "Failed to wait for events: %s\n", strerror(errno));
+            break;
+        }
+        char drain[0x40];
+        while (read(g_watch_wake_fds[0], drain, sizeof(drain)) > 0) {
+        }
+        if (fds[0].revents & POLLIN) {
+            watch_read_events(&ctx);
+        }
+    }
+
+    /* Let running workers finish, so that their results are logged. */
+    watch_reap(&ctx, 0);
+    watch_free(&ctx);
+    return 0;
+}
+
+#endif
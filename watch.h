@@ -0,0 +1,43 @@
+#ifndef HACTOOL_WATCH_H
+#define HACTOOL_WATCH_H
+
+#include <stdio.h>
+#include <sys/types.h>
+#include "types.h"
+#include "settings.h"
+#include "utils.h"
+
+#define WATCH_LOG_SIGNATURE "# hactool watch log v2"
+#define WATCH_DEFAULT_JOBS 2
+#define WATCH_MAX_JOBS 64
+#define WATCH_EXIT_FAILED_CHECK 3 /* A worker's exit status when the file was read, but a check on it failed. */
+
+typedef struct {
+    pid_t pid;
+    char *name; /* Of the file, or NULL for a catalog update. */
+    file_stamp_t stamp;
+} watch_worker_t;
+
+typedef struct {
+    hactool_ctx_t *tool_ctx;
+    const char *dir;
+    FILE *log;
+    int inotify_fd;
+    char **queue;
+    uint32_t queue_start;
+    uint32_t queue_end;
+    uint32_t max_queue;
+    char **records; /* Open-addressed set of "<name>\t<size>\t<mtime>\t<ctime>\t<inode>" keys already in the log. */
+    uint32_t num_records;
+    uint32_t num_record_buckets;
+    watch_worker_t workers[WATCH_MAX_JOBS];
+    uint32_t num_workers;
+    int is_catalog_due; /* Files were processed since the catalog was last updated. */
+} watch_ctx_t;
+
+/* Returns 1 in worker processes, with input_name set to the file to process, and the settings adjusted
+ * for it. The watcher itself returns 0 once interrupted, or -1 on failure. */
+int watch_run(hactool_ctx_t *tool_ctx, const char *dir, char *input_name, size_t input_size);
+int watch_merge(const char *out_path, char **paths, unsigned int num_paths);
+
+#endif
@@ -1,6 +1,8 @@
 #include <string.h>
 #include "rsa.h"
 #include "xci.h"
+#include "tar.h"
+#include "nca.h"
 
 /* This RSA-PKCS1 public key is only accessible to the gamecard controller. */
 /* However, it (and other XCI keys) can be dumped with a GCD attack on two signatures. */
@@ -24,16 +26,43 @@ const unsigned char xci_header_pubk[0x100] = {
     0x9A, 0xC1, 0xDD, 0x62, 0x86, 0x9C, 0x2E, 0xE1, 0x2D, 0x6F, 0x62, 0x67, 0x51, 0x08, 0x0E, 0xCF
 };
 
+/* Process the NCAs of the secure partition straight out of the XCI, without dumping them first. */
+static void xci_process_secure_ncas(xci_ctx_t *ctx) {
+    hfs0_ctx_t *secure = &ctx->secure_ctx;
+    nca_nested_t *ncas = calloc(secure->header->num_files + 1, sizeof(nca_nested_t));
+    if (ncas == NULL) {
+        fprintf(stderr, "Failed to allocate secure partition NCAs!\n");
+        fatal_exit();
+    }
+    uint32_t num_ncas = 0;
+    for (uint32_t i = 0; i < secure->header->num_files; i++) {
+        hfs0_file_entry_t *cur_file = hfs0_get_file_entry(secure->header, i);
+        char *cur_name = hfs0_get_file_name(secure->header, i);
+        size_t name_len = strlen(cur_name);
+        if (name_len < 4 || strcmp(cur_name + name_len - 4, ".nca")) {
+            continue;
+        }
+        nca_nested_t *nested = &ncas[num_ncas++];
+        nca_init_nested(&nested->nca_ctx, &nested->tool_ctx, ctx->tool_ctx, ctx->file, secure->offset + hfs0_get_header_size(secure->header) + cur_file->offset, cur_file->size, cur_name);
+    }
+
+    uint32_t num_jobs = ctx->tool_ctx->settings.jobs ? ctx->tool_ctx->settings.jobs : HACTOOL_DEFAULT_JOBS;
+    nca_process_nested(ncas, num_ncas, num_jobs, ctx->file_name, "secure:/");
+    nca_free_nested(ncas, num_ncas);
+    free(ncas);
+}
+
 void xci_process(xci_ctx_t *ctx) {
     fseeko64(ctx->file, 0, SEEK_SET);
     if (fread(&ctx->header, 1, 0x200, ctx->file) != 0x200) {
         fprintf(stderr, "Failed to read XCI header!\n");
+        results_add_error(ctx->tool_ctx->results);
         return;
     }
     
     if (ctx->header.magic != MAGIC_HEAD) {
         fprintf(stderr, "Error: XCI header is corrupt!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     
     if (ctx->tool_ctx->action & ACTION_VERIFY) {
@@ -42,17 +71,20 @@ void xci_process(xci_ctx_t *ctx) {
         } else {
             ctx->header_sig_validity = VALIDITY_INVALID;
         }
+        results_add_check(ctx->tool_ctx->results, ctx->header_sig_validity);
     }
     
     ctx->hfs0_hash_validity = check_memory_hash_table(ctx->file, ctx->header.hfs0_header_hash, ctx->header.hfs0_offset, ctx->header.hfs0_header_size, ctx->header.hfs0_header_size, 0);
     if (ctx->hfs0_hash_validity != VALIDITY_VALID) {
         fprintf(stderr, "Error: XCI partition is corrupt!\n");
-        exit(EXIT_FAILURE);
+        fatal_exit();
     }
     
     hactool_ctx_t blank_ctx;
     memset(&blank_ctx, 0, sizeof(blank_ctx));
     blank_ctx.action = ctx->tool_ctx->action & ~(ACTION_EXTRACT | ACTION_INFO);
+    blank_ctx.manifest = ctx->tool_ctx->manifest;
+    blank_ctx.results = ctx->tool_ctx->results;
     
     ctx->partition_ctx.file = ctx->file;
     ctx->partition_ctx.offset = ctx->header.hfs0_offset;
@@ -62,7 +94,7 @@ void xci_process(xci_ctx_t *ctx) {
     
     if (ctx->partition_ctx.header->num_files != 3) {
         fprintf(stderr, "Error: Invalid XCI partition!\n");
-        exit(EXIT_FAILURE);    
+        fatal_exit();    
     }
     
     for (unsigned int i = 0; i < 3; i++)  {
@@ -80,7 +112,7 @@ void xci_process(xci_ctx_t *ctx) {
         
         if (cur_ctx == NULL) {
             fprintf(stderr, "Unknown XCI partition: %s\n", cur_name);
-            exit(EXIT_FAILURE);
+            fatal_exit();
         }
         
         cur_ctx->name = cur_name;
@@ -101,9 +133,26 @@ void xci_process(xci_ctx_t *ctx) {
     if (ctx->tool_ctx->action & ACTION_EXTRACT) {
         xci_save(ctx);
     }
+
+    if (ctx->tool_ctx->settings.nca_dir_path.valid == VALIDITY_VALID) {
+        xci_process_secure_ncas(ctx);
+    }
 }
 
 void xci_save(xci_ctx_t *ctx) {
+    if (ctx->tool_ctx->hfs0_tar != NULL) {
+        /* Archive every partition into a single stream. */
+        printf("Archiving XCI...\n");
+        hfs0_ctx_t *partitions[3] = {&ctx->update_ctx, &ctx->normal_ctx, &ctx->secure_ctx};
+        for (unsigned int i = 0; i < 3; i++) {
+            tar_add_directory(ctx->tool_ctx->hfs0_tar, partitions[i]->name);
+            for (uint32_t j = 0; j < partitions[i]->header->num_files; j++) {
+                hfs0_archive_file(partitions[i], j, ctx->tool_ctx->hfs0_tar, partitions[i]->name);
+            }
+        }
+        return;
+    }
+
     /* Extract to directory. */
     if (ctx->tool_ctx->settings.out_dir_path.enabled && ctx->tool_ctx->settings.out_dir_path.path.valid == VALIDITY_VALID) {
         printf("Extracting XCI...\n");
@@ -122,7 +171,7 @@ void xci_save(xci_ctx_t *ctx) {
             }
             if (cur_ctx == NULL) {
                 fprintf(stderr, "Unkown XCI partition found in extraction: %s\n", cur_name);
-                exit(EXIT_FAILURE);
+                fatal_exit();
             }
             filepath_t partition_dirpath;
             filepath_copy(&partition_dirpath, dirpath);
@@ -196,6 +245,7 @@ void xci_print_hfs0(hfs0_ctx_t *ctx) {
             hfs0_file_entry_t *cur_file = hfs0_get_file_entry(ctx->header, i);
             if (ctx->tool_ctx->action & ACTION_VERIFY) {
                 validity_t hash_validity = check_memory_hash_table(ctx->file, cur_file->hash, ctx->offset + hfs0_get_header_size(ctx->header) + cur_file->offset, cur_file->hashed_size, cur_file->hashed_size, 0);
+                results_add_check(ctx->tool_ctx->results, hash_validity);
                 printf("%s%s:/%-48s %012"PRIx64"-%012"PRIx64" (%s)\n", i == 0 ? "                          " : "                                    ", ctx->name == NULL ? "hfs0" : ctx->name, hfs0_get_file_name(ctx->header, i), cur_file->offset, cur_file->offset + cur_file->size, GET_VALIDITY_STR(hash_validity));
             } else {
                 printf("%s%s:/%-48s %012"PRIx64"-%012"PRIx64"\n", i == 0 ? "                          " : "                                    ", ctx->name == NULL ? "hfs0" : ctx->name, hfs0_get_file_name(ctx->header, i), cur_file->offset, cur_file->offset + cur_file->size);
@@ -42,6 +42,7 @@ typedef struct {
 
 typedef struct {
     FILE *file; /* File for this NCA. */
+    const char *file_name; /* Path of file, for NCA workers to open their own; NULL to process NCAs one by one. */
     validity_t header_sig_validity;
     validity_t cert_sig_validity;
     validity_t hfs0_hash_validity;